@@ -1,3 +1,9960 @@
 /**
  */
-#include "lava.h"
\ No newline at end of file
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#    define _POSIX_C_SOURCE 200809L
+#endif
+#include "lava.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <pthread.h>
+#    include <sched.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <time.h>
+#    include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+#    define LAVA_NULL nullptr
+#else
+#    define LAVA_NULL NULL
+#endif
+
+//--- Host memory
+//--------------------------------------------------------------------
+static void* lava_malloc(const VkAllocationCallbacks* allocator, size_t size)
+{
+    if(LAVA_NULL != allocator && LAVA_NULL != allocator->pfnAllocation) {
+        return allocator->pfnAllocation(allocator->pUserData, size, 16, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    }
+    return malloc(size);
+}
+
+static void* lava_realloc(const VkAllocationCallbacks* allocator, void* ptr, size_t size)
+{
+    if(LAVA_NULL != allocator && LAVA_NULL != allocator->pfnReallocation) {
+        return allocator->pfnReallocation(allocator->pUserData, ptr, size, 16, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    }
+    return realloc(ptr, size);
+}
+
+static void lava_free(const VkAllocationCallbacks* allocator, void* ptr)
+{
+    if(LAVA_NULL == ptr) {
+        return;
+    }
+    if(LAVA_NULL != allocator && LAVA_NULL != allocator->pfnFree) {
+        allocator->pfnFree(allocator->pUserData, ptr);
+        return;
+    }
+    free(ptr);
+}
+
+static void* lava_calloc(const VkAllocationCallbacks* allocator, size_t size)
+{
+    void* ptr = lava_malloc(allocator, size);
+    if(LAVA_NULL != ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/**
+ @brief Grow an array to hold at least `count` elements.
+ */
+static bool lava_reserve(const VkAllocationCallbacks* allocator, void** ptr, uint32_t* capacity, uint32_t count, size_t element_size)
+{
+    if(count <= *capacity) {
+        return true;
+    }
+    uint32_t new_capacity = (*capacity < 16) ? 16 : *capacity;
+    while(new_capacity < count) {
+        new_capacity <<= 1;
+    }
+    void* new_ptr = lava_realloc(allocator, *ptr, new_capacity * element_size);
+    if(LAVA_NULL == new_ptr) {
+        return false;
+    }
+    *ptr = new_ptr;
+    *capacity = new_capacity;
+    return true;
+}
+
+//--- Mutex
+//--------------------------------------------------------------------
+#ifdef _WIN32
+typedef CRITICAL_SECTION lava_mutex;
+
+static void lava_mutex_initialize(lava_mutex* mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+static void lava_mutex_terminate(lava_mutex* mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+static void lava_mutex_lock(lava_mutex* mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+static void lava_mutex_unlock(lava_mutex* mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+#else
+typedef pthread_mutex_t lava_mutex;
+
+static void lava_mutex_initialize(lava_mutex* mutex)
+{
+    pthread_mutex_init(mutex, LAVA_NULL);
+}
+
+static void lava_mutex_terminate(lava_mutex* mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void lava_mutex_lock(lava_mutex* mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static void lava_mutex_unlock(lava_mutex* mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+#endif
+
+//--- Thread
+//--------------------------------------------------------------------
+#ifdef _WIN32
+typedef CONDITION_VARIABLE lava_condition;
+typedef HANDLE lava_thread;
+typedef DWORD(WINAPI* lava_thread_proc)(void* argument);
+#    define LAVA_THREAD_PROC(NAME) DWORD WINAPI NAME(void* argument)
+#    define LAVA_THREAD_RETURN (0)
+
+static void lava_condition_initialize(lava_condition* condition)
+{
+    InitializeConditionVariable(condition);
+}
+
+static void lava_condition_terminate(lava_condition* condition)
+{
+    (void)condition;
+}
+
+static void lava_condition_wait(lava_condition* condition, lava_mutex* mutex)
+{
+    SleepConditionVariableCS(condition, mutex, INFINITE);
+}
+
+static void lava_condition_broadcast(lava_condition* condition)
+{
+    WakeAllConditionVariable(condition);
+}
+
+static bool lava_thread_create(lava_thread* thread, lava_thread_proc proc, void* argument)
+{
+    *thread = CreateThread(LAVA_NULL, 0, proc, argument, 0, LAVA_NULL);
+    return LAVA_NULL != *thread;
+}
+
+static void lava_thread_join(lava_thread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static void lava_thread_yield(void)
+{
+    SwitchToThread();
+}
+
+static uint32_t lava_core_count(void)
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (0 < system_info.dwNumberOfProcessors) ? (uint32_t)system_info.dwNumberOfProcessors : 1;
+}
+
+static uint64_t lava_timestamp(void)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (uint64_t)frequency.QuadPart;
+}
+
+static int32_t lava_atomic_load32(volatile int32_t* x)
+{
+    return (int32_t)InterlockedOr((volatile LONG*)x, 0);
+}
+
+static int32_t lava_atomic_add32(volatile int32_t* x, int32_t value)
+{
+    return (int32_t)InterlockedExchangeAdd((volatile LONG*)x, value);
+}
+
+static int64_t lava_atomic_load64(volatile int64_t* x)
+{
+    return (int64_t)InterlockedOr64((volatile LONG64*)x, 0);
+}
+
+static int64_t lava_atomic_add64(volatile int64_t* x, int64_t value)
+{
+    return (int64_t)InterlockedExchangeAdd64((volatile LONG64*)x, value);
+}
+
+static void lava_atomic_store64(volatile int64_t* x, int64_t value)
+{
+    InterlockedExchange64((volatile LONG64*)x, value);
+}
+
+static bool lava_atomic_cas64(volatile int64_t* x, int64_t expected, int64_t desired)
+{
+    return expected == (int64_t)InterlockedCompareExchange64((volatile LONG64*)x, desired, expected);
+}
+
+static void lava_atomic_fence(void)
+{
+    MemoryBarrier();
+}
+#else
+typedef pthread_cond_t lava_condition;
+typedef pthread_t lava_thread;
+typedef void* (*lava_thread_proc)(void* argument);
+#    define LAVA_THREAD_PROC(NAME) void* NAME(void* argument)
+#    define LAVA_THREAD_RETURN (LAVA_NULL)
+
+static void lava_condition_initialize(lava_condition* condition)
+{
+    pthread_cond_init(condition, LAVA_NULL);
+}
+
+static void lava_condition_terminate(lava_condition* condition)
+{
+    pthread_cond_destroy(condition);
+}
+
+static void lava_condition_wait(lava_condition* condition, lava_mutex* mutex)
+{
+    pthread_cond_wait(condition, mutex);
+}
+
+static void lava_condition_broadcast(lava_condition* condition)
+{
+    pthread_cond_broadcast(condition);
+}
+
+static bool lava_thread_create(lava_thread* thread, lava_thread_proc proc, void* argument)
+{
+    return 0 == pthread_create(thread, LAVA_NULL, proc, argument);
+}
+
+static void lava_thread_join(lava_thread thread)
+{
+    pthread_join(thread, LAVA_NULL);
+}
+
+static void lava_thread_yield(void)
+{
+    sched_yield();
+}
+
+static uint32_t lava_core_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (0 < count) ? (uint32_t)count : 1;
+}
+
+static uint64_t lava_timestamp(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static int32_t lava_atomic_load32(volatile int32_t* x)
+{
+    return __atomic_load_n(x, __ATOMIC_SEQ_CST);
+}
+
+static int32_t lava_atomic_add32(volatile int32_t* x, int32_t value)
+{
+    return __atomic_fetch_add(x, value, __ATOMIC_SEQ_CST);
+}
+
+static int64_t lava_atomic_load64(volatile int64_t* x)
+{
+    return __atomic_load_n(x, __ATOMIC_SEQ_CST);
+}
+
+static int64_t lava_atomic_add64(volatile int64_t* x, int64_t value)
+{
+    return __atomic_fetch_add(x, value, __ATOMIC_SEQ_CST);
+}
+
+static void lava_atomic_store64(volatile int64_t* x, int64_t value)
+{
+    __atomic_store_n(x, value, __ATOMIC_SEQ_CST);
+}
+
+static bool lava_atomic_cas64(volatile int64_t* x, int64_t expected, int64_t desired)
+{
+    return __atomic_compare_exchange_n(x, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void lava_atomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+//--- File
+//--------------------------------------------------------------------
+typedef struct lava_mapped_file_t
+{
+    const void* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} lava_mapped_file;
+
+#ifdef _WIN32
+static bool lava_map_file(const char* path, lava_mapped_file* mapped_file)
+{
+    memset(mapped_file, 0, sizeof(lava_mapped_file));
+    mapped_file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, LAVA_NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, LAVA_NULL);
+    if(INVALID_HANDLE_VALUE == mapped_file->file) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mapped_file->file, &size) || size.QuadPart <= 0) {
+        CloseHandle(mapped_file->file);
+        return false;
+    }
+    mapped_file->mapping = CreateFileMappingA(mapped_file->file, LAVA_NULL, PAGE_READONLY, 0, 0, LAVA_NULL);
+    if(LAVA_NULL == mapped_file->mapping) {
+        CloseHandle(mapped_file->file);
+        return false;
+    }
+    mapped_file->data = MapViewOfFile(mapped_file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(LAVA_NULL == mapped_file->data) {
+        CloseHandle(mapped_file->mapping);
+        CloseHandle(mapped_file->file);
+        return false;
+    }
+    mapped_file->size = (size_t)size.QuadPart;
+    return true;
+}
+
+static void lava_unmap_file(lava_mapped_file* mapped_file)
+{
+    UnmapViewOfFile(mapped_file->data);
+    CloseHandle(mapped_file->mapping);
+    CloseHandle(mapped_file->file);
+}
+
+/**
+ @brief Write a whole file to temporary_path, flush it to the disk, then move it over path.
+ */
+static bool lava_write_file(const char* path, const char* temporary_path, const void* data, size_t size)
+{
+    HANDLE file = CreateFileA(temporary_path, GENERIC_WRITE, 0, LAVA_NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, LAVA_NULL);
+    if(INVALID_HANDLE_VALUE == file) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    while(0 < size) {
+        DWORD written = 0;
+        DWORD chunk = (0x40000000U < size) ? 0x40000000U : (DWORD)size;
+        if(!WriteFile(file, bytes, chunk, &written, LAVA_NULL) || 0 == written) {
+            CloseHandle(file);
+            DeleteFileA(temporary_path);
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    bool flushed = FALSE != FlushFileBuffers(file);
+    CloseHandle(file);
+    if(!flushed || !MoveFileExA(temporary_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporary_path);
+        return false;
+    }
+    return true;
+}
+#else
+static bool lava_map_file(const char* path, lava_mapped_file* mapped_file)
+{
+    memset(mapped_file, 0, sizeof(lava_mapped_file));
+    int file = open(path, O_RDONLY);
+    if(file < 0) {
+        return false;
+    }
+    struct stat status;
+    if(0 != fstat(file, &status) || status.st_size <= 0) {
+        close(file);
+        return false;
+    }
+    void* data = mmap(LAVA_NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    //The mapping stays valid after the descriptor is closed
+    close(file);
+    if(MAP_FAILED == data) {
+        return false;
+    }
+    mapped_file->data = data;
+    mapped_file->size = (size_t)status.st_size;
+    return true;
+}
+
+static void lava_unmap_file(lava_mapped_file* mapped_file)
+{
+    munmap((void*)mapped_file->data, mapped_file->size);
+}
+
+static bool lava_write_file(const char* path, const char* temporary_path, const void* data, size_t size)
+{
+    int file = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(file < 0) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    while(0 < size) {
+        ssize_t written = write(file, bytes, size);
+        if(written <= 0) {
+            close(file);
+            unlink(temporary_path);
+            return false;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    bool flushed = 0 == fsync(file);
+    close(file);
+    //rename replaces atomically, readers see either the old or the new file
+    if(!flushed || 0 != rename(temporary_path, path)) {
+        unlink(temporary_path);
+        return false;
+    }
+    return true;
+}
+#endif
+
+//--- Utility
+//--------------------------------------------------------------------
+static VkDeviceSize lava_align_up(VkDeviceSize x, VkDeviceSize alignment)
+{
+    return (alignment <= 1) ? x : (x + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceSize lava_align_down(VkDeviceSize x, VkDeviceSize alignment)
+{
+    return (alignment <= 1) ? x : x / alignment * alignment;
+}
+
+static uint32_t lava_popcount(uint32_t x)
+{
+    uint32_t count = 0;
+    for(; 0 != x; x &= x - 1) {
+        ++count;
+    }
+    return count;
+}
+
+static VkImageAspectFlags lava_format_aspect(VkFormat format)
+{
+    switch(format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_S8_UINT:
+        return VK_IMAGE_ASPECT_STENCIL_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+        return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+static bool lava_format_is_multi_planar(VkFormat format)
+{
+    //The packed 4:2:2 formats in the same range have a single plane
+    switch(format) {
+    case VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM:
+    case VK_FORMAT_G8_B8R8_2PLANE_420_UNORM:
+    case VK_FORMAT_G8_B8_R8_3PLANE_422_UNORM:
+    case VK_FORMAT_G8_B8R8_2PLANE_422_UNORM:
+    case VK_FORMAT_G8_B8_R8_3PLANE_444_UNORM:
+    case VK_FORMAT_G10X6_B10X6_R10X6_3PLANE_420_UNORM_3PACK16:
+    case VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16:
+    case VK_FORMAT_G10X6_B10X6_R10X6_3PLANE_422_UNORM_3PACK16:
+    case VK_FORMAT_G10X6_B10X6R10X6_2PLANE_422_UNORM_3PACK16:
+    case VK_FORMAT_G10X6_B10X6_R10X6_3PLANE_444_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4_R12X4_3PLANE_420_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4R12X4_2PLANE_420_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4_R12X4_3PLANE_422_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4R12X4_2PLANE_422_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4_R12X4_3PLANE_444_UNORM_3PACK16:
+    case VK_FORMAT_G16_B16_R16_3PLANE_420_UNORM:
+    case VK_FORMAT_G16_B16R16_2PLANE_420_UNORM:
+    case VK_FORMAT_G16_B16_R16_3PLANE_422_UNORM:
+    case VK_FORMAT_G16_B16R16_2PLANE_422_UNORM:
+    case VK_FORMAT_G16_B16_R16_3PLANE_444_UNORM:
+    case VK_FORMAT_G8_B8R8_2PLANE_444_UNORM:
+    case VK_FORMAT_G10X6_B10X6R10X6_2PLANE_444_UNORM_3PACK16:
+    case VK_FORMAT_G12X4_B12X4R12X4_2PLANE_444_UNORM_3PACK16:
+    case VK_FORMAT_G16_B16R16_2PLANE_444_UNORM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//--- Memory
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_BLOCK_SIZE (64ULL * 1024ULL * 1024ULL)
+#define LAVA_DEFAULT_BUDGET_UPDATE_INTERVAL (30)
+#define LAVA_DEFAULT_EVICTION_THRESHOLD (0.9f)
+#define LAVA_DEFAULT_MEMORY_PRIORITY (0.5f)
+#define LAVA_MAX_QUEUE_FAMILY_INDICES (4)
+
+/**
+ Kinds of resources bound to a range, used to honor bufferImageGranularity.
+ */
+#define LAVA_RESOURCE_UNKNOWN (0)
+#define LAVA_RESOURCE_BUFFER (1)
+#define LAVA_RESOURCE_IMAGE_LINEAR (2)
+#define LAVA_RESOURCE_IMAGE_OPTIMAL (3)
+
+typedef struct lava_memory_block_t lava_memory_block;
+
+struct lava_allocation_t
+{
+    lava_memory_block* block;
+    lava_allocation* prev; //!< Neighbours in the block, sorted by offset.
+    lava_allocation* next;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    lava_allocation_create_flags flags;
+    uint32_t kind;
+    float priority;
+    bool placeholder; //!< Range reserved for a move in flight.
+    void* user_data;
+    VkDeviceAddress device_address;
+
+    //--- Recreation info for movable resources
+    VkBuffer buffer;
+    VkImage image;
+    VkBufferCreateInfo buffer_info;
+    VkImageCreateInfo image_info;
+    uint32_t queue_family_indices[LAVA_MAX_QUEUE_FAMILY_INDICES];
+    VkImageLayout image_layout;
+    lava_allocation* move_target;
+};
+
+struct lava_memory_block_t
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t memory_type_index;
+    uint32_t allocation_count;
+    void* mapped;
+    float priority;
+    bool dedicated;
+    lava_allocation* head;
+};
+
+typedef struct lava_memory_block_array_t
+{
+    lava_memory_block** blocks;
+    uint32_t count;
+    uint32_t capacity;
+} lava_memory_block_array;
+
+struct lava_memory_allocator_t
+{
+    crater_device* device;
+    VkPhysicalDevice physical_device;
+    const VkAllocationCallbacks* allocator;
+    lava_memory_allocator_create_flags flags;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize block_size;
+    VkDeviceSize buffer_image_granularity;
+    lava_mutex mutex;
+    lava_memory_block_array types[VK_MAX_MEMORY_TYPES];
+    lava_defragment_context* defragment;
+
+    //--- Budget
+    uint32_t budget_update_interval;
+    float eviction_threshold;
+    bool budget_fetched;
+    uint64_t budget_frame;
+    VkDeviceSize heap_block_bytes[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize fetched_block_bytes[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize fetched_usage[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize fetched_budget[VK_MAX_MEMORY_HEAPS];
+    lava_mutex eviction_mutex;
+    lava_eviction_callback_info* evictions;
+    uint32_t eviction_count;
+    uint32_t eviction_capacity;
+};
+
+static float lava_memory_priority(const lava_memory_allocator* memory_allocator, float priority)
+{
+    if(0 == (memory_allocator->flags & (LAVA_MEMORY_ALLOCATOR_CREATE_MEMORY_PRIORITY_BIT | LAVA_MEMORY_ALLOCATOR_CREATE_PAGEABLE_DEVICE_LOCAL_MEMORY_BIT))) {
+        return LAVA_DEFAULT_MEMORY_PRIORITY;
+    }
+    if(priority <= 0.0f) {
+        return LAVA_DEFAULT_MEMORY_PRIORITY;
+    }
+    return (1.0f < priority) ? 1.0f : priority;
+}
+
+static bool lava_find_memory_type(
+    const VkPhysicalDeviceMemoryProperties* properties,
+    uint32_t type_bits,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    uint32_t* memory_type_index)
+{
+    uint32_t best_cost = UINT32_MAX;
+    for(uint32_t i = 0; i < properties->memoryTypeCount; ++i) {
+        if(0 == (type_bits & (1U << i))) {
+            continue;
+        }
+        VkMemoryPropertyFlags flags = properties->memoryTypes[i].propertyFlags;
+        if(required != (flags & required)) {
+            continue;
+        }
+        uint32_t cost = lava_popcount(preferred & ~flags) * 8 + lava_popcount(flags & ~(required | preferred));
+        if(cost < best_cost) {
+            best_cost = cost;
+            *memory_type_index = i;
+        }
+    }
+    return best_cost != UINT32_MAX;
+}
+
+static bool lava_granularity_conflict(uint32_t kind0, uint32_t kind1)
+{
+    if(kind0 == kind1) {
+        return false;
+    }
+    return LAVA_RESOURCE_UNKNOWN == kind0 || LAVA_RESOURCE_UNKNOWN == kind1 || LAVA_RESOURCE_IMAGE_OPTIMAL == kind0 || LAVA_RESOURCE_IMAGE_OPTIMAL == kind1;
+}
+
+/**
+ @brief First fit search over the gaps between allocations of a block.
+ */
+static bool lava_block_find(
+    const lava_memory_allocator* memory_allocator,
+    const lava_memory_block* block,
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    uint32_t kind,
+    float priority,
+    VkDeviceSize* offset,
+    lava_allocation** prev)
+{
+    if(block->dedicated || block->size - block->used < size || block->priority != priority) {
+        return false;
+    }
+    VkDeviceSize granularity = memory_allocator->buffer_image_granularity;
+    lava_allocation* left = LAVA_NULL;
+    lava_allocation* right = block->head;
+    for(;;) {
+        VkDeviceSize begin = 0;
+        if(LAVA_NULL != left) {
+            begin = left->offset + left->size;
+            if(lava_granularity_conflict(left->kind, kind)) {
+                begin = lava_align_up(begin, granularity);
+            }
+        }
+        begin = lava_align_up(begin, alignment);
+        VkDeviceSize end = (LAVA_NULL != right) ? right->offset : block->size;
+        if(begin + size <= end) {
+            bool conflict = LAVA_NULL != right
+                            && lava_granularity_conflict(kind, right->kind)
+                            && lava_align_down(right->offset, granularity) <= lava_align_down(begin + size - 1, granularity);
+            if(!conflict) {
+                *offset = begin;
+                *prev = left;
+                return true;
+            }
+        }
+        if(LAVA_NULL == right) {
+            return false;
+        }
+        left = right;
+        right = right->next;
+    }
+}
+
+static void lava_block_insert(lava_memory_block* block, lava_allocation* prev, lava_allocation* allocation)
+{
+    allocation->block = block;
+    allocation->prev = prev;
+    if(LAVA_NULL == prev) {
+        allocation->next = block->head;
+        block->head = allocation;
+    } else {
+        allocation->next = prev->next;
+        prev->next = allocation;
+    }
+    if(LAVA_NULL != allocation->next) {
+        allocation->next->prev = allocation;
+    }
+    block->used += allocation->size;
+    ++block->allocation_count;
+}
+
+static void lava_block_remove(lava_memory_block* block, lava_allocation* allocation)
+{
+    if(LAVA_NULL == allocation->prev) {
+        block->head = allocation->next;
+    } else {
+        allocation->prev->next = allocation->next;
+    }
+    if(LAVA_NULL != allocation->next) {
+        allocation->next->prev = allocation->prev;
+    }
+    allocation->prev = allocation->next = LAVA_NULL;
+    block->used -= allocation->size;
+    --block->allocation_count;
+}
+
+static VkResult lava_block_create(
+    lava_memory_allocator* memory_allocator,
+    uint32_t memory_type_index,
+    VkDeviceSize size,
+    float priority,
+    bool dedicated,
+    VkBuffer dedicated_buffer,
+    VkImage dedicated_image,
+    lava_memory_block** block)
+{
+    VkMemoryAllocateInfo allocate_info = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        LAVA_NULL,
+        size,
+        memory_type_index,
+    };
+    VkMemoryDedicatedAllocateInfo dedicated_info = {
+        VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        LAVA_NULL,
+        dedicated_image,
+        dedicated_buffer,
+    };
+    if(dedicated && (VK_NULL_HANDLE != dedicated_buffer || VK_NULL_HANDLE != dedicated_image)) {
+        dedicated_info.pNext = allocate_info.pNext;
+        allocate_info.pNext = &dedicated_info;
+    }
+    VkMemoryPriorityAllocateInfoEXT priority_info = {
+        VK_STRUCTURE_TYPE_MEMORY_PRIORITY_ALLOCATE_INFO_EXT,
+        LAVA_NULL,
+        priority,
+    };
+    if(0 != (memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_MEMORY_PRIORITY_BIT)) {
+        priority_info.pNext = allocate_info.pNext;
+        allocate_info.pNext = &priority_info;
+    }
+    VkMemoryAllocateFlagsInfo flags_info = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        LAVA_NULL,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+        0,
+    };
+    if(0 != (memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT)) {
+        flags_info.pNext = allocate_info.pNext;
+        allocate_info.pNext = &flags_info;
+    }
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult result = vkAllocateMemory(memory_allocator->device->device_, &allocate_info, memory_allocator->allocator, &memory);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    void* mapped = LAVA_NULL;
+    if(0 != (memory_allocator->memory_properties.memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        result = vkMapMemory(memory_allocator->device->device_, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if(VK_SUCCESS != result) {
+            vkFreeMemory(memory_allocator->device->device_, memory, memory_allocator->allocator);
+            return result;
+        }
+    }
+    lava_memory_block_array* array = &memory_allocator->types[memory_type_index];
+    if(!lava_reserve(memory_allocator->allocator, (void**)&array->blocks, &array->capacity, array->count + 1, sizeof(lava_memory_block*))) {
+        vkFreeMemory(memory_allocator->device->device_, memory, memory_allocator->allocator);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    lava_memory_block* new_block = (lava_memory_block*)lava_calloc(memory_allocator->allocator, sizeof(lava_memory_block));
+    if(LAVA_NULL == new_block) {
+        vkFreeMemory(memory_allocator->device->device_, memory, memory_allocator->allocator);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_block->memory = memory;
+    new_block->size = size;
+    new_block->memory_type_index = memory_type_index;
+    new_block->mapped = mapped;
+    new_block->priority = priority;
+    new_block->dedicated = dedicated;
+    array->blocks[array->count] = new_block;
+    ++array->count;
+    memory_allocator->heap_block_bytes[memory_allocator->memory_properties.memoryTypes[memory_type_index].heapIndex] += size;
+    *block = new_block;
+    return VK_SUCCESS;
+}
+
+static void lava_block_destroy(lava_memory_allocator* memory_allocator, lava_memory_block* block)
+{
+    lava_memory_block_array* array = &memory_allocator->types[block->memory_type_index];
+    for(uint32_t i = 0; i < array->count; ++i) {
+        if(array->blocks[i] == block) {
+            array->blocks[i] = array->blocks[array->count - 1];
+            --array->count;
+            break;
+        }
+    }
+    memory_allocator->heap_block_bytes[memory_allocator->memory_properties.memoryTypes[block->memory_type_index].heapIndex] -= block->size;
+    vkFreeMemory(memory_allocator->device->device_, block->memory, memory_allocator->allocator);
+    lava_free(memory_allocator->allocator, block);
+}
+
+/**
+ @brief Release a block which has become empty, keeping one pooled block per type to avoid thrashing.
+ */
+static bool lava_block_release_if_empty(lava_memory_allocator* memory_allocator, lava_memory_block* block)
+{
+    if(0 < block->allocation_count) {
+        return false;
+    }
+    if(!block->dedicated) {
+        const lava_memory_block_array* array = &memory_allocator->types[block->memory_type_index];
+        uint32_t pooled = 0;
+        for(uint32_t i = 0; i < array->count; ++i) {
+            pooled += array->blocks[i]->dedicated ? 0 : 1;
+        }
+        if(pooled <= 1 && LAVA_NULL == memory_allocator->defragment) {
+            return false;
+        }
+    }
+    lava_block_destroy(memory_allocator, block);
+    return true;
+}
+
+/**
+ @brief Find room for an allocation in the pooled blocks of a type. Must be called with the mutex held.
+ */
+static bool lava_place_allocation(lava_memory_allocator* memory_allocator, uint32_t memory_type_index, VkDeviceSize alignment, lava_allocation* allocation)
+{
+    lava_memory_block_array* array = &memory_allocator->types[memory_type_index];
+    for(uint32_t i = 0; i < array->count; ++i) {
+        VkDeviceSize offset;
+        lava_allocation* prev;
+        if(lava_block_find(memory_allocator, array->blocks[i], allocation->size, alignment, allocation->kind, allocation->priority, &offset, &prev)) {
+            allocation->offset = offset;
+            lava_block_insert(array->blocks[i], prev, allocation);
+            return true;
+        }
+    }
+    return false;
+}
+
+static VkResult lava_allocate_internal(
+    lava_memory_allocator* memory_allocator,
+    const VkMemoryRequirements* requirements,
+    const lava_allocation_create_info* create_info,
+    uint32_t kind,
+    VkBuffer dedicated_buffer,
+    VkImage dedicated_image,
+    lava_allocation** allocation)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != requirements);
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != allocation);
+    lava_allocation* new_allocation = (lava_allocation*)lava_calloc(memory_allocator->allocator, sizeof(lava_allocation));
+    if(LAVA_NULL == new_allocation) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_allocation->size = requirements->size;
+    new_allocation->flags = create_info->flags;
+    new_allocation->kind = kind;
+    new_allocation->priority = lava_memory_priority(memory_allocator, create_info->priority);
+    new_allocation->user_data = create_info->user_data;
+
+    bool dedicated = 0 != (create_info->flags & LAVA_ALLOCATION_CREATE_DEDICATED_BIT) || (memory_allocator->block_size / 2) < requirements->size;
+    VkMemoryPropertyFlags required = create_info->required_flags;
+    if(0 != (create_info->flags & LAVA_ALLOCATION_CREATE_MAPPED_BIT)) {
+        required |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+    uint32_t type_bits = requirements->memoryTypeBits;
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    uint32_t memory_type_index = 0;
+    while(lava_find_memory_type(&memory_allocator->memory_properties, type_bits, required, create_info->preferred_flags, &memory_type_index)) {
+        type_bits &= ~(1U << memory_type_index);
+        lava_mutex_lock(&memory_allocator->mutex);
+        if(!dedicated && lava_place_allocation(memory_allocator, memory_type_index, requirements->alignment, new_allocation)) {
+            lava_mutex_unlock(&memory_allocator->mutex);
+            *allocation = new_allocation;
+            return VK_SUCCESS;
+        }
+        lava_memory_block* block = LAVA_NULL;
+        if(dedicated) {
+            result = lava_block_create(memory_allocator, memory_type_index, requirements->size, new_allocation->priority, true, dedicated_buffer, dedicated_image, &block);
+        } else {
+            VkDeviceSize heap_size = memory_allocator->memory_properties.memoryHeaps[memory_allocator->memory_properties.memoryTypes[memory_type_index].heapIndex].size;
+            VkDeviceSize block_size = memory_allocator->block_size;
+            while(heap_size < block_size * 8 && requirements->size * 2 <= block_size) {
+                block_size >>= 1;
+            }
+            result = lava_block_create(memory_allocator, memory_type_index, block_size, new_allocation->priority, false, VK_NULL_HANDLE, VK_NULL_HANDLE, &block);
+        }
+        if(VK_SUCCESS == result) {
+            new_allocation->offset = 0;
+            lava_block_insert(block, LAVA_NULL, new_allocation);
+            lava_mutex_unlock(&memory_allocator->mutex);
+            *allocation = new_allocation;
+            return VK_SUCCESS;
+        }
+        lava_mutex_unlock(&memory_allocator->mutex);
+        if(VK_ERROR_OUT_OF_HOST_MEMORY == result) {
+            break;
+        }
+    }
+    lava_free(memory_allocator->allocator, new_allocation);
+    return result;
+}
+
+static void lava_cancel_move(lava_memory_allocator* memory_allocator, lava_allocation* allocation);
+static bool lava_adopt_move_source(lava_memory_allocator* memory_allocator, lava_allocation* allocation);
+
+static void lava_free_internal(lava_memory_allocator* memory_allocator, lava_allocation* allocation)
+{
+    lava_mutex_lock(&memory_allocator->mutex);
+    if(LAVA_NULL != allocation->move_target) {
+        lava_cancel_move(memory_allocator, allocation);
+    }
+    lava_memory_block* block = allocation->block;
+    lava_block_remove(block, allocation);
+    lava_block_release_if_empty(memory_allocator, block);
+    lava_mutex_unlock(&memory_allocator->mutex);
+    lava_free(memory_allocator->allocator, allocation);
+}
+
+VkResult LAVA_API lava_create_memory_allocator(const lava_memory_allocator_create_info* create_info, lava_memory_allocator** memory_allocator)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != memory_allocator);
+    lava_memory_allocator* new_allocator = (lava_memory_allocator*)lava_calloc(create_info->allocator, sizeof(lava_memory_allocator));
+    if(LAVA_NULL == new_allocator) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_allocator->device = create_info->device;
+    new_allocator->physical_device = create_info->physical_device;
+    new_allocator->allocator = create_info->allocator;
+    new_allocator->flags = create_info->flags;
+    new_allocator->block_size = (0 < create_info->block_size) ? create_info->block_size : LAVA_DEFAULT_BLOCK_SIZE;
+    new_allocator->budget_update_interval = (0 < create_info->budget_update_interval) ? create_info->budget_update_interval : LAVA_DEFAULT_BUDGET_UPDATE_INTERVAL;
+    new_allocator->eviction_threshold = (0.0f < create_info->eviction_threshold) ? create_info->eviction_threshold : LAVA_DEFAULT_EVICTION_THRESHOLD;
+    vkGetPhysicalDeviceMemoryProperties(create_info->physical_device, &new_allocator->memory_properties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(create_info->physical_device, &properties);
+    new_allocator->buffer_image_granularity = properties.limits.bufferImageGranularity;
+    lava_mutex_initialize(&new_allocator->mutex);
+    lava_mutex_initialize(&new_allocator->eviction_mutex);
+    *memory_allocator = new_allocator;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_memory_allocator(lava_memory_allocator* memory_allocator)
+{
+    if(LAVA_NULL == memory_allocator) {
+        return;
+    }
+    assert(LAVA_NULL == memory_allocator->defragment);
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+        lava_memory_block_array* array = &memory_allocator->types[i];
+        for(uint32_t j = 0; j < array->count; ++j) {
+            lava_memory_block* block = array->blocks[j];
+            while(LAVA_NULL != block->head) {
+                lava_allocation* next = block->head->next;
+                lava_free(allocator, block->head);
+                block->head = next;
+            }
+            vkFreeMemory(memory_allocator->device->device_, block->memory, allocator);
+            lava_free(allocator, block);
+        }
+        lava_free(allocator, array->blocks);
+    }
+    lava_free(allocator, memory_allocator->evictions);
+    lava_mutex_terminate(&memory_allocator->eviction_mutex);
+    lava_mutex_terminate(&memory_allocator->mutex);
+    lava_free(allocator, memory_allocator);
+}
+
+VkResult LAVA_API lava_allocate_memory(lava_memory_allocator* memory_allocator, const VkMemoryRequirements* requirements, const lava_allocation_create_info* create_info, lava_allocation** allocation)
+{
+    return lava_allocate_internal(memory_allocator, requirements, create_info, LAVA_RESOURCE_UNKNOWN, VK_NULL_HANDLE, VK_NULL_HANDLE, allocation);
+}
+
+void LAVA_API lava_free_memory(lava_memory_allocator* memory_allocator, lava_allocation* allocation)
+{
+    if(LAVA_NULL == allocation) {
+        return;
+    }
+    lava_free_internal(memory_allocator, allocation);
+}
+
+static VkDeviceAddress lava_buffer_device_address(const lava_memory_allocator* memory_allocator, VkBuffer buffer, VkBufferUsageFlags usage)
+{
+    if(0 == (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)) {
+        return 0;
+    }
+    assert(0 != (memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT));
+    VkBufferDeviceAddressInfo address_info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, LAVA_NULL, buffer};
+    return vkGetBufferDeviceAddress(memory_allocator->device->device_, &address_info);
+}
+
+VkResult LAVA_API lava_create_buffer(lava_memory_allocator* memory_allocator, const VkBufferCreateInfo* buffer_create_info, const lava_allocation_create_info* create_info, VkBuffer* buffer, lava_allocation** allocation)
+{
+    assert(LAVA_NULL != buffer_create_info);
+    assert(LAVA_NULL != buffer);
+    VkDevice device = memory_allocator->device->device_;
+    VkResult result = vkCreateBuffer(device, buffer_create_info, memory_allocator->allocator, buffer);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, *buffer, &requirements);
+    result = lava_allocate_internal(memory_allocator, &requirements, create_info, LAVA_RESOURCE_BUFFER, *buffer, VK_NULL_HANDLE, allocation);
+    if(VK_SUCCESS != result) {
+        vkDestroyBuffer(device, *buffer, memory_allocator->allocator);
+        *buffer = VK_NULL_HANDLE;
+        return result;
+    }
+    lava_allocation* new_allocation = *allocation;
+    result = vkBindBufferMemory(device, *buffer, new_allocation->block->memory, new_allocation->offset);
+    if(VK_SUCCESS != result) {
+        lava_free_internal(memory_allocator, new_allocation);
+        vkDestroyBuffer(device, *buffer, memory_allocator->allocator);
+        *buffer = VK_NULL_HANDLE;
+        *allocation = LAVA_NULL;
+        return result;
+    }
+    new_allocation->buffer = *buffer;
+    new_allocation->buffer_info = *buffer_create_info;
+    new_allocation->buffer_info.pNext = LAVA_NULL;
+    if(VK_SHARING_MODE_CONCURRENT == buffer_create_info->sharingMode && buffer_create_info->queueFamilyIndexCount <= LAVA_MAX_QUEUE_FAMILY_INDICES) {
+        memcpy(new_allocation->queue_family_indices, buffer_create_info->pQueueFamilyIndices, sizeof(uint32_t) * buffer_create_info->queueFamilyIndexCount);
+        new_allocation->buffer_info.pQueueFamilyIndices = new_allocation->queue_family_indices;
+    } else if(VK_SHARING_MODE_CONCURRENT == buffer_create_info->sharingMode) {
+        new_allocation->flags &= ~LAVA_ALLOCATION_CREATE_MOVABLE_BIT;
+    }
+    if(new_allocation->block->dedicated) {
+        new_allocation->flags &= ~LAVA_ALLOCATION_CREATE_MOVABLE_BIT;
+    }
+    new_allocation->device_address = lava_buffer_device_address(memory_allocator, *buffer, buffer_create_info->usage);
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_buffer(lava_memory_allocator* memory_allocator, VkBuffer buffer, lava_allocation* allocation)
+{
+    //A buffer being copied by a defragmentation step is destroyed once the copy is done
+    if(VK_NULL_HANDLE != buffer && !lava_adopt_move_source(memory_allocator, allocation)) {
+        vkDestroyBuffer(memory_allocator->device->device_, buffer, memory_allocator->allocator);
+    }
+    lava_free_memory(memory_allocator, allocation);
+}
+
+VkResult LAVA_API lava_create_image(lava_memory_allocator* memory_allocator, const VkImageCreateInfo* image_create_info, const lava_allocation_create_info* create_info, VkImage* image, lava_allocation** allocation)
+{
+    assert(LAVA_NULL != image_create_info);
+    assert(LAVA_NULL != image);
+    VkDevice device = memory_allocator->device->device_;
+    VkResult result = vkCreateImage(device, image_create_info, memory_allocator->allocator, image);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, *image, &requirements);
+    uint32_t kind = (VK_IMAGE_TILING_LINEAR == image_create_info->tiling) ? LAVA_RESOURCE_IMAGE_LINEAR : LAVA_RESOURCE_IMAGE_OPTIMAL;
+    result = lava_allocate_internal(memory_allocator, &requirements, create_info, kind, VK_NULL_HANDLE, *image, allocation);
+    if(VK_SUCCESS != result) {
+        vkDestroyImage(device, *image, memory_allocator->allocator);
+        *image = VK_NULL_HANDLE;
+        return result;
+    }
+    lava_allocation* new_allocation = *allocation;
+    result = vkBindImageMemory(device, *image, new_allocation->block->memory, new_allocation->offset);
+    if(VK_SUCCESS != result) {
+        lava_free_internal(memory_allocator, new_allocation);
+        vkDestroyImage(device, *image, memory_allocator->allocator);
+        *image = VK_NULL_HANDLE;
+        *allocation = LAVA_NULL;
+        return result;
+    }
+    new_allocation->image = *image;
+    new_allocation->image_info = *image_create_info;
+    new_allocation->image_info.pNext = LAVA_NULL;
+    new_allocation->image_layout = image_create_info->initialLayout;
+    bool movable = !new_allocation->block->dedicated
+                   && !lava_format_is_multi_planar(image_create_info->format)
+                   && 0 == (image_create_info->flags & (VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_DISJOINT_BIT));
+    if(VK_SHARING_MODE_CONCURRENT == image_create_info->sharingMode) {
+        if(image_create_info->queueFamilyIndexCount <= LAVA_MAX_QUEUE_FAMILY_INDICES) {
+            memcpy(new_allocation->queue_family_indices, image_create_info->pQueueFamilyIndices, sizeof(uint32_t) * image_create_info->queueFamilyIndexCount);
+            new_allocation->image_info.pQueueFamilyIndices = new_allocation->queue_family_indices;
+        } else {
+            movable = false;
+        }
+    }
+    if(!movable) {
+        new_allocation->flags &= ~LAVA_ALLOCATION_CREATE_MOVABLE_BIT;
+    }
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_image(lava_memory_allocator* memory_allocator, VkImage image, lava_allocation* allocation)
+{
+    if(VK_NULL_HANDLE != image && !lava_adopt_move_source(memory_allocator, allocation)) {
+        vkDestroyImage(memory_allocator->device->device_, image, memory_allocator->allocator);
+    }
+    lava_free_memory(memory_allocator, allocation);
+}
+
+void LAVA_API lava_get_allocation_info(const lava_allocation* allocation, lava_allocation_info* info)
+{
+    assert(LAVA_NULL != allocation);
+    assert(LAVA_NULL != info);
+    const lava_memory_block* block = allocation->block;
+    info->memory = block->memory;
+    info->offset = allocation->offset;
+    info->size = allocation->size;
+    info->memory_type_index = block->memory_type_index;
+    info->mapped = (LAVA_NULL != block->mapped) ? (uint8_t*)block->mapped + allocation->offset : LAVA_NULL;
+    info->user_data = allocation->user_data;
+    info->device_address = allocation->device_address;
+}
+
+void LAVA_API lava_set_allocation_image_layout(lava_allocation* allocation, VkImageLayout layout)
+{
+    assert(LAVA_NULL != allocation);
+    allocation->image_layout = layout;
+}
+
+void LAVA_API lava_get_memory_stats(lava_memory_allocator* memory_allocator, lava_memory_stats* stats)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != stats);
+    memset(stats, 0, sizeof(lava_memory_stats));
+    lava_mutex_lock(&memory_allocator->mutex);
+    for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+        const lava_memory_block_array* array = &memory_allocator->types[i];
+        for(uint32_t j = 0; j < array->count; ++j) {
+            stats->block_count += 1;
+            stats->block_bytes += array->blocks[j]->size;
+            stats->allocation_count += array->blocks[j]->allocation_count;
+            stats->allocation_bytes += array->blocks[j]->used;
+        }
+    }
+    lava_mutex_unlock(&memory_allocator->mutex);
+}
+
+//--- Memory budget
+//--------------------------------------------------------------------
+/**
+ @brief Query the driver budget. Must be called with the mutex held.
+ */
+static void lava_fetch_memory_budget(lava_memory_allocator* memory_allocator)
+{
+    const VkPhysicalDeviceMemoryProperties* properties = &memory_allocator->memory_properties;
+    if(0 != (memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_MEMORY_BUDGET_BIT)) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties;
+        memset(&budget_properties, 0, sizeof(budget_properties));
+        budget_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties2;
+        memset(&properties2, 0, sizeof(properties2));
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budget_properties;
+        if(LAVA_NULL != vkGetPhysicalDeviceMemoryProperties2KHR) {
+            vkGetPhysicalDeviceMemoryProperties2KHR(memory_allocator->physical_device, &properties2);
+        } else {
+            vkGetPhysicalDeviceMemoryProperties2(memory_allocator->physical_device, &properties2);
+        }
+        for(uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+            memory_allocator->fetched_usage[i] = budget_properties.heapUsage[i];
+            memory_allocator->fetched_budget[i] = (0 < budget_properties.heapBudget[i]) ? budget_properties.heapBudget[i] : properties->memoryHeaps[i].size;
+            memory_allocator->fetched_block_bytes[i] = memory_allocator->heap_block_bytes[i];
+        }
+    } else {
+        //Without the extension, only lava's own blocks are known and 80% of a heap is a common safe limit
+        for(uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+            memory_allocator->fetched_usage[i] = memory_allocator->heap_block_bytes[i];
+            memory_allocator->fetched_budget[i] = properties->memoryHeaps[i].size * 8 / 10;
+            memory_allocator->fetched_block_bytes[i] = memory_allocator->heap_block_bytes[i];
+        }
+    }
+    memory_allocator->budget_fetched = true;
+}
+
+static VkDeviceSize lava_estimate_usage(const lava_memory_allocator* memory_allocator, uint32_t heap_index)
+{
+    VkDeviceSize usage = memory_allocator->fetched_usage[heap_index];
+    VkDeviceSize current = memory_allocator->heap_block_bytes[heap_index];
+    VkDeviceSize fetched = memory_allocator->fetched_block_bytes[heap_index];
+    if(fetched <= current) {
+        return usage + (current - fetched);
+    }
+    return (fetched - current < usage) ? usage - (fetched - current) : 0;
+}
+
+void LAVA_API lava_update_memory_budget(lava_memory_allocator* memory_allocator, uint64_t frame_index)
+{
+    assert(LAVA_NULL != memory_allocator);
+    VkDeviceSize excess[VK_MAX_MEMORY_HEAPS];
+    uint32_t heap_count = memory_allocator->memory_properties.memoryHeapCount;
+    bool over = false;
+    lava_mutex_lock(&memory_allocator->mutex);
+    if(!memory_allocator->budget_fetched || memory_allocator->budget_update_interval <= frame_index - memory_allocator->budget_frame) {
+        lava_fetch_memory_budget(memory_allocator);
+        memory_allocator->budget_frame = frame_index;
+    }
+    for(uint32_t i = 0; i < heap_count; ++i) {
+        VkDeviceSize usage = lava_estimate_usage(memory_allocator, i);
+        VkDeviceSize limit = (VkDeviceSize)((double)memory_allocator->fetched_budget[i] * memory_allocator->eviction_threshold);
+        excess[i] = (limit < usage) ? usage - limit : 0;
+        over = over || (0 < excess[i]);
+    }
+    lava_mutex_unlock(&memory_allocator->mutex);
+    if(!over) {
+        return;
+    }
+
+    //Ask caches in priority order, outside of the allocation lock so that they can free memory
+    lava_mutex_lock(&memory_allocator->eviction_mutex);
+    for(uint32_t i = 0; i < heap_count; ++i) {
+        for(uint32_t j = 0; j < memory_allocator->eviction_count && 0 < excess[i]; ++j) {
+            const lava_eviction_callback_info* info = &memory_allocator->evictions[j];
+            VkDeviceSize freed = info->callback(info->user_data, i, excess[i]);
+            excess[i] = (freed < excess[i]) ? excess[i] - freed : 0;
+        }
+    }
+    lava_mutex_unlock(&memory_allocator->eviction_mutex);
+}
+
+void LAVA_API lava_get_memory_budget(lava_memory_allocator* memory_allocator, lava_memory_budget* budgets)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != budgets);
+    memset(budgets, 0, sizeof(lava_memory_budget) * VK_MAX_MEMORY_HEAPS);
+    lava_mutex_lock(&memory_allocator->mutex);
+    if(!memory_allocator->budget_fetched) {
+        lava_fetch_memory_budget(memory_allocator);
+    }
+    const VkPhysicalDeviceMemoryProperties* properties = &memory_allocator->memory_properties;
+    for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+        const lava_memory_block_array* array = &memory_allocator->types[i];
+        for(uint32_t j = 0; j < array->count; ++j) {
+            budgets[properties->memoryTypes[i].heapIndex].allocation_bytes += array->blocks[j]->used;
+        }
+    }
+    for(uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+        budgets[i].block_bytes = memory_allocator->heap_block_bytes[i];
+        budgets[i].usage = lava_estimate_usage(memory_allocator, i);
+        budgets[i].budget = memory_allocator->fetched_budget[i];
+    }
+    lava_mutex_unlock(&memory_allocator->mutex);
+}
+
+VkResult LAVA_API lava_register_eviction_callback(lava_memory_allocator* memory_allocator, const lava_eviction_callback_info* info)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != info);
+    assert(LAVA_NULL != info->callback);
+    lava_mutex_lock(&memory_allocator->eviction_mutex);
+    if(!lava_reserve(memory_allocator->allocator, (void**)&memory_allocator->evictions, &memory_allocator->eviction_capacity, memory_allocator->eviction_count + 1, sizeof(lava_eviction_callback_info))) {
+        lava_mutex_unlock(&memory_allocator->eviction_mutex);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t pos = memory_allocator->eviction_count;
+    while(0 < pos && info->priority < memory_allocator->evictions[pos - 1].priority) {
+        memory_allocator->evictions[pos] = memory_allocator->evictions[pos - 1];
+        --pos;
+    }
+    memory_allocator->evictions[pos] = *info;
+    ++memory_allocator->eviction_count;
+    lava_mutex_unlock(&memory_allocator->eviction_mutex);
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_unregister_eviction_callback(lava_memory_allocator* memory_allocator, PFN_lava_memory_evict callback, void* user_data)
+{
+    assert(LAVA_NULL != memory_allocator);
+    lava_mutex_lock(&memory_allocator->eviction_mutex);
+    for(uint32_t i = 0; i < memory_allocator->eviction_count; ++i) {
+        if(memory_allocator->evictions[i].callback != callback || memory_allocator->evictions[i].user_data != user_data) {
+            continue;
+        }
+        for(uint32_t j = i + 1; j < memory_allocator->eviction_count; ++j) {
+            memory_allocator->evictions[j - 1] = memory_allocator->evictions[j];
+        }
+        --memory_allocator->eviction_count;
+        break;
+    }
+    lava_mutex_unlock(&memory_allocator->eviction_mutex);
+}
+
+void LAVA_API lava_set_allocation_priority(lava_memory_allocator* memory_allocator, lava_allocation* allocation, float priority)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != allocation);
+    if(0 == (memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_PAGEABLE_DEVICE_LOCAL_MEMORY_BIT)
+       || LAVA_NULL == memory_allocator->device->vkSetDeviceMemoryPriorityEXT) {
+        return;
+    }
+    lava_mutex_lock(&memory_allocator->mutex);
+    lava_memory_block* block = allocation->block;
+    if(block->dedicated) {
+        allocation->priority = lava_memory_priority(memory_allocator, priority);
+        block->priority = allocation->priority;
+        memory_allocator->device->vkSetDeviceMemoryPriorityEXT(memory_allocator->device->device_, block->memory, block->priority);
+    }
+    lava_mutex_unlock(&memory_allocator->mutex);
+}
+
+//--- Defragmentation
+//--------------------------------------------------------------------
+typedef struct lava_defragment_move_t
+{
+    lava_allocation* allocation; //!< NULL if freed while the move was in flight.
+    lava_allocation* target;
+    VkBuffer buffer;
+    VkImage image;
+    //Copied from the allocation while planning, the step records without the lock
+    VkBuffer src_buffer;
+    VkImage src_image;
+    VkDeviceSize size;
+    VkImageCreateInfo image_info;
+    VkImageLayout image_layout;
+    bool owns_source; //!< The source was destroyed while being copied, the commit destroys it.
+} lava_defragment_move;
+
+struct lava_defragment_context_t
+{
+    lava_memory_allocator* memory_allocator;
+    lava_defragment_create_info info;
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    lava_defragment_move* moves;
+    uint32_t move_count;
+    uint32_t move_capacity;
+    lava_memory_block** blocks;
+    uint32_t block_capacity;
+    bool in_flight;
+    lava_defragment_stats stats;
+};
+
+static void lava_cancel_move(lava_memory_allocator* memory_allocator, lava_allocation* allocation)
+{
+    lava_defragment_context* context = memory_allocator->defragment;
+    assert(LAVA_NULL != context);
+    for(uint32_t i = 0; i < context->move_count; ++i) {
+        if(context->moves[i].allocation == allocation) {
+            context->moves[i].allocation = LAVA_NULL;
+            break;
+        }
+    }
+    allocation->move_target = LAVA_NULL;
+}
+
+/**
+ @brief Take over the source of a move in flight, so that it outlives the copy.
+ */
+static bool lava_adopt_move_source(lava_memory_allocator* memory_allocator, lava_allocation* allocation)
+{
+    if(LAVA_NULL == allocation) {
+        return false;
+    }
+    bool adopted = false;
+    lava_mutex_lock(&memory_allocator->mutex);
+    lava_defragment_context* context = memory_allocator->defragment;
+    for(uint32_t i = 0; LAVA_NULL != allocation->move_target && i < context->move_count; ++i) {
+        if(context->moves[i].allocation == allocation) {
+            context->moves[i].owns_source = true;
+            adopted = true;
+            break;
+        }
+    }
+    lava_mutex_unlock(&memory_allocator->mutex);
+    return adopted;
+}
+
+static VkResult lava_defragment_create_resource(lava_memory_allocator* memory_allocator, const lava_allocation* allocation, const lava_allocation* target, lava_defragment_move* move)
+{
+    VkDevice device = memory_allocator->device->device_;
+    VkResult result;
+    move->buffer = VK_NULL_HANDLE;
+    move->image = VK_NULL_HANDLE;
+    if(LAVA_RESOURCE_BUFFER == allocation->kind) {
+        result = vkCreateBuffer(device, &allocation->buffer_info, memory_allocator->allocator, &move->buffer);
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+        result = vkBindBufferMemory(device, move->buffer, target->block->memory, target->offset);
+        if(VK_SUCCESS != result) {
+            vkDestroyBuffer(device, move->buffer, memory_allocator->allocator);
+        }
+        return result;
+    }
+    VkImageCreateInfo image_info = allocation->image_info;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    result = vkCreateImage(device, &image_info, memory_allocator->allocator, &move->image);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    result = vkBindImageMemory(device, move->image, target->block->memory, target->offset);
+    if(VK_SUCCESS != result) {
+        vkDestroyImage(device, move->image, memory_allocator->allocator);
+    }
+    return result;
+}
+
+static int lava_compare_block_used(const void* x0, const void* x1)
+{
+    const lava_memory_block* b0 = *(const lava_memory_block* const*)x0;
+    const lava_memory_block* b1 = *(const lava_memory_block* const*)x1;
+    return (b0->used < b1->used) ? 1 : ((b1->used < b0->used) ? -1 : 0);
+}
+
+/**
+ @brief Plan moves from the sparsest blocks into the densest ones. Must be called with the mutex held.
+ */
+static void lava_defragment_plan(lava_defragment_context* context)
+{
+    lava_memory_allocator* memory_allocator = context->memory_allocator;
+    const VkDeviceSize max_bytes = (0 < context->info.max_bytes_per_step) ? context->info.max_bytes_per_step : ~0ULL;
+    const uint32_t max_moves = (0 < context->info.max_moves_per_step) ? context->info.max_moves_per_step : UINT32_MAX;
+    VkDeviceSize bytes = 0;
+    for(uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type) {
+        lava_memory_block_array* array = &memory_allocator->types[type];
+        uint32_t count = 0;
+        if(!lava_reserve(memory_allocator->allocator, (void**)&context->blocks, &context->block_capacity, array->count, sizeof(lava_memory_block*))) {
+            return;
+        }
+        for(uint32_t i = 0; i < array->count; ++i) {
+            if(!array->blocks[i]->dedicated) {
+                context->blocks[count++] = array->blocks[i];
+            }
+        }
+        if(count < 2) {
+            continue;
+        }
+        qsort(context->blocks, count, sizeof(lava_memory_block*), lava_compare_block_used);
+        for(uint32_t src = count - 1; 0 < src; --src) {
+            for(lava_allocation* allocation = context->blocks[src]->head; LAVA_NULL != allocation; allocation = allocation->next) {
+                if(allocation->placeholder
+                   || LAVA_NULL != allocation->move_target
+                   || 0 == (allocation->flags & LAVA_ALLOCATION_CREATE_MOVABLE_BIT)
+                   || LAVA_RESOURCE_UNKNOWN == allocation->kind) {
+                    continue;
+                }
+                if(max_moves <= context->move_count || max_bytes < bytes + allocation->size) {
+                    return;
+                }
+                VkMemoryRequirements requirements;
+                if(LAVA_RESOURCE_BUFFER == allocation->kind) {
+                    vkGetBufferMemoryRequirements(memory_allocator->device->device_, allocation->buffer, &requirements);
+                } else {
+                    vkGetImageMemoryRequirements(memory_allocator->device->device_, allocation->image, &requirements);
+                }
+                for(uint32_t dst = 0; dst < src; ++dst) {
+                    VkDeviceSize offset;
+                    lava_allocation* prev;
+                    if(!lava_block_find(memory_allocator, context->blocks[dst], allocation->size, requirements.alignment, allocation->kind, allocation->priority, &offset, &prev)) {
+                        continue;
+                    }
+                    if(!lava_reserve(memory_allocator->allocator, (void**)&context->moves, &context->move_capacity, context->move_count + 1, sizeof(lava_defragment_move))) {
+                        return;
+                    }
+                    lava_allocation* target = (lava_allocation*)lava_calloc(memory_allocator->allocator, sizeof(lava_allocation));
+                    if(LAVA_NULL == target) {
+                        return;
+                    }
+                    target->size = allocation->size;
+                    target->kind = allocation->kind;
+                    target->priority = allocation->priority;
+                    target->offset = offset;
+                    target->placeholder = true;
+                    lava_block_insert(context->blocks[dst], prev, target);
+                    lava_defragment_move* move = &context->moves[context->move_count];
+                    if(VK_SUCCESS != lava_defragment_create_resource(memory_allocator, allocation, target, move)) {
+                        lava_block_remove(context->blocks[dst], target);
+                        lava_free(memory_allocator->allocator, target);
+                        break;
+                    }
+                    move->allocation = allocation;
+                    move->target = target;
+                    move->src_buffer = allocation->buffer;
+                    move->src_image = allocation->image;
+                    move->size = allocation->buffer_info.size;
+                    move->image_info = allocation->image_info;
+                    move->image_layout = allocation->image_layout;
+                    move->owns_source = false;
+                    allocation->move_target = target;
+                    ++context->move_count;
+                    bytes += allocation->size;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void lava_defragment_record(lava_defragment_context* context)
+{
+    VkCommandBuffer command_buffer = context->command_buffer;
+    uint32_t image_count = 0;
+    for(uint32_t i = 0; i < context->move_count; ++i) {
+        const lava_defragment_move* move = &context->moves[i];
+        if(VK_NULL_HANDLE != move->buffer) {
+            VkBufferCopy region = {0, 0, move->size};
+            vkCmdCopyBuffer(command_buffer, move->src_buffer, move->buffer, 1, &region);
+        } else {
+            ++image_count;
+        }
+    }
+    if(image_count <= 0) {
+        return;
+    }
+    for(uint32_t i = 0; i < context->move_count; ++i) {
+        const lava_defragment_move* move = &context->moves[i];
+        if(VK_NULL_HANDLE == move->image) {
+            continue;
+        }
+        const VkImageCreateInfo* info = &move->image_info;
+        VkImageSubresourceRange range = {lava_format_aspect(info->format), 0, info->mipLevels, 0, info->arrayLayers};
+        VkImageMemoryBarrier barriers[2] = {
+            {
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                LAVA_NULL,
+                VK_ACCESS_MEMORY_WRITE_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT,
+                move->image_layout,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                move->src_image,
+                range,
+            },
+            {
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                LAVA_NULL,
+                0,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                move->image,
+                range,
+            },
+        };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, LAVA_NULL, 0, LAVA_NULL, 2, barriers);
+        for(uint32_t mip = 0; mip < info->mipLevels; ++mip) {
+            VkExtent3D extent = {info->extent.width >> mip, info->extent.height >> mip, info->extent.depth >> mip};
+            extent.width = (0 < extent.width) ? extent.width : 1;
+            extent.height = (0 < extent.height) ? extent.height : 1;
+            extent.depth = (0 < extent.depth) ? extent.depth : 1;
+            VkImageCopy region = {
+                {range.aspectMask, mip, 0, info->arrayLayers},
+                {0, 0, 0},
+                {range.aspectMask, mip, 0, info->arrayLayers},
+                {0, 0, 0},
+                extent,
+            };
+            vkCmdCopyImage(command_buffer, move->src_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, move->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+        VkImageLayout final_layout = (VK_IMAGE_LAYOUT_UNDEFINED == move->image_layout || VK_IMAGE_LAYOUT_PREINITIALIZED == move->image_layout)
+                                         ? VK_IMAGE_LAYOUT_GENERAL
+                                         : move->image_layout;
+        barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[1].newLayout = final_layout;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, LAVA_NULL, 0, LAVA_NULL, 1, &barriers[1]);
+    }
+}
+
+/**
+ @brief Swap every finished move into place and release emptied blocks.
+ */
+static void lava_defragment_commit(lava_defragment_context* context)
+{
+    lava_memory_allocator* memory_allocator = context->memory_allocator;
+    VkDevice device = memory_allocator->device->device_;
+    for(uint32_t i = 0; i < context->move_count; ++i) {
+        lava_defragment_move* move = &context->moves[i];
+        //A concurrent free cancels the move under the mutex, so only read the allocation while holding it
+        lava_mutex_lock(&memory_allocator->mutex);
+        lava_allocation* allocation = move->allocation;
+        if(LAVA_NULL != allocation && LAVA_NULL != context->info.move_callback) {
+            context->info.move_callback(context->info.user_data, allocation, allocation->buffer, move->buffer, allocation->image, move->image);
+        }
+        lava_allocation* target = move->target;
+        lava_memory_block* dst_block = target->block;
+        if(LAVA_NULL == allocation) {
+            lava_block_remove(dst_block, target);
+            lava_mutex_unlock(&memory_allocator->mutex);
+            lava_free(memory_allocator->allocator, target);
+            if(VK_NULL_HANDLE != move->buffer) {
+                vkDestroyBuffer(device, move->buffer, memory_allocator->allocator);
+            }
+            if(VK_NULL_HANDLE != move->image) {
+                vkDestroyImage(device, move->image, memory_allocator->allocator);
+            }
+            if(move->owns_source && VK_NULL_HANDLE != move->src_buffer) {
+                vkDestroyBuffer(device, move->src_buffer, memory_allocator->allocator);
+            }
+            if(move->owns_source && VK_NULL_HANDLE != move->src_image) {
+                vkDestroyImage(device, move->src_image, memory_allocator->allocator);
+            }
+            continue;
+        }
+        VkBuffer old_buffer = allocation->buffer;
+        VkImage old_image = allocation->image;
+        lava_memory_block* src_block = allocation->block;
+        lava_block_remove(src_block, allocation);
+
+        //Take over the reserved range
+        allocation->offset = target->offset;
+        allocation->block = dst_block;
+        allocation->prev = target->prev;
+        allocation->next = target->next;
+        if(LAVA_NULL == target->prev) {
+            dst_block->head = allocation;
+        } else {
+            target->prev->next = allocation;
+        }
+        if(LAVA_NULL != target->next) {
+            target->next->prev = allocation;
+        }
+        allocation->buffer = move->buffer;
+        allocation->image = move->image;
+        allocation->move_target = LAVA_NULL;
+        if(VK_NULL_HANDLE != move->buffer) {
+            allocation->device_address = lava_buffer_device_address(memory_allocator, move->buffer, allocation->buffer_info.usage);
+        }
+        if(VK_NULL_HANDLE != move->image && (VK_IMAGE_LAYOUT_UNDEFINED == allocation->image_layout || VK_IMAGE_LAYOUT_PREINITIALIZED == allocation->image_layout)) {
+            allocation->image_layout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+        context->stats.bytes_moved += allocation->size;
+        context->stats.allocations_moved += 1;
+        VkDeviceSize src_size = src_block->size;
+        if(lava_block_release_if_empty(memory_allocator, src_block)) {
+            context->stats.blocks_freed += 1;
+            context->stats.bytes_freed += src_size;
+        }
+        lava_mutex_unlock(&memory_allocator->mutex);
+        lava_free(memory_allocator->allocator, target);
+        if(VK_NULL_HANDLE != old_buffer) {
+            vkDestroyBuffer(device, old_buffer, memory_allocator->allocator);
+        }
+        if(VK_NULL_HANDLE != old_image) {
+            vkDestroyImage(device, old_image, memory_allocator->allocator);
+        }
+    }
+    context->move_count = 0;
+    context->in_flight = false;
+}
+
+VkResult LAVA_API lava_begin_defragment(lava_memory_allocator* memory_allocator, const lava_defragment_create_info* create_info, lava_defragment_context** context)
+{
+    assert(LAVA_NULL != memory_allocator);
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != context);
+    if(LAVA_NULL != memory_allocator->defragment) {
+        return VK_ERROR_UNKNOWN;
+    }
+    VkDevice device = memory_allocator->device->device_;
+    lava_defragment_context* new_context = (lava_defragment_context*)lava_calloc(memory_allocator->allocator, sizeof(lava_defragment_context));
+    if(LAVA_NULL == new_context) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_context->memory_allocator = memory_allocator;
+    new_context->info = *create_info;
+
+    VkCommandPoolCreateInfo pool_info = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        LAVA_NULL,
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        create_info->queue_family_index,
+    };
+    VkResult result = vkCreateCommandPool(device, &pool_info, memory_allocator->allocator, &new_context->command_pool);
+    if(VK_SUCCESS != result) {
+        lava_free(memory_allocator->allocator, new_context);
+        return result;
+    }
+    VkCommandBufferAllocateInfo command_buffer_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        LAVA_NULL,
+        new_context->command_pool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        1,
+    };
+    VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, LAVA_NULL, 0};
+    result = vkAllocateCommandBuffers(device, &command_buffer_info, &new_context->command_buffer);
+    if(VK_SUCCESS == result) {
+        result = vkCreateFence(device, &fence_info, memory_allocator->allocator, &new_context->fence);
+    }
+    if(VK_SUCCESS != result) {
+        vkDestroyCommandPool(device, new_context->command_pool, memory_allocator->allocator);
+        lava_free(memory_allocator->allocator, new_context);
+        return result;
+    }
+    memory_allocator->defragment = new_context;
+    *context = new_context;
+    return VK_SUCCESS;
+}
+
+VkResult LAVA_API lava_defragment_step(lava_defragment_context* context)
+{
+    assert(LAVA_NULL != context);
+    lava_memory_allocator* memory_allocator = context->memory_allocator;
+    VkDevice device = memory_allocator->device->device_;
+    if(context->in_flight) {
+        if(VK_SUCCESS != vkGetFenceStatus(device, context->fence)) {
+            return VK_NOT_READY;
+        }
+        lava_defragment_commit(context);
+        vkResetFences(device, 1, &context->fence);
+        vkResetCommandPool(device, context->command_pool, 0);
+    }
+
+    lava_mutex_lock(&memory_allocator->mutex);
+    lava_defragment_plan(context);
+    lava_mutex_unlock(&memory_allocator->mutex);
+    if(context->move_count <= 0) {
+        return VK_SUCCESS;
+    }
+
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        LAVA_NULL,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        LAVA_NULL,
+    };
+    VkResult result = vkBeginCommandBuffer(context->command_buffer, &begin_info);
+    if(VK_SUCCESS == result) {
+        lava_defragment_record(context);
+        result = vkEndCommandBuffer(context->command_buffer);
+    }
+    if(VK_SUCCESS == result) {
+        VkSubmitInfo submit_info = {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            LAVA_NULL,
+            0,
+            LAVA_NULL,
+            LAVA_NULL,
+            1,
+            &context->command_buffer,
+            0,
+            LAVA_NULL,
+        };
+        result = vkQueueSubmit(context->info.queue, 1, &submit_info, context->fence);
+    }
+    if(VK_SUCCESS != result) {
+        //Roll back every planned move, skipping the ones a concurrent free already cancelled
+        lava_mutex_lock(&memory_allocator->mutex);
+        for(uint32_t i = 0; i < context->move_count; ++i) {
+            if(LAVA_NULL != context->moves[i].allocation) {
+                context->moves[i].allocation->move_target = LAVA_NULL;
+                context->moves[i].allocation = LAVA_NULL;
+            }
+        }
+        lava_mutex_unlock(&memory_allocator->mutex);
+        lava_defragment_commit(context);
+        vkResetCommandPool(device, context->command_pool, 0);
+        return result;
+    }
+    context->in_flight = true;
+    return VK_INCOMPLETE;
+}
+
+void LAVA_API lava_end_defragment(lava_defragment_context* context, lava_defragment_stats* stats)
+{
+    if(LAVA_NULL == context) {
+        return;
+    }
+    lava_memory_allocator* memory_allocator = context->memory_allocator;
+    VkDevice device = memory_allocator->device->device_;
+    if(context->in_flight) {
+        vkWaitForFences(device, 1, &context->fence, VK_TRUE, UINT64_MAX);
+        lava_defragment_commit(context);
+    }
+    if(LAVA_NULL != stats) {
+        *stats = context->stats;
+    }
+    vkDestroyFence(device, context->fence, memory_allocator->allocator);
+    vkDestroyCommandPool(device, context->command_pool, memory_allocator->allocator);
+    lava_free(memory_allocator->allocator, context->moves);
+    lava_free(memory_allocator->allocator, context->blocks);
+    lava_mutex_lock(&memory_allocator->mutex);
+    memory_allocator->defragment = LAVA_NULL;
+    lava_mutex_unlock(&memory_allocator->mutex);
+    lava_free(memory_allocator->allocator, context);
+}
+
+//--- Transient resources
+//--------------------------------------------------------------------
+typedef struct lava_transient_resource_t
+{
+    VkImage image;
+    VkBuffer buffer;
+    uint32_t first_use;
+    uint32_t last_use;
+    VkPipelineStageFlags2 first_stage;
+    VkAccessFlags2 first_access;
+    VkImageLayout first_layout;
+    VkPipelineStageFlags2 last_stage;
+    VkAccessFlags2 last_access;
+    VkPipelineStageFlags2 src_stage; //!< Source scope of the first barrier, from the previous user of the memory.
+    VkAccessFlags2 src_access;
+    VkImageSubresourceRange range;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    uint32_t memory_type_index;
+    uint32_t heap;
+    VkDeviceSize offset;
+} lava_transient_resource;
+
+typedef struct lava_transient_heap_t
+{
+    lava_allocation* allocation;
+    uint32_t memory_type_index;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+} lava_transient_heap;
+
+struct lava_transient_pool_t
+{
+    lava_memory_allocator* memory_allocator;
+    lava_transient_resource* resources;
+    uint32_t resource_count;
+    uint32_t* order; //!< Resource indices sorted by first use.
+    lava_transient_heap heaps[VK_MAX_MEMORY_TYPES];
+    uint32_t heap_count;
+    lava_transient_pool_stats stats;
+};
+
+static bool lava_lifetime_overlap(const lava_transient_resource* r0, const lava_transient_resource* r1)
+{
+    return !(r0->last_use < r1->first_use || r1->last_use < r0->first_use);
+}
+
+static bool lava_range_overlap(const lava_transient_resource* r0, const lava_transient_resource* r1)
+{
+    return r0->heap == r1->heap && r0->offset < r1->offset + r1->size && r1->offset < r0->offset + r0->size;
+}
+
+/**
+ @brief Greedy interval packing of the resources of one heap, largest first.
+ */
+static VkDeviceSize lava_transient_place(lava_transient_resource* resources, uint32_t* indices, uint32_t count, VkDeviceSize granularity, uint32_t* scratch)
+{
+    //Sort by decreasing size
+    for(uint32_t i = 1; i < count; ++i) {
+        uint32_t index = indices[i];
+        uint32_t j = i;
+        for(; 0 < j && resources[indices[j - 1]].size < resources[index].size; --j) {
+            indices[j] = indices[j - 1];
+        }
+        indices[j] = index;
+    }
+    VkDeviceSize heap_size = 0;
+    for(uint32_t i = 0; i < count; ++i) {
+        lava_transient_resource* resource = &resources[indices[i]];
+        VkDeviceSize alignment = (resource->alignment < granularity) ? granularity : resource->alignment;
+
+        //Collect placed resources alive at the same time, sorted by offset
+        uint32_t live_count = 0;
+        for(uint32_t j = 0; j < i; ++j) {
+            if(!lava_lifetime_overlap(resource, &resources[indices[j]])) {
+                continue;
+            }
+            uint32_t k = live_count;
+            for(; 0 < k && resources[indices[j]].offset < resources[scratch[k - 1]].offset; --k) {
+                scratch[k] = scratch[k - 1];
+            }
+            scratch[k] = indices[j];
+            ++live_count;
+        }
+        VkDeviceSize offset = 0;
+        for(uint32_t j = 0; j < live_count; ++j) {
+            const lava_transient_resource* live = &resources[scratch[j]];
+            if(offset + resource->size <= live->offset) {
+                break;
+            }
+            VkDeviceSize end = lava_align_up(live->offset + live->size, alignment);
+            offset = (offset < end) ? end : offset;
+        }
+        resource->offset = offset;
+        heap_size = (heap_size < offset + resource->size) ? offset + resource->size : heap_size;
+    }
+    return heap_size;
+}
+
+static void lava_transient_destroy_resources(lava_transient_pool* pool)
+{
+    lava_memory_allocator* memory_allocator = pool->memory_allocator;
+    VkDevice device = memory_allocator->device->device_;
+    for(uint32_t i = 0; i < pool->resource_count; ++i) {
+        if(VK_NULL_HANDLE != pool->resources[i].image) {
+            vkDestroyImage(device, pool->resources[i].image, memory_allocator->allocator);
+        }
+        if(VK_NULL_HANDLE != pool->resources[i].buffer) {
+            vkDestroyBuffer(device, pool->resources[i].buffer, memory_allocator->allocator);
+        }
+    }
+    for(uint32_t i = 0; i < pool->heap_count; ++i) {
+        lava_free_memory(memory_allocator, pool->heaps[i].allocation);
+    }
+}
+
+VkResult LAVA_API lava_create_transient_pool(const lava_transient_pool_create_info* create_info, lava_transient_pool** pool)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->memory_allocator);
+    assert(LAVA_NULL != pool);
+    lava_memory_allocator* memory_allocator = create_info->memory_allocator;
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    VkDevice device = memory_allocator->device->device_;
+    uint32_t count = create_info->resource_count;
+    lava_transient_pool* new_pool = (lava_transient_pool*)lava_calloc(allocator, sizeof(lava_transient_pool));
+    if(LAVA_NULL == new_pool) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_pool->memory_allocator = memory_allocator;
+    new_pool->resources = (lava_transient_resource*)lava_calloc(allocator, sizeof(lava_transient_resource) * (count + 1));
+    new_pool->order = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * (count * 2 + 1));
+    if(LAVA_NULL == new_pool->resources || LAVA_NULL == new_pool->order) {
+        lava_free(allocator, new_pool->resources);
+        lava_free(allocator, new_pool->order);
+        lava_free(allocator, new_pool);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_pool->resource_count = count;
+
+    //Create the resources and choose their memory types
+    VkResult result = VK_SUCCESS;
+    const VkPhysicalDeviceMemoryProperties* properties = &memory_allocator->memory_properties;
+    for(uint32_t i = 0; i < count && VK_SUCCESS == result; ++i) {
+        const lava_transient_resource_info* info = &create_info->resources[i];
+        lava_transient_resource* resource = &new_pool->resources[i];
+        assert((LAVA_NULL == info->image_info) != (LAVA_NULL == info->buffer_info));
+        assert(info->first_use <= info->last_use);
+        resource->first_use = info->first_use;
+        resource->last_use = info->last_use;
+        resource->first_stage = info->first_stage;
+        resource->first_access = info->first_access;
+        resource->last_stage = (0 != info->last_stage) ? info->last_stage : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        resource->last_access = (0 != info->last_stage) ? info->last_access : VK_ACCESS_2_MEMORY_WRITE_BIT;
+        resource->first_layout = (VK_IMAGE_LAYOUT_UNDEFINED == info->first_layout) ? VK_IMAGE_LAYOUT_GENERAL : info->first_layout;
+        VkMemoryRequirements requirements;
+        bool lazy = false;
+        if(LAVA_NULL != info->image_info) {
+            result = vkCreateImage(device, info->image_info, allocator, &resource->image);
+            if(VK_SUCCESS != result) {
+                break;
+            }
+            vkGetImageMemoryRequirements(device, resource->image, &requirements);
+            VkImageSubresourceRange range = {lava_format_aspect(info->image_info->format), 0, info->image_info->mipLevels, 0, info->image_info->arrayLayers};
+            resource->range = range;
+            lazy = 0 != (info->image_info->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+        } else {
+            result = vkCreateBuffer(device, info->buffer_info, allocator, &resource->buffer);
+            if(VK_SUCCESS != result) {
+                break;
+            }
+            vkGetBufferMemoryRequirements(device, resource->buffer, &requirements);
+        }
+        resource->size = requirements.size;
+        resource->alignment = requirements.alignment;
+        if(!(lazy && lava_find_memory_type(properties, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resource->memory_type_index))
+           && !lava_find_memory_type(properties, requirements.memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resource->memory_type_index)) {
+            result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+        new_pool->stats.resource_bytes += requirements.size;
+    }
+
+    //Pack every memory type into its own heap
+    uint32_t* indices = new_pool->order;
+    uint32_t* scratch = new_pool->order + count;
+    for(uint32_t type = 0; type < properties->memoryTypeCount && VK_SUCCESS == result; ++type) {
+        uint32_t type_count = 0;
+        VkDeviceSize alignment = 1;
+        for(uint32_t i = 0; i < count; ++i) {
+            if(type == new_pool->resources[i].memory_type_index) {
+                indices[type_count++] = i;
+                alignment = (alignment < new_pool->resources[i].alignment) ? new_pool->resources[i].alignment : alignment;
+            }
+        }
+        if(type_count <= 0) {
+            continue;
+        }
+        lava_transient_heap* heap = &new_pool->heaps[new_pool->heap_count];
+        heap->memory_type_index = type;
+        heap->alignment = alignment;
+        heap->size = lava_transient_place(new_pool->resources, indices, type_count, memory_allocator->buffer_image_granularity, scratch);
+        for(uint32_t i = 0; i < type_count; ++i) {
+            new_pool->resources[indices[i]].heap = new_pool->heap_count;
+        }
+        VkMemoryRequirements requirements = {heap->size, heap->alignment, 1U << type};
+        lava_allocation_create_info allocation_info = {LAVA_ALLOCATION_CREATE_DEDICATED_BIT, 0, 0, LAVA_NULL, 0.0f};
+        result = lava_allocate_memory(memory_allocator, &requirements, &allocation_info, &heap->allocation);
+        if(VK_SUCCESS != result) {
+            break;
+        }
+        new_pool->stats.heap_bytes += heap->size;
+        if(0 != (properties->memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+            new_pool->stats.lazy_bytes += heap->size;
+        }
+        ++new_pool->heap_count;
+    }
+    new_pool->stats.heap_count = new_pool->heap_count;
+
+    //Bind and find out which accesses the first barrier of every resource waits for
+    for(uint32_t i = 0; i < count && VK_SUCCESS == result; ++i) {
+        lava_transient_resource* resource = &new_pool->resources[i];
+        lava_allocation_info allocation_info;
+        lava_get_allocation_info(new_pool->heaps[resource->heap].allocation, &allocation_info);
+        if(VK_NULL_HANDLE != resource->image) {
+            result = vkBindImageMemory(device, resource->image, allocation_info.memory, allocation_info.offset + resource->offset);
+        } else {
+            result = vkBindBufferMemory(device, resource->buffer, allocation_info.memory, allocation_info.offset + resource->offset);
+        }
+        //Memory of an earlier resource of the frame, or else whatever used the range last during the previous frame
+        bool aliased = false;
+        for(uint32_t j = 0; j < count; ++j) {
+            const lava_transient_resource* other = &new_pool->resources[j];
+            if(i != j && other->first_use < resource->first_use && lava_range_overlap(resource, other)) {
+                resource->src_stage |= other->last_stage;
+                resource->src_access |= other->last_access;
+                aliased = true;
+            }
+        }
+        for(uint32_t j = 0; j < count && !aliased; ++j) {
+            const lava_transient_resource* other = &new_pool->resources[j];
+            if(i == j || lava_range_overlap(resource, other)) {
+                resource->src_stage |= other->last_stage;
+                resource->src_access |= other->last_access;
+            }
+        }
+    }
+    if(VK_SUCCESS != result) {
+        lava_transient_destroy_resources(new_pool);
+        lava_free(allocator, new_pool->resources);
+        lava_free(allocator, new_pool->order);
+        lava_free(allocator, new_pool);
+        return result;
+    }
+
+    for(uint32_t i = 0; i < count; ++i) {
+        uint32_t j = i;
+        for(; 0 < j && new_pool->resources[i].first_use < new_pool->resources[new_pool->order[j - 1]].first_use; --j) {
+            new_pool->order[j] = new_pool->order[j - 1];
+        }
+        new_pool->order[j] = i;
+    }
+    *pool = new_pool;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_transient_pool(lava_transient_pool* pool)
+{
+    if(LAVA_NULL == pool) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = pool->memory_allocator->allocator;
+    lava_transient_destroy_resources(pool);
+    lava_free(allocator, pool->resources);
+    lava_free(allocator, pool->order);
+    lava_free(allocator, pool);
+}
+
+VkImage LAVA_API lava_get_transient_image(const lava_transient_pool* pool, uint32_t index)
+{
+    assert(LAVA_NULL != pool);
+    assert(index < pool->resource_count);
+    return pool->resources[index].image;
+}
+
+VkBuffer LAVA_API lava_get_transient_buffer(const lava_transient_pool* pool, uint32_t index)
+{
+    assert(LAVA_NULL != pool);
+    assert(index < pool->resource_count);
+    return pool->resources[index].buffer;
+}
+
+void LAVA_API lava_get_transient_pool_stats(const lava_transient_pool* pool, lava_transient_pool_stats* stats)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != stats);
+    *stats = pool->stats;
+}
+
+void LAVA_API lava_get_transient_barriers(
+    const lava_transient_pool* pool,
+    uint32_t pass_index,
+    uint32_t* image_barrier_count,
+    VkImageMemoryBarrier2* image_barriers,
+    uint32_t* buffer_barrier_count,
+    VkBufferMemoryBarrier2* buffer_barriers)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != image_barrier_count);
+    assert(LAVA_NULL != buffer_barrier_count);
+    //Lower bound of the pass in the first use order
+    uint32_t begin = 0;
+    uint32_t end = pool->resource_count;
+    while(begin < end) {
+        uint32_t middle = begin + (end - begin) / 2;
+        if(pool->resources[pool->order[middle]].first_use < pass_index) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    uint32_t image_count = 0;
+    uint32_t buffer_count = 0;
+    for(uint32_t i = begin; i < pool->resource_count; ++i) {
+        const lava_transient_resource* resource = &pool->resources[pool->order[i]];
+        if(pass_index != resource->first_use) {
+            break;
+        }
+        if(VK_NULL_HANDLE != resource->image) {
+            if(LAVA_NULL != image_barriers) {
+                if(*image_barrier_count <= image_count) {
+                    continue;
+                }
+                VkImageMemoryBarrier2* barrier = &image_barriers[image_count];
+                barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                barrier->pNext = LAVA_NULL;
+                barrier->srcStageMask = resource->src_stage;
+                barrier->srcAccessMask = resource->src_access;
+                barrier->dstStageMask = resource->first_stage;
+                barrier->dstAccessMask = resource->first_access;
+                barrier->oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                barrier->newLayout = resource->first_layout;
+                barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier->image = resource->image;
+                barrier->subresourceRange = resource->range;
+            }
+            ++image_count;
+        } else {
+            if(LAVA_NULL != buffer_barriers) {
+                if(*buffer_barrier_count <= buffer_count) {
+                    continue;
+                }
+                VkBufferMemoryBarrier2* barrier = &buffer_barriers[buffer_count];
+                barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+                barrier->pNext = LAVA_NULL;
+                barrier->srcStageMask = resource->src_stage;
+                barrier->srcAccessMask = resource->src_access;
+                barrier->dstStageMask = resource->first_stage;
+                barrier->dstAccessMask = resource->first_access;
+                barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier->buffer = resource->buffer;
+                barrier->offset = 0;
+                barrier->size = VK_WHOLE_SIZE;
+            }
+            ++buffer_count;
+        }
+    }
+    if(LAVA_NULL == image_barriers || image_count < *image_barrier_count) {
+        *image_barrier_count = image_count;
+    }
+    if(LAVA_NULL == buffer_barriers || buffer_count < *buffer_barrier_count) {
+        *buffer_barrier_count = buffer_count;
+    }
+}
+
+void LAVA_API lava_cmd_transient_barriers(const lava_transient_pool* pool, VkCommandBuffer command_buffer, uint32_t pass_index)
+{
+#define LAVA_TRANSIENT_BARRIER_BATCH (32)
+    uint32_t image_count = 0;
+    uint32_t buffer_count = 0;
+    lava_get_transient_barriers(pool, pass_index, &image_count, LAVA_NULL, &buffer_count, LAVA_NULL);
+    if(image_count <= 0 && buffer_count <= 0) {
+        return;
+    }
+    VkImageMemoryBarrier2 image_stack[LAVA_TRANSIENT_BARRIER_BATCH];
+    VkBufferMemoryBarrier2 buffer_stack[LAVA_TRANSIENT_BARRIER_BATCH];
+    const VkAllocationCallbacks* allocator = pool->memory_allocator->allocator;
+    VkImageMemoryBarrier2* image_barriers = (image_count <= LAVA_TRANSIENT_BARRIER_BATCH) ? image_stack : (VkImageMemoryBarrier2*)lava_malloc(allocator, sizeof(VkImageMemoryBarrier2) * image_count);
+    VkBufferMemoryBarrier2* buffer_barriers = (buffer_count <= LAVA_TRANSIENT_BARRIER_BATCH) ? buffer_stack : (VkBufferMemoryBarrier2*)lava_malloc(allocator, sizeof(VkBufferMemoryBarrier2) * buffer_count);
+    if(LAVA_NULL != image_barriers && LAVA_NULL != buffer_barriers) {
+        lava_get_transient_barriers(pool, pass_index, &image_count, image_barriers, &buffer_count, buffer_barriers);
+        VkDependencyInfo dependency_info = {
+            VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            LAVA_NULL,
+            0,
+            0,
+            LAVA_NULL,
+            buffer_count,
+            buffer_barriers,
+            image_count,
+            image_barriers,
+        };
+        vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    }
+    if(image_barriers != image_stack) {
+        lava_free(allocator, image_barriers);
+    }
+    if(buffer_barriers != buffer_stack) {
+        lava_free(allocator, buffer_barriers);
+    }
+#undef LAVA_TRANSIENT_BARRIER_BATCH
+}
+
+//--- Sparse images
+//--------------------------------------------------------------------
+#define LAVA_SPARSE_NO_PAGE (0xFFFFFFFFU)
+
+typedef struct lava_sparse_level_t
+{
+    uint32_t first_tile;
+    uint32_t count_x;
+    uint32_t count_y;
+    uint32_t count_z;
+    VkExtent3D extent;
+} lava_sparse_level;
+
+typedef struct lava_sparse_tile_t
+{
+    uint64_t last_request;
+    bool pending;
+} lava_sparse_tile;
+
+typedef struct lava_sparse_sort_key_t
+{
+    uint64_t key;
+    uint32_t value; //!< Tile or page.
+} lava_sparse_sort_key;
+
+typedef struct lava_sparse_assignment_t
+{
+    uint32_t tile;
+    uint32_t page;
+    uint32_t evicted; //!< Previous tile of the page, LAVA_SPARSE_NO_PAGE if it was free.
+} lava_sparse_assignment;
+
+struct lava_sparse_image_t
+{
+    lava_memory_allocator* memory_allocator;
+    VkQueue queue;
+    VkImage image;
+    VkImageAspectFlags aspect;
+    uint32_t aspect_count; //!< A page holds one tile of every aspect.
+    uint32_t mip_levels;
+    uint32_t array_layers;
+    VkExtent3D granularity;
+    VkDeviceSize page_size;
+    uint32_t mip_tail_first_lod;
+    uint32_t keep_frames;
+    lava_sparse_level* levels; //!< array_layers * mip_tail_first_lod entries.
+    lava_sparse_tile* tiles;
+    uint32_t* page_table; //!< Tile to page.
+    uint32_t tile_count;
+    lava_allocation* pages;
+    uint32_t page_count;
+    uint32_t* page_tiles; //!< Page to tile.
+    uint32_t* free_pages;
+    uint32_t free_count;
+    lava_allocation* mip_tail;
+    uint32_t* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    uint32_t* candidates;
+    lava_sparse_sort_key* sort_keys; //!< Scratch of lava_sparse_update.
+    uint32_t sort_key_capacity;
+    lava_sparse_assignment* assignments; //!< Scratch of lava_sparse_update, committed once the binds are queued.
+    uint32_t assignment_capacity;
+    VkSparseImageMemoryBind* binds;
+    uint32_t bind_capacity;
+    lava_sparse_stats stats;
+};
+
+static uint32_t lava_div_up(uint32_t x, uint32_t y)
+{
+    return (x + y - 1) / y;
+}
+
+static void lava_sparse_free_arrays(const VkAllocationCallbacks* allocator, lava_sparse_image* image)
+{
+    lava_free(allocator, image->levels);
+    lava_free(allocator, image->tiles);
+    lava_free(allocator, image->page_table);
+    lava_free(allocator, image->page_tiles);
+    lava_free(allocator, image->free_pages);
+    lava_free(allocator, image->pending);
+    lava_free(allocator, image->candidates);
+    lava_free(allocator, image->sort_keys);
+    lava_free(allocator, image->assignments);
+    lava_free(allocator, image->binds);
+}
+
+static void lava_sparse_release(lava_sparse_image* image)
+{
+    lava_memory_allocator* memory_allocator = image->memory_allocator;
+    if(VK_NULL_HANDLE != image->image) {
+        vkDestroyImage(memory_allocator->device->device_, image->image, memory_allocator->allocator);
+    }
+    lava_free_memory(memory_allocator, image->pages);
+    lava_free_memory(memory_allocator, image->mip_tail);
+    lava_sparse_free_arrays(memory_allocator->allocator, image);
+    lava_free(memory_allocator->allocator, image);
+}
+
+/**
+ @brief Whether a sparse requirement has an opaque region to bind, the mip tail of an aspect or the metadata.
+ */
+static bool lava_sparse_has_tail(const lava_sparse_image* image, const VkSparseImageMemoryRequirements* sparse_requirements)
+{
+    VkImageAspectFlags aspect = sparse_requirements->formatProperties.aspectMask;
+    if(sparse_requirements->imageMipTailSize <= 0) {
+        return false;
+    }
+    if(0 != (aspect & VK_IMAGE_ASPECT_METADATA_BIT)) {
+        return true;
+    }
+    return 0 != (aspect & image->aspect) && sparse_requirements->imageMipTailFirstLod < image->mip_levels;
+}
+
+/**
+ @brief Bind the mip tails of every aspect and layer, and the metadata, from one allocation and wait for it.
+ */
+static VkResult lava_sparse_bind_mip_tail(lava_sparse_image* image, uint32_t sparse_count, const VkSparseImageMemoryRequirements* sparse_requirements, uint32_t memory_type_bits)
+{
+    uint32_t bind_count = 0;
+    VkDeviceSize size = 0;
+    for(uint32_t i = 0; i < sparse_count; ++i) {
+        if(lava_sparse_has_tail(image, &sparse_requirements[i])) {
+            bool single = 0 != (sparse_requirements[i].formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT);
+            uint32_t tail_count = single ? 1 : image->array_layers;
+            bind_count += tail_count;
+            size += lava_align_up(sparse_requirements[i].imageMipTailSize, image->page_size) * tail_count;
+        }
+    }
+    if(bind_count <= 0) {
+        return VK_SUCCESS;
+    }
+    lava_memory_allocator* memory_allocator = image->memory_allocator;
+    VkDevice device = memory_allocator->device->device_;
+    VkMemoryRequirements requirements = {size, image->page_size, memory_type_bits};
+    lava_allocation_create_info allocation_info = {LAVA_ALLOCATION_CREATE_DEDICATED_BIT, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, LAVA_NULL, 0.0f};
+    VkResult result = lava_allocate_memory(memory_allocator, &requirements, &allocation_info, &image->mip_tail);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    lava_allocation_info tail_info;
+    lava_get_allocation_info(image->mip_tail, &tail_info);
+    VkSparseMemoryBind* binds = (VkSparseMemoryBind*)lava_malloc(memory_allocator->allocator, sizeof(VkSparseMemoryBind) * bind_count);
+    if(LAVA_NULL == binds) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t count = 0;
+    VkDeviceSize offset = tail_info.offset;
+    for(uint32_t i = 0; i < sparse_count; ++i) {
+        const VkSparseImageMemoryRequirements* tail = &sparse_requirements[i];
+        if(!lava_sparse_has_tail(image, tail)) {
+            continue;
+        }
+        bool single = 0 != (tail->formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT);
+        uint32_t tail_count = single ? 1 : image->array_layers;
+        //Metadata has no image region, it is only bound through opaque binds with its own flag
+        VkSparseMemoryBindFlags flags = (0 != (tail->formatProperties.aspectMask & VK_IMAGE_ASPECT_METADATA_BIT)) ? VK_SPARSE_MEMORY_BIND_METADATA_BIT : 0;
+        for(uint32_t j = 0; j < tail_count; ++j) {
+            binds[count].resourceOffset = tail->imageMipTailOffset + j * tail->imageMipTailStride;
+            binds[count].size = tail->imageMipTailSize;
+            binds[count].memory = tail_info.memory;
+            binds[count].memoryOffset = offset;
+            binds[count].flags = flags;
+            offset += lava_align_up(tail->imageMipTailSize, image->page_size);
+            ++count;
+        }
+    }
+    VkSparseImageOpaqueMemoryBindInfo opaque_info = {image->image, bind_count, binds};
+    VkBindSparseInfo bind_info;
+    memset(&bind_info, 0, sizeof(bind_info));
+    bind_info.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+    bind_info.imageOpaqueBindCount = 1;
+    bind_info.pImageOpaqueBinds = &opaque_info;
+    VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, LAVA_NULL, 0};
+    VkFence fence = VK_NULL_HANDLE;
+    result = vkCreateFence(device, &fence_info, memory_allocator->allocator, &fence);
+    if(VK_SUCCESS == result) {
+        result = vkQueueBindSparse(image->queue, 1, &bind_info, fence);
+        if(VK_SUCCESS == result) {
+            result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        vkDestroyFence(device, fence, memory_allocator->allocator);
+    }
+    lava_free(memory_allocator->allocator, binds);
+    ++image->stats.bind_calls;
+    return result;
+}
+
+VkResult LAVA_API lava_create_sparse_image(const lava_sparse_image_create_info* create_info, lava_sparse_image** image)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->memory_allocator);
+    assert(LAVA_NULL != create_info->image_info);
+    assert(0 < create_info->max_resident_pages);
+    assert(LAVA_NULL != image);
+    lava_memory_allocator* memory_allocator = create_info->memory_allocator;
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    VkDevice device = memory_allocator->device->device_;
+    lava_sparse_image* new_image = (lava_sparse_image*)lava_calloc(allocator, sizeof(lava_sparse_image));
+    if(LAVA_NULL == new_image) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_image->memory_allocator = memory_allocator;
+    new_image->queue = create_info->queue;
+    new_image->aspect = lava_format_aspect(create_info->image_info->format);
+    new_image->aspect_count = (0 != (new_image->aspect & VK_IMAGE_ASPECT_DEPTH_BIT) && 0 != (new_image->aspect & VK_IMAGE_ASPECT_STENCIL_BIT)) ? 2 : 1;
+    new_image->mip_levels = create_info->image_info->mipLevels;
+    new_image->array_layers = create_info->image_info->arrayLayers;
+    new_image->keep_frames = create_info->keep_frames;
+
+    VkImageCreateInfo image_info = *create_info->image_info;
+    image_info.flags |= VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+    VkResult result = vkCreateImage(device, &image_info, allocator, &new_image->image);
+    if(VK_SUCCESS != result) {
+        lava_free(allocator, new_image);
+        return result;
+    }
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, new_image->image, &requirements);
+    new_image->page_size = requirements.alignment;
+
+    VkSparseImageMemoryRequirements sparse_requirements[4];
+    uint32_t sparse_count = 4;
+    vkGetImageSparseMemoryRequirements(device, new_image->image, &sparse_count, sparse_requirements);
+    //Depth and stencil may be reported separately, tiles cover the levels before the first mip tail of any aspect
+    const VkSparseImageMemoryRequirements* sparse = LAVA_NULL;
+    new_image->mip_tail_first_lod = new_image->mip_levels;
+    for(uint32_t i = 0; i < sparse_count; ++i) {
+        if(0 == (sparse_requirements[i].formatProperties.aspectMask & new_image->aspect)) {
+            continue;
+        }
+        if(LAVA_NULL == sparse) {
+            sparse = &sparse_requirements[i];
+        }
+        if(sparse_requirements[i].imageMipTailFirstLod < new_image->mip_tail_first_lod) {
+            new_image->mip_tail_first_lod = sparse_requirements[i].imageMipTailFirstLod;
+        }
+    }
+    if(LAVA_NULL == sparse) {
+        lava_sparse_release(new_image);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    new_image->granularity = sparse->formatProperties.imageGranularity;
+
+    //Page table layout, level by level for every layer
+    uint32_t level_count = new_image->array_layers * new_image->mip_tail_first_lod;
+    new_image->levels = (lava_sparse_level*)lava_calloc(allocator, sizeof(lava_sparse_level) * (level_count + 1));
+    if(LAVA_NULL == new_image->levels) {
+        lava_sparse_release(new_image);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t tile_count = 0;
+    for(uint32_t layer = 0; layer < new_image->array_layers; ++layer) {
+        for(uint32_t mip = 0; mip < new_image->mip_tail_first_lod; ++mip) {
+            lava_sparse_level* level = &new_image->levels[layer * new_image->mip_tail_first_lod + mip];
+            level->extent.width = (0 < (image_info.extent.width >> mip)) ? (image_info.extent.width >> mip) : 1;
+            level->extent.height = (0 < (image_info.extent.height >> mip)) ? (image_info.extent.height >> mip) : 1;
+            level->extent.depth = (0 < (image_info.extent.depth >> mip)) ? (image_info.extent.depth >> mip) : 1;
+            level->count_x = lava_div_up(level->extent.width, new_image->granularity.width);
+            level->count_y = lava_div_up(level->extent.height, new_image->granularity.height);
+            level->count_z = lava_div_up(level->extent.depth, new_image->granularity.depth);
+            level->first_tile = tile_count;
+            tile_count += level->count_x * level->count_y * level->count_z;
+        }
+    }
+    uint32_t page_count = create_info->max_resident_pages;
+    new_image->tile_count = tile_count;
+    new_image->page_count = page_count;
+    new_image->tiles = (lava_sparse_tile*)lava_calloc(allocator, sizeof(lava_sparse_tile) * (tile_count + 1));
+    new_image->page_table = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * (tile_count + 1));
+    new_image->candidates = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * (page_count + 1));
+    new_image->page_tiles = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * page_count);
+    new_image->free_pages = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * page_count);
+    if(LAVA_NULL == new_image->tiles || LAVA_NULL == new_image->page_table || LAVA_NULL == new_image->candidates || LAVA_NULL == new_image->page_tiles || LAVA_NULL == new_image->free_pages) {
+        lava_sparse_release(new_image);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < tile_count; ++i) {
+        new_image->page_table[i] = LAVA_SPARSE_NO_PAGE;
+    }
+    for(uint32_t i = 0; i < page_count; ++i) {
+        new_image->page_tiles[i] = LAVA_SPARSE_NO_PAGE;
+        new_image->free_pages[i] = page_count - 1 - i;
+    }
+    new_image->free_count = page_count;
+
+    //The page heap, the fixed budget of the image
+    VkMemoryRequirements heap_requirements = {new_image->page_size * new_image->aspect_count * page_count, new_image->page_size, requirements.memoryTypeBits};
+    lava_allocation_create_info allocation_info = {LAVA_ALLOCATION_CREATE_DEDICATED_BIT, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, LAVA_NULL, 0.0f};
+    result = lava_allocate_memory(memory_allocator, &heap_requirements, &allocation_info, &new_image->pages);
+    if(VK_SUCCESS == result) {
+        result = lava_sparse_bind_mip_tail(new_image, sparse_count, sparse_requirements, requirements.memoryTypeBits);
+    }
+    if(VK_SUCCESS != result) {
+        lava_sparse_release(new_image);
+        return result;
+    }
+    *image = new_image;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_sparse_image(lava_sparse_image* image)
+{
+    if(LAVA_NULL == image) {
+        return;
+    }
+    lava_sparse_release(image);
+}
+
+VkImage LAVA_API lava_get_sparse_image(const lava_sparse_image* image)
+{
+    assert(LAVA_NULL != image);
+    return image->image;
+}
+
+void LAVA_API lava_get_sparse_image_properties(const lava_sparse_image* image, lava_sparse_image_properties* properties)
+{
+    assert(LAVA_NULL != image);
+    assert(LAVA_NULL != properties);
+    properties->tile_extent = image->granularity;
+    properties->page_size = image->page_size;
+    properties->mip_tail_first_lod = image->mip_tail_first_lod;
+    properties->tile_count = image->tile_count;
+    properties->max_resident_pages = image->page_count;
+}
+
+void LAVA_API lava_get_sparse_stats(const lava_sparse_image* image, lava_sparse_stats* stats)
+{
+    assert(LAVA_NULL != image);
+    assert(LAVA_NULL != stats);
+    *stats = image->stats;
+    stats->resident_pages = image->page_count - image->free_count;
+    stats->pending_requests = image->pending_count;
+}
+
+uint32_t LAVA_API lava_sparse_tile_index(const lava_sparse_image* image, uint32_t mip_level, uint32_t array_layer, uint32_t x, uint32_t y, uint32_t z)
+{
+    assert(LAVA_NULL != image);
+    if(image->mip_tail_first_lod <= mip_level || image->array_layers <= array_layer) {
+        return LAVA_SPARSE_NO_PAGE;
+    }
+    const lava_sparse_level* level = &image->levels[array_layer * image->mip_tail_first_lod + mip_level];
+    uint32_t tx = x / image->granularity.width;
+    uint32_t ty = y / image->granularity.height;
+    uint32_t tz = z / image->granularity.depth;
+    if(level->count_x <= tx || level->count_y <= ty || level->count_z <= tz) {
+        return LAVA_SPARSE_NO_PAGE;
+    }
+    return level->first_tile + (tz * level->count_y + ty) * level->count_x + tx;
+}
+
+void LAVA_API lava_sparse_request_tiles(lava_sparse_image* image, uint64_t frame_index, uint32_t count, const uint32_t* tiles)
+{
+    assert(LAVA_NULL != image);
+    assert(0 == count || LAVA_NULL != tiles);
+    const VkAllocationCallbacks* allocator = image->memory_allocator->allocator;
+    for(uint32_t i = 0; i < count; ++i) {
+        uint32_t tile = tiles[i];
+        if(image->tile_count <= tile) {
+            continue;
+        }
+        image->tiles[tile].last_request = frame_index;
+        if(LAVA_SPARSE_NO_PAGE != image->page_table[tile] || image->tiles[tile].pending) {
+            continue;
+        }
+        if(!lava_reserve(allocator, (void**)&image->pending, &image->pending_capacity, image->pending_count + 1, sizeof(uint32_t))) {
+            return;
+        }
+        image->tiles[tile].pending = true;
+        image->pending[image->pending_count++] = tile;
+    }
+}
+
+bool LAVA_API lava_sparse_is_resident(const lava_sparse_image* image, uint32_t tile)
+{
+    assert(LAVA_NULL != image);
+    return tile < image->tile_count && LAVA_SPARSE_NO_PAGE != image->page_table[tile];
+}
+
+const uint32_t* LAVA_API lava_sparse_get_page_table(const lava_sparse_image* image, uint32_t* tile_count)
+{
+    assert(LAVA_NULL != image);
+    if(LAVA_NULL != tile_count) {
+        *tile_count = image->tile_count;
+    }
+    return image->page_table;
+}
+
+/**
+ @brief Find the index in levels of the level holding a tile.
+ */
+static uint32_t lava_sparse_tile_level(const lava_sparse_image* image, uint32_t tile)
+{
+    uint32_t begin = 0;
+    uint32_t end = image->array_layers * image->mip_tail_first_lod;
+    while(1 < end - begin) {
+        uint32_t middle = begin + (end - begin) / 2;
+        if(tile < image->levels[middle].first_tile) {
+            end = middle;
+        } else {
+            begin = middle;
+        }
+    }
+    return begin;
+}
+
+/**
+ @brief Find the level and coordinates of a tile.
+ */
+static void lava_sparse_tile_region(const lava_sparse_image* image, uint32_t tile, VkSparseImageMemoryBind* bind)
+{
+    uint32_t begin = lava_sparse_tile_level(image, tile);
+    const lava_sparse_level* level = &image->levels[begin];
+    uint32_t local = tile - level->first_tile;
+    uint32_t tx = local % level->count_x;
+    uint32_t ty = (local / level->count_x) % level->count_y;
+    uint32_t tz = local / (level->count_x * level->count_y);
+    bind->subresource.aspectMask = 0;
+    bind->subresource.mipLevel = begin % image->mip_tail_first_lod;
+    bind->subresource.arrayLayer = begin / image->mip_tail_first_lod;
+    bind->offset.x = (int32_t)(tx * image->granularity.width);
+    bind->offset.y = (int32_t)(ty * image->granularity.height);
+    bind->offset.z = (int32_t)(tz * image->granularity.depth);
+    //Tiles on the border of a level are clipped to the level
+    bind->extent.width = level->extent.width - (uint32_t)bind->offset.x;
+    bind->extent.height = level->extent.height - (uint32_t)bind->offset.y;
+    bind->extent.depth = level->extent.depth - (uint32_t)bind->offset.z;
+    bind->extent.width = (image->granularity.width < bind->extent.width) ? image->granularity.width : bind->extent.width;
+    bind->extent.height = (image->granularity.height < bind->extent.height) ? image->granularity.height : bind->extent.height;
+    bind->extent.depth = (image->granularity.depth < bind->extent.depth) ? image->granularity.depth : bind->extent.depth;
+    bind->flags = 0;
+}
+
+/**
+ @brief Write one bind of a tile for every aspect, the aspects of a page being consecutive in memory.
+ @return The number of written binds.
+ */
+static uint32_t lava_sparse_tile_binds(const lava_sparse_image* image, uint32_t tile, VkDeviceMemory memory, VkDeviceSize memory_offset, VkSparseImageMemoryBind* binds)
+{
+    static const VkImageAspectFlags aspects[] = {VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_ASPECT_STENCIL_BIT};
+    VkSparseImageMemoryBind region;
+    lava_sparse_tile_region(image, tile, &region);
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < sizeof(aspects) / sizeof(aspects[0]); ++i) {
+        if(0 == (image->aspect & aspects[i])) {
+            continue;
+        }
+        binds[count] = region;
+        binds[count].subresource.aspectMask = aspects[i];
+        binds[count].memory = memory;
+        binds[count].memoryOffset = (VK_NULL_HANDLE == memory) ? 0 : memory_offset + count * image->page_size;
+        ++count;
+    }
+    return count;
+}
+
+static int lava_compare_sparse_keys(const void* x0, const void* x1)
+{
+    const lava_sparse_sort_key* k0 = (const lava_sparse_sort_key*)x0;
+    const lava_sparse_sort_key* k1 = (const lava_sparse_sort_key*)x1;
+    if(k0->key != k1->key) {
+        return (k0->key < k1->key) ? -1 : 1;
+    }
+    return (k0->value < k1->value) ? -1 : ((k1->value < k0->value) ? 1 : 0);
+}
+
+VkResult LAVA_API lava_sparse_update(lava_sparse_image* image, const lava_sparse_update_info* update_info)
+{
+    assert(LAVA_NULL != image);
+    assert(LAVA_NULL != update_info);
+    lava_memory_allocator* memory_allocator = image->memory_allocator;
+    if(image->pending_count <= 0 && 0 == update_info->wait_semaphore_count && 0 == update_info->signal_semaphore_count && VK_NULL_HANDLE == update_info->fence) {
+        return VK_SUCCESS;
+    }
+    uint32_t max_binds = (0 < update_info->max_binds) ? update_info->max_binds : UINT32_MAX;
+    uint32_t bind_count = (image->pending_count < max_binds) ? image->pending_count : max_binds;
+    //A bind may need one unbind of an evicted tile, both for every aspect
+    if(!lava_reserve(memory_allocator->allocator, (void**)&image->binds, &image->bind_capacity, bind_count * 2 * image->aspect_count + 1, sizeof(VkSparseImageMemoryBind))
+       || !lava_reserve(memory_allocator->allocator, (void**)&image->assignments, &image->assignment_capacity, bind_count + 1, sizeof(lava_sparse_assignment))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    uint32_t key_count = (image->page_count < image->pending_count) ? image->pending_count : image->page_count;
+    if(!lava_reserve(memory_allocator->allocator, (void**)&image->sort_keys, &image->sort_key_capacity, key_count + 1, sizeof(lava_sparse_sort_key))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    //Coarser levels first, so that a fallback exists before the details arrive
+    lava_sparse_sort_key* keys = image->sort_keys;
+    for(uint32_t i = 0; i < image->pending_count; ++i) {
+        uint32_t tile = image->pending[i];
+        uint32_t mip_level = lava_sparse_tile_level(image, tile) % image->mip_tail_first_lod;
+        keys[i].key = image->mip_tail_first_lod - mip_level;
+        keys[i].value = tile;
+    }
+    qsort(keys, image->pending_count, sizeof(lava_sparse_sort_key), lava_compare_sparse_keys);
+    for(uint32_t i = 0; i < image->pending_count; ++i) {
+        image->pending[i] = keys[i].value;
+    }
+
+    //Least recently requested pages are evicted first
+    uint32_t candidate_count = 0;
+    uint32_t candidate = 0;
+    if(image->free_count < bind_count) {
+        for(uint32_t page = 0; page < image->page_count; ++page) {
+            uint32_t tile = image->page_tiles[page];
+            if(LAVA_SPARSE_NO_PAGE != tile && image->tiles[tile].last_request + image->keep_frames < update_info->frame_index) {
+                keys[candidate_count].key = image->tiles[tile].last_request;
+                keys[candidate_count].value = page;
+                ++candidate_count;
+            }
+        }
+        qsort(keys, candidate_count, sizeof(lava_sparse_sort_key), lava_compare_sparse_keys);
+        for(uint32_t i = 0; i < candidate_count; ++i) {
+            image->candidates[i] = keys[i].value;
+        }
+    }
+
+    //Build the binds first, the page table only changes once they are queued
+    lava_allocation_info page_info;
+    lava_get_allocation_info(image->pages, &page_info);
+    VkDeviceSize page_stride = image->page_size * image->aspect_count;
+    uint32_t free_count = image->free_count;
+    uint32_t count = 0;
+    uint32_t done = 0;
+    for(; done < bind_count; ++done) {
+        lava_sparse_assignment* assignment = &image->assignments[done];
+        assignment->tile = image->pending[done];
+        assignment->evicted = LAVA_SPARSE_NO_PAGE;
+        if(0 < free_count) {
+            assignment->page = image->free_pages[--free_count];
+        } else if(candidate < candidate_count) {
+            assignment->page = image->candidates[candidate++];
+            assignment->evicted = image->page_tiles[assignment->page];
+            count += lava_sparse_tile_binds(image, assignment->evicted, VK_NULL_HANDLE, 0, &image->binds[count]);
+        } else {
+            //Every resident tile is still in use
+            break;
+        }
+        count += lava_sparse_tile_binds(image, assignment->tile, page_info.memory, page_info.offset + assignment->page * page_stride, &image->binds[count]);
+    }
+
+    VkSparseImageMemoryBindInfo image_bind_info = {image->image, count, image->binds};
+    VkBindSparseInfo bind_info;
+    memset(&bind_info, 0, sizeof(bind_info));
+    bind_info.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+    bind_info.waitSemaphoreCount = update_info->wait_semaphore_count;
+    bind_info.pWaitSemaphores = update_info->wait_semaphores;
+    bind_info.imageBindCount = (0 < count) ? 1 : 0;
+    bind_info.pImageBinds = &image_bind_info;
+    bind_info.signalSemaphoreCount = update_info->signal_semaphore_count;
+    bind_info.pSignalSemaphores = update_info->signal_semaphores;
+    VkResult result = vkQueueBindSparse(image->queue, 1, &bind_info, update_info->fence);
+    ++image->stats.bind_calls;
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    image->free_count = free_count;
+    for(uint32_t i = 0; i < done; ++i) {
+        const lava_sparse_assignment* assignment = &image->assignments[i];
+        if(LAVA_SPARSE_NO_PAGE != assignment->evicted) {
+            image->page_table[assignment->evicted] = LAVA_SPARSE_NO_PAGE;
+            ++image->stats.unbinds;
+        }
+        image->page_table[assignment->tile] = assignment->page;
+        image->page_tiles[assignment->page] = assignment->tile;
+        image->tiles[assignment->tile].pending = false;
+        ++image->stats.binds;
+    }
+    //Requests which did not get a page stay pending
+    image->pending_count -= done;
+    memmove(image->pending, image->pending + done, sizeof(uint32_t) * image->pending_count);
+    return (0 < image->pending_count) ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+//--- Device address
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_ADDRESS_CHUNK_SIZE (16ULL * 1024ULL * 1024ULL)
+#define LAVA_NO_SLOT (0xFFFFFFFFU)
+
+typedef struct lava_address_free_range_t
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} lava_address_free_range;
+
+typedef struct lava_address_chunk_t
+{
+    VkBuffer buffer;
+    lava_allocation* allocation;
+    VkDeviceSize size;
+    VkDeviceAddress address;
+    uint8_t* mapped;
+    lava_address_free_range* free_ranges; //!< Sorted by offset, neighbours are always merged.
+    uint32_t free_count;
+    uint32_t free_capacity;
+} lava_address_chunk;
+
+typedef struct lava_address_retired_t
+{
+    lava_address_range* ranges;
+    uint32_t count;
+    uint32_t capacity;
+} lava_address_retired;
+
+struct lava_address_pool_t
+{
+    lava_memory_allocator* memory_allocator;
+    VkBufferUsageFlags usage;
+    VkMemoryPropertyFlags required_flags;
+    VkMemoryPropertyFlags preferred_flags;
+    VkDeviceSize chunk_size;
+    lava_mutex mutex;
+    lava_address_chunk* chunks;
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+    uint32_t range_count;
+    VkDeviceSize range_bytes;
+    uint32_t frame_count;
+    uint64_t frame_index;
+    lava_address_retired* retired; //!< Per frame slot, ranges freed while the GPU may still use them.
+
+    //--- Pointer table
+    VkBuffer table_buffer;
+    lava_allocation* table_allocation;
+    VkDeviceAddress table_address;
+    VkDeviceAddress* table;
+    uint32_t* free_slots;
+    uint32_t free_slot_count;
+};
+
+static VkResult lava_address_chunk_create(lava_address_pool* pool, VkDeviceSize size)
+{
+    lava_memory_allocator* memory_allocator = pool->memory_allocator;
+    if(!lava_reserve(memory_allocator->allocator, (void**)&pool->chunks, &pool->chunk_capacity, pool->chunk_count + 1, sizeof(lava_address_chunk))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    lava_address_chunk* chunk = &pool->chunks[pool->chunk_count];
+    memset(chunk, 0, sizeof(lava_address_chunk));
+    if(!lava_reserve(memory_allocator->allocator, (void**)&chunk->free_ranges, &chunk->free_capacity, 1, sizeof(lava_address_free_range))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, LAVA_NULL, 0, size, pool->usage, VK_SHARING_MODE_EXCLUSIVE, 0, LAVA_NULL};
+    lava_allocation_create_info allocation_info = {0, pool->required_flags, pool->preferred_flags, LAVA_NULL, 0.0f};
+    VkResult result = lava_create_buffer(memory_allocator, &buffer_info, &allocation_info, &chunk->buffer, &chunk->allocation);
+    if(VK_SUCCESS != result) {
+        lava_free(memory_allocator->allocator, chunk->free_ranges);
+        return result;
+    }
+    lava_allocation_info info;
+    lava_get_allocation_info(chunk->allocation, &info);
+    chunk->size = size;
+    chunk->address = info.device_address;
+    chunk->mapped = (uint8_t*)info.mapped;
+    chunk->free_ranges[0].offset = 0;
+    chunk->free_ranges[0].size = size;
+    chunk->free_count = 1;
+    ++pool->chunk_count;
+    return VK_SUCCESS;
+}
+
+/**
+ @brief First fit in the free ranges of a chunk.
+ */
+static bool lava_address_chunk_allocate(const VkAllocationCallbacks* allocator, lava_address_chunk* chunk, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+    for(uint32_t i = 0; i < chunk->free_count; ++i) {
+        lava_address_free_range* range = &chunk->free_ranges[i];
+        VkDeviceSize begin = lava_align_up(range->offset, alignment);
+        VkDeviceSize end = range->offset + range->size;
+        if(end < begin || end - begin < size) {
+            continue;
+        }
+        VkDeviceSize head = begin - range->offset;
+        VkDeviceSize tail = end - (begin + size);
+        if(0 < head && 0 < tail) {
+            //Split in two, the padding before the range stays free
+            if(!lava_reserve(allocator, (void**)&chunk->free_ranges, &chunk->free_capacity, chunk->free_count + 1, sizeof(lava_address_free_range))) {
+                return false;
+            }
+            range = &chunk->free_ranges[i];
+            memmove(range + 2, range + 1, sizeof(lava_address_free_range) * (chunk->free_count - i - 1));
+            ++chunk->free_count;
+            range[0].size = head;
+            range[1].offset = begin + size;
+            range[1].size = tail;
+        } else if(0 < head) {
+            range->size = head;
+        } else if(0 < tail) {
+            range->offset = begin + size;
+            range->size = tail;
+        } else {
+            memmove(range, range + 1, sizeof(lava_address_free_range) * (chunk->free_count - i - 1));
+            --chunk->free_count;
+        }
+        *offset = begin;
+        return true;
+    }
+    return false;
+}
+
+static bool lava_address_chunk_free(const VkAllocationCallbacks* allocator, lava_address_chunk* chunk, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t index = 0;
+    while(index < chunk->free_count && chunk->free_ranges[index].offset < offset) {
+        ++index;
+    }
+    bool merge_prev = 0 < index && (chunk->free_ranges[index - 1].offset + chunk->free_ranges[index - 1].size) == offset;
+    bool merge_next = index < chunk->free_count && (offset + size) == chunk->free_ranges[index].offset;
+    if(merge_prev && merge_next) {
+        chunk->free_ranges[index - 1].size += size + chunk->free_ranges[index].size;
+        memmove(&chunk->free_ranges[index], &chunk->free_ranges[index + 1], sizeof(lava_address_free_range) * (chunk->free_count - index - 1));
+        --chunk->free_count;
+    } else if(merge_prev) {
+        chunk->free_ranges[index - 1].size += size;
+    } else if(merge_next) {
+        chunk->free_ranges[index].offset = offset;
+        chunk->free_ranges[index].size += size;
+    } else {
+        if(!lava_reserve(allocator, (void**)&chunk->free_ranges, &chunk->free_capacity, chunk->free_count + 1, sizeof(lava_address_free_range))) {
+            return false;
+        }
+        memmove(&chunk->free_ranges[index + 1], &chunk->free_ranges[index], sizeof(lava_address_free_range) * (chunk->free_count - index));
+        chunk->free_ranges[index].offset = offset;
+        chunk->free_ranges[index].size = size;
+        ++chunk->free_count;
+    }
+    return true;
+}
+
+VkResult LAVA_API lava_create_address_pool(const lava_address_pool_create_info* create_info, lava_address_pool** pool)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->memory_allocator);
+    assert(0 != (create_info->memory_allocator->flags & LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT));
+    assert(LAVA_NULL != pool);
+    lava_memory_allocator* memory_allocator = create_info->memory_allocator;
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    lava_address_pool* new_pool = (lava_address_pool*)lava_calloc(allocator, sizeof(lava_address_pool));
+    if(LAVA_NULL == new_pool) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_pool->memory_allocator = memory_allocator;
+    new_pool->usage = create_info->usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    new_pool->required_flags = create_info->required_flags;
+    new_pool->preferred_flags = create_info->preferred_flags;
+    new_pool->chunk_size = (0 < create_info->chunk_size) ? create_info->chunk_size : LAVA_DEFAULT_ADDRESS_CHUNK_SIZE;
+    lava_mutex_initialize(&new_pool->mutex);
+    *pool = new_pool;
+    new_pool->frame_count = create_info->frame_count;
+    if(0 < new_pool->frame_count) {
+        new_pool->retired = (lava_address_retired*)lava_calloc(allocator, sizeof(lava_address_retired) * new_pool->frame_count);
+        if(LAVA_NULL == new_pool->retired) {
+            lava_destroy_address_pool(new_pool);
+            *pool = LAVA_NULL;
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    if(create_info->pointer_table_capacity <= 0) {
+        return VK_SUCCESS;
+    }
+
+    //The table is written by the host on every allocation
+    uint32_t capacity = create_info->pointer_table_capacity;
+    new_pool->free_slots = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * capacity);
+    if(LAVA_NULL == new_pool->free_slots) {
+        lava_destroy_address_pool(new_pool);
+        *pool = LAVA_NULL;
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < capacity; ++i) {
+        new_pool->free_slots[i] = capacity - 1 - i;
+    }
+    new_pool->free_slot_count = capacity;
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, LAVA_NULL, 0, sizeof(VkDeviceAddress) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_SHARING_MODE_EXCLUSIVE, 0, LAVA_NULL};
+    lava_allocation_create_info allocation_info = {LAVA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, LAVA_NULL, 0.0f};
+    VkResult result = lava_create_buffer(memory_allocator, &buffer_info, &allocation_info, &new_pool->table_buffer, &new_pool->table_allocation);
+    if(VK_SUCCESS != result) {
+        lava_destroy_address_pool(new_pool);
+        *pool = LAVA_NULL;
+        return result;
+    }
+    lava_allocation_info info;
+    lava_get_allocation_info(new_pool->table_allocation, &info);
+    new_pool->table_address = info.device_address;
+    new_pool->table = (VkDeviceAddress*)info.mapped;
+    memset(new_pool->table, 0, sizeof(VkDeviceAddress) * capacity);
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_address_pool(lava_address_pool* pool)
+{
+    if(LAVA_NULL == pool) {
+        return;
+    }
+    lava_memory_allocator* memory_allocator = pool->memory_allocator;
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    for(uint32_t i = 0; i < pool->chunk_count; ++i) {
+        lava_destroy_buffer(memory_allocator, pool->chunks[i].buffer, pool->chunks[i].allocation);
+        lava_free(allocator, pool->chunks[i].free_ranges);
+    }
+    if(LAVA_NULL != pool->table_allocation) {
+        lava_destroy_buffer(memory_allocator, pool->table_buffer, pool->table_allocation);
+    }
+    lava_free(allocator, pool->chunks);
+    lava_free(allocator, pool->free_slots);
+    if(LAVA_NULL != pool->retired) {
+        for(uint32_t i = 0; i < pool->frame_count; ++i) {
+            lava_free(allocator, pool->retired[i].ranges);
+        }
+    }
+    lava_free(allocator, pool->retired);
+    lava_mutex_terminate(&pool->mutex);
+    lava_free(allocator, pool);
+}
+
+VkResult LAVA_API lava_address_allocate(lava_address_pool* pool, VkDeviceSize size, VkDeviceSize alignment, lava_address_range* range)
+{
+    assert(LAVA_NULL != pool);
+    assert(0 < size);
+    assert(LAVA_NULL != range);
+    const VkAllocationCallbacks* allocator = pool->memory_allocator->allocator;
+    alignment = (0 < alignment) ? alignment : 16;
+    lava_mutex_lock(&pool->mutex);
+    if(LAVA_NULL != pool->table && pool->free_slot_count <= 0) {
+        lava_mutex_unlock(&pool->mutex);
+        return VK_ERROR_OUT_OF_POOL_MEMORY;
+    }
+    uint32_t chunk_index = 0;
+    VkDeviceSize offset = 0;
+    for(; chunk_index < pool->chunk_count; ++chunk_index) {
+        if(lava_address_chunk_allocate(allocator, &pool->chunks[chunk_index], size, alignment, &offset)) {
+            break;
+        }
+    }
+    if(pool->chunk_count <= chunk_index) {
+        VkDeviceSize chunk_size = (pool->chunk_size < size) ? lava_align_up(size, pool->chunk_size) : pool->chunk_size;
+        VkResult result = lava_address_chunk_create(pool, chunk_size);
+        if(VK_SUCCESS != result || !lava_address_chunk_allocate(allocator, &pool->chunks[chunk_index], size, alignment, &offset)) {
+            lava_mutex_unlock(&pool->mutex);
+            return (VK_SUCCESS != result) ? result : VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    const lava_address_chunk* chunk = &pool->chunks[chunk_index];
+    range->buffer = chunk->buffer;
+    range->offset = offset;
+    range->size = size;
+    range->address = chunk->address + offset;
+    range->mapped = (LAVA_NULL != chunk->mapped) ? chunk->mapped + offset : LAVA_NULL;
+    range->chunk = chunk_index;
+    range->slot = LAVA_NO_SLOT;
+    if(LAVA_NULL != pool->table) {
+        range->slot = pool->free_slots[--pool->free_slot_count];
+        pool->table[range->slot] = range->address;
+    }
+    ++pool->range_count;
+    pool->range_bytes += size;
+    lava_mutex_unlock(&pool->mutex);
+    return VK_SUCCESS;
+}
+
+/**
+ @brief Return the bytes and the pointer table entry of a range, under the mutex.
+ */
+static void lava_address_release(lava_address_pool* pool, const lava_address_range* range)
+{
+    if(!lava_address_chunk_free(pool->memory_allocator->allocator, &pool->chunks[range->chunk], range->offset, range->size)) {
+        //The range leaks until the pool is destroyed
+        return;
+    }
+    if(LAVA_NO_SLOT != range->slot) {
+        pool->table[range->slot] = 0;
+        pool->free_slots[pool->free_slot_count++] = range->slot;
+    }
+    --pool->range_count;
+    pool->range_bytes -= range->size;
+}
+
+void LAVA_API lava_address_free(lava_address_pool* pool, const lava_address_range* range)
+{
+    assert(LAVA_NULL != pool);
+    if(LAVA_NULL == range || VK_NULL_HANDLE == range->buffer) {
+        return;
+    }
+    assert(range->chunk < pool->chunk_count);
+    lava_mutex_lock(&pool->mutex);
+    //Shaders of the frames in flight may still read the range through its table entry
+    lava_address_retired* retired = (0 < pool->frame_count) ? &pool->retired[pool->frame_index % pool->frame_count] : LAVA_NULL;
+    if(LAVA_NULL != retired && lava_reserve(pool->memory_allocator->allocator, (void**)&retired->ranges, &retired->capacity, retired->count + 1, sizeof(lava_address_range))) {
+        retired->ranges[retired->count++] = *range;
+    } else {
+        lava_address_release(pool, range);
+    }
+    lava_mutex_unlock(&pool->mutex);
+}
+
+void LAVA_API lava_begin_address_frame(lava_address_pool* pool, uint64_t frame_index)
+{
+    assert(LAVA_NULL != pool);
+    if(pool->frame_count <= 0) {
+        return;
+    }
+    lava_mutex_lock(&pool->mutex);
+    pool->frame_index = frame_index;
+    lava_address_retired* retired = &pool->retired[frame_index % pool->frame_count];
+    for(uint32_t i = 0; i < retired->count; ++i) {
+        lava_address_release(pool, &retired->ranges[i]);
+    }
+    retired->count = 0;
+    lava_mutex_unlock(&pool->mutex);
+}
+
+void LAVA_API lava_get_address_pool_stats(lava_address_pool* pool, lava_address_pool_stats* stats)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != stats);
+    lava_mutex_lock(&pool->mutex);
+    stats->chunk_count = pool->chunk_count;
+    stats->range_count = pool->range_count;
+    stats->chunk_bytes = 0;
+    for(uint32_t i = 0; i < pool->chunk_count; ++i) {
+        stats->chunk_bytes += pool->chunks[i].size;
+    }
+    stats->range_bytes = pool->range_bytes;
+    lava_mutex_unlock(&pool->mutex);
+}
+
+VkDeviceAddress LAVA_API lava_get_pointer_table_address(const lava_address_pool* pool)
+{
+    assert(LAVA_NULL != pool);
+    return pool->table_address;
+}
+
+//--- Command pools
+//--------------------------------------------------------------------
+#define LAVA_COMMAND_BUFFER_BATCH (8)
+
+typedef struct lava_command_buffer_list_t
+{
+    VkCommandBuffer* command_buffers;
+    uint32_t used;
+    uint32_t count;
+    uint32_t capacity;
+} lava_command_buffer_list;
+
+/**
+ @brief The pool of one thread in one frame slot. Padded so that threads do not share cache lines.
+ */
+typedef struct lava_thread_command_pool_t
+{
+    VkCommandPool pool;
+    uint64_t reset_frame; //!< Frame the pool was last reset for, plus one.
+    lava_command_buffer_list lists[2]; //!< Primary and secondary.
+    uint8_t padding[64];
+} lava_thread_command_pool;
+
+typedef struct lava_command_frame_t
+{
+    lava_command_frame_end_info end_info;
+    bool pending;
+} lava_command_frame;
+
+struct lava_command_pool_set_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t thread_count;
+    uint32_t frame_count;
+    uint32_t slot;
+    uint64_t frame_index;
+    lava_command_frame* frames;
+    lava_thread_command_pool* pools; //!< frame_count * thread_count entries.
+};
+
+VkResult LAVA_API lava_create_command_pool_set(const lava_command_pool_set_create_info* create_info, lava_command_pool_set** set)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(0 < create_info->thread_count);
+    assert(0 < create_info->frame_count);
+    assert(LAVA_NULL != set);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_command_pool_set* new_set = (lava_command_pool_set*)lava_calloc(allocator, sizeof(lava_command_pool_set));
+    if(LAVA_NULL == new_set) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_set->device = create_info->device;
+    new_set->allocator = allocator;
+    new_set->thread_count = create_info->thread_count;
+    new_set->frame_count = create_info->frame_count;
+    uint32_t pool_count = create_info->thread_count * create_info->frame_count;
+    new_set->frames = (lava_command_frame*)lava_calloc(allocator, sizeof(lava_command_frame) * create_info->frame_count);
+    new_set->pools = (lava_thread_command_pool*)lava_calloc(allocator, sizeof(lava_thread_command_pool) * pool_count);
+    if(LAVA_NULL == new_set->frames || LAVA_NULL == new_set->pools) {
+        lava_destroy_command_pool_set(new_set);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    //Command buffers are only reset with their pool
+    VkCommandPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, LAVA_NULL, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, create_info->queue_family_index};
+    for(uint32_t i = 0; i < pool_count; ++i) {
+        VkResult result = vkCreateCommandPool(create_info->device->device_, &pool_info, allocator, &new_set->pools[i].pool);
+        if(VK_SUCCESS != result) {
+            lava_destroy_command_pool_set(new_set);
+            return result;
+        }
+    }
+    *set = new_set;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_command_pool_set(lava_command_pool_set* set)
+{
+    if(LAVA_NULL == set) {
+        return;
+    }
+    if(LAVA_NULL != set->pools) {
+        uint32_t pool_count = set->thread_count * set->frame_count;
+        for(uint32_t i = 0; i < pool_count; ++i) {
+            lava_thread_command_pool* pool = &set->pools[i];
+            if(VK_NULL_HANDLE != pool->pool) {
+                vkDestroyCommandPool(set->device->device_, pool->pool, set->allocator);
+            }
+            lava_free(set->allocator, pool->lists[0].command_buffers);
+            lava_free(set->allocator, pool->lists[1].command_buffers);
+        }
+    }
+    lava_free(set->allocator, set->pools);
+    lava_free(set->allocator, set->frames);
+    lava_free(set->allocator, set);
+}
+
+VkResult LAVA_API lava_begin_command_frame(lava_command_pool_set* set, uint64_t frame_index)
+{
+    assert(LAVA_NULL != set);
+    uint32_t slot = (uint32_t)(frame_index % set->frame_count);
+    lava_command_frame* frame = &set->frames[slot];
+    if(frame->pending) {
+        VkDevice device = set->device->device_;
+        VkResult result = VK_SUCCESS;
+        if(VK_NULL_HANDLE != frame->end_info.fence) {
+            result = vkWaitForFences(device, 1, &frame->end_info.fence, VK_TRUE, UINT64_MAX);
+        } else if(VK_NULL_HANDLE != frame->end_info.timeline_semaphore) {
+            VkSemaphoreWaitInfo wait_info = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO, LAVA_NULL, 0, 1, &frame->end_info.timeline_semaphore, &frame->end_info.timeline_value};
+            result = vkWaitSemaphores(device, &wait_info, UINT64_MAX);
+        }
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+        frame->pending = false;
+    }
+    set->slot = slot;
+    set->frame_index = frame_index;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_end_command_frame(lava_command_pool_set* set, const lava_command_frame_end_info* end_info)
+{
+    assert(LAVA_NULL != set);
+    lava_command_frame* frame = &set->frames[set->slot];
+    if(LAVA_NULL != end_info) {
+        frame->end_info = *end_info;
+        frame->pending = true;
+    }
+}
+
+VkResult LAVA_API lava_allocate_command_buffer(lava_command_pool_set* set, uint32_t thread_index, VkCommandBufferLevel level, VkCommandBuffer* command_buffer)
+{
+    assert(LAVA_NULL != set);
+    assert(thread_index < set->thread_count);
+    assert(LAVA_NULL != command_buffer);
+    VkDevice device = set->device->device_;
+    lava_thread_command_pool* pool = &set->pools[set->slot * set->thread_count + thread_index];
+    if(pool->reset_frame != set->frame_index + 1) {
+        if(0 < pool->reset_frame) {
+            VkResult result = vkResetCommandPool(device, pool->pool, 0);
+            if(VK_SUCCESS != result) {
+                return result;
+            }
+        }
+        pool->reset_frame = set->frame_index + 1;
+        pool->lists[0].used = 0;
+        pool->lists[1].used = 0;
+    }
+    lava_command_buffer_list* list = &pool->lists[(VK_COMMAND_BUFFER_LEVEL_PRIMARY == level) ? 0 : 1];
+    if(list->count <= list->used) {
+        //Grow by a batch, reused every frame from now on
+        if(!lava_reserve(set->allocator, (void**)&list->command_buffers, &list->capacity, list->count + LAVA_COMMAND_BUFFER_BATCH, sizeof(VkCommandBuffer))) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        VkCommandBufferAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, LAVA_NULL, pool->pool, level, LAVA_COMMAND_BUFFER_BATCH};
+        VkResult result = vkAllocateCommandBuffers(device, &allocate_info, list->command_buffers + list->count);
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+        list->count += LAVA_COMMAND_BUFFER_BATCH;
+    }
+    *command_buffer = list->command_buffers[list->used++];
+    return VK_SUCCESS;
+}
+
+//--- Jobs
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_JOB_QUEUE_CAPACITY (1024)
+#define LAVA_JOB_SPIN_COUNT (64)
+
+/**
+ @brief Chase-Lev deque. The owner pushes and pops at the bottom, thieves take from the top.
+ */
+typedef struct lava_job_deque_t
+{
+    volatile int64_t top;
+    uint8_t padding0[64 - sizeof(int64_t)];
+    volatile int64_t bottom;
+    uint8_t padding1[64 - sizeof(int64_t)];
+    lava_job* jobs;
+    int64_t mask;
+    uint32_t random;
+} lava_job_deque;
+
+typedef struct lava_job_worker_t
+{
+    lava_job_system* job_system;
+    uint32_t index;
+    lava_thread thread;
+    bool started;
+} lava_job_worker;
+
+struct lava_job_system_t
+{
+    const VkAllocationCallbacks* allocator;
+    uint32_t worker_count;
+    lava_job_deque* deques;
+    lava_job_worker* workers;
+    lava_mutex mutex;
+    lava_condition condition;
+    volatile int32_t queued; //!< Jobs pushed and not taken yet.
+    volatile int32_t sleeping;
+    volatile int32_t quit;
+};
+
+static bool lava_job_push(lava_job_deque* deque, const lava_job* job)
+{
+    int64_t bottom = lava_atomic_load64(&deque->bottom);
+    int64_t top = lava_atomic_load64(&deque->top);
+    if(deque->mask < bottom - top) {
+        return false;
+    }
+    deque->jobs[bottom & deque->mask] = *job;
+    lava_atomic_store64(&deque->bottom, bottom + 1);
+    return true;
+}
+
+static bool lava_job_pop(lava_job_deque* deque, lava_job* job)
+{
+    int64_t bottom = lava_atomic_load64(&deque->bottom) - 1;
+    lava_atomic_store64(&deque->bottom, bottom);
+    lava_atomic_fence();
+    int64_t top = lava_atomic_load64(&deque->top);
+    if(bottom < top) {
+        lava_atomic_store64(&deque->bottom, top);
+        return false;
+    }
+    *job = deque->jobs[bottom & deque->mask];
+    if(top < bottom) {
+        return true;
+    }
+    //The last job, race the thieves for it
+    bool taken = lava_atomic_cas64(&deque->top, top, top + 1);
+    lava_atomic_store64(&deque->bottom, top + 1);
+    return taken;
+}
+
+static bool lava_job_steal(lava_job_deque* deque, lava_job* job)
+{
+    int64_t top = lava_atomic_load64(&deque->top);
+    lava_atomic_fence();
+    int64_t bottom = lava_atomic_load64(&deque->bottom);
+    if(bottom <= top) {
+        return false;
+    }
+    *job = deque->jobs[top & deque->mask];
+    return lava_atomic_cas64(&deque->top, top, top + 1);
+}
+
+static bool lava_job_take(lava_job_system* job_system, uint32_t worker_index, lava_job* job)
+{
+    lava_job_deque* deque = &job_system->deques[worker_index];
+    bool taken = lava_job_pop(deque, job);
+    if(!taken && 1 < job_system->worker_count) {
+        //Start from a random victim so that thieves spread out
+        deque->random ^= deque->random << 13;
+        deque->random ^= deque->random >> 17;
+        deque->random ^= deque->random << 5;
+        uint32_t first = deque->random % job_system->worker_count;
+        for(uint32_t i = 0; i < job_system->worker_count && !taken; ++i) {
+            uint32_t victim = (first + i) % job_system->worker_count;
+            if(victim != worker_index) {
+                taken = lava_job_steal(&job_system->deques[victim], job);
+            }
+        }
+    }
+    if(taken) {
+        lava_atomic_add32(&job_system->queued, -1);
+    }
+    return taken;
+}
+
+static void lava_job_run(const lava_job* job, uint32_t worker_index)
+{
+    job->function(job->user_data, worker_index);
+    if(LAVA_NULL != job->counter) {
+        lava_atomic_add32(&job->counter->value, -1);
+    }
+}
+
+static LAVA_THREAD_PROC(lava_job_worker_proc)
+{
+    lava_job_worker* worker = (lava_job_worker*)argument;
+    lava_job_system* job_system = worker->job_system;
+    uint32_t spin = 0;
+    while(0 == lava_atomic_load32(&job_system->quit)) {
+        lava_job job;
+        if(lava_job_take(job_system, worker->index, &job)) {
+            lava_job_run(&job, worker->index);
+            spin = 0;
+            continue;
+        }
+        if(++spin < LAVA_JOB_SPIN_COUNT) {
+            lava_thread_yield();
+            continue;
+        }
+        //Submitters read sleeping after publishing queued, so either side sees the other
+        lava_mutex_lock(&job_system->mutex);
+        lava_atomic_add32(&job_system->sleeping, 1);
+        while(0 == lava_atomic_load32(&job_system->queued) && 0 == lava_atomic_load32(&job_system->quit)) {
+            lava_condition_wait(&job_system->condition, &job_system->mutex);
+        }
+        lava_atomic_add32(&job_system->sleeping, -1);
+        lava_mutex_unlock(&job_system->mutex);
+        spin = 0;
+    }
+    return LAVA_THREAD_RETURN;
+}
+
+VkResult LAVA_API lava_create_job_system(const lava_job_system_create_info* create_info, lava_job_system** job_system)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != job_system);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_job_system* new_system = (lava_job_system*)lava_calloc(allocator, sizeof(lava_job_system));
+    if(LAVA_NULL == new_system) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t worker_count = (0 < create_info->worker_count) ? create_info->worker_count : lava_core_count();
+    uint32_t capacity = 1;
+    while(capacity < ((0 < create_info->queue_capacity) ? create_info->queue_capacity : LAVA_DEFAULT_JOB_QUEUE_CAPACITY)) {
+        capacity <<= 1;
+    }
+    new_system->allocator = allocator;
+    new_system->worker_count = worker_count;
+    lava_mutex_initialize(&new_system->mutex);
+    lava_condition_initialize(&new_system->condition);
+    new_system->deques = (lava_job_deque*)lava_calloc(allocator, sizeof(lava_job_deque) * worker_count);
+    new_system->workers = (lava_job_worker*)lava_calloc(allocator, sizeof(lava_job_worker) * worker_count);
+    if(LAVA_NULL == new_system->deques || LAVA_NULL == new_system->workers) {
+        lava_destroy_job_system(new_system);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < worker_count; ++i) {
+        lava_job_deque* deque = &new_system->deques[i];
+        deque->jobs = (lava_job*)lava_malloc(allocator, sizeof(lava_job) * capacity);
+        if(LAVA_NULL == deque->jobs) {
+            lava_destroy_job_system(new_system);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        deque->mask = capacity - 1;
+        deque->random = 0x9E3779B9U * (i + 1);
+        new_system->workers[i].job_system = new_system;
+        new_system->workers[i].index = i;
+    }
+    //Worker 0 is the thread calling lava_wait_jobs
+    for(uint32_t i = 1; i < worker_count; ++i) {
+        if(!lava_thread_create(&new_system->workers[i].thread, lava_job_worker_proc, &new_system->workers[i])) {
+            lava_destroy_job_system(new_system);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        new_system->workers[i].started = true;
+    }
+    *job_system = new_system;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_job_system(lava_job_system* job_system)
+{
+    if(LAVA_NULL == job_system) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = job_system->allocator;
+    lava_mutex_lock(&job_system->mutex);
+    lava_atomic_add32(&job_system->quit, 1);
+    lava_condition_broadcast(&job_system->condition);
+    lava_mutex_unlock(&job_system->mutex);
+    if(LAVA_NULL != job_system->workers) {
+        for(uint32_t i = 1; i < job_system->worker_count; ++i) {
+            if(job_system->workers[i].started) {
+                lava_thread_join(job_system->workers[i].thread);
+            }
+        }
+    }
+    if(LAVA_NULL != job_system->deques) {
+        for(uint32_t i = 0; i < job_system->worker_count; ++i) {
+            lava_free(allocator, job_system->deques[i].jobs);
+        }
+    }
+    lava_free(allocator, job_system->workers);
+    lava_free(allocator, job_system->deques);
+    lava_condition_terminate(&job_system->condition);
+    lava_mutex_terminate(&job_system->mutex);
+    lava_free(allocator, job_system);
+}
+
+uint32_t LAVA_API lava_get_job_worker_count(const lava_job_system* job_system)
+{
+    assert(LAVA_NULL != job_system);
+    return job_system->worker_count;
+}
+
+void LAVA_API lava_submit_jobs(lava_job_system* job_system, uint32_t worker_index, uint32_t job_count, const lava_job* jobs)
+{
+    assert(LAVA_NULL != job_system);
+    assert(worker_index < job_system->worker_count);
+    assert(0 == job_count || LAVA_NULL != jobs);
+    lava_job_deque* deque = &job_system->deques[worker_index];
+    uint32_t pushed = 0;
+    for(; pushed < job_count; ++pushed) {
+        if(LAVA_NULL != jobs[pushed].counter) {
+            lava_atomic_add32(&jobs[pushed].counter->value, 1);
+        }
+        lava_atomic_add32(&job_system->queued, 1);
+        if(!lava_job_push(deque, &jobs[pushed])) {
+            lava_atomic_add32(&job_system->queued, -1);
+            break;
+        }
+    }
+    if(0 < pushed && 0 < lava_atomic_load32(&job_system->sleeping)) {
+        lava_mutex_lock(&job_system->mutex);
+        lava_condition_broadcast(&job_system->condition);
+        lava_mutex_unlock(&job_system->mutex);
+    }
+    for(uint32_t i = pushed; i < job_count; ++i) {
+        if(i != pushed && LAVA_NULL != jobs[i].counter) {
+            lava_atomic_add32(&jobs[i].counter->value, 1);
+        }
+        lava_job_run(&jobs[i], worker_index);
+    }
+}
+
+void LAVA_API lava_wait_jobs(lava_job_system* job_system, uint32_t worker_index, lava_job_counter* counter)
+{
+    assert(LAVA_NULL != job_system);
+    assert(worker_index < job_system->worker_count);
+    assert(LAVA_NULL != counter);
+    while(0 < lava_atomic_load32(&counter->value)) {
+        lava_job job;
+        if(lava_job_take(job_system, worker_index, &job)) {
+            lava_job_run(&job, worker_index);
+        } else {
+            lava_thread_yield();
+        }
+    }
+}
+
+//--- Parallel recording
+//--------------------------------------------------------------------
+typedef struct lava_record_chunk_t
+{
+    const lava_parallel_record_info* record_info;
+    uint32_t first_draw;
+    uint32_t draw_count;
+    VkCommandBuffer command_buffer;
+    VkResult result;
+} lava_record_chunk;
+
+static void VKAPI_PTR lava_record_chunk_job(void* user_data, uint32_t worker_index)
+{
+    lava_record_chunk* chunk = (lava_record_chunk*)user_data;
+    const lava_parallel_record_info* record_info = chunk->record_info;
+    chunk->result = lava_allocate_command_buffer(record_info->command_pool_set, worker_index, VK_COMMAND_BUFFER_LEVEL_SECONDARY, &chunk->command_buffer);
+    if(VK_SUCCESS != chunk->result) {
+        return;
+    }
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        LAVA_NULL,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        record_info->inheritance_info,
+    };
+    chunk->result = vkBeginCommandBuffer(chunk->command_buffer, &begin_info);
+    if(VK_SUCCESS != chunk->result) {
+        return;
+    }
+    record_info->record(record_info->user_data, chunk->command_buffer, chunk->first_draw, chunk->draw_count, worker_index);
+    chunk->result = vkEndCommandBuffer(chunk->command_buffer);
+}
+
+VkResult LAVA_API lava_record_parallel(const lava_parallel_record_info* record_info, uint32_t* command_buffer_count, VkCommandBuffer* command_buffers)
+{
+    assert(LAVA_NULL != record_info);
+    assert(LAVA_NULL != record_info->job_system);
+    assert(LAVA_NULL != record_info->command_pool_set);
+    assert(lava_get_job_worker_count(record_info->job_system) <= record_info->command_pool_set->thread_count);
+    assert(LAVA_NULL != record_info->record);
+    assert(LAVA_NULL != command_buffer_count);
+    assert(LAVA_NULL != command_buffers);
+    *command_buffer_count = 0;
+    if(record_info->draw_count <= 0) {
+        return VK_SUCCESS;
+    }
+    //A few chunks per worker leave room for stealing when draws are uneven
+    uint32_t worker_count = lava_get_job_worker_count(record_info->job_system);
+    uint32_t chunk_size = (0 < record_info->chunk_size) ? record_info->chunk_size : lava_div_up(record_info->draw_count, worker_count * 4);
+    if(LAVA_MAX_PARALLEL_RECORD_CHUNKS < lava_div_up(record_info->draw_count, chunk_size)) {
+        chunk_size = lava_div_up(record_info->draw_count, LAVA_MAX_PARALLEL_RECORD_CHUNKS);
+    }
+    uint32_t chunk_count = lava_div_up(record_info->draw_count, chunk_size);
+
+    lava_record_chunk chunks[LAVA_MAX_PARALLEL_RECORD_CHUNKS];
+    lava_job jobs[LAVA_MAX_PARALLEL_RECORD_CHUNKS] = {{LAVA_NULL, LAVA_NULL, LAVA_NULL}};
+    lava_job_counter counter = {0};
+    for(uint32_t i = 0; i < chunk_count; ++i) {
+        chunks[i].record_info = record_info;
+        chunks[i].first_draw = i * chunk_size;
+        chunks[i].draw_count = (record_info->draw_count - chunks[i].first_draw < chunk_size) ? record_info->draw_count - chunks[i].first_draw : chunk_size;
+        chunks[i].command_buffer = VK_NULL_HANDLE;
+        chunks[i].result = VK_SUCCESS;
+        jobs[i].function = lava_record_chunk_job;
+        jobs[i].user_data = &chunks[i];
+        jobs[i].counter = &counter;
+    }
+    lava_submit_jobs(record_info->job_system, record_info->worker_index, chunk_count, jobs);
+    lava_wait_jobs(record_info->job_system, record_info->worker_index, &counter);
+    for(uint32_t i = 0; i < chunk_count; ++i) {
+        if(VK_SUCCESS != chunks[i].result) {
+            return chunks[i].result;
+        }
+        command_buffers[i] = chunks[i].command_buffer;
+    }
+    *command_buffer_count = chunk_count;
+    return VK_SUCCESS;
+}
+
+VkResult LAVA_API lava_cmd_record_parallel(VkCommandBuffer command_buffer, const lava_parallel_record_info* record_info)
+{
+    VkCommandBuffer command_buffers[LAVA_MAX_PARALLEL_RECORD_CHUNKS];
+    uint32_t command_buffer_count = 0;
+    VkResult result = lava_record_parallel(record_info, &command_buffer_count, command_buffers);
+    if(VK_SUCCESS == result && 0 < command_buffer_count) {
+        vkCmdExecuteCommands(command_buffer, command_buffer_count, command_buffers);
+    }
+    return result;
+}
+
+//--- Handle map
+//--------------------------------------------------------------------
+#define LAVA_HANDLE_KEY(HANDLE) LAVA_OBJECT_HANDLE(HANDLE)
+#define LAVA_HANDLE_MAP_EMPTY (0xFFFFFFFFU)
+
+/**
+ @brief Open addressing map from a Vulkan handle to an index, with linear probing and backward shift deletion.
+ */
+typedef struct lava_handle_map_t
+{
+    uint64_t* keys;
+    uint32_t* values;
+    uint32_t capacity;
+    uint32_t count;
+} lava_handle_map;
+
+static uint32_t lava_hash64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+static uint64_t lava_hash_combine(uint64_t seed, uint64_t value)
+{
+    return seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2));
+}
+
+static uint64_t lava_hash_bytes(uint64_t seed, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = seed;
+    for(; sizeof(uint64_t) <= size; bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        hash = lava_hash_combine(hash, word);
+    }
+    if(0 < size) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        hash = lava_hash_combine(hash, word);
+    }
+    return hash;
+}
+
+static void lava_handle_map_terminate(const VkAllocationCallbacks* allocator, lava_handle_map* map)
+{
+    lava_free(allocator, map->keys);
+    lava_free(allocator, map->values);
+    memset(map, 0, sizeof(lava_handle_map));
+}
+
+static uint32_t lava_handle_map_find(const lava_handle_map* map, uint64_t key)
+{
+    if(map->count <= 0) {
+        return LAVA_HANDLE_MAP_EMPTY;
+    }
+    uint32_t mask = map->capacity - 1;
+    for(uint32_t slot = lava_hash64(key) & mask;; slot = (slot + 1) & mask) {
+        if(LAVA_HANDLE_MAP_EMPTY == map->values[slot]) {
+            return LAVA_HANDLE_MAP_EMPTY;
+        }
+        if(map->keys[slot] == key) {
+            return map->values[slot];
+        }
+    }
+}
+
+static void lava_handle_map_assign(lava_handle_map* map, uint64_t key, uint32_t value)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = lava_hash64(key) & mask;
+    while(LAVA_HANDLE_MAP_EMPTY != map->values[slot] && map->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    if(LAVA_HANDLE_MAP_EMPTY == map->values[slot]) {
+        ++map->count;
+    }
+    map->keys[slot] = key;
+    map->values[slot] = value;
+}
+
+static bool lava_handle_map_insert(const VkAllocationCallbacks* allocator, lava_handle_map* map, uint64_t key, uint32_t value)
+{
+    //Keep the load under one half
+    if(map->capacity <= (map->count + 1) * 2) {
+        uint32_t capacity = (0 < map->capacity) ? map->capacity * 2 : 64;
+        lava_handle_map new_map;
+        new_map.keys = (uint64_t*)lava_malloc(allocator, sizeof(uint64_t) * capacity);
+        new_map.values = (uint32_t*)lava_malloc(allocator, sizeof(uint32_t) * capacity);
+        new_map.capacity = capacity;
+        new_map.count = 0;
+        if(LAVA_NULL == new_map.keys || LAVA_NULL == new_map.values) {
+            lava_handle_map_terminate(allocator, &new_map);
+            return false;
+        }
+        memset(new_map.values, 0xFF, sizeof(uint32_t) * capacity);
+        for(uint32_t i = 0; i < map->capacity; ++i) {
+            if(LAVA_HANDLE_MAP_EMPTY != map->values[i]) {
+                lava_handle_map_assign(&new_map, map->keys[i], map->values[i]);
+            }
+        }
+        lava_handle_map_terminate(allocator, map);
+        *map = new_map;
+    }
+    lava_handle_map_assign(map, key, value);
+    return true;
+}
+
+static void lava_handle_map_clear(lava_handle_map* map)
+{
+    if(0 < map->count) {
+        memset(map->values, 0xFF, sizeof(uint32_t) * map->capacity);
+        map->count = 0;
+    }
+}
+
+static void lava_handle_map_erase(lava_handle_map* map, uint64_t key)
+{
+    if(map->count <= 0) {
+        return;
+    }
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = lava_hash64(key) & mask;
+    for(;; slot = (slot + 1) & mask) {
+        if(LAVA_HANDLE_MAP_EMPTY == map->values[slot]) {
+            return;
+        }
+        if(map->keys[slot] == key) {
+            break;
+        }
+    }
+    //Shift back the entries of the cluster which probed past the hole
+    uint32_t hole = slot;
+    for(uint32_t next = (hole + 1) & mask; LAVA_HANDLE_MAP_EMPTY != map->values[next]; next = (next + 1) & mask) {
+        uint32_t home = lava_hash64(map->keys[next]) & mask;
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            map->keys[hole] = map->keys[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
+    }
+    map->values[hole] = LAVA_HANDLE_MAP_EMPTY;
+    --map->count;
+}
+
+//--- Barriers
+//--------------------------------------------------------------------
+#define LAVA_NO_PENDING (0xFFFFFFFFU)
+#define LAVA_PENDING_GLOBAL (0xFFFFFFFEU) //!< Buffer hazard folded into the global barrier, other buffer values index buffer_barriers.
+
+typedef struct lava_subresource_state_t
+{
+    VkImageLayout layout;
+    uint32_t queue_family_index;
+    VkPipelineStageFlags2 write_stage; //!< Stages of the last write or layout transition.
+    VkAccessFlags2 write_access;
+    VkPipelineStageFlags2 read_stage; //!< Stages which read since the last write.
+    VkPipelineStageFlags2 visible_stage; //!< Stages and accesses the last write is already visible to.
+    VkAccessFlags2 visible_access;
+    uint32_t pending; //!< Barrier of the current batch for this subresource.
+} lava_subresource_state;
+
+typedef struct lava_tracked_resource_t
+{
+    uint64_t key;
+    VkImage image;
+    VkBuffer buffer;
+    VkImageAspectFlags aspect;
+    uint32_t mip_levels;
+    uint32_t array_layers;
+    lava_subresource_state* states; //!< mip major, one entry for buffers.
+} lava_tracked_resource;
+
+struct lava_barrier_tracker_t
+{
+    const VkAllocationCallbacks* allocator;
+    lava_handle_map map;
+    lava_tracked_resource* resources;
+    uint32_t resource_count;
+    uint32_t resource_capacity;
+
+    //--- Current batch
+    VkImageMemoryBarrier2* image_barriers;
+    uint32_t image_barrier_count;
+    uint32_t image_barrier_capacity;
+    VkBufferMemoryBarrier2* buffer_barriers;
+    uint32_t buffer_barrier_count;
+    uint32_t buffer_barrier_capacity;
+    VkMemoryBarrier2 memory_barrier;
+    lava_subresource_state** pending_states; //!< States whose pending index must be cleared on flush.
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    lava_barrier_stats stats;
+};
+
+static VkAccessFlags2 lava_write_access_mask(void)
+{
+    return VK_ACCESS_2_SHADER_WRITE_BIT
+           | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+           | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+           | VK_ACCESS_2_TRANSFER_WRITE_BIT
+           | VK_ACCESS_2_HOST_WRITE_BIT
+           | VK_ACCESS_2_MEMORY_WRITE_BIT
+           | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+           | VK_ACCESS_2_TRANSFORM_FEEDBACK_WRITE_BIT_EXT
+           | VK_ACCESS_2_TRANSFORM_FEEDBACK_COUNTER_WRITE_BIT_EXT
+           | VK_ACCESS_2_COMMAND_PREPROCESS_WRITE_BIT_NV
+           | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+}
+
+static void lava_subresource_initialize(lava_subresource_state* state, const lava_resource_state* initial_state)
+{
+    memset(state, 0, sizeof(lava_subresource_state));
+    state->pending = LAVA_NO_PENDING;
+    if(LAVA_NULL == initial_state) {
+        state->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        state->queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+        return;
+    }
+    state->layout = initial_state->layout;
+    state->queue_family_index = initial_state->queue_family_index;
+    if(0 != (initial_state->access & lava_write_access_mask())) {
+        state->write_stage = initial_state->stage;
+        state->write_access = initial_state->access & lava_write_access_mask();
+    } else {
+        state->read_stage = initial_state->stage;
+    }
+}
+
+/**
+ @brief Compute the dependency between the current state and a new access, then move the state.
+ @return true if a barrier is needed, its scopes being written to the out parameters.
+ */
+static bool lava_subresource_transition(
+    lava_subresource_state* current,
+    const lava_resource_state* state,
+    bool image,
+    VkPipelineStageFlags2* src_stage,
+    VkAccessFlags2* src_access,
+    VkImageLayout* old_layout,
+    uint32_t* src_queue_family_index)
+{
+    VkAccessFlags2 write_access = state->access & lava_write_access_mask();
+    bool layout_change = image && state->layout != current->layout;
+    bool ownership_change = VK_QUEUE_FAMILY_IGNORED != state->queue_family_index && VK_QUEUE_FAMILY_IGNORED != current->queue_family_index && state->queue_family_index != current->queue_family_index;
+    *old_layout = current->layout;
+    *src_queue_family_index = current->queue_family_index;
+    if(0 != write_access || layout_change || ownership_change) {
+        //Write after write or read, or a transition which writes the image itself
+        *src_stage = current->write_stage | current->read_stage;
+        *src_access = current->write_access;
+        bool needed = 0 != *src_stage || layout_change || ownership_change;
+        if(0 != write_access) {
+            current->write_stage = state->stage;
+            current->write_access = write_access;
+            current->read_stage = 0;
+            current->visible_stage = 0;
+            current->visible_access = 0;
+        } else {
+            current->write_stage = state->stage;
+            current->write_access = 0;
+            current->read_stage = state->stage;
+            current->visible_stage = state->stage;
+            current->visible_access = state->access;
+        }
+        if(image) {
+            current->layout = state->layout;
+        }
+        if(VK_QUEUE_FAMILY_IGNORED != state->queue_family_index) {
+            current->queue_family_index = state->queue_family_index;
+        }
+        return needed;
+    }
+    //Read after write, unless an earlier barrier already made the write visible to this access
+    bool needed = 0 != current->write_stage && (0 != (state->stage & ~current->visible_stage) || 0 != (state->access & ~current->visible_access));
+    *src_stage = current->write_stage;
+    *src_access = current->write_access;
+    if(needed) {
+        current->visible_stage |= state->stage;
+        current->visible_access |= state->access;
+    }
+    current->read_stage |= state->stage;
+    if(VK_QUEUE_FAMILY_IGNORED == current->queue_family_index) {
+        current->queue_family_index = state->queue_family_index;
+    }
+    return needed;
+}
+
+/**
+ @brief Add an access of the same command to a subresource which already has a barrier in the batch.
+ */
+static void lava_subresource_accumulate(lava_subresource_state* current, const lava_resource_state* state, bool image)
+{
+    VkAccessFlags2 write_access = state->access & lava_write_access_mask();
+    if(image) {
+        current->layout = state->layout;
+    }
+    if(0 != write_access) {
+        current->write_stage |= state->stage;
+        current->write_access |= write_access;
+        current->visible_stage = 0;
+        current->visible_access = 0;
+    } else {
+        current->read_stage |= state->stage;
+        if(0 == current->write_access) {
+            current->visible_stage |= state->stage;
+            current->visible_access |= state->access;
+        }
+    }
+}
+
+static lava_tracked_resource* lava_find_tracked(const lava_barrier_tracker* tracker, uint64_t key)
+{
+    uint32_t index = lava_handle_map_find(&tracker->map, key);
+    return (LAVA_HANDLE_MAP_EMPTY != index) ? &tracker->resources[index] : LAVA_NULL;
+}
+
+static VkResult lava_track(lava_barrier_tracker* tracker, uint64_t key, VkImage image, VkBuffer buffer, VkImageAspectFlags aspect, uint32_t mip_levels, uint32_t array_layers, const lava_resource_state* initial_state)
+{
+    if(LAVA_NULL != lava_find_tracked(tracker, key)) {
+        return VK_ERROR_UNKNOWN;
+    }
+    if(!lava_reserve(tracker->allocator, (void**)&tracker->resources, &tracker->resource_capacity, tracker->resource_count + 1, sizeof(lava_tracked_resource))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t state_count = mip_levels * array_layers;
+    lava_tracked_resource* resource = &tracker->resources[tracker->resource_count];
+    resource->key = key;
+    resource->image = image;
+    resource->buffer = buffer;
+    resource->aspect = aspect;
+    resource->mip_levels = mip_levels;
+    resource->array_layers = array_layers;
+    resource->states = (lava_subresource_state*)lava_malloc(tracker->allocator, sizeof(lava_subresource_state) * state_count);
+    if(LAVA_NULL == resource->states) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if(!lava_handle_map_insert(tracker->allocator, &tracker->map, key, tracker->resource_count)) {
+        lava_free(tracker->allocator, resource->states);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < state_count; ++i) {
+        lava_subresource_initialize(&resource->states[i], initial_state);
+    }
+    ++tracker->resource_count;
+    return VK_SUCCESS;
+}
+
+static void lava_untrack(lava_barrier_tracker* tracker, uint64_t key)
+{
+    uint32_t index = lava_handle_map_find(&tracker->map, key);
+    if(LAVA_HANDLE_MAP_EMPTY == index) {
+        return;
+    }
+    //Pending barriers of the resource are still recorded, the states they point to are forgotten
+    lava_tracked_resource* resource = &tracker->resources[index];
+    uint32_t state_count = resource->mip_levels * resource->array_layers;
+    for(uint32_t i = 0; i < tracker->pending_count;) {
+        if(resource->states <= tracker->pending_states[i] && tracker->pending_states[i] < resource->states + state_count) {
+            tracker->pending_states[i] = tracker->pending_states[--tracker->pending_count];
+        } else {
+            ++i;
+        }
+    }
+    lava_free(tracker->allocator, resource->states);
+    lava_handle_map_erase(&tracker->map, key);
+    --tracker->resource_count;
+    if(index != tracker->resource_count) {
+        tracker->resources[index] = tracker->resources[tracker->resource_count];
+        lava_handle_map_assign(&tracker->map, tracker->resources[index].key, index);
+    }
+}
+
+static bool lava_add_pending(lava_barrier_tracker* tracker, lava_subresource_state* state, uint32_t pending)
+{
+    if(!lava_reserve(tracker->allocator, (void**)&tracker->pending_states, &tracker->pending_capacity, tracker->pending_count + 1, sizeof(lava_subresource_state*))) {
+        return false;
+    }
+    state->pending = pending;
+    tracker->pending_states[tracker->pending_count++] = state;
+    return true;
+}
+
+VkResult LAVA_API lava_create_barrier_tracker(const lava_barrier_tracker_create_info* create_info, lava_barrier_tracker** tracker)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != tracker);
+    lava_barrier_tracker* new_tracker = (lava_barrier_tracker*)lava_calloc(create_info->allocator, sizeof(lava_barrier_tracker));
+    if(LAVA_NULL == new_tracker) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_tracker->allocator = create_info->allocator;
+    new_tracker->memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    *tracker = new_tracker;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_barrier_tracker(lava_barrier_tracker* tracker)
+{
+    if(LAVA_NULL == tracker) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = tracker->allocator;
+    for(uint32_t i = 0; i < tracker->resource_count; ++i) {
+        lava_free(allocator, tracker->resources[i].states);
+    }
+    lava_handle_map_terminate(allocator, &tracker->map);
+    lava_free(allocator, tracker->resources);
+    lava_free(allocator, tracker->image_barriers);
+    lava_free(allocator, tracker->buffer_barriers);
+    lava_free(allocator, tracker->pending_states);
+    lava_free(allocator, tracker);
+}
+
+VkResult LAVA_API lava_track_image(lava_barrier_tracker* tracker, VkImage image, VkImageAspectFlags aspect, uint32_t mip_levels, uint32_t array_layers, const lava_resource_state* initial_state)
+{
+    assert(LAVA_NULL != tracker);
+    assert(0 < mip_levels && 0 < array_layers);
+    return lava_track(tracker, LAVA_HANDLE_KEY(image), image, VK_NULL_HANDLE, aspect, mip_levels, array_layers, initial_state);
+}
+
+VkResult LAVA_API lava_track_buffer(lava_barrier_tracker* tracker, VkBuffer buffer, const lava_resource_state* initial_state)
+{
+    assert(LAVA_NULL != tracker);
+    return lava_track(tracker, LAVA_HANDLE_KEY(buffer), VK_NULL_HANDLE, buffer, 0, 1, 1, initial_state);
+}
+
+void LAVA_API lava_untrack_image(lava_barrier_tracker* tracker, VkImage image)
+{
+    assert(LAVA_NULL != tracker);
+    lava_untrack(tracker, LAVA_HANDLE_KEY(image));
+}
+
+void LAVA_API lava_untrack_buffer(lava_barrier_tracker* tracker, VkBuffer buffer)
+{
+    assert(LAVA_NULL != tracker);
+    lava_untrack(tracker, LAVA_HANDLE_KEY(buffer));
+}
+
+void LAVA_API lava_require_image(lava_barrier_tracker* tracker, VkImage image, const VkImageSubresourceRange* range, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != tracker);
+    assert(LAVA_NULL != range);
+    assert(LAVA_NULL != state);
+    ++tracker->stats.requests;
+    lava_tracked_resource* resource = lava_find_tracked(tracker, LAVA_HANDLE_KEY(image));
+    if(LAVA_NULL == resource) {
+        return;
+    }
+    uint32_t mip_end = (VK_REMAINING_MIP_LEVELS == range->levelCount) ? resource->mip_levels : range->baseMipLevel + range->levelCount;
+    uint32_t layer_end = (VK_REMAINING_ARRAY_LAYERS == range->layerCount) ? resource->array_layers : range->baseArrayLayer + range->layerCount;
+    mip_end = (resource->mip_levels < mip_end) ? resource->mip_levels : mip_end;
+    layer_end = (resource->array_layers < layer_end) ? resource->array_layers : layer_end;
+    for(uint32_t mip = range->baseMipLevel; mip < mip_end; ++mip) {
+        for(uint32_t layer = range->baseArrayLayer; layer < layer_end; ++layer) {
+            lava_subresource_state* current = &resource->states[mip * resource->array_layers + layer];
+            if(LAVA_NO_PENDING != current->pending) {
+                //No command ran since the pending barrier, both accesses belong to the next one
+                VkImageMemoryBarrier2* barrier = &tracker->image_barriers[current->pending];
+                lava_subresource_accumulate(current, state, true);
+                barrier->dstStageMask |= state->stage;
+                barrier->dstAccessMask |= state->access;
+                barrier->newLayout = current->layout;
+                continue;
+            }
+            VkPipelineStageFlags2 src_stage;
+            VkAccessFlags2 src_access;
+            VkImageLayout old_layout;
+            uint32_t src_queue_family_index;
+            if(!lava_subresource_transition(current, state, true, &src_stage, &src_access, &old_layout, &src_queue_family_index)) {
+                continue;
+            }
+            ++tracker->stats.transitions;
+            if(!lava_reserve(tracker->allocator, (void**)&tracker->image_barriers, &tracker->image_barrier_capacity, tracker->image_barrier_count + 1, sizeof(VkImageMemoryBarrier2))) {
+                return;
+            }
+            VkImageMemoryBarrier2* barrier = &tracker->image_barriers[tracker->image_barrier_count];
+            barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            barrier->pNext = LAVA_NULL;
+            barrier->srcStageMask = src_stage;
+            barrier->srcAccessMask = src_access;
+            barrier->dstStageMask = state->stage;
+            barrier->dstAccessMask = state->access;
+            barrier->oldLayout = old_layout;
+            barrier->newLayout = current->layout;
+            barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            if(src_queue_family_index != current->queue_family_index && VK_QUEUE_FAMILY_IGNORED != src_queue_family_index) {
+                barrier->srcQueueFamilyIndex = src_queue_family_index;
+                barrier->dstQueueFamilyIndex = current->queue_family_index;
+            }
+            barrier->image = image;
+            barrier->subresourceRange.aspectMask = resource->aspect;
+            barrier->subresourceRange.baseMipLevel = mip;
+            barrier->subresourceRange.levelCount = 1;
+            barrier->subresourceRange.baseArrayLayer = layer;
+            barrier->subresourceRange.layerCount = 1;
+            if(lava_add_pending(tracker, current, tracker->image_barrier_count)) {
+                ++tracker->image_barrier_count;
+            }
+        }
+    }
+}
+
+void LAVA_API lava_require_buffer(lava_barrier_tracker* tracker, VkBuffer buffer, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != tracker);
+    assert(LAVA_NULL != state);
+    ++tracker->stats.requests;
+    lava_tracked_resource* resource = lava_find_tracked(tracker, LAVA_HANDLE_KEY(buffer));
+    if(LAVA_NULL == resource) {
+        return;
+    }
+    lava_subresource_state* current = &resource->states[0];
+    if(LAVA_NO_PENDING != current->pending) {
+        //Also true of a queue family transfer, whose acquire takes the access instead of emitting another pair
+        lava_subresource_accumulate(current, state, false);
+        if(LAVA_PENDING_GLOBAL == current->pending) {
+            tracker->memory_barrier.dstStageMask |= state->stage;
+            tracker->memory_barrier.dstAccessMask |= state->access;
+        } else {
+            VkBufferMemoryBarrier2* barrier = &tracker->buffer_barriers[current->pending];
+            barrier->dstStageMask |= state->stage;
+            barrier->dstAccessMask |= state->access;
+        }
+        return;
+    }
+    VkPipelineStageFlags2 src_stage;
+    VkAccessFlags2 src_access;
+    VkImageLayout old_layout;
+    uint32_t src_queue_family_index;
+    if(!lava_subresource_transition(current, state, false, &src_stage, &src_access, &old_layout, &src_queue_family_index)) {
+        return;
+    }
+    ++tracker->stats.transitions;
+    if(VK_QUEUE_FAMILY_IGNORED == src_queue_family_index || src_queue_family_index == current->queue_family_index) {
+        //Every buffer hazard of the batch goes into the global barrier
+        tracker->memory_barrier.srcStageMask |= src_stage;
+        tracker->memory_barrier.srcAccessMask |= src_access;
+        tracker->memory_barrier.dstStageMask |= state->stage;
+        tracker->memory_barrier.dstAccessMask |= state->access;
+        lava_add_pending(tracker, current, LAVA_PENDING_GLOBAL);
+        return;
+    }
+    if(!lava_reserve(tracker->allocator, (void**)&tracker->buffer_barriers, &tracker->buffer_barrier_capacity, tracker->buffer_barrier_count + 1, sizeof(VkBufferMemoryBarrier2))) {
+        return;
+    }
+    VkBufferMemoryBarrier2* barrier = &tracker->buffer_barriers[tracker->buffer_barrier_count];
+    barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier->pNext = LAVA_NULL;
+    barrier->srcStageMask = src_stage;
+    barrier->srcAccessMask = src_access;
+    barrier->dstStageMask = state->stage;
+    barrier->dstAccessMask = state->access;
+    barrier->srcQueueFamilyIndex = src_queue_family_index;
+    barrier->dstQueueFamilyIndex = current->queue_family_index;
+    barrier->buffer = buffer;
+    barrier->offset = 0;
+    barrier->size = VK_WHOLE_SIZE;
+    if(lava_add_pending(tracker, current, tracker->buffer_barrier_count)) {
+        ++tracker->buffer_barrier_count;
+    }
+}
+
+static bool lava_image_barrier_mergeable(const VkImageMemoryBarrier2* b0, const VkImageMemoryBarrier2* b1)
+{
+    return b0->image == b1->image
+           && b0->srcStageMask == b1->srcStageMask
+           && b0->srcAccessMask == b1->srcAccessMask
+           && b0->dstStageMask == b1->dstStageMask
+           && b0->dstAccessMask == b1->dstAccessMask
+           && b0->oldLayout == b1->oldLayout
+           && b0->newLayout == b1->newLayout
+           && b0->srcQueueFamilyIndex == b1->srcQueueFamilyIndex
+           && b0->dstQueueFamilyIndex == b1->dstQueueFamilyIndex;
+}
+
+void LAVA_API lava_cmd_flush_barriers(lava_barrier_tracker* tracker, VkCommandBuffer command_buffer)
+{
+    assert(LAVA_NULL != tracker);
+    for(uint32_t i = 0; i < tracker->pending_count; ++i) {
+        tracker->pending_states[i]->pending = LAVA_NO_PENDING;
+    }
+    tracker->pending_count = 0;
+    bool memory = 0 != tracker->memory_barrier.srcStageMask || 0 != tracker->memory_barrier.dstStageMask;
+    if(!memory && tracker->image_barrier_count <= 0 && tracker->buffer_barrier_count <= 0) {
+        return;
+    }
+
+    //Subresources were added layer by layer, fold neighbours into ranges
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < tracker->image_barrier_count; ++i) {
+        VkImageMemoryBarrier2* barrier = &tracker->image_barriers[i];
+        if(0 < count) {
+            VkImageMemoryBarrier2* last = &tracker->image_barriers[count - 1];
+            VkImageSubresourceRange* r0 = &last->subresourceRange;
+            const VkImageSubresourceRange* r1 = &barrier->subresourceRange;
+            if(lava_image_barrier_mergeable(last, barrier)) {
+                if(1 == r0->levelCount && r0->baseMipLevel == r1->baseMipLevel && r0->baseArrayLayer + r0->layerCount == r1->baseArrayLayer) {
+                    r0->layerCount += r1->layerCount;
+                    continue;
+                }
+                if(r0->baseArrayLayer == r1->baseArrayLayer && r0->layerCount == r1->layerCount && r0->baseMipLevel + r0->levelCount == r1->baseMipLevel) {
+                    r0->levelCount += r1->levelCount;
+                    continue;
+                }
+            }
+        }
+        tracker->image_barriers[count++] = *barrier;
+    }
+    //Merging layers of the next mip happens on a second pass, once they are ranges
+    uint32_t merged = (0 < count) ? 1 : 0;
+    for(uint32_t i = 1; i < count; ++i) {
+        VkImageMemoryBarrier2* last = &tracker->image_barriers[merged - 1];
+        const VkImageMemoryBarrier2* barrier = &tracker->image_barriers[i];
+        if(lava_image_barrier_mergeable(last, barrier)
+           && last->subresourceRange.baseArrayLayer == barrier->subresourceRange.baseArrayLayer
+           && last->subresourceRange.layerCount == barrier->subresourceRange.layerCount
+           && last->subresourceRange.baseMipLevel + last->subresourceRange.levelCount == barrier->subresourceRange.baseMipLevel) {
+            last->subresourceRange.levelCount += barrier->subresourceRange.levelCount;
+            continue;
+        }
+        tracker->image_barriers[merged++] = *barrier;
+    }
+
+    VkDependencyInfo dependency_info;
+    memset(&dependency_info, 0, sizeof(dependency_info));
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.memoryBarrierCount = memory ? 1 : 0;
+    dependency_info.pMemoryBarriers = &tracker->memory_barrier;
+    dependency_info.bufferMemoryBarrierCount = tracker->buffer_barrier_count;
+    dependency_info.pBufferMemoryBarriers = tracker->buffer_barriers;
+    dependency_info.imageMemoryBarrierCount = merged;
+    dependency_info.pImageMemoryBarriers = tracker->image_barriers;
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    tracker->stats.barriers += dependency_info.memoryBarrierCount + dependency_info.bufferMemoryBarrierCount + dependency_info.imageMemoryBarrierCount;
+    tracker->stats.dependencies += 1;
+
+    tracker->image_barrier_count = 0;
+    tracker->buffer_barrier_count = 0;
+    tracker->memory_barrier.srcStageMask = 0;
+    tracker->memory_barrier.srcAccessMask = 0;
+    tracker->memory_barrier.dstStageMask = 0;
+    tracker->memory_barrier.dstAccessMask = 0;
+}
+
+bool LAVA_API lava_get_image_state(const lava_barrier_tracker* tracker, VkImage image, uint32_t mip_level, uint32_t array_layer, lava_resource_state* state)
+{
+    assert(LAVA_NULL != tracker);
+    assert(LAVA_NULL != state);
+    const lava_tracked_resource* resource = lava_find_tracked(tracker, LAVA_HANDLE_KEY(image));
+    if(LAVA_NULL == resource || resource->mip_levels <= mip_level || resource->array_layers <= array_layer) {
+        return false;
+    }
+    const lava_subresource_state* current = &resource->states[mip_level * resource->array_layers + array_layer];
+    state->stage = current->write_stage | current->read_stage;
+    state->access = current->write_access | current->visible_access;
+    state->layout = current->layout;
+    state->queue_family_index = current->queue_family_index;
+    return true;
+}
+
+void LAVA_API lava_get_barrier_stats(const lava_barrier_tracker* tracker, lava_barrier_stats* stats)
+{
+    assert(LAVA_NULL != tracker);
+    assert(LAVA_NULL != stats);
+    *stats = tracker->stats;
+}
+
+//--- Render graph
+//--------------------------------------------------------------------
+#define LAVA_GRAPH_NONE (0xFFFFFFFFU)
+#define LAVA_GRAPH_QUEUE_COUNT (2)
+
+typedef struct lava_graph_resource_desc_t
+{
+    bool is_image;
+    bool imported;
+    bool exported;
+    VkImageCreateInfo image_info;
+    VkBufferCreateInfo buffer_info;
+    VkImage image;
+    VkBuffer buffer;
+    VkImageAspectFlags aspect;
+    lava_resource_state initial_state;
+    lava_resource_state final_state;
+
+    //--- Compile
+    bool needed;
+    uint32_t last_writer;
+    uint32_t readers; //!< Accesses reading since the last write, linked by next_reader.
+    VkImageLayout dependency_layout;
+    uint32_t first_use;
+    uint32_t last_use;
+    uint32_t queue_mask;
+    uint32_t transient_index;
+    lava_resource_state first_state;
+    lava_resource_state used_state; //!< Union of the stages and accesses of every use.
+    lava_subresource_state state;
+    uint32_t last_queue;
+    uint32_t last_position[LAVA_GRAPH_QUEUE_COUNT];
+    uint32_t pending_group;
+    uint32_t pending_barrier;
+} lava_graph_resource_desc;
+
+typedef struct lava_graph_access_t
+{
+    uint32_t pass;
+    lava_graph_resource resource;
+    lava_resource_state state;
+    bool write;
+    uint32_t next_reader;
+} lava_graph_access;
+
+typedef struct lava_graph_pass_t
+{
+    lava_graph_pass_info info;
+    uint32_t queue;
+    bool alive;
+    uint32_t level;
+    uint32_t first_access; //!< Range in access_order.
+    uint32_t access_count;
+    uint32_t batch;
+} lava_graph_pass;
+
+typedef struct lava_graph_batch_t
+{
+    uint32_t queue;
+    uint32_t ordinal; //!< Timeline value signaled, relative to the frame.
+    uint32_t wait_ordinal; //!< Value of the other queue waited, 0 for none.
+    uint32_t first_position; //!< Range in batch_positions.
+    uint32_t position_count;
+} lava_graph_batch;
+
+typedef struct lava_graph_group_t
+{
+    uint32_t first_barrier;
+    uint32_t barrier_count;
+    VkMemoryBarrier2 memory_barrier;
+} lava_graph_group;
+
+struct lava_render_graph_t
+{
+    lava_memory_allocator* memory_allocator;
+    const VkAllocationCallbacks* allocator;
+    uint32_t queue_family_indices[LAVA_GRAPH_QUEUE_COUNT];
+    bool async_compute;
+    VkSemaphore timelines[LAVA_GRAPH_QUEUE_COUNT];
+    uint64_t timeline_values[LAVA_GRAPH_QUEUE_COUNT];
+
+    //--- Declaration
+    lava_graph_resource_desc* resources;
+    uint32_t resource_count;
+    uint32_t resource_capacity;
+    lava_graph_pass* passes;
+    uint32_t pass_count;
+    uint32_t pass_capacity;
+    lava_graph_access* accesses;
+    uint32_t access_count;
+    uint32_t access_capacity;
+
+    //--- Compiled
+    uint32_t* access_order;
+    uint32_t access_order_capacity;
+    uint32_t* schedule; //!< Alive passes in execution order.
+    uint32_t schedule_count;
+    uint32_t schedule_capacity;
+    uint32_t* position_groups; //!< Barrier group recorded before each position, schedule_count + 1 entries, the last one after every pass.
+    uint32_t position_group_capacity;
+    uint32_t* batch_positions;
+    uint32_t batch_position_capacity;
+    lava_graph_batch* batches;
+    uint32_t batch_count;
+    uint32_t batch_capacity;
+    lava_graph_group* groups;
+    uint32_t group_count;
+    uint32_t group_capacity;
+    VkImageMemoryBarrier2* barriers; //!< Image handles are patched when recording.
+    uint32_t* barrier_resources;
+    uint32_t* barrier_groups;
+    uint32_t barrier_count;
+    uint32_t barrier_capacity;
+    uint32_t barrier_resource_capacity;
+    uint32_t barrier_group_capacity;
+    VkImageMemoryBarrier2* scratch_barriers;
+    uint32_t scratch_barrier_capacity;
+    uint32_t* transient_indices; //!< Transient resource of each graph resource.
+    uint32_t transient_index_capacity;
+    lava_transient_pool* transient_pool;
+    bool compiled;
+    lava_graph_stats stats;
+};
+
+static uint32_t lava_graph_push_resource(lava_render_graph* graph)
+{
+    if(!lava_reserve(graph->allocator, (void**)&graph->resources, &graph->resource_capacity, graph->resource_count + 1, sizeof(lava_graph_resource_desc))) {
+        return LAVA_GRAPH_NULL_RESOURCE;
+    }
+    lava_graph_resource_desc* desc = &graph->resources[graph->resource_count];
+    memset(desc, 0, sizeof(lava_graph_resource_desc));
+    desc->initial_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    desc->initial_state.queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+    return graph->resource_count++;
+}
+
+static void lava_graph_add_access(lava_render_graph* graph, uint32_t pass_index, lava_graph_resource resource, const lava_resource_state* state, bool write)
+{
+    assert(pass_index < graph->pass_count);
+    assert(LAVA_NULL != state);
+    if(graph->resource_count <= resource) {
+        return;
+    }
+    if(!lava_reserve(graph->allocator, (void**)&graph->accesses, &graph->access_capacity, graph->access_count + 1, sizeof(lava_graph_access))) {
+        return;
+    }
+    lava_graph_access* access = &graph->accesses[graph->access_count++];
+    access->pass = pass_index;
+    access->resource = resource;
+    access->state = *state;
+    access->state.queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+    access->write = write;
+    access->next_reader = LAVA_GRAPH_NONE;
+}
+
+VkResult LAVA_API lava_create_render_graph(const lava_render_graph_create_info* create_info, lava_render_graph** graph)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->memory_allocator);
+    assert(LAVA_NULL != graph);
+    lava_memory_allocator* memory_allocator = create_info->memory_allocator;
+    lava_render_graph* new_graph = (lava_render_graph*)lava_calloc(memory_allocator->allocator, sizeof(lava_render_graph));
+    if(LAVA_NULL == new_graph) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_graph->memory_allocator = memory_allocator;
+    new_graph->allocator = memory_allocator->allocator;
+    new_graph->queue_family_indices[LAVA_GRAPH_QUEUE_GRAPHICS] = create_info->graphics_queue_family_index;
+    new_graph->queue_family_indices[LAVA_GRAPH_QUEUE_ASYNC_COMPUTE] = create_info->compute_queue_family_index;
+    new_graph->async_compute = VK_QUEUE_FAMILY_IGNORED != create_info->compute_queue_family_index && create_info->graphics_queue_family_index != create_info->compute_queue_family_index;
+
+    //Submissions of a frame order each other with one timeline per queue
+    VkSemaphoreTypeCreateInfo type_info = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO, LAVA_NULL, VK_SEMAPHORE_TYPE_TIMELINE, 0};
+    VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &type_info, 0};
+    uint32_t queue_count = new_graph->async_compute ? 2 : 1;
+    for(uint32_t i = 0; i < queue_count; ++i) {
+        VkResult result = vkCreateSemaphore(memory_allocator->device->device_, &semaphore_info, new_graph->allocator, &new_graph->timelines[i]);
+        if(VK_SUCCESS != result) {
+            lava_destroy_render_graph(new_graph);
+            return result;
+        }
+    }
+    *graph = new_graph;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_render_graph(lava_render_graph* graph)
+{
+    if(LAVA_NULL == graph) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = graph->allocator;
+    lava_destroy_transient_pool(graph->transient_pool);
+    for(uint32_t i = 0; i < LAVA_GRAPH_QUEUE_COUNT; ++i) {
+        if(VK_NULL_HANDLE != graph->timelines[i]) {
+            vkDestroySemaphore(graph->memory_allocator->device->device_, graph->timelines[i], allocator);
+        }
+    }
+    lava_free(allocator, graph->resources);
+    lava_free(allocator, graph->passes);
+    lava_free(allocator, graph->accesses);
+    lava_free(allocator, graph->access_order);
+    lava_free(allocator, graph->schedule);
+    lava_free(allocator, graph->position_groups);
+    lava_free(allocator, graph->batch_positions);
+    lava_free(allocator, graph->batches);
+    lava_free(allocator, graph->groups);
+    lava_free(allocator, graph->barriers);
+    lava_free(allocator, graph->barrier_resources);
+    lava_free(allocator, graph->barrier_groups);
+    lava_free(allocator, graph->scratch_barriers);
+    lava_free(allocator, graph->transient_indices);
+    lava_free(allocator, graph);
+}
+
+void LAVA_API lava_graph_reset(lava_render_graph* graph)
+{
+    assert(LAVA_NULL != graph);
+    graph->resource_count = 0;
+    graph->pass_count = 0;
+    graph->access_count = 0;
+}
+
+lava_graph_resource LAVA_API lava_graph_create_image(lava_render_graph* graph, const VkImageCreateInfo* image_info)
+{
+    assert(LAVA_NULL != graph);
+    assert(LAVA_NULL != image_info);
+    lava_graph_resource resource = lava_graph_push_resource(graph);
+    if(LAVA_GRAPH_NULL_RESOURCE != resource) {
+        lava_graph_resource_desc* desc = &graph->resources[resource];
+        desc->is_image = true;
+        desc->image_info = *image_info;
+        desc->image_info.pNext = LAVA_NULL;
+        desc->image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        desc->image_info.queueFamilyIndexCount = 0;
+        desc->image_info.pQueueFamilyIndices = LAVA_NULL;
+        desc->aspect = lava_format_aspect(image_info->format);
+    }
+    return resource;
+}
+
+lava_graph_resource LAVA_API lava_graph_create_buffer(lava_render_graph* graph, const VkBufferCreateInfo* buffer_info)
+{
+    assert(LAVA_NULL != graph);
+    assert(LAVA_NULL != buffer_info);
+    lava_graph_resource resource = lava_graph_push_resource(graph);
+    if(LAVA_GRAPH_NULL_RESOURCE != resource) {
+        lava_graph_resource_desc* desc = &graph->resources[resource];
+        desc->buffer_info = *buffer_info;
+        desc->buffer_info.pNext = LAVA_NULL;
+        desc->buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        desc->buffer_info.queueFamilyIndexCount = 0;
+        desc->buffer_info.pQueueFamilyIndices = LAVA_NULL;
+    }
+    return resource;
+}
+
+lava_graph_resource LAVA_API lava_graph_import_image(lava_render_graph* graph, VkImage image, VkImageAspectFlags aspect, uint32_t mip_levels, uint32_t array_layers, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != graph);
+    lava_graph_resource resource = lava_graph_push_resource(graph);
+    if(LAVA_GRAPH_NULL_RESOURCE != resource) {
+        lava_graph_resource_desc* desc = &graph->resources[resource];
+        desc->is_image = true;
+        desc->imported = true;
+        desc->image = image;
+        desc->aspect = aspect;
+        desc->image_info.mipLevels = mip_levels;
+        desc->image_info.arrayLayers = array_layers;
+        if(LAVA_NULL != state) {
+            desc->initial_state = *state;
+        }
+    }
+    return resource;
+}
+
+lava_graph_resource LAVA_API lava_graph_import_buffer(lava_render_graph* graph, VkBuffer buffer, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != graph);
+    lava_graph_resource resource = lava_graph_push_resource(graph);
+    if(LAVA_GRAPH_NULL_RESOURCE != resource) {
+        lava_graph_resource_desc* desc = &graph->resources[resource];
+        desc->imported = true;
+        desc->buffer = buffer;
+        if(LAVA_NULL != state) {
+            desc->initial_state = *state;
+        }
+    }
+    return resource;
+}
+
+void LAVA_API lava_graph_export(lava_render_graph* graph, lava_graph_resource resource, const lava_resource_state* final_state)
+{
+    assert(LAVA_NULL != graph);
+    assert(resource < graph->resource_count);
+    lava_graph_resource_desc* desc = &graph->resources[resource];
+    desc->exported = true;
+    memset(&desc->final_state, 0, sizeof(lava_resource_state));
+    desc->final_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if(LAVA_NULL != final_state) {
+        desc->final_state = *final_state;
+    }
+    desc->final_state.queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+}
+
+uint32_t LAVA_API lava_graph_add_pass(lava_render_graph* graph, const lava_graph_pass_info* pass_info)
+{
+    assert(LAVA_NULL != graph);
+    assert(LAVA_NULL != pass_info);
+    if(!lava_reserve(graph->allocator, (void**)&graph->passes, &graph->pass_capacity, graph->pass_count + 1, sizeof(lava_graph_pass))) {
+        return LAVA_GRAPH_NONE;
+    }
+    lava_graph_pass* pass = &graph->passes[graph->pass_count];
+    memset(pass, 0, sizeof(lava_graph_pass));
+    pass->info = *pass_info;
+    pass->queue = (graph->async_compute && LAVA_GRAPH_QUEUE_ASYNC_COMPUTE == pass_info->queue) ? LAVA_GRAPH_QUEUE_ASYNC_COMPUTE : LAVA_GRAPH_QUEUE_GRAPHICS;
+    return graph->pass_count++;
+}
+
+void LAVA_API lava_graph_read(lava_render_graph* graph, uint32_t pass_index, lava_graph_resource resource, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != graph);
+    lava_graph_add_access(graph, pass_index, resource, state, false);
+}
+
+void LAVA_API lava_graph_write(lava_render_graph* graph, uint32_t pass_index, lava_graph_resource resource, const lava_resource_state* state)
+{
+    assert(LAVA_NULL != graph);
+    lava_graph_add_access(graph, pass_index, resource, state, true);
+}
+
+/**
+ @brief Order accesses by pass with a counting sort, keeping declaration order inside a pass.
+ */
+static bool lava_graph_sort_accesses(lava_render_graph* graph)
+{
+    if(!lava_reserve(graph->allocator, (void**)&graph->access_order, &graph->access_order_capacity, graph->access_count + 1, sizeof(uint32_t))) {
+        return false;
+    }
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        graph->passes[i].access_count = 0;
+    }
+    for(uint32_t i = 0; i < graph->access_count; ++i) {
+        ++graph->passes[graph->accesses[i].pass].access_count;
+    }
+    uint32_t offset = 0;
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        graph->passes[i].first_access = offset;
+        offset += graph->passes[i].access_count;
+        graph->passes[i].access_count = 0;
+    }
+    for(uint32_t i = 0; i < graph->access_count; ++i) {
+        lava_graph_pass* pass = &graph->passes[graph->accesses[i].pass];
+        graph->access_order[pass->first_access + pass->access_count++] = i;
+    }
+    return true;
+}
+
+/**
+ @brief Keep the passes which write an exported resource or something read by a kept pass.
+ */
+static void lava_graph_cull(lava_render_graph* graph)
+{
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        graph->resources[i].needed = graph->resources[i].exported;
+    }
+    for(uint32_t i = graph->pass_count; 0 < i; --i) {
+        lava_graph_pass* pass = &graph->passes[i - 1];
+        pass->alive = 0 != (pass->info.flags & LAVA_GRAPH_PASS_SIDE_EFFECT_BIT);
+        for(uint32_t j = 0; j < pass->access_count && !pass->alive; ++j) {
+            const lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            pass->alive = access->write && graph->resources[access->resource].needed;
+        }
+        if(!pass->alive) {
+            continue;
+        }
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            const lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            if(!access->write) {
+                graph->resources[access->resource].needed = true;
+            }
+        }
+    }
+}
+
+/**
+ @brief Level of a pass is one more than the deepest pass it depends on, so passes of a level are independent.
+ */
+static void lava_graph_levels(lava_render_graph* graph)
+{
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        desc->last_writer = LAVA_GRAPH_NONE;
+        desc->readers = LAVA_GRAPH_NONE;
+        desc->dependency_layout = desc->initial_state.layout;
+    }
+    graph->stats.level_count = 0;
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        lava_graph_pass* pass = &graph->passes[i];
+        if(!pass->alive) {
+            continue;
+        }
+        uint32_t level = 0;
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            lava_graph_resource_desc* desc = &graph->resources[access->resource];
+            //A read in another layout transitions the image, it orders like a write
+            bool exclusive = access->write || (desc->is_image && access->state.layout != desc->dependency_layout);
+            if(LAVA_GRAPH_NONE != desc->last_writer && desc->last_writer != i && level <= graph->passes[desc->last_writer].level) {
+                level = graph->passes[desc->last_writer].level + 1;
+            }
+            if(exclusive) {
+                for(uint32_t reader = desc->readers; LAVA_GRAPH_NONE != reader; reader = graph->accesses[reader].next_reader) {
+                    uint32_t reader_pass = graph->accesses[reader].pass;
+                    if(reader_pass != i && level <= graph->passes[reader_pass].level) {
+                        level = graph->passes[reader_pass].level + 1;
+                    }
+                }
+            }
+        }
+        pass->level = level;
+        graph->stats.level_count = (graph->stats.level_count <= level) ? level + 1 : graph->stats.level_count;
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            uint32_t access_index = graph->access_order[pass->first_access + j];
+            lava_graph_access* access = &graph->accesses[access_index];
+            lava_graph_resource_desc* desc = &graph->resources[access->resource];
+            bool exclusive = access->write || (desc->is_image && access->state.layout != desc->dependency_layout);
+            if(exclusive) {
+                desc->last_writer = i;
+                desc->readers = LAVA_GRAPH_NONE;
+            } else {
+                access->next_reader = desc->readers;
+                desc->readers = access_index;
+            }
+            desc->dependency_layout = access->state.layout;
+        }
+    }
+}
+
+/**
+ @brief Sort alive passes by level with a stable counting sort.
+ */
+static bool lava_graph_schedule(lava_render_graph* graph)
+{
+    uint32_t level_count = graph->stats.level_count;
+    if(!lava_reserve(graph->allocator, (void**)&graph->schedule, &graph->schedule_capacity, graph->pass_count + level_count + 1, sizeof(uint32_t))) {
+        return false;
+    }
+    //The tail of the array counts passes per level
+    uint32_t* offsets = graph->schedule + graph->pass_count;
+    memset(offsets, 0, sizeof(uint32_t) * (level_count + 1));
+    uint32_t alive_count = 0;
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        if(graph->passes[i].alive) {
+            ++offsets[graph->passes[i].level + 1];
+            ++alive_count;
+        }
+    }
+    for(uint32_t i = 1; i <= level_count; ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    //Level offsets are consumed as passes are placed, the schedule never reaches past alive_count
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        if(graph->passes[i].alive) {
+            graph->schedule[offsets[graph->passes[i].level]++] = i;
+        }
+    }
+    graph->schedule_count = alive_count;
+    graph->stats.culled_pass_count = graph->pass_count - alive_count;
+    return true;
+}
+
+static VkResult lava_graph_allocate_transients(lava_render_graph* graph)
+{
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        desc->first_use = LAVA_GRAPH_NONE;
+        desc->last_use = 0;
+        desc->queue_mask = 0;
+        desc->transient_index = LAVA_GRAPH_NONE;
+    }
+    for(uint32_t position = 0; position < graph->schedule_count; ++position) {
+        const lava_graph_pass* pass = &graph->passes[graph->schedule[position]];
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            const lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            lava_graph_resource_desc* desc = &graph->resources[access->resource];
+            if(LAVA_GRAPH_NONE == desc->first_use) {
+                desc->first_use = position;
+                desc->first_state = access->state;
+                desc->used_state.stage = 0;
+                desc->used_state.access = 0;
+            }
+            desc->used_state.stage |= access->state.stage;
+            desc->used_state.access |= access->state.access;
+            desc->last_use = position;
+            desc->queue_mask |= 1U << pass->queue;
+        }
+    }
+
+    lava_destroy_transient_pool(graph->transient_pool);
+    graph->transient_pool = LAVA_NULL;
+    if(!lava_reserve(graph->allocator, (void**)&graph->transient_indices, &graph->transient_index_capacity, graph->resource_count + 1, sizeof(uint32_t))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t transient_count = 0;
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        if(!desc->imported) {
+            desc->image = VK_NULL_HANDLE;
+            desc->buffer = VK_NULL_HANDLE;
+            if(LAVA_GRAPH_NONE != desc->first_use) {
+                desc->transient_index = transient_count++;
+            }
+        }
+        graph->transient_indices[i] = desc->transient_index;
+    }
+    if(transient_count <= 0) {
+        memset(&graph->stats.transient, 0, sizeof(lava_transient_pool_stats));
+        return VK_SUCCESS;
+    }
+    lava_transient_resource_info* infos = (lava_transient_resource_info*)lava_malloc(graph->allocator, sizeof(lava_transient_resource_info) * transient_count);
+    if(LAVA_NULL == infos) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        if(LAVA_GRAPH_NONE == desc->transient_index) {
+            continue;
+        }
+        //Resources of both queues are shared concurrently, and their overlap in time is unknown so they are not aliased
+        bool shared = 0 != (desc->queue_mask & (1U << LAVA_GRAPH_QUEUE_ASYNC_COMPUTE));
+        if(shared) {
+            desc->first_use = 0;
+            desc->last_use = graph->schedule_count;
+        }
+        if(0 != (desc->queue_mask & (1U << LAVA_GRAPH_QUEUE_GRAPHICS)) && shared) {
+            desc->image_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            desc->image_info.queueFamilyIndexCount = LAVA_GRAPH_QUEUE_COUNT;
+            desc->image_info.pQueueFamilyIndices = graph->queue_family_indices;
+            desc->buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            desc->buffer_info.queueFamilyIndexCount = LAVA_GRAPH_QUEUE_COUNT;
+            desc->buffer_info.pQueueFamilyIndices = graph->queue_family_indices;
+        }
+        lava_transient_resource_info* info = &infos[desc->transient_index];
+        info->image_info = desc->is_image ? &desc->image_info : LAVA_NULL;
+        info->buffer_info = desc->is_image ? LAVA_NULL : &desc->buffer_info;
+        info->first_use = desc->first_use;
+        info->last_use = desc->last_use;
+        info->first_stage = desc->first_state.stage;
+        info->first_access = desc->first_state.access;
+        info->first_layout = desc->first_state.layout;
+        info->last_stage = desc->used_state.stage;
+        info->last_access = desc->used_state.access;
+    }
+    lava_transient_pool_create_info pool_info = {graph->memory_allocator, transient_count, infos};
+    VkResult result = lava_create_transient_pool(&pool_info, &graph->transient_pool);
+    lava_free(graph->allocator, infos);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        if(LAVA_GRAPH_NONE != desc->transient_index) {
+            desc->image = lava_get_transient_image(graph->transient_pool, desc->transient_index);
+            desc->buffer = lava_get_transient_buffer(graph->transient_pool, desc->transient_index);
+        }
+    }
+    lava_get_transient_pool_stats(graph->transient_pool, &graph->stats.transient);
+    return VK_SUCCESS;
+}
+
+static uint32_t lava_graph_open_batch(lava_render_graph* graph, uint32_t queue, uint32_t* ordinals, uint32_t wait_ordinal)
+{
+    if(!lava_reserve(graph->allocator, (void**)&graph->batches, &graph->batch_capacity, graph->batch_count + 1, sizeof(lava_graph_batch))) {
+        return LAVA_GRAPH_NONE;
+    }
+    lava_graph_batch* batch = &graph->batches[graph->batch_count];
+    batch->queue = queue;
+    batch->ordinal = ++ordinals[queue];
+    batch->wait_ordinal = wait_ordinal;
+    batch->first_position = 0;
+    batch->position_count = 0;
+    return graph->batch_count++;
+}
+
+static uint32_t lava_graph_open_group(lava_render_graph* graph)
+{
+    if(!lava_reserve(graph->allocator, (void**)&graph->groups, &graph->group_capacity, graph->group_count + 1, sizeof(lava_graph_group))) {
+        return LAVA_GRAPH_NONE;
+    }
+    lava_graph_group* group = &graph->groups[graph->group_count];
+    memset(group, 0, sizeof(lava_graph_group));
+    group->memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    return graph->group_count++;
+}
+
+/**
+ @brief Move a resource to a new state inside a barrier group, folding with a barrier the group already has for it.
+ */
+static bool lava_graph_transition(lava_render_graph* graph, uint32_t resource, uint32_t group_index, uint32_t queue, const lava_resource_state* state)
+{
+    lava_graph_resource_desc* desc = &graph->resources[resource];
+    lava_graph_group* group = &graph->groups[group_index];
+    if(LAVA_GRAPH_NONE != desc->last_queue && desc->last_queue != queue) {
+        //The semaphore wait between the queues already orders and flushes everything before it, a later transition only chains to the wait
+        desc->state.write_stage = 0;
+        desc->state.write_access = 0;
+        desc->state.read_stage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        desc->state.visible_stage = 0;
+        desc->state.visible_access = 0;
+        desc->pending_group = LAVA_GRAPH_NONE;
+    }
+    desc->last_queue = queue;
+    if(desc->pending_group == group_index) {
+        lava_subresource_accumulate(&desc->state, state, desc->is_image);
+        if(desc->is_image) {
+            VkImageMemoryBarrier2* barrier = &graph->barriers[desc->pending_barrier];
+            barrier->dstStageMask |= state->stage;
+            barrier->dstAccessMask |= state->access;
+            barrier->newLayout = desc->state.layout;
+        } else {
+            group->memory_barrier.dstStageMask |= state->stage;
+            group->memory_barrier.dstAccessMask |= state->access;
+        }
+        return true;
+    }
+    VkPipelineStageFlags2 src_stage;
+    VkAccessFlags2 src_access;
+    VkImageLayout old_layout;
+    uint32_t src_queue_family_index;
+    if(!lava_subresource_transition(&desc->state, state, desc->is_image, &src_stage, &src_access, &old_layout, &src_queue_family_index)) {
+        return true;
+    }
+    desc->pending_group = group_index;
+    if(!desc->is_image) {
+        group->memory_barrier.srcStageMask |= src_stage;
+        group->memory_barrier.srcAccessMask |= src_access;
+        group->memory_barrier.dstStageMask |= state->stage;
+        group->memory_barrier.dstAccessMask |= state->access;
+        return true;
+    }
+    uint32_t count = graph->barrier_count + 1;
+    if(!lava_reserve(graph->allocator, (void**)&graph->barriers, &graph->barrier_capacity, count, sizeof(VkImageMemoryBarrier2))
+       || !lava_reserve(graph->allocator, (void**)&graph->barrier_resources, &graph->barrier_resource_capacity, count, sizeof(uint32_t))
+       || !lava_reserve(graph->allocator, (void**)&graph->barrier_groups, &graph->barrier_group_capacity, count, sizeof(uint32_t))) {
+        return false;
+    }
+    desc->pending_barrier = graph->barrier_count;
+    VkImageMemoryBarrier2* barrier = &graph->barriers[graph->barrier_count];
+    barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier->pNext = LAVA_NULL;
+    barrier->srcStageMask = src_stage;
+    barrier->srcAccessMask = src_access;
+    barrier->dstStageMask = state->stage;
+    barrier->dstAccessMask = state->access;
+    barrier->oldLayout = old_layout;
+    barrier->newLayout = desc->state.layout;
+    barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier->image = VK_NULL_HANDLE;
+    barrier->subresourceRange.aspectMask = desc->aspect;
+    barrier->subresourceRange.baseMipLevel = 0;
+    barrier->subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier->subresourceRange.baseArrayLayer = 0;
+    barrier->subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    graph->barrier_resources[graph->barrier_count] = resource;
+    graph->barrier_groups[graph->barrier_count] = group_index;
+    ++graph->barrier_count;
+    return true;
+}
+
+/**
+ @brief Split the schedule in submissions and barrier groups, simulating the state of every resource.
+ */
+static VkResult lava_graph_synchronize(lava_render_graph* graph)
+{
+    graph->batch_count = 0;
+    graph->group_count = 0;
+    graph->barrier_count = 0;
+    if(!lava_reserve(graph->allocator, (void**)&graph->position_groups, &graph->position_group_capacity, graph->schedule_count + 1, sizeof(uint32_t))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        lava_graph_resource_desc* desc = &graph->resources[i];
+        lava_resource_state initial_state = desc->initial_state;
+        if(LAVA_GRAPH_NONE != desc->transient_index) {
+            //Wait for the previous user of the memory, an earlier resource of the frame or the previous frame
+            initial_state.stage = graph->transient_pool->resources[desc->transient_index].src_stage;
+            initial_state.access = graph->transient_pool->resources[desc->transient_index].src_access;
+            initial_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+        lava_subresource_initialize(&desc->state, &initial_state);
+        desc->state.queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+        desc->last_queue = LAVA_GRAPH_NONE;
+        desc->last_position[0] = LAVA_GRAPH_NONE;
+        desc->last_position[1] = LAVA_GRAPH_NONE;
+        desc->pending_group = LAVA_GRAPH_NONE;
+    }
+
+    uint32_t ordinals[LAVA_GRAPH_QUEUE_COUNT] = {0, 0};
+    uint32_t open_batches[LAVA_GRAPH_QUEUE_COUNT] = {LAVA_GRAPH_NONE, LAVA_GRAPH_NONE};
+    uint32_t waited[LAVA_GRAPH_QUEUE_COUNT] = {0, 0};
+    uint32_t groups[LAVA_GRAPH_QUEUE_COUNT] = {LAVA_GRAPH_NONE, LAVA_GRAPH_NONE};
+    uint32_t levels[LAVA_GRAPH_QUEUE_COUNT] = {LAVA_GRAPH_NONE, LAVA_GRAPH_NONE};
+    for(uint32_t position = 0; position < graph->schedule_count; ++position) {
+        lava_graph_pass* pass = &graph->passes[graph->schedule[position]];
+        uint32_t queue = pass->queue;
+        uint32_t other = 1 - queue;
+        graph->position_groups[position] = LAVA_GRAPH_NONE;
+
+        //Wait for the latest submission of the other queue touching a resource of the pass
+        uint32_t wait_ordinal = 0;
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            const lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            uint32_t last = graph->resources[access->resource].last_position[other];
+            if(LAVA_GRAPH_NONE != last) {
+                const lava_graph_batch* producer = &graph->batches[graph->passes[graph->schedule[last]].batch];
+                wait_ordinal = (wait_ordinal < producer->ordinal) ? producer->ordinal : wait_ordinal;
+            }
+        }
+        if(wait_ordinal <= waited[queue]) {
+            wait_ordinal = 0;
+        } else {
+            //The producer signals at its end, so it cannot take more passes
+            if(open_batches[other] != LAVA_GRAPH_NONE && graph->batches[open_batches[other]].ordinal <= wait_ordinal) {
+                open_batches[other] = LAVA_GRAPH_NONE;
+            }
+            open_batches[queue] = LAVA_GRAPH_NONE;
+            waited[queue] = wait_ordinal;
+        }
+        if(LAVA_GRAPH_NONE == open_batches[queue]) {
+            open_batches[queue] = lava_graph_open_batch(graph, queue, ordinals, wait_ordinal);
+            if(LAVA_GRAPH_NONE == open_batches[queue]) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+            groups[queue] = LAVA_GRAPH_NONE;
+        }
+        pass->batch = open_batches[queue];
+        ++graph->batches[pass->batch].position_count;
+
+        //One barrier group for every level of a queue, the passes of a level being independent
+        if(LAVA_GRAPH_NONE == groups[queue] || levels[queue] != pass->level) {
+            groups[queue] = lava_graph_open_group(graph);
+            if(LAVA_GRAPH_NONE == groups[queue]) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+            levels[queue] = pass->level;
+            graph->position_groups[position] = groups[queue];
+        }
+        for(uint32_t j = 0; j < pass->access_count; ++j) {
+            const lava_graph_access* access = &graph->accesses[graph->access_order[pass->first_access + j]];
+            if(!lava_graph_transition(graph, access->resource, groups[queue], queue, &access->state)) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+            graph->resources[access->resource].last_position[queue] = position;
+        }
+    }
+
+    //The last submission runs on graphics after everything else, and moves exported resources to their final state
+    uint32_t final_batch = open_batches[LAVA_GRAPH_QUEUE_GRAPHICS];
+    uint32_t final_wait = (waited[LAVA_GRAPH_QUEUE_GRAPHICS] < ordinals[LAVA_GRAPH_QUEUE_ASYNC_COMPUTE]) ? ordinals[LAVA_GRAPH_QUEUE_ASYNC_COMPUTE] : 0;
+    if(LAVA_GRAPH_NONE == final_batch || 0 < final_wait) {
+        final_batch = lava_graph_open_batch(graph, LAVA_GRAPH_QUEUE_GRAPHICS, ordinals, final_wait);
+        if(LAVA_GRAPH_NONE == final_batch) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    uint32_t final_group = lava_graph_open_group(graph);
+    if(LAVA_GRAPH_NONE == final_group) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    graph->position_groups[graph->schedule_count] = final_group;
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        const lava_graph_resource_desc* desc = &graph->resources[i];
+        if(desc->exported && (desc->imported || LAVA_GRAPH_NONE != desc->first_use)) {
+            if(!lava_graph_transition(graph, i, final_group, LAVA_GRAPH_QUEUE_GRAPHICS, &desc->final_state)) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+        }
+    }
+
+    //Positions of each batch, in execution order
+    if(!lava_reserve(graph->allocator, (void**)&graph->batch_positions, &graph->batch_position_capacity, graph->schedule_count + 1, sizeof(uint32_t))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t offset = 0;
+    for(uint32_t i = 0; i < graph->batch_count; ++i) {
+        graph->batches[i].first_position = offset;
+        offset += graph->batches[i].position_count;
+        graph->batches[i].position_count = 0;
+    }
+    for(uint32_t position = 0; position < graph->schedule_count; ++position) {
+        lava_graph_batch* batch = &graph->batches[graph->passes[graph->schedule[position]].batch];
+        graph->batch_positions[batch->first_position + batch->position_count++] = position;
+    }
+
+    //Image barriers of a group contiguous, with a stable counting sort
+    if(!lava_reserve(graph->allocator, (void**)&graph->scratch_barriers, &graph->scratch_barrier_capacity, graph->barrier_count + 1, sizeof(VkImageMemoryBarrier2))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < graph->barrier_count; ++i) {
+        ++graph->groups[graph->barrier_groups[i]].barrier_count;
+    }
+    offset = 0;
+    for(uint32_t i = 0; i < graph->group_count; ++i) {
+        graph->groups[i].first_barrier = offset;
+        offset += graph->groups[i].barrier_count;
+        graph->groups[i].barrier_count = 0;
+    }
+    memcpy(graph->scratch_barriers, graph->barriers, sizeof(VkImageMemoryBarrier2) * graph->barrier_count);
+    for(uint32_t i = 0; i < graph->barrier_count; ++i) {
+        lava_graph_group* group = &graph->groups[graph->barrier_groups[i]];
+        uint32_t index = group->first_barrier + group->barrier_count++;
+        graph->barriers[index] = graph->scratch_barriers[i];
+        graph->barrier_groups[index] = graph->barrier_resources[i];
+    }
+    //barrier_groups now holds the resource of each sorted barrier
+    memcpy(graph->barrier_resources, graph->barrier_groups, sizeof(uint32_t) * graph->barrier_count);
+
+    graph->stats.submit_count = graph->batch_count;
+    graph->stats.barrier_count = graph->barrier_count;
+    graph->stats.dependency_count = 0;
+    for(uint32_t i = 0; i < graph->group_count; ++i) {
+        const lava_graph_group* group = &graph->groups[i];
+        if(0 != group->memory_barrier.srcStageMask || 0 != group->memory_barrier.dstStageMask) {
+            ++graph->stats.barrier_count;
+        }
+        if(0 < group->barrier_count || 0 != group->memory_barrier.srcStageMask || 0 != group->memory_barrier.dstStageMask) {
+            ++graph->stats.dependency_count;
+        }
+    }
+    return VK_SUCCESS;
+}
+
+/**
+ @brief Hash everything compile depends on. Handles of imported resources are only read when recording.
+ */
+static uint64_t lava_graph_structure_hash(const lava_render_graph* graph)
+{
+    uint64_t hash = lava_hash_combine(0, graph->resource_count);
+    hash = lava_hash_combine(hash, graph->pass_count);
+    hash = lava_hash_combine(hash, graph->access_count);
+    for(uint32_t i = 0; i < graph->resource_count; ++i) {
+        const lava_graph_resource_desc* desc = &graph->resources[i];
+        hash = lava_hash_combine(hash, (desc->is_image ? 1U : 0U) | (desc->imported ? 2U : 0U) | (desc->exported ? 4U : 0U));
+        hash = lava_hash_combine(hash, desc->aspect);
+        if(desc->is_image) {
+            const VkImageCreateInfo* info = &desc->image_info;
+            hash = lava_hash_combine(hash, info->flags);
+            hash = lava_hash_combine(hash, info->imageType);
+            hash = lava_hash_combine(hash, info->format);
+            hash = lava_hash_combine(hash, ((uint64_t)info->extent.width << 32) | info->extent.height);
+            hash = lava_hash_combine(hash, info->extent.depth);
+            hash = lava_hash_combine(hash, ((uint64_t)info->mipLevels << 32) | info->arrayLayers);
+            hash = lava_hash_combine(hash, info->samples);
+            hash = lava_hash_combine(hash, info->tiling);
+            hash = lava_hash_combine(hash, info->usage);
+        } else {
+            hash = lava_hash_combine(hash, desc->buffer_info.flags);
+            hash = lava_hash_combine(hash, desc->buffer_info.size);
+            hash = lava_hash_combine(hash, desc->buffer_info.usage);
+        }
+        hash = lava_hash_combine(hash, desc->initial_state.stage);
+        hash = lava_hash_combine(hash, desc->initial_state.access);
+        hash = lava_hash_combine(hash, ((uint64_t)desc->initial_state.layout << 32) | desc->initial_state.queue_family_index);
+        if(desc->exported) {
+            hash = lava_hash_combine(hash, desc->final_state.stage);
+            hash = lava_hash_combine(hash, desc->final_state.access);
+            hash = lava_hash_combine(hash, desc->final_state.layout);
+        }
+    }
+    for(uint32_t i = 0; i < graph->pass_count; ++i) {
+        hash = lava_hash_combine(hash, ((uint64_t)graph->passes[i].queue << 32) | graph->passes[i].info.flags);
+    }
+    for(uint32_t i = 0; i < graph->access_count; ++i) {
+        const lava_graph_access* access = &graph->accesses[i];
+        hash = lava_hash_combine(hash, ((uint64_t)access->pass << 32) | access->resource);
+        hash = lava_hash_combine(hash, access->state.stage);
+        hash = lava_hash_combine(hash, access->state.access);
+        hash = lava_hash_combine(hash, ((uint64_t)access->state.layout << 1) | (access->write ? 1U : 0U));
+    }
+    return hash;
+}
+
+VkResult LAVA_API lava_graph_compile(lava_render_graph* graph)
+{
+    assert(LAVA_NULL != graph);
+    uint64_t hash = lava_graph_structure_hash(graph);
+    if(graph->compiled && hash == graph->stats.structure_hash) {
+        //Same structure as the previous frame, only the transient handles of the new declaration are missing
+        for(uint32_t i = 0; i < graph->resource_count; ++i) {
+            lava_graph_resource_desc* desc = &graph->resources[i];
+            if(LAVA_GRAPH_NONE != graph->transient_indices[i]) {
+                desc->image = lava_get_transient_image(graph->transient_pool, graph->transient_indices[i]);
+                desc->buffer = lava_get_transient_buffer(graph->transient_pool, graph->transient_indices[i]);
+            }
+        }
+        ++graph->stats.reuse_count;
+        return VK_SUCCESS;
+    }
+    graph->compiled = false;
+    graph->stats.pass_count = graph->pass_count;
+    graph->stats.reuse_count = 0;
+    graph->stats.structure_hash = hash;
+    if(!lava_graph_sort_accesses(graph)) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    lava_graph_cull(graph);
+    lava_graph_levels(graph);
+    if(!lava_graph_schedule(graph)) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    VkResult result = lava_graph_allocate_transients(graph);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    result = lava_graph_synchronize(graph);
+    graph->compiled = VK_SUCCESS == result;
+    return result;
+}
+
+static void lava_graph_cmd_group(lava_render_graph* graph, VkCommandBuffer command_buffer, uint32_t group_index)
+{
+    if(LAVA_GRAPH_NONE == group_index) {
+        return;
+    }
+    const lava_graph_group* group = &graph->groups[group_index];
+    bool memory = 0 != group->memory_barrier.srcStageMask || 0 != group->memory_barrier.dstStageMask;
+    if(!memory && group->barrier_count <= 0) {
+        return;
+    }
+    //Patch the handles, which only exist once transient resources are created or imported
+    VkImageMemoryBarrier2* barriers = graph->scratch_barriers;
+    for(uint32_t i = 0; i < group->barrier_count; ++i) {
+        barriers[i] = graph->barriers[group->first_barrier + i];
+        barriers[i].image = graph->resources[graph->barrier_resources[group->first_barrier + i]].image;
+    }
+    VkDependencyInfo dependency_info;
+    memset(&dependency_info, 0, sizeof(dependency_info));
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.memoryBarrierCount = memory ? 1 : 0;
+    dependency_info.pMemoryBarriers = &group->memory_barrier;
+    dependency_info.imageMemoryBarrierCount = group->barrier_count;
+    dependency_info.pImageMemoryBarriers = barriers;
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+}
+
+VkResult LAVA_API lava_graph_execute(lava_render_graph* graph, const lava_graph_execute_info* execute_info)
+{
+    assert(LAVA_NULL != graph);
+    assert(LAVA_NULL != execute_info);
+    assert(LAVA_NULL != execute_info->graphics_command_pool_set);
+    assert(!graph->async_compute || LAVA_NULL != execute_info->compute_command_pool_set);
+    uint64_t bases[LAVA_GRAPH_QUEUE_COUNT] = {graph->timeline_values[0], graph->timeline_values[1]};
+    bool first[LAVA_GRAPH_QUEUE_COUNT] = {true, true};
+    VkResult result = VK_SUCCESS;
+    for(uint32_t i = 0; i < graph->batch_count && VK_SUCCESS == result; ++i) {
+        const lava_graph_batch* batch = &graph->batches[i];
+        uint32_t queue = batch->queue;
+        bool last = (i + 1) == graph->batch_count;
+        lava_command_pool_set* pool_set = (LAVA_GRAPH_QUEUE_GRAPHICS == queue) ? execute_info->graphics_command_pool_set : execute_info->compute_command_pool_set;
+        VkCommandBuffer command_buffer;
+        result = lava_allocate_command_buffer(pool_set, execute_info->thread_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &command_buffer);
+        if(VK_SUCCESS != result) {
+            break;
+        }
+        VkCommandBufferBeginInfo begin_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, LAVA_NULL, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, LAVA_NULL};
+        result = vkBeginCommandBuffer(command_buffer, &begin_info);
+        if(VK_SUCCESS != result) {
+            break;
+        }
+        for(uint32_t j = 0; j < batch->position_count; ++j) {
+            uint32_t position = graph->batch_positions[batch->first_position + j];
+            uint32_t pass_index = graph->schedule[position];
+            const lava_graph_pass* pass = &graph->passes[pass_index];
+            lava_graph_cmd_group(graph, command_buffer, graph->position_groups[position]);
+            bool label = LAVA_NULL != pass->info.name && LAVA_NULL != vkCmdBeginDebugUtilsLabelEXT;
+            if(label) {
+                VkDebugUtilsLabelEXT label_info = {VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT, LAVA_NULL, pass->info.name, {0.0f, 0.0f, 0.0f, 0.0f}};
+                vkCmdBeginDebugUtilsLabelEXT(command_buffer, &label_info);
+            }
+            if(LAVA_NULL != pass->info.execute) {
+                pass->info.execute(pass->info.user_data, graph, pass_index, command_buffer);
+            }
+            if(label) {
+                vkCmdEndDebugUtilsLabelEXT(command_buffer);
+            }
+        }
+        if(last) {
+            lava_graph_cmd_group(graph, command_buffer, graph->position_groups[graph->schedule_count]);
+        }
+        result = vkEndCommandBuffer(command_buffer);
+        if(VK_SUCCESS != result) {
+            break;
+        }
+
+        //At most the user semaphores plus one timeline on each side
+#define LAVA_GRAPH_MAX_SEMAPHORES (16)
+        VkSemaphoreSubmitInfo waits[LAVA_GRAPH_MAX_SEMAPHORES + 1];
+        VkSemaphoreSubmitInfo signals[LAVA_GRAPH_MAX_SEMAPHORES + 1];
+        uint32_t wait_count = 0;
+        uint32_t signal_count = 0;
+        //The first batch of a queue also waits for the other queue in the previous execution, which may share transient memory
+        uint64_t wait_value = (0 < batch->wait_ordinal) ? bases[1 - queue] + batch->wait_ordinal : (first[queue] ? bases[1 - queue] : 0);
+        if(0 < wait_value) {
+            VkSemaphoreSubmitInfo* wait = &waits[wait_count++];
+            memset(wait, 0, sizeof(VkSemaphoreSubmitInfo));
+            wait->sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+            wait->semaphore = graph->timelines[1 - queue];
+            wait->value = wait_value;
+            wait->stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        }
+        if(first[queue] && LAVA_GRAPH_QUEUE_GRAPHICS == queue) {
+            assert(execute_info->wait_semaphore_count <= LAVA_GRAPH_MAX_SEMAPHORES);
+            for(uint32_t j = 0; j < execute_info->wait_semaphore_count && j < LAVA_GRAPH_MAX_SEMAPHORES; ++j) {
+                waits[wait_count++] = execute_info->wait_semaphores[j];
+            }
+        }
+        first[queue] = false;
+        VkSemaphoreSubmitInfo* signal = &signals[signal_count++];
+        memset(signal, 0, sizeof(VkSemaphoreSubmitInfo));
+        signal->sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+        signal->semaphore = graph->timelines[queue];
+        signal->value = bases[queue] + batch->ordinal;
+        signal->stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        if(last) {
+            assert(execute_info->signal_semaphore_count <= LAVA_GRAPH_MAX_SEMAPHORES);
+            for(uint32_t j = 0; j < execute_info->signal_semaphore_count && j < LAVA_GRAPH_MAX_SEMAPHORES; ++j) {
+                signals[signal_count++] = execute_info->signal_semaphores[j];
+            }
+        }
+#undef LAVA_GRAPH_MAX_SEMAPHORES
+        VkCommandBufferSubmitInfo command_buffer_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO, LAVA_NULL, command_buffer, 0};
+        VkSubmitInfo2 submit_info = {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+            LAVA_NULL,
+            0,
+            wait_count,
+            waits,
+            1,
+            &command_buffer_info,
+            signal_count,
+            signals,
+        };
+        VkQueue vk_queue = (LAVA_GRAPH_QUEUE_GRAPHICS == queue) ? execute_info->graphics_queue : execute_info->compute_queue;
+        result = vkQueueSubmit2(vk_queue, 1, &submit_info, last ? execute_info->fence : VK_NULL_HANDLE);
+        graph->timeline_values[queue] = bases[queue] + batch->ordinal;
+    }
+    return result;
+}
+
+VkImage LAVA_API lava_graph_get_image(const lava_render_graph* graph, lava_graph_resource resource)
+{
+    assert(LAVA_NULL != graph);
+    return (resource < graph->resource_count) ? graph->resources[resource].image : VK_NULL_HANDLE;
+}
+
+VkBuffer LAVA_API lava_graph_get_buffer(const lava_render_graph* graph, lava_graph_resource resource)
+{
+    assert(LAVA_NULL != graph);
+    return (resource < graph->resource_count) ? graph->resources[resource].buffer : VK_NULL_HANDLE;
+}
+
+void LAVA_API lava_graph_get_stats(const lava_render_graph* graph, lava_graph_stats* stats)
+{
+    assert(LAVA_NULL != graph);
+    assert(LAVA_NULL != stats);
+    *stats = graph->stats;
+}
+
+//--- Queues
+//--------------------------------------------------------------------
+typedef struct lava_deferred_submit_t
+{
+    struct lava_deferred_submit_t* next;
+    VkSubmitInfo2 submit; //!< Arrays point into the same allocation.
+} lava_deferred_submit;
+
+struct lava_queue_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    VkQueue queue;
+    uint32_t queue_family_index;
+    VkSemaphore timeline;
+    lava_mutex mutex;
+    volatile int64_t reserved; //!< Value of the latest flush, taken before its deferred list. Written under mutex.
+    volatile int64_t submitted; //!< Value of the latest successful vkQueueSubmit2. Written under mutex.
+    volatile int64_t completed; //!< Only moves forward.
+    volatile int64_t deferred; //!< Head of the lava_deferred_submit list, pushed by any thread and taken under mutex.
+    lava_queue_stats stats;
+    VkSubmitInfo2* submits; //!< Scratch copies of the caller's batches, under mutex.
+    uint32_t submit_capacity;
+    VkSemaphoreSubmitInfo* signals;
+    uint32_t signal_capacity;
+};
+
+static void lava_queue_complete(lava_queue* queue, uint64_t value)
+{
+    for(;;) {
+        int64_t completed = lava_atomic_load64(&queue->completed);
+        if((int64_t)value <= completed || lava_atomic_cas64(&queue->completed, completed, (int64_t)value)) {
+            return;
+        }
+    }
+}
+
+VkResult LAVA_API lava_create_queue(const lava_queue_create_info* create_info, lava_queue** queue)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != queue);
+    lava_queue* new_queue = (lava_queue*)lava_calloc(create_info->allocator, sizeof(lava_queue));
+    if(LAVA_NULL == new_queue) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_queue->device = create_info->device;
+    new_queue->allocator = create_info->allocator;
+    new_queue->queue = create_info->queue;
+    new_queue->queue_family_index = create_info->queue_family_index;
+    VkSemaphoreTypeCreateInfo type_info = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO, LAVA_NULL, VK_SEMAPHORE_TYPE_TIMELINE, 0};
+    VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &type_info, 0};
+    VkResult result = vkCreateSemaphore(create_info->device->device_, &semaphore_info, create_info->allocator, &new_queue->timeline);
+    if(VK_SUCCESS != result) {
+        lava_free(create_info->allocator, new_queue);
+        return result;
+    }
+    lava_mutex_initialize(&new_queue->mutex);
+    *queue = new_queue;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_queue(lava_queue* queue)
+{
+    if(LAVA_NULL == queue) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = queue->allocator;
+    lava_deferred_submit* deferred = (lava_deferred_submit*)(intptr_t)queue->deferred;
+    while(LAVA_NULL != deferred) {
+        lava_deferred_submit* next = deferred->next;
+        lava_free(allocator, deferred);
+        deferred = next;
+    }
+    vkDestroySemaphore(queue->device->device_, queue->timeline, allocator);
+    lava_mutex_terminate(&queue->mutex);
+    lava_free(allocator, queue->submits);
+    lava_free(allocator, queue->signals);
+    lava_free(allocator, queue);
+}
+
+VkQueue LAVA_API lava_get_vk_queue(const lava_queue* queue)
+{
+    assert(LAVA_NULL != queue);
+    return queue->queue;
+}
+
+uint32_t LAVA_API lava_get_queue_family_index(const lava_queue* queue)
+{
+    assert(LAVA_NULL != queue);
+    return queue->queue_family_index;
+}
+
+VkSemaphore LAVA_API lava_get_queue_timeline(const lava_queue* queue)
+{
+    assert(LAVA_NULL != queue);
+    return queue->timeline;
+}
+
+/**
+ @brief Put batches taken by a failed flush back behind the ones deferred since, under the queue mutex.
+
+ deferred is in submission order. Only the mutex owner unlinks nodes, so the tail of the list is stable.
+ */
+static void lava_queue_restore_deferred(lava_queue* queue, lava_deferred_submit* deferred)
+{
+    lava_deferred_submit* newest = LAVA_NULL;
+    while(LAVA_NULL != deferred) {
+        lava_deferred_submit* next = deferred->next;
+        deferred->next = newest;
+        newest = deferred;
+        deferred = next;
+    }
+    if(LAVA_NULL == newest) {
+        return;
+    }
+    for(;;) {
+        int64_t head = lava_atomic_load64(&queue->deferred);
+        if(0 != head) {
+            lava_deferred_submit* tail = (lava_deferred_submit*)(intptr_t)head;
+            while(LAVA_NULL != tail->next) {
+                tail = tail->next;
+            }
+            tail->next = newest;
+            return;
+        }
+        if(lava_atomic_cas64(&queue->deferred, 0, (int64_t)(intptr_t)newest)) {
+            return;
+        }
+    }
+}
+
+/**
+ @brief Submit the deferred batches followed by the given ones in one call, under the queue mutex.
+
+ On failure the deferred batches are kept for the next flush, whose value covers their tickets.
+ */
+static VkResult lava_queue_flush(lava_queue* queue, uint32_t submit_count, const VkSubmitInfo2* submits, VkFence fence, uint64_t* value)
+{
+    //Reserve the value before taking the list, so that a request pushed after it gets a later ticket
+    *value = (uint64_t)queue->reserved + 1;
+    lava_atomic_store64(&queue->reserved, (int64_t)*value);
+    int64_t head;
+    do {
+        head = lava_atomic_load64(&queue->deferred);
+    } while(!lava_atomic_cas64(&queue->deferred, head, 0));
+    //The list is last in first out, reverse it to keep the submission order
+    lava_deferred_submit* deferred = LAVA_NULL;
+    uint32_t deferred_count = 0;
+    for(lava_deferred_submit* node = (lava_deferred_submit*)(intptr_t)head; LAVA_NULL != node; ++deferred_count) {
+        lava_deferred_submit* next = node->next;
+        node->next = deferred;
+        deferred = node;
+        node = next;
+    }
+
+    //An empty batch still signals, so that the ticket retires after everything submitted before
+    uint32_t total_count = deferred_count + submit_count;
+    uint32_t count = (0 < total_count) ? total_count : 1;
+    VkResult result = VK_ERROR_OUT_OF_HOST_MEMORY;
+    if(lava_reserve(queue->allocator, (void**)&queue->submits, &queue->submit_capacity, count, sizeof(VkSubmitInfo2))) {
+        uint32_t index = 0;
+        for(lava_deferred_submit* node = deferred; LAVA_NULL != node; node = node->next) {
+            queue->submits[index++] = node->submit;
+        }
+        if(0 < submit_count) {
+            memcpy(queue->submits + index, submits, sizeof(VkSubmitInfo2) * submit_count);
+        } else if(0 == total_count) {
+            memset(queue->submits, 0, sizeof(VkSubmitInfo2));
+            queue->submits[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+        }
+        VkSubmitInfo2* last = &queue->submits[count - 1];
+        uint32_t signal_count = last->signalSemaphoreInfoCount + 1;
+        if(lava_reserve(queue->allocator, (void**)&queue->signals, &queue->signal_capacity, signal_count, sizeof(VkSemaphoreSubmitInfo))) {
+            if(1 < signal_count) {
+                memcpy(queue->signals, last->pSignalSemaphoreInfos, sizeof(VkSemaphoreSubmitInfo) * (signal_count - 1));
+            }
+            VkSemaphoreSubmitInfo* signal = &queue->signals[signal_count - 1];
+            memset(signal, 0, sizeof(VkSemaphoreSubmitInfo));
+            signal->sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+            signal->semaphore = queue->timeline;
+            signal->value = *value;
+            signal->stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            last->signalSemaphoreInfoCount = signal_count;
+            last->pSignalSemaphoreInfos = queue->signals;
+            result = vkQueueSubmit2(queue->queue, count, queue->submits, fence);
+            ++queue->stats.submit_calls;
+            queue->stats.batches += count;
+        }
+    }
+    if(VK_SUCCESS != result) {
+        lava_queue_restore_deferred(queue, deferred);
+        return result;
+    }
+    lava_atomic_store64(&queue->submitted, (int64_t)*value);
+    while(LAVA_NULL != deferred) {
+        lava_deferred_submit* next = deferred->next;
+        lava_free(queue->allocator, deferred);
+        deferred = next;
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_submit(lava_queue* queue, uint32_t submit_count, const VkSubmitInfo2* submits, VkFence fence, lava_submit_ticket* ticket)
+{
+    assert(LAVA_NULL != queue);
+    assert(0 == submit_count || LAVA_NULL != submits);
+    uint64_t value;
+    lava_mutex_lock(&queue->mutex);
+    VkResult result = lava_queue_flush(queue, submit_count, submits, fence, &value);
+    lava_mutex_unlock(&queue->mutex);
+    if(LAVA_NULL != ticket) {
+        ticket->queue = queue;
+        ticket->value = (VK_SUCCESS == result) ? value : 0;
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_defer_submit(lava_queue* queue, const VkSubmitInfo2* submit, lava_submit_ticket* ticket)
+{
+    assert(LAVA_NULL != queue);
+    assert(LAVA_NULL != submit);
+    //One allocation holds the batch and copies of its arrays
+    size_t waits_offset = (size_t)lava_align_up(sizeof(lava_deferred_submit), sizeof(uint64_t));
+    size_t command_buffers_offset = waits_offset + sizeof(VkSemaphoreSubmitInfo) * submit->waitSemaphoreInfoCount;
+    size_t signals_offset = (size_t)lava_align_up(command_buffers_offset + sizeof(VkCommandBufferSubmitInfo) * submit->commandBufferInfoCount, sizeof(uint64_t));
+    size_t size = signals_offset + sizeof(VkSemaphoreSubmitInfo) * submit->signalSemaphoreInfoCount;
+    char* memory = (char*)lava_malloc(queue->allocator, size);
+    if(LAVA_NULL == memory) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    lava_deferred_submit* node = (lava_deferred_submit*)memory;
+    node->submit = *submit;
+    if(0 < submit->waitSemaphoreInfoCount) {
+        memcpy(memory + waits_offset, submit->pWaitSemaphoreInfos, sizeof(VkSemaphoreSubmitInfo) * submit->waitSemaphoreInfoCount);
+        node->submit.pWaitSemaphoreInfos = (const VkSemaphoreSubmitInfo*)(memory + waits_offset);
+    }
+    if(0 < submit->commandBufferInfoCount) {
+        memcpy(memory + command_buffers_offset, submit->pCommandBufferInfos, sizeof(VkCommandBufferSubmitInfo) * submit->commandBufferInfoCount);
+        node->submit.pCommandBufferInfos = (const VkCommandBufferSubmitInfo*)(memory + command_buffers_offset);
+    }
+    if(0 < submit->signalSemaphoreInfoCount) {
+        memcpy(memory + signals_offset, submit->pSignalSemaphoreInfos, sizeof(VkSemaphoreSubmitInfo) * submit->signalSemaphoreInfoCount);
+        node->submit.pSignalSemaphoreInfos = (const VkSemaphoreSubmitInfo*)(memory + signals_offset);
+    }
+    int64_t head;
+    do {
+        head = lava_atomic_load64(&queue->deferred);
+        node->next = (lava_deferred_submit*)(intptr_t)head;
+    } while(!lava_atomic_cas64(&queue->deferred, head, (int64_t)(intptr_t)node));
+    if(LAVA_NULL != ticket) {
+        //Read after the push, the flush taking this batch signals at least this value
+        ticket->queue = queue;
+        ticket->value = (uint64_t)lava_atomic_load64(&queue->reserved) + 1;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult LAVA_API lava_flush_submits(lava_queue* queue, VkFence fence, lava_submit_ticket* ticket)
+{
+    assert(LAVA_NULL != queue);
+    VkResult result = VK_SUCCESS;
+    uint64_t value;
+    lava_mutex_lock(&queue->mutex);
+    if(0 != lava_atomic_load64(&queue->deferred) || VK_NULL_HANDLE != fence) {
+        result = lava_queue_flush(queue, 0, LAVA_NULL, fence, &value);
+    } else {
+        value = (uint64_t)queue->submitted;
+    }
+    lava_mutex_unlock(&queue->mutex);
+    if(LAVA_NULL != ticket) {
+        ticket->queue = queue;
+        ticket->value = (VK_SUCCESS == result) ? value : 0;
+    }
+    return result;
+}
+
+void LAVA_API lava_get_queue_stats(lava_queue* queue, lava_queue_stats* stats)
+{
+    assert(LAVA_NULL != queue);
+    assert(LAVA_NULL != stats);
+    lava_mutex_lock(&queue->mutex);
+    *stats = queue->stats;
+    lava_mutex_unlock(&queue->mutex);
+}
+
+lava_submit_ticket LAVA_API lava_get_last_ticket(lava_queue* queue)
+{
+    assert(LAVA_NULL != queue);
+    lava_submit_ticket ticket;
+    ticket.queue = queue;
+    ticket.value = (uint64_t)lava_atomic_load64(&queue->submitted);
+    return ticket;
+}
+
+uint64_t LAVA_API lava_update_queue(lava_queue* queue)
+{
+    assert(LAVA_NULL != queue);
+    uint64_t value = 0;
+    if(VK_SUCCESS == vkGetSemaphoreCounterValue(queue->device->device_, queue->timeline, &value)) {
+        lava_queue_complete(queue, value);
+    }
+    return (uint64_t)lava_atomic_load64(&queue->completed);
+}
+
+bool LAVA_API lava_is_complete(lava_submit_ticket ticket)
+{
+    return LAVA_NULL == ticket.queue || ticket.value <= (uint64_t)lava_atomic_load64(&ticket.queue->completed);
+}
+
+/**
+ @brief Wait on the timeline value of a ticket only, without flushing batches deferred on its queue.
+ */
+static VkResult lava_wait_timeline(lava_submit_ticket ticket, uint64_t timeout)
+{
+    lava_queue* queue = ticket.queue;
+    VkSemaphoreWaitInfo wait_info = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO, LAVA_NULL, 0, 1, &queue->timeline, &ticket.value};
+    VkResult result = vkWaitSemaphores(queue->device->device_, &wait_info, timeout);
+    if(VK_SUCCESS == result) {
+        lava_queue_complete(queue, ticket.value);
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_wait_ticket(lava_submit_ticket ticket, uint64_t timeout)
+{
+    if(lava_is_complete(ticket)) {
+        return VK_SUCCESS;
+    }
+    lava_queue* queue = ticket.queue;
+    if((int64_t)ticket.value > lava_atomic_load64(&queue->submitted)) {
+        //Still in the deferred list, nothing would ever signal it
+        VkResult result = lava_flush_submits(queue, VK_NULL_HANDLE, LAVA_NULL);
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+    }
+    return lava_wait_timeline(ticket, timeout);
+}
+
+//--- Deferred destruction
+//--------------------------------------------------------------------
+#if VK_USE_64_BIT_PTR_DEFINES == 1
+#    define LAVA_HANDLE_FROM_KEY(TYPE, KEY) ((TYPE)(uintptr_t)(KEY))
+#else
+#    define LAVA_HANDLE_FROM_KEY(TYPE, KEY) ((TYPE)(KEY))
+#endif
+#define LAVA_DELETION_WAIT_TIMEOUT (1000000ULL) //!< Nanoseconds the thread blocks on a ticket before looking for new requests.
+#define LAVA_DELETION_MAX_UPDATED_QUEUES (8)
+
+typedef enum lava_deletion_kind_t
+{
+    LAVA_DELETION_OBJECT = 0,
+    LAVA_DELETION_BUFFER,
+    LAVA_DELETION_IMAGE,
+    LAVA_DELETION_MEMORY,
+    LAVA_DELETION_CALL,
+} lava_deletion_kind;
+
+typedef struct lava_deletion_t
+{
+    lava_submit_ticket ticket;
+    lava_deletion_kind kind;
+    VkObjectType type;
+    uint64_t handle;
+    lava_allocation* allocation;
+    PFN_lava_deferred_call function;
+    void* user_data;
+} lava_deletion;
+
+struct lava_deletion_queue_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_memory_allocator* memory_allocator;
+    lava_deletion_queue_create_flags flags;
+    lava_mutex mutex;
+    lava_condition condition;
+    lava_mutex retire_mutex; //!< Held while draining, by the thread or lava_collect_deletions.
+    lava_thread thread;
+    bool started;
+    volatile int32_t quit;
+    lava_deletion* incoming; //!< Pushed under mutex.
+    uint32_t incoming_count;
+    uint32_t incoming_capacity;
+    lava_deletion* retiring; //!< Under retire_mutex.
+    uint32_t retiring_count;
+    uint32_t retiring_capacity;
+};
+
+static bool lava_is_deletable(VkObjectType type)
+{
+    switch(type) {
+    case VK_OBJECT_TYPE_BUFFER:
+    case VK_OBJECT_TYPE_IMAGE:
+    case VK_OBJECT_TYPE_BUFFER_VIEW:
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+    case VK_OBJECT_TYPE_SAMPLER:
+    case VK_OBJECT_TYPE_SAMPLER_YCBCR_CONVERSION:
+    case VK_OBJECT_TYPE_SHADER_MODULE:
+    case VK_OBJECT_TYPE_PIPELINE:
+    case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+    case VK_OBJECT_TYPE_PIPELINE_CACHE:
+    case VK_OBJECT_TYPE_RENDER_PASS:
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+    case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    case VK_OBJECT_TYPE_QUERY_POOL:
+    case VK_OBJECT_TYPE_COMMAND_POOL:
+    case VK_OBJECT_TYPE_SEMAPHORE:
+    case VK_OBJECT_TYPE_FENCE:
+    case VK_OBJECT_TYPE_EVENT:
+    case VK_OBJECT_TYPE_DEVICE_MEMORY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void lava_delete_object(lava_deletion_queue* deletion_queue, const lava_deletion* deletion)
+{
+    VkDevice device = deletion_queue->device->device_;
+    const VkAllocationCallbacks* allocator = deletion_queue->allocator;
+    uint64_t handle = deletion->handle;
+    switch(deletion->kind) {
+    case LAVA_DELETION_BUFFER:
+        lava_destroy_buffer(deletion_queue->memory_allocator, LAVA_HANDLE_FROM_KEY(VkBuffer, handle), deletion->allocation);
+        return;
+    case LAVA_DELETION_IMAGE:
+        lava_destroy_image(deletion_queue->memory_allocator, LAVA_HANDLE_FROM_KEY(VkImage, handle), deletion->allocation);
+        return;
+    case LAVA_DELETION_MEMORY:
+        lava_free_memory(deletion_queue->memory_allocator, deletion->allocation);
+        return;
+    case LAVA_DELETION_CALL:
+        deletion->function(deletion->user_data);
+        return;
+    default:
+        break;
+    }
+    switch(deletion->type) {
+    case VK_OBJECT_TYPE_BUFFER:
+        vkDestroyBuffer(device, LAVA_HANDLE_FROM_KEY(VkBuffer, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_IMAGE:
+        vkDestroyImage(device, LAVA_HANDLE_FROM_KEY(VkImage, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_BUFFER_VIEW:
+        vkDestroyBufferView(device, LAVA_HANDLE_FROM_KEY(VkBufferView, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+        vkDestroyImageView(device, LAVA_HANDLE_FROM_KEY(VkImageView, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_SAMPLER:
+        vkDestroySampler(device, LAVA_HANDLE_FROM_KEY(VkSampler, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_SAMPLER_YCBCR_CONVERSION:
+        vkDestroySamplerYcbcrConversion(device, LAVA_HANDLE_FROM_KEY(VkSamplerYcbcrConversion, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_SHADER_MODULE:
+        vkDestroyShaderModule(device, LAVA_HANDLE_FROM_KEY(VkShaderModule, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_PIPELINE:
+        vkDestroyPipeline(device, LAVA_HANDLE_FROM_KEY(VkPipeline, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+        vkDestroyPipelineLayout(device, LAVA_HANDLE_FROM_KEY(VkPipelineLayout, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_PIPELINE_CACHE:
+        vkDestroyPipelineCache(device, LAVA_HANDLE_FROM_KEY(VkPipelineCache, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_RENDER_PASS:
+        vkDestroyRenderPass(device, LAVA_HANDLE_FROM_KEY(VkRenderPass, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+        vkDestroyFramebuffer(device, LAVA_HANDLE_FROM_KEY(VkFramebuffer, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+        vkDestroyDescriptorSetLayout(device, LAVA_HANDLE_FROM_KEY(VkDescriptorSetLayout, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+        vkDestroyDescriptorPool(device, LAVA_HANDLE_FROM_KEY(VkDescriptorPool, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_QUERY_POOL:
+        vkDestroyQueryPool(device, LAVA_HANDLE_FROM_KEY(VkQueryPool, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_COMMAND_POOL:
+        vkDestroyCommandPool(device, LAVA_HANDLE_FROM_KEY(VkCommandPool, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_SEMAPHORE:
+        vkDestroySemaphore(device, LAVA_HANDLE_FROM_KEY(VkSemaphore, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_FENCE:
+        vkDestroyFence(device, LAVA_HANDLE_FROM_KEY(VkFence, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_EVENT:
+        vkDestroyEvent(device, LAVA_HANDLE_FROM_KEY(VkEvent, handle), allocator);
+        break;
+    case VK_OBJECT_TYPE_DEVICE_MEMORY:
+        vkFreeMemory(device, LAVA_HANDLE_FROM_KEY(VkDeviceMemory, handle), allocator);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+static VkResult lava_push_deletion(lava_deletion_queue* deletion_queue, const lava_deletion* deletion)
+{
+    lava_mutex_lock(&deletion_queue->mutex);
+    if(!lava_reserve(deletion_queue->allocator, (void**)&deletion_queue->incoming, &deletion_queue->incoming_capacity, deletion_queue->incoming_count + 1, sizeof(lava_deletion))) {
+        lava_mutex_unlock(&deletion_queue->mutex);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    deletion_queue->incoming[deletion_queue->incoming_count++] = *deletion;
+    //The thread only sleeps while nothing is queued
+    if(1 == deletion_queue->incoming_count) {
+        lava_condition_broadcast(&deletion_queue->condition);
+    }
+    lava_mutex_unlock(&deletion_queue->mutex);
+    return VK_SUCCESS;
+}
+
+static uint32_t lava_drain_deletions(lava_deletion_queue* deletion_queue, bool wait)
+{
+    lava_mutex_lock(&deletion_queue->retire_mutex);
+    lava_mutex_lock(&deletion_queue->mutex);
+    uint32_t incoming_count = deletion_queue->incoming_count;
+    if(0 < incoming_count && lava_reserve(deletion_queue->allocator, (void**)&deletion_queue->retiring, &deletion_queue->retiring_capacity, deletion_queue->retiring_count + incoming_count, sizeof(lava_deletion))) {
+        memcpy(deletion_queue->retiring + deletion_queue->retiring_count, deletion_queue->incoming, sizeof(lava_deletion) * incoming_count);
+        deletion_queue->retiring_count += incoming_count;
+        deletion_queue->incoming_count = 0;
+    }
+    lava_mutex_unlock(&deletion_queue->mutex);
+
+    //One counter query per queue for the whole batch
+    lava_queue* updated[LAVA_DELETION_MAX_UPDATED_QUEUES];
+    uint32_t updated_count = 0;
+    for(uint32_t i = 0; i < deletion_queue->retiring_count; ++i) {
+        lava_submit_ticket ticket = deletion_queue->retiring[i].ticket;
+        if(lava_is_complete(ticket)) {
+            continue;
+        }
+        if(wait) {
+            lava_wait_ticket(ticket, UINT64_MAX);
+            continue;
+        }
+        bool found = false;
+        for(uint32_t j = 0; j < updated_count && !found; ++j) {
+            found = updated[j] == ticket.queue;
+        }
+        if(!found) {
+            lava_update_queue(ticket.queue);
+            if(updated_count < LAVA_DELETION_MAX_UPDATED_QUEUES) {
+                updated[updated_count++] = ticket.queue;
+            }
+        }
+    }
+
+    uint32_t count = 0;
+    uint32_t deleted = 0;
+    for(uint32_t i = 0; i < deletion_queue->retiring_count; ++i) {
+        const lava_deletion* deletion = &deletion_queue->retiring[i];
+        if(lava_is_complete(deletion->ticket)) {
+            lava_delete_object(deletion_queue, deletion);
+            ++deleted;
+        } else {
+            deletion_queue->retiring[count++] = *deletion;
+        }
+    }
+    deletion_queue->retiring_count = count;
+    lava_mutex_unlock(&deletion_queue->retire_mutex);
+    return deleted;
+}
+
+/**
+ @brief Find the first retiring request whose batch is submitted but not complete.
+ */
+static bool lava_next_running_deletion(lava_deletion_queue* deletion_queue, lava_submit_ticket* ticket)
+{
+    bool found = false;
+    lava_mutex_lock(&deletion_queue->retire_mutex);
+    for(uint32_t i = 0; i < deletion_queue->retiring_count && !found; ++i) {
+        lava_submit_ticket next = deletion_queue->retiring[i].ticket;
+        if(!lava_is_complete(next) && (int64_t)next.value <= lava_atomic_load64(&next.queue->submitted)) {
+            *ticket = next;
+            found = true;
+        }
+    }
+    lava_mutex_unlock(&deletion_queue->retire_mutex);
+    return found;
+}
+
+static LAVA_THREAD_PROC(lava_deletion_proc)
+{
+    lava_deletion_queue* deletion_queue = (lava_deletion_queue*)argument;
+    bool running = false;
+    while(0 == lava_atomic_load32(&deletion_queue->quit)) {
+        //Without GPU work to wait for, only a new request or the destruction wakes the thread up.
+        //Requests of batches the application has not flushed yet are looked at again then.
+        lava_mutex_lock(&deletion_queue->mutex);
+        while(0 == deletion_queue->incoming_count && !running && 0 == lava_atomic_load32(&deletion_queue->quit)) {
+            lava_condition_wait(&deletion_queue->condition, &deletion_queue->mutex);
+        }
+        lava_mutex_unlock(&deletion_queue->mutex);
+        lava_drain_deletions(deletion_queue, false);
+        //Requests are mostly in submission order, the first submitted one is the next to retire.
+        //Only wait on the timeline: flushing would submit batches the application deferred on its own queue.
+        lava_submit_ticket ticket;
+        running = lava_next_running_deletion(deletion_queue, &ticket);
+        if(running) {
+            lava_wait_timeline(ticket, LAVA_DELETION_WAIT_TIMEOUT);
+        }
+    }
+    return LAVA_THREAD_RETURN;
+}
+
+VkResult LAVA_API lava_create_deletion_queue(const lava_deletion_queue_create_info* create_info, lava_deletion_queue** deletion_queue)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != deletion_queue);
+    lava_deletion_queue* new_queue = (lava_deletion_queue*)lava_calloc(create_info->allocator, sizeof(lava_deletion_queue));
+    if(LAVA_NULL == new_queue) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_queue->device = create_info->device;
+    new_queue->allocator = create_info->allocator;
+    new_queue->memory_allocator = create_info->memory_allocator;
+    new_queue->flags = create_info->flags;
+    lava_mutex_initialize(&new_queue->mutex);
+    lava_condition_initialize(&new_queue->condition);
+    lava_mutex_initialize(&new_queue->retire_mutex);
+    if(0 == (create_info->flags & LAVA_DELETION_QUEUE_CREATE_MANUAL_BIT)) {
+        if(!lava_thread_create(&new_queue->thread, lava_deletion_proc, new_queue)) {
+            lava_destroy_deletion_queue(new_queue);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        new_queue->started = true;
+    }
+    *deletion_queue = new_queue;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_deletion_queue(lava_deletion_queue* deletion_queue)
+{
+    if(LAVA_NULL == deletion_queue) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = deletion_queue->allocator;
+    if(deletion_queue->started) {
+        lava_mutex_lock(&deletion_queue->mutex);
+        lava_atomic_add32(&deletion_queue->quit, 1);
+        lava_condition_broadcast(&deletion_queue->condition);
+        lava_mutex_unlock(&deletion_queue->mutex);
+        lava_thread_join(deletion_queue->thread);
+    }
+    lava_drain_deletions(deletion_queue, true);
+    lava_free(allocator, deletion_queue->incoming);
+    lava_free(allocator, deletion_queue->retiring);
+    lava_mutex_terminate(&deletion_queue->retire_mutex);
+    lava_condition_terminate(&deletion_queue->condition);
+    lava_mutex_terminate(&deletion_queue->mutex);
+    lava_free(allocator, deletion_queue);
+}
+
+VkResult LAVA_API lava_defer_destroy(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkObjectType type, uint64_t handle)
+{
+    assert(LAVA_NULL != deletion_queue);
+    if(!lava_is_deletable(type)) {
+        return VK_ERROR_UNKNOWN;
+    }
+    lava_deletion deletion;
+    memset(&deletion, 0, sizeof(lava_deletion));
+    deletion.ticket = ticket;
+    deletion.kind = LAVA_DELETION_OBJECT;
+    deletion.type = type;
+    deletion.handle = handle;
+    return lava_push_deletion(deletion_queue, &deletion);
+}
+
+VkResult LAVA_API lava_defer_destroy_buffer(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkBuffer buffer, lava_allocation* allocation)
+{
+    assert(LAVA_NULL != deletion_queue);
+    if(LAVA_NULL == deletion_queue->memory_allocator) {
+        return VK_ERROR_UNKNOWN;
+    }
+    lava_deletion deletion;
+    memset(&deletion, 0, sizeof(lava_deletion));
+    deletion.ticket = ticket;
+    deletion.kind = LAVA_DELETION_BUFFER;
+    deletion.handle = LAVA_OBJECT_HANDLE(buffer);
+    deletion.allocation = allocation;
+    return lava_push_deletion(deletion_queue, &deletion);
+}
+
+VkResult LAVA_API lava_defer_destroy_image(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkImage image, lava_allocation* allocation)
+{
+    assert(LAVA_NULL != deletion_queue);
+    if(LAVA_NULL == deletion_queue->memory_allocator) {
+        return VK_ERROR_UNKNOWN;
+    }
+    lava_deletion deletion;
+    memset(&deletion, 0, sizeof(lava_deletion));
+    deletion.ticket = ticket;
+    deletion.kind = LAVA_DELETION_IMAGE;
+    deletion.handle = LAVA_OBJECT_HANDLE(image);
+    deletion.allocation = allocation;
+    return lava_push_deletion(deletion_queue, &deletion);
+}
+
+VkResult LAVA_API lava_defer_free_memory(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, lava_allocation* allocation)
+{
+    assert(LAVA_NULL != deletion_queue);
+    if(LAVA_NULL == deletion_queue->memory_allocator) {
+        return VK_ERROR_UNKNOWN;
+    }
+    lava_deletion deletion;
+    memset(&deletion, 0, sizeof(lava_deletion));
+    deletion.ticket = ticket;
+    deletion.kind = LAVA_DELETION_MEMORY;
+    deletion.allocation = allocation;
+    return lava_push_deletion(deletion_queue, &deletion);
+}
+
+VkResult LAVA_API lava_defer_call(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, PFN_lava_deferred_call function, void* user_data)
+{
+    assert(LAVA_NULL != deletion_queue);
+    assert(LAVA_NULL != function);
+    lava_deletion deletion;
+    memset(&deletion, 0, sizeof(lava_deletion));
+    deletion.ticket = ticket;
+    deletion.kind = LAVA_DELETION_CALL;
+    deletion.function = function;
+    deletion.user_data = user_data;
+    return lava_push_deletion(deletion_queue, &deletion);
+}
+
+uint32_t LAVA_API lava_collect_deletions(lava_deletion_queue* deletion_queue, bool wait)
+{
+    assert(LAVA_NULL != deletion_queue);
+    return lava_drain_deletions(deletion_queue, wait);
+}
+
+//--- Synchronization pools
+//--------------------------------------------------------------------
+typedef struct lava_pending_semaphore_t
+{
+    VkSemaphore semaphore;
+    lava_submit_ticket ticket;
+} lava_pending_semaphore;
+
+struct lava_sync_pool_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_mutex mutex;
+    VkFence* free_fences;
+    uint32_t free_fence_count;
+    uint32_t free_fence_capacity;
+    VkFence* released_fences; //!< Signaled, reset with one vkResetFences before reuse.
+    uint32_t released_fence_count;
+    uint32_t released_fence_capacity;
+    VkSemaphore* free_semaphores;
+    uint32_t free_semaphore_count;
+    uint32_t free_semaphore_capacity;
+    lava_pending_semaphore* pending_semaphores; //!< In release order.
+    uint32_t pending_semaphore_count;
+    uint32_t pending_semaphore_capacity;
+    uint32_t fence_count;
+    uint32_t semaphore_count;
+    uint64_t created_fences;
+    uint64_t created_semaphores;
+    uint64_t acquired_fences;
+    uint64_t acquired_semaphores;
+};
+
+static VkResult lava_sync_pool_create_fence(lava_sync_pool* pool, VkFence* fence)
+{
+    VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, LAVA_NULL, 0};
+    VkResult result = vkCreateFence(pool->device->device_, &fence_info, pool->allocator, fence);
+    if(VK_SUCCESS == result) {
+        ++pool->fence_count;
+        ++pool->created_fences;
+    }
+    return result;
+}
+
+static VkResult lava_sync_pool_create_semaphore(lava_sync_pool* pool, VkSemaphore* semaphore)
+{
+    VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, LAVA_NULL, 0};
+    VkResult result = vkCreateSemaphore(pool->device->device_, &semaphore_info, pool->allocator, semaphore);
+    if(VK_SUCCESS == result) {
+        ++pool->semaphore_count;
+        ++pool->created_semaphores;
+    }
+    return result;
+}
+
+/**
+ @brief Move semaphores whose consumer has retired to the free list.
+ */
+static void lava_sync_pool_retire_semaphores(lava_sync_pool* pool)
+{
+    if(!lava_reserve(pool->allocator, (void**)&pool->free_semaphores, &pool->free_semaphore_capacity, pool->free_semaphore_count + pool->pending_semaphore_count, sizeof(VkSemaphore))) {
+        return;
+    }
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < pool->pending_semaphore_count; ++i) {
+        const lava_pending_semaphore* pending = &pool->pending_semaphores[i];
+        if(lava_is_complete(pending->ticket)) {
+            pool->free_semaphores[pool->free_semaphore_count++] = pending->semaphore;
+        } else {
+            pool->pending_semaphores[count++] = *pending;
+        }
+    }
+    pool->pending_semaphore_count = count;
+}
+
+VkResult LAVA_API lava_create_sync_pool(const lava_sync_pool_create_info* create_info, lava_sync_pool** pool)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != pool);
+    lava_sync_pool* new_pool = (lava_sync_pool*)lava_calloc(create_info->allocator, sizeof(lava_sync_pool));
+    if(LAVA_NULL == new_pool) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_pool->device = create_info->device;
+    new_pool->allocator = create_info->allocator;
+    lava_mutex_initialize(&new_pool->mutex);
+    if(!lava_reserve(new_pool->allocator, (void**)&new_pool->free_fences, &new_pool->free_fence_capacity, create_info->initial_fence_count + 1, sizeof(VkFence))
+       || !lava_reserve(new_pool->allocator, (void**)&new_pool->free_semaphores, &new_pool->free_semaphore_capacity, create_info->initial_semaphore_count + 1, sizeof(VkSemaphore))) {
+        lava_destroy_sync_pool(new_pool);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < create_info->initial_fence_count; ++i) {
+        VkResult result = lava_sync_pool_create_fence(new_pool, &new_pool->free_fences[new_pool->free_fence_count]);
+        if(VK_SUCCESS != result) {
+            lava_destroy_sync_pool(new_pool);
+            return result;
+        }
+        ++new_pool->free_fence_count;
+    }
+    for(uint32_t i = 0; i < create_info->initial_semaphore_count; ++i) {
+        VkResult result = lava_sync_pool_create_semaphore(new_pool, &new_pool->free_semaphores[new_pool->free_semaphore_count]);
+        if(VK_SUCCESS != result) {
+            lava_destroy_sync_pool(new_pool);
+            return result;
+        }
+        ++new_pool->free_semaphore_count;
+    }
+    *pool = new_pool;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_sync_pool(lava_sync_pool* pool)
+{
+    if(LAVA_NULL == pool) {
+        return;
+    }
+    VkDevice device = pool->device->device_;
+    const VkAllocationCallbacks* allocator = pool->allocator;
+    for(uint32_t i = 0; i < pool->free_fence_count; ++i) {
+        vkDestroyFence(device, pool->free_fences[i], allocator);
+    }
+    for(uint32_t i = 0; i < pool->released_fence_count; ++i) {
+        vkDestroyFence(device, pool->released_fences[i], allocator);
+    }
+    for(uint32_t i = 0; i < pool->free_semaphore_count; ++i) {
+        vkDestroySemaphore(device, pool->free_semaphores[i], allocator);
+    }
+    for(uint32_t i = 0; i < pool->pending_semaphore_count; ++i) {
+        vkDestroySemaphore(device, pool->pending_semaphores[i].semaphore, allocator);
+    }
+    lava_free(allocator, pool->free_fences);
+    lava_free(allocator, pool->released_fences);
+    lava_free(allocator, pool->free_semaphores);
+    lava_free(allocator, pool->pending_semaphores);
+    lava_mutex_terminate(&pool->mutex);
+    lava_free(allocator, pool);
+}
+
+VkResult LAVA_API lava_acquire_fence(lava_sync_pool* pool, VkFence* fence)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != fence);
+    VkResult result = VK_SUCCESS;
+    lava_mutex_lock(&pool->mutex);
+    if(pool->free_fence_count <= 0 && 0 < pool->released_fence_count
+       && lava_reserve(pool->allocator, (void**)&pool->free_fences, &pool->free_fence_capacity, pool->released_fence_count, sizeof(VkFence))) {
+        //One reset for every fence released since the last time
+        result = vkResetFences(pool->device->device_, pool->released_fence_count, pool->released_fences);
+        if(VK_SUCCESS == result) {
+            memcpy(pool->free_fences, pool->released_fences, sizeof(VkFence) * pool->released_fence_count);
+            pool->free_fence_count = pool->released_fence_count;
+            pool->released_fence_count = 0;
+        }
+    }
+    if(0 < pool->free_fence_count) {
+        *fence = pool->free_fences[--pool->free_fence_count];
+    } else if(VK_SUCCESS == result) {
+        result = lava_sync_pool_create_fence(pool, fence);
+    }
+    if(VK_SUCCESS == result) {
+        ++pool->acquired_fences;
+    }
+    lava_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+void LAVA_API lava_release_fence(lava_sync_pool* pool, VkFence fence)
+{
+    assert(LAVA_NULL != pool);
+    if(VK_NULL_HANDLE == fence) {
+        return;
+    }
+    lava_mutex_lock(&pool->mutex);
+    if(lava_reserve(pool->allocator, (void**)&pool->released_fences, &pool->released_fence_capacity, pool->released_fence_count + 1, sizeof(VkFence))) {
+        pool->released_fences[pool->released_fence_count++] = fence;
+    } else {
+        vkDestroyFence(pool->device->device_, fence, pool->allocator);
+        --pool->fence_count;
+    }
+    lava_mutex_unlock(&pool->mutex);
+}
+
+VkResult LAVA_API lava_acquire_semaphore(lava_sync_pool* pool, VkSemaphore* semaphore)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != semaphore);
+    VkResult result = VK_SUCCESS;
+    lava_mutex_lock(&pool->mutex);
+    if(pool->free_semaphore_count <= 0 && 0 < pool->pending_semaphore_count) {
+        lava_sync_pool_retire_semaphores(pool);
+        if(pool->free_semaphore_count <= 0 && LAVA_NULL != pool->pending_semaphores[0].ticket.queue) {
+            //The cached counter may lag behind, ask once for the oldest consumer
+            lava_update_queue(pool->pending_semaphores[0].ticket.queue);
+            lava_sync_pool_retire_semaphores(pool);
+        }
+    }
+    if(0 < pool->free_semaphore_count) {
+        *semaphore = pool->free_semaphores[--pool->free_semaphore_count];
+    } else {
+        result = lava_sync_pool_create_semaphore(pool, semaphore);
+    }
+    if(VK_SUCCESS == result) {
+        ++pool->acquired_semaphores;
+    }
+    lava_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+void LAVA_API lava_release_semaphore(lava_sync_pool* pool, VkSemaphore semaphore, lava_submit_ticket ticket)
+{
+    assert(LAVA_NULL != pool);
+    if(VK_NULL_HANDLE == semaphore) {
+        return;
+    }
+    lava_mutex_lock(&pool->mutex);
+    if(lava_reserve(pool->allocator, (void**)&pool->pending_semaphores, &pool->pending_semaphore_capacity, pool->pending_semaphore_count + 1, sizeof(lava_pending_semaphore))) {
+        lava_pending_semaphore* pending = &pool->pending_semaphores[pool->pending_semaphore_count++];
+        pending->semaphore = semaphore;
+        pending->ticket = ticket;
+    } else {
+        vkDestroySemaphore(pool->device->device_, semaphore, pool->allocator);
+        --pool->semaphore_count;
+    }
+    lava_mutex_unlock(&pool->mutex);
+}
+
+void LAVA_API lava_get_sync_pool_stats(lava_sync_pool* pool, lava_sync_pool_stats* stats)
+{
+    assert(LAVA_NULL != pool);
+    assert(LAVA_NULL != stats);
+    lava_mutex_lock(&pool->mutex);
+    stats->fence_count = pool->fence_count;
+    stats->free_fence_count = pool->free_fence_count + pool->released_fence_count;
+    stats->semaphore_count = pool->semaphore_count;
+    stats->free_semaphore_count = pool->free_semaphore_count + pool->pending_semaphore_count;
+    stats->created_fences = pool->created_fences;
+    stats->created_semaphores = pool->created_semaphores;
+    stats->acquired_fences = pool->acquired_fences;
+    stats->acquired_semaphores = pool->acquired_semaphores;
+    lava_mutex_unlock(&pool->mutex);
+}
+
+//--- Queue families
+//--------------------------------------------------------------------
+#define LAVA_MAX_QUEUE_FAMILIES (32)
+#define LAVA_OWNERSHIP_BARRIER_BATCH (32)
+#define LAVA_ROLE_COMMAND_BUFFER_BATCH (16)
+
+static const float lava_queue_priorities[LAVA_QUEUE_ROLE_COUNT] = {1.0f, 1.0f, 1.0f};
+
+struct lava_device_queues_t
+{
+    const VkAllocationCallbacks* allocator;
+    lava_queue* queues[LAVA_QUEUE_ROLE_COUNT];
+    bool owned[LAVA_QUEUE_ROLE_COUNT];
+    uint32_t family_indices[LAVA_QUEUE_ROLE_COUNT];
+};
+
+static uint32_t lava_find_queue_family(uint32_t count, const VkQueueFamilyProperties* properties, VkQueueFlags required, VkQueueFlags excluded)
+{
+    for(uint32_t i = 0; i < count; ++i) {
+        if(0 < properties[i].queueCount && required == (properties[i].queueFlags & required) && 0 == (properties[i].queueFlags & excluded)) {
+            return i;
+        }
+    }
+    return VK_QUEUE_FAMILY_IGNORED;
+}
+
+VkResult LAVA_API lava_find_queue_families(VkPhysicalDevice physical_device, lava_queue_families* families)
+{
+    assert(LAVA_NULL != families);
+    VkQueueFamilyProperties properties[LAVA_MAX_QUEUE_FAMILIES];
+    uint32_t count = LAVA_MAX_QUEUE_FAMILIES;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, properties);
+    memset(families, 0, sizeof(lava_queue_families));
+
+    uint32_t graphics = lava_find_queue_family(count, properties, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT, 0);
+    if(VK_QUEUE_FAMILY_IGNORED == graphics) {
+        graphics = lava_find_queue_family(count, properties, VK_QUEUE_GRAPHICS_BIT, 0);
+    }
+    if(VK_QUEUE_FAMILY_IGNORED == graphics) {
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+    uint32_t compute = lava_find_queue_family(count, properties, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+    if(VK_QUEUE_FAMILY_IGNORED == compute) {
+        compute = graphics;
+    }
+    uint32_t transfer = lava_find_queue_family(count, properties, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    if(VK_QUEUE_FAMILY_IGNORED == transfer) {
+        transfer = compute;
+    }
+    families->family_indices[LAVA_QUEUE_ROLE_GRAPHICS] = graphics;
+    families->family_indices[LAVA_QUEUE_ROLE_COMPUTE] = compute;
+    families->family_indices[LAVA_QUEUE_ROLE_TRANSFER] = transfer;
+
+    //A role sharing a family takes the next queue of it, or the last one when the family has no more
+    uint32_t used[LAVA_MAX_QUEUE_FAMILIES];
+    memset(used, 0, sizeof(used));
+    for(uint32_t i = 0; i < LAVA_QUEUE_ROLE_COUNT; ++i) {
+        uint32_t family = families->family_indices[i];
+        if(used[family] < properties[family].queueCount) {
+            families->queue_indices[i] = used[family]++;
+        } else {
+            families->queue_indices[i] = used[family] - 1;
+        }
+    }
+    for(uint32_t i = 0; i < LAVA_QUEUE_ROLE_COUNT; ++i) {
+        uint32_t family = families->family_indices[i];
+        if(used[family] <= 0) {
+            continue;
+        }
+        VkDeviceQueueCreateInfo* queue_info = &families->queue_create_infos[families->queue_create_info_count++];
+        queue_info->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_info->pNext = LAVA_NULL;
+        queue_info->flags = 0;
+        queue_info->queueFamilyIndex = family;
+        queue_info->queueCount = used[family];
+        queue_info->pQueuePriorities = lava_queue_priorities;
+        used[family] = 0;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult LAVA_API lava_create_device_queues(const lava_device_queues_create_info* create_info, lava_device_queues** queues)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != create_info->families);
+    assert(LAVA_NULL != queues);
+    const lava_queue_families* families = create_info->families;
+    lava_device_queues* new_queues = (lava_device_queues*)lava_calloc(create_info->allocator, sizeof(lava_device_queues));
+    if(LAVA_NULL == new_queues) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_queues->allocator = create_info->allocator;
+    for(uint32_t i = 0; i < LAVA_QUEUE_ROLE_COUNT; ++i) {
+        new_queues->family_indices[i] = families->family_indices[i];
+        for(uint32_t j = 0; j < i && LAVA_NULL == new_queues->queues[i]; ++j) {
+            if(families->family_indices[j] == families->family_indices[i] && families->queue_indices[j] == families->queue_indices[i]) {
+                new_queues->queues[i] = new_queues->queues[j];
+            }
+        }
+        if(LAVA_NULL != new_queues->queues[i]) {
+            continue;
+        }
+        lava_queue_create_info queue_info = {create_info->device, create_info->allocator, VK_NULL_HANDLE, families->family_indices[i]};
+        vkGetDeviceQueue(create_info->device->device_, families->family_indices[i], families->queue_indices[i], &queue_info.queue);
+        VkResult result = lava_create_queue(&queue_info, &new_queues->queues[i]);
+        if(VK_SUCCESS != result) {
+            lava_destroy_device_queues(new_queues);
+            return result;
+        }
+        new_queues->owned[i] = true;
+    }
+    *queues = new_queues;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_device_queues(lava_device_queues* queues)
+{
+    if(LAVA_NULL == queues) {
+        return;
+    }
+    for(uint32_t i = 0; i < LAVA_QUEUE_ROLE_COUNT; ++i) {
+        if(queues->owned[i]) {
+            lava_destroy_queue(queues->queues[i]);
+        }
+    }
+    lava_free(queues->allocator, queues);
+}
+
+lava_queue* LAVA_API lava_get_role_queue(const lava_device_queues* queues, lava_queue_role role)
+{
+    assert(LAVA_NULL != queues);
+    assert(role < LAVA_QUEUE_ROLE_COUNT);
+    return queues->queues[role];
+}
+
+uint32_t LAVA_API lava_get_role_family_index(const lava_device_queues* queues, lava_queue_role role)
+{
+    assert(LAVA_NULL != queues);
+    assert(role < LAVA_QUEUE_ROLE_COUNT);
+    return queues->family_indices[role];
+}
+
+bool LAVA_API lava_roles_need_semaphore(const lava_device_queues* queues, lava_queue_role role0, lava_queue_role role1)
+{
+    assert(LAVA_NULL != queues);
+    assert(role0 < LAVA_QUEUE_ROLE_COUNT && role1 < LAVA_QUEUE_ROLE_COUNT);
+    return queues->queues[role0] != queues->queues[role1];
+}
+
+VkSemaphoreSubmitInfo LAVA_API lava_ticket_wait_info(lava_submit_ticket ticket, VkPipelineStageFlags2 stage_mask)
+{
+    assert(LAVA_NULL != ticket.queue);
+    VkSemaphoreSubmitInfo wait_info;
+    memset(&wait_info, 0, sizeof(VkSemaphoreSubmitInfo));
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    wait_info.semaphore = ticket.queue->timeline;
+    wait_info.value = ticket.value;
+    wait_info.stageMask = stage_mask;
+    return wait_info;
+}
+
+VkResult LAVA_API lava_submit_role(lava_device_queues* queues, lava_queue_role role, uint32_t wait_count, const lava_submit_ticket* waits, uint32_t command_buffer_count, const VkCommandBuffer* command_buffers, lava_submit_ticket* ticket)
+{
+    assert(LAVA_NULL != queues);
+    assert(role < LAVA_QUEUE_ROLE_COUNT);
+    lava_queue* queue = queues->queues[role];
+
+    //Only the latest ticket of each other queue matters, which are at most the other roles
+    VkSemaphoreSubmitInfo wait_infos[LAVA_QUEUE_ROLE_COUNT];
+    uint32_t wait_info_count = 0;
+    for(uint32_t i = 0; i < wait_count; ++i) {
+        if(LAVA_NULL == waits[i].queue || queue == waits[i].queue || lava_is_complete(waits[i])) {
+            continue;
+        }
+        uint32_t index = 0;
+        while(index < wait_info_count && wait_infos[index].semaphore != waits[i].queue->timeline) {
+            ++index;
+        }
+        if(index < wait_info_count) {
+            wait_infos[index].value = (wait_infos[index].value < waits[i].value) ? waits[i].value : wait_infos[index].value;
+        } else if(wait_info_count < LAVA_QUEUE_ROLE_COUNT) {
+            wait_infos[wait_info_count++] = lava_ticket_wait_info(waits[i], VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+        }
+    }
+    VkCommandBufferSubmitInfo command_buffer_infos[LAVA_ROLE_COMMAND_BUFFER_BATCH];
+    VkCommandBufferSubmitInfo* infos = command_buffer_infos;
+    if(LAVA_ROLE_COMMAND_BUFFER_BATCH < command_buffer_count) {
+        infos = (VkCommandBufferSubmitInfo*)lava_malloc(queues->allocator, sizeof(VkCommandBufferSubmitInfo) * command_buffer_count);
+        if(LAVA_NULL == infos) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    for(uint32_t i = 0; i < command_buffer_count; ++i) {
+        infos[i].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+        infos[i].pNext = LAVA_NULL;
+        infos[i].commandBuffer = command_buffers[i];
+        infos[i].deviceMask = 0;
+    }
+    VkSubmitInfo2 submit_info;
+    memset(&submit_info, 0, sizeof(VkSubmitInfo2));
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submit_info.waitSemaphoreInfoCount = wait_info_count;
+    submit_info.pWaitSemaphoreInfos = wait_infos;
+    submit_info.commandBufferInfoCount = command_buffer_count;
+    submit_info.pCommandBufferInfos = infos;
+    VkResult result = lava_submit(queue, 1, &submit_info, VK_NULL_HANDLE, ticket);
+    if(infos != command_buffer_infos) {
+        lava_free(queues->allocator, infos);
+    }
+    return result;
+}
+
+static void lava_cmd_ownership_barriers(VkCommandBuffer command_buffer, uint32_t image_count, const VkImageMemoryBarrier2* image_barriers, uint32_t buffer_count, const VkBufferMemoryBarrier2* buffer_barriers)
+{
+    if(image_count <= 0 && buffer_count <= 0) {
+        return;
+    }
+    VkDependencyInfo dependency_info;
+    memset(&dependency_info, 0, sizeof(VkDependencyInfo));
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.bufferMemoryBarrierCount = buffer_count;
+    dependency_info.pBufferMemoryBarriers = buffer_barriers;
+    dependency_info.imageMemoryBarrierCount = image_count;
+    dependency_info.pImageMemoryBarriers = image_barriers;
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+}
+
+/**
+ @brief Record the release or the acquire half of ownership transfers, in batches of barriers.
+ */
+static void lava_cmd_ownership(const lava_device_queues* queues, VkCommandBuffer command_buffer, uint32_t transfer_count, const lava_ownership_transfer* transfers, bool acquire)
+{
+    VkImageMemoryBarrier2 image_barriers[LAVA_OWNERSHIP_BARRIER_BATCH];
+    VkBufferMemoryBarrier2 buffer_barriers[LAVA_OWNERSHIP_BARRIER_BATCH];
+    uint32_t image_count = 0;
+    uint32_t buffer_count = 0;
+    for(uint32_t i = 0; i < transfer_count; ++i) {
+        const lava_ownership_transfer* transfer = &transfers[i];
+        uint32_t src_family = queues->family_indices[transfer->src_role];
+        uint32_t dst_family = queues->family_indices[transfer->dst_role];
+        bool family_change = src_family != dst_family;
+        if(!acquire && !family_change) {
+            continue;
+        }
+        VkPipelineStageFlags2 src_stage = transfer->src_state.stage;
+        VkAccessFlags2 src_access = transfer->src_state.access & lava_write_access_mask();
+        VkPipelineStageFlags2 dst_stage = transfer->dst_state.stage;
+        VkAccessFlags2 dst_access = transfer->dst_state.access;
+        if(family_change) {
+            if(acquire) {
+                //Chains to the semaphore wait in front of the batch, the release already made the writes available
+                src_stage = (0 != dst_stage) ? dst_stage : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+                src_access = 0;
+            } else {
+                dst_stage = VK_PIPELINE_STAGE_2_NONE;
+                dst_access = 0;
+            }
+        } else {
+            src_family = VK_QUEUE_FAMILY_IGNORED;
+            dst_family = VK_QUEUE_FAMILY_IGNORED;
+        }
+        if(VK_NULL_HANDLE != transfer->image) {
+            VkImageMemoryBarrier2* barrier = &image_barriers[image_count++];
+            barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            barrier->pNext = LAVA_NULL;
+            barrier->srcStageMask = src_stage;
+            barrier->srcAccessMask = src_access;
+            barrier->dstStageMask = dst_stage;
+            barrier->dstAccessMask = dst_access;
+            barrier->oldLayout = transfer->src_state.layout;
+            barrier->newLayout = transfer->dst_state.layout;
+            barrier->srcQueueFamilyIndex = src_family;
+            barrier->dstQueueFamilyIndex = dst_family;
+            barrier->image = transfer->image;
+            barrier->subresourceRange = transfer->range;
+        } else {
+            VkBufferMemoryBarrier2* barrier = &buffer_barriers[buffer_count++];
+            barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+            barrier->pNext = LAVA_NULL;
+            barrier->srcStageMask = src_stage;
+            barrier->srcAccessMask = src_access;
+            barrier->dstStageMask = dst_stage;
+            barrier->dstAccessMask = dst_access;
+            barrier->srcQueueFamilyIndex = src_family;
+            barrier->dstQueueFamilyIndex = dst_family;
+            barrier->buffer = transfer->buffer;
+            barrier->offset = transfer->offset;
+            barrier->size = transfer->size;
+        }
+        if(LAVA_OWNERSHIP_BARRIER_BATCH <= image_count || LAVA_OWNERSHIP_BARRIER_BATCH <= buffer_count) {
+            lava_cmd_ownership_barriers(command_buffer, image_count, image_barriers, buffer_count, buffer_barriers);
+            image_count = 0;
+            buffer_count = 0;
+        }
+    }
+    lava_cmd_ownership_barriers(command_buffer, image_count, image_barriers, buffer_count, buffer_barriers);
+}
+
+void LAVA_API lava_cmd_release_ownership(const lava_device_queues* queues, VkCommandBuffer command_buffer, uint32_t transfer_count, const lava_ownership_transfer* transfers)
+{
+    assert(LAVA_NULL != queues);
+    assert(0 == transfer_count || LAVA_NULL != transfers);
+    lava_cmd_ownership(queues, command_buffer, transfer_count, transfers, false);
+}
+
+void LAVA_API lava_cmd_acquire_ownership(const lava_device_queues* queues, VkCommandBuffer command_buffer, uint32_t transfer_count, const lava_ownership_transfer* transfers)
+{
+    assert(LAVA_NULL != queues);
+    assert(0 == transfer_count || LAVA_NULL != transfers);
+    lava_cmd_ownership(queues, command_buffer, transfer_count, transfers, true);
+}
+
+//--- Descriptor cache
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_SETS_PER_POOL (256)
+#define LAVA_DESCRIPTOR_NONE (0xFFFFFFFFU)
+#define LAVA_DESCRIPTOR_WRITE_BATCH (32)
+
+typedef struct lava_descriptor_entry_t
+{
+    VkDescriptorSetLayout layout;
+    VkDescriptorSet set;
+    uint32_t first_binding; //!< Copy of the bindings, to tell hash collisions apart.
+    uint32_t binding_count;
+    uint32_t next; //!< Next entry with the same hash.
+} lava_descriptor_entry;
+
+typedef struct lava_descriptor_frame_t
+{
+    VkDescriptorPool* pools;
+    uint32_t pool_count;
+    uint32_t pool_capacity;
+    uint32_t current_pool;
+    uint64_t reset_frame; //!< Frame index plus one of the last reset.
+    lava_handle_map map; //!< Hash to the first entry.
+    lava_descriptor_entry* entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    lava_descriptor_binding* bindings;
+    uint32_t binding_count;
+    uint32_t binding_capacity;
+    lava_descriptor_cache_stats stats;
+    char padding[64]; //!< Frames of different threads are written concurrently.
+} lava_descriptor_frame;
+
+struct lava_descriptor_cache_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t thread_count;
+    uint32_t frame_count;
+    uint32_t sets_per_pool;
+    uint32_t pool_size_count;
+    VkDescriptorPoolSize* pool_sizes;
+    uint64_t frame_index;
+    lava_descriptor_frame* frames; //!< frame_count slots of thread_count frames.
+};
+
+static bool lava_is_image_descriptor(VkDescriptorType type)
+{
+    return VK_DESCRIPTOR_TYPE_SAMPLER == type || VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER == type || VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE == type || VK_DESCRIPTOR_TYPE_STORAGE_IMAGE == type || VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT == type;
+}
+
+static bool lava_is_texel_descriptor(VkDescriptorType type)
+{
+    return VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER == type || VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER == type;
+}
+
+static uint64_t lava_hash_descriptors(VkDescriptorSetLayout layout, uint32_t binding_count, const lava_descriptor_binding* bindings)
+{
+    uint64_t hash = lava_hash_combine(0, LAVA_OBJECT_HANDLE(layout));
+    for(uint32_t i = 0; i < binding_count; ++i) {
+        const lava_descriptor_binding* binding = &bindings[i];
+        hash = lava_hash_combine(hash, ((uint64_t)binding->binding << 32) | binding->array_element);
+        hash = lava_hash_combine(hash, binding->type);
+        if(lava_is_image_descriptor(binding->type)) {
+            hash = lava_hash_combine(hash, LAVA_OBJECT_HANDLE(binding->image_info.sampler));
+            hash = lava_hash_combine(hash, LAVA_OBJECT_HANDLE(binding->image_info.imageView));
+            hash = lava_hash_combine(hash, binding->image_info.imageLayout);
+        } else if(lava_is_texel_descriptor(binding->type)) {
+            hash = lava_hash_combine(hash, LAVA_OBJECT_HANDLE(binding->texel_buffer_view));
+        } else {
+            hash = lava_hash_combine(hash, LAVA_OBJECT_HANDLE(binding->buffer_info.buffer));
+            hash = lava_hash_combine(hash, binding->buffer_info.offset);
+            hash = lava_hash_combine(hash, binding->buffer_info.range);
+        }
+    }
+    return hash;
+}
+
+static bool lava_descriptor_binding_equal(const lava_descriptor_binding* x0, const lava_descriptor_binding* x1)
+{
+    if(x0->binding != x1->binding || x0->array_element != x1->array_element || x0->type != x1->type) {
+        return false;
+    }
+    if(lava_is_image_descriptor(x0->type)) {
+        return x0->image_info.sampler == x1->image_info.sampler && x0->image_info.imageView == x1->image_info.imageView && x0->image_info.imageLayout == x1->image_info.imageLayout;
+    }
+    if(lava_is_texel_descriptor(x0->type)) {
+        return x0->texel_buffer_view == x1->texel_buffer_view;
+    }
+    return x0->buffer_info.buffer == x1->buffer_info.buffer && x0->buffer_info.offset == x1->buffer_info.offset && x0->buffer_info.range == x1->buffer_info.range;
+}
+
+static void lava_reset_descriptor_frame(lava_descriptor_cache* cache, lava_descriptor_frame* frame)
+{
+    //Only pools used since the last reset hold sets
+    for(uint32_t i = 0; i < frame->pool_count && i <= frame->current_pool; ++i) {
+        vkResetDescriptorPool(cache->device->device_, frame->pools[i], 0);
+    }
+    frame->current_pool = 0;
+    frame->entry_count = 0;
+    frame->binding_count = 0;
+    lava_handle_map_clear(&frame->map);
+}
+
+static VkResult lava_allocate_descriptor_set(lava_descriptor_cache* cache, lava_descriptor_frame* frame, VkDescriptorSetLayout layout, VkDescriptorSet* set)
+{
+    for(;;) {
+        if(frame->pool_count <= frame->current_pool) {
+            if(!lava_reserve(cache->allocator, (void**)&frame->pools, &frame->pool_capacity, frame->pool_count + 1, sizeof(VkDescriptorPool))) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+            VkDescriptorPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO, LAVA_NULL, 0, cache->sets_per_pool, cache->pool_size_count, cache->pool_sizes};
+            VkResult result = vkCreateDescriptorPool(cache->device->device_, &pool_info, cache->allocator, &frame->pools[frame->pool_count]);
+            if(VK_SUCCESS != result) {
+                return result;
+            }
+            ++frame->pool_count;
+        }
+        VkDescriptorSetAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, LAVA_NULL, frame->pools[frame->current_pool], 1, &layout};
+        VkResult result = vkAllocateDescriptorSets(cache->device->device_, &allocate_info, set);
+        if(VK_ERROR_OUT_OF_POOL_MEMORY != result && VK_ERROR_FRAGMENTED_POOL != result) {
+            return result;
+        }
+        //A linear pool never frees, move on to the next one
+        ++frame->current_pool;
+    }
+}
+
+VkResult LAVA_API lava_create_descriptor_cache(const lava_descriptor_cache_create_info* create_info, lava_descriptor_cache** cache)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != cache);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_descriptor_cache* new_cache = (lava_descriptor_cache*)lava_calloc(allocator, sizeof(lava_descriptor_cache));
+    if(LAVA_NULL == new_cache) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_cache->device = create_info->device;
+    new_cache->allocator = allocator;
+    new_cache->thread_count = (0 < create_info->thread_count) ? create_info->thread_count : 1;
+    new_cache->frame_count = (0 < create_info->frame_count) ? create_info->frame_count : 1;
+    new_cache->sets_per_pool = (0 < create_info->sets_per_pool) ? create_info->sets_per_pool : LAVA_DEFAULT_SETS_PER_POOL;
+    static const VkDescriptorType default_types[] = {
+        VK_DESCRIPTOR_TYPE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+        VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+    };
+    static const uint32_t default_ratios[] = {1, 4, 4, 1, 1, 1, 2, 2, 1, 1, 1};
+    uint32_t pool_size_count = (0 < create_info->pool_size_count) ? create_info->pool_size_count : (uint32_t)(sizeof(default_types) / sizeof(default_types[0]));
+    new_cache->pool_sizes = (VkDescriptorPoolSize*)lava_malloc(allocator, sizeof(VkDescriptorPoolSize) * pool_size_count);
+    new_cache->frames = (lava_descriptor_frame*)lava_calloc(allocator, sizeof(lava_descriptor_frame) * new_cache->thread_count * new_cache->frame_count);
+    if(LAVA_NULL == new_cache->pool_sizes || LAVA_NULL == new_cache->frames) {
+        lava_destroy_descriptor_cache(new_cache);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_cache->pool_size_count = pool_size_count;
+    if(0 < create_info->pool_size_count) {
+        memcpy(new_cache->pool_sizes, create_info->pool_sizes, sizeof(VkDescriptorPoolSize) * pool_size_count);
+    } else {
+        for(uint32_t i = 0; i < pool_size_count; ++i) {
+            new_cache->pool_sizes[i].type = default_types[i];
+            new_cache->pool_sizes[i].descriptorCount = new_cache->sets_per_pool * default_ratios[i];
+        }
+    }
+    *cache = new_cache;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_descriptor_cache(lava_descriptor_cache* cache)
+{
+    if(LAVA_NULL == cache) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = cache->allocator;
+    if(LAVA_NULL != cache->frames) {
+        for(uint32_t i = 0; i < (cache->thread_count * cache->frame_count); ++i) {
+            lava_descriptor_frame* frame = &cache->frames[i];
+            for(uint32_t j = 0; j < frame->pool_count; ++j) {
+                vkDestroyDescriptorPool(cache->device->device_, frame->pools[j], allocator);
+            }
+            lava_free(allocator, frame->pools);
+            lava_free(allocator, frame->entries);
+            lava_free(allocator, frame->bindings);
+            lava_handle_map_terminate(allocator, &frame->map);
+        }
+    }
+    lava_free(allocator, cache->frames);
+    lava_free(allocator, cache->pool_sizes);
+    lava_free(allocator, cache);
+}
+
+void LAVA_API lava_begin_descriptor_frame(lava_descriptor_cache* cache, uint64_t frame_index)
+{
+    assert(LAVA_NULL != cache);
+    cache->frame_index = frame_index;
+}
+
+VkResult LAVA_API lava_get_descriptor_set(lava_descriptor_cache* cache, uint32_t thread_index, VkDescriptorSetLayout layout, uint32_t binding_count, const lava_descriptor_binding* bindings, VkDescriptorSet* set)
+{
+    assert(LAVA_NULL != cache);
+    assert(thread_index < cache->thread_count);
+    assert(0 == binding_count || LAVA_NULL != bindings);
+    assert(LAVA_NULL != set);
+    uint32_t slot = (uint32_t)(cache->frame_index % cache->frame_count);
+    lava_descriptor_frame* frame = &cache->frames[slot * cache->thread_count + thread_index];
+    if(frame->reset_frame != (cache->frame_index + 1)) {
+        lava_reset_descriptor_frame(cache, frame);
+        frame->reset_frame = cache->frame_index + 1;
+    }
+    ++frame->stats.requests;
+
+    uint64_t hash = lava_hash_descriptors(layout, binding_count, bindings);
+    uint32_t first = lava_handle_map_find(&frame->map, hash);
+    for(uint32_t index = first; LAVA_HANDLE_MAP_EMPTY != index; index = frame->entries[index].next) {
+        const lava_descriptor_entry* entry = &frame->entries[index];
+        if(entry->layout != layout || entry->binding_count != binding_count) {
+            continue;
+        }
+        uint32_t i = 0;
+        while(i < binding_count && lava_descriptor_binding_equal(&frame->bindings[entry->first_binding + i], &bindings[i])) {
+            ++i;
+        }
+        if(i == binding_count) {
+            ++frame->stats.hits;
+            frame->stats.saved_descriptor_writes += binding_count;
+            *set = entry->set;
+            return VK_SUCCESS;
+        }
+    }
+
+    if(!lava_reserve(cache->allocator, (void**)&frame->entries, &frame->entry_capacity, frame->entry_count + 1, sizeof(lava_descriptor_entry))
+       || !lava_reserve(cache->allocator, (void**)&frame->bindings, &frame->binding_capacity, frame->binding_count + binding_count, sizeof(lava_descriptor_binding))) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    VkResult result = lava_allocate_descriptor_set(cache, frame, layout, set);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    ++frame->stats.allocated_sets;
+    VkWriteDescriptorSet writes[LAVA_DESCRIPTOR_WRITE_BATCH];
+    uint32_t write_count = 0;
+    for(uint32_t i = 0; i < binding_count; ++i) {
+        const lava_descriptor_binding* binding = &bindings[i];
+        VkWriteDescriptorSet* write = &writes[write_count++];
+        write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write->pNext = LAVA_NULL;
+        write->dstSet = *set;
+        write->dstBinding = binding->binding;
+        write->dstArrayElement = binding->array_element;
+        write->descriptorCount = 1;
+        write->descriptorType = binding->type;
+        write->pImageInfo = &binding->image_info;
+        write->pBufferInfo = &binding->buffer_info;
+        write->pTexelBufferView = &binding->texel_buffer_view;
+        if(LAVA_DESCRIPTOR_WRITE_BATCH <= write_count || (i + 1) == binding_count) {
+            vkUpdateDescriptorSets(cache->device->device_, write_count, writes, 0, LAVA_NULL);
+            write_count = 0;
+        }
+    }
+    frame->stats.written_descriptors += binding_count;
+
+    lava_descriptor_entry* entry = &frame->entries[frame->entry_count];
+    entry->layout = layout;
+    entry->set = *set;
+    entry->first_binding = frame->binding_count;
+    entry->binding_count = binding_count;
+    entry->next = first;
+    if(0 < binding_count) {
+        memcpy(frame->bindings + frame->binding_count, bindings, sizeof(lava_descriptor_binding) * binding_count);
+    }
+    if(!lava_handle_map_insert(cache->allocator, &frame->map, hash, frame->entry_count)) {
+        //The set is valid, it only cannot be found again
+        return VK_SUCCESS;
+    }
+    ++frame->entry_count;
+    frame->binding_count += binding_count;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_get_descriptor_cache_stats(const lava_descriptor_cache* cache, lava_descriptor_cache_stats* stats)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != stats);
+    memset(stats, 0, sizeof(lava_descriptor_cache_stats));
+    for(uint32_t i = 0; i < (cache->thread_count * cache->frame_count); ++i) {
+        const lava_descriptor_frame* frame = &cache->frames[i];
+        stats->requests += frame->stats.requests;
+        stats->hits += frame->stats.hits;
+        stats->allocated_sets += frame->stats.allocated_sets;
+        stats->written_descriptors += frame->stats.written_descriptors;
+        stats->saved_descriptor_writes += frame->stats.saved_descriptor_writes;
+        stats->pool_count += frame->pool_count;
+    }
+}
+
+//--- Descriptor layouts
+//--------------------------------------------------------------------
+typedef struct lava_descriptor_range_t
+{
+    uint32_t binding;
+    uint32_t count; //!< Descriptors, or bytes of an inline uniform block.
+    uint32_t offset;
+    uint32_t stride;
+    VkDescriptorType type;
+    VkDeviceSize buffer_offset; //!< Offset of the binding in a descriptor buffer.
+} lava_descriptor_range;
+
+struct lava_descriptor_layout_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_descriptor_layout_flags flags;
+    VkPipelineBindPoint pipeline_bind_point;
+    uint32_t set;
+    VkDescriptorSetLayout set_layout;
+    VkDescriptorUpdateTemplate update_template;
+    uint32_t data_size;
+    uint32_t range_count;
+    lava_descriptor_range* ranges;
+    VkDescriptorUpdateTemplateEntry* entries;
+    VkDeviceSize buffer_size; //!< Size of the layout in a descriptor buffer.
+};
+
+static uint32_t lava_descriptor_data_stride(VkDescriptorType type)
+{
+    switch(type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+        return (uint32_t)sizeof(VkDescriptorImageInfo);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        return (uint32_t)sizeof(VkBufferView);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+        return (uint32_t)sizeof(VkDescriptorBufferInfo);
+    case VK_DESCRIPTOR_TYPE_INLINE_UNIFORM_BLOCK:
+        return 1;
+    default:
+        //Acceleration structures are handles
+        return (uint32_t)sizeof(uint64_t);
+    }
+}
+
+static const lava_descriptor_range* lava_find_descriptor_range(const lava_descriptor_layout* layout, uint32_t binding)
+{
+    for(uint32_t i = 0; i < layout->range_count; ++i) {
+        if(binding == layout->ranges[i].binding) {
+            return &layout->ranges[i];
+        }
+    }
+    return LAVA_NULL;
+}
+
+VkResult LAVA_API lava_create_descriptor_layout(const lava_descriptor_layout_create_info* create_info, lava_descriptor_layout** layout)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(0 == create_info->binding_count || LAVA_NULL != create_info->bindings);
+    assert(LAVA_NULL != layout);
+    if(0 != (create_info->flags & LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT)) {
+        //Views carry no address and format for vkGetDescriptorEXT, and descriptor buffers have no dynamic offsets
+        for(uint32_t i = 0; i < create_info->binding_count; ++i) {
+            switch(create_info->bindings[i].descriptorType) {
+            case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+            case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+                return VK_ERROR_FEATURE_NOT_PRESENT;
+            default:
+                break;
+            }
+        }
+    }
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_descriptor_layout* new_layout = (lava_descriptor_layout*)lava_calloc(allocator, sizeof(lava_descriptor_layout));
+    if(LAVA_NULL == new_layout) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_layout->device = create_info->device;
+    new_layout->allocator = allocator;
+    new_layout->flags = create_info->flags;
+    new_layout->pipeline_bind_point = create_info->pipeline_bind_point;
+    new_layout->set = create_info->set;
+    if(0 < create_info->binding_count) {
+        new_layout->ranges = (lava_descriptor_range*)lava_malloc(allocator, sizeof(lava_descriptor_range) * create_info->binding_count);
+        new_layout->entries = (VkDescriptorUpdateTemplateEntry*)lava_malloc(allocator, sizeof(VkDescriptorUpdateTemplateEntry) * create_info->binding_count);
+        if(LAVA_NULL == new_layout->ranges || LAVA_NULL == new_layout->entries) {
+            lava_destroy_descriptor_layout(new_layout);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+
+    //Pack the bindings in declaration order, each aligned to its element
+    uint32_t offset = 0;
+    for(uint32_t i = 0; i < create_info->binding_count; ++i) {
+        const VkDescriptorSetLayoutBinding* binding = &create_info->bindings[i];
+        if(0 == binding->descriptorCount) {
+            continue;
+        }
+        uint32_t stride = lava_descriptor_data_stride(binding->descriptorType);
+        uint32_t alignment = (1 < stride) ? (uint32_t)sizeof(uint64_t) : 1;
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        lava_descriptor_range* range = &new_layout->ranges[new_layout->range_count];
+        range->binding = binding->binding;
+        range->count = binding->descriptorCount;
+        range->offset = offset;
+        range->stride = stride;
+        range->type = binding->descriptorType;
+        range->buffer_offset = 0;
+        VkDescriptorUpdateTemplateEntry* entry = &new_layout->entries[new_layout->range_count];
+        entry->dstBinding = binding->binding;
+        entry->dstArrayElement = 0;
+        entry->descriptorCount = binding->descriptorCount;
+        entry->descriptorType = binding->descriptorType;
+        entry->offset = offset;
+        entry->stride = stride;
+        offset += stride * binding->descriptorCount;
+        ++new_layout->range_count;
+    }
+    new_layout->data_size = (offset + (uint32_t)sizeof(uint64_t) - 1) & ~((uint32_t)sizeof(uint64_t) - 1);
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, LAVA_NULL, 0, create_info->binding_count, create_info->bindings};
+    if(0 != (create_info->flags & LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT)) {
+        layout_info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+    }
+    if(0 != (create_info->flags & LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT)) {
+        layout_info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    }
+    VkResult result = vkCreateDescriptorSetLayout(create_info->device->device_, &layout_info, allocator, &new_layout->set_layout);
+    if(VK_SUCCESS != result) {
+        lava_destroy_descriptor_layout(new_layout);
+        return result;
+    }
+    if(0 != (create_info->flags & LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT)) {
+        //Descriptor buffers place bindings where the driver says, instead of an update template
+        VkDevice device = create_info->device->device_;
+        PFN_vkGetDescriptorSetLayoutSizeEXT get_layout_size = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutSizeEXT");
+        PFN_vkGetDescriptorSetLayoutBindingOffsetEXT get_binding_offset = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+        if(LAVA_NULL == get_layout_size || LAVA_NULL == get_binding_offset) {
+            lava_destroy_descriptor_layout(new_layout);
+            return VK_ERROR_EXTENSION_NOT_PRESENT;
+        }
+        get_layout_size(device, new_layout->set_layout, &new_layout->buffer_size);
+        for(uint32_t i = 0; i < new_layout->range_count; ++i) {
+            get_binding_offset(device, new_layout->set_layout, new_layout->ranges[i].binding, &new_layout->ranges[i].buffer_offset);
+        }
+        *layout = new_layout;
+        return VK_SUCCESS;
+    }
+    //A push template also needs a pipeline layout, see lava_prepare_push_descriptors
+    if(0 == (create_info->flags & LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT) && 0 < new_layout->range_count) {
+        VkDescriptorUpdateTemplateCreateInfo template_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            LAVA_NULL,
+            0,
+            new_layout->range_count,
+            new_layout->entries,
+            VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            new_layout->set_layout,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            VK_NULL_HANDLE,
+            0,
+        };
+        result = vkCreateDescriptorUpdateTemplate(create_info->device->device_, &template_info, allocator, &new_layout->update_template);
+        if(VK_SUCCESS != result) {
+            lava_destroy_descriptor_layout(new_layout);
+            return result;
+        }
+    }
+    *layout = new_layout;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_descriptor_layout(lava_descriptor_layout* layout)
+{
+    if(LAVA_NULL == layout) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = layout->allocator;
+    if(VK_NULL_HANDLE != layout->update_template) {
+        vkDestroyDescriptorUpdateTemplate(layout->device->device_, layout->update_template, allocator);
+    }
+    if(VK_NULL_HANDLE != layout->set_layout) {
+        vkDestroyDescriptorSetLayout(layout->device->device_, layout->set_layout, allocator);
+    }
+    lava_free(allocator, layout->entries);
+    lava_free(allocator, layout->ranges);
+    lava_free(allocator, layout);
+}
+
+VkDescriptorSetLayout LAVA_API lava_get_descriptor_set_layout(const lava_descriptor_layout* layout)
+{
+    assert(LAVA_NULL != layout);
+    return layout->set_layout;
+}
+
+uint32_t LAVA_API lava_get_descriptor_data_size(const lava_descriptor_layout* layout)
+{
+    assert(LAVA_NULL != layout);
+    return layout->data_size;
+}
+
+uint32_t LAVA_API lava_get_descriptor_data_offset(const lava_descriptor_layout* layout, uint32_t binding, uint32_t array_element)
+{
+    assert(LAVA_NULL != layout);
+    const lava_descriptor_range* range = lava_find_descriptor_range(layout, binding);
+    if(LAVA_NULL == range || range->count <= array_element) {
+        return LAVA_DESCRIPTOR_INVALID_OFFSET;
+    }
+    return range->offset + range->stride * array_element;
+}
+
+void LAVA_API lava_write_descriptor_image(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, const VkDescriptorImageInfo* image_info)
+{
+    assert(LAVA_NULL != data);
+    assert(LAVA_NULL != image_info);
+    uint32_t offset = lava_get_descriptor_data_offset(layout, binding, array_element);
+    assert(LAVA_DESCRIPTOR_INVALID_OFFSET != offset);
+    memcpy((uint8_t*)data + offset, image_info, sizeof(VkDescriptorImageInfo));
+}
+
+void LAVA_API lava_write_descriptor_buffer(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, const VkDescriptorBufferInfo* buffer_info)
+{
+    assert(LAVA_NULL != data);
+    assert(LAVA_NULL != buffer_info);
+    uint32_t offset = lava_get_descriptor_data_offset(layout, binding, array_element);
+    assert(LAVA_DESCRIPTOR_INVALID_OFFSET != offset);
+    memcpy((uint8_t*)data + offset, buffer_info, sizeof(VkDescriptorBufferInfo));
+}
+
+void LAVA_API lava_write_descriptor_texel_buffer(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, VkBufferView buffer_view)
+{
+    assert(LAVA_NULL != data);
+    uint32_t offset = lava_get_descriptor_data_offset(layout, binding, array_element);
+    assert(LAVA_DESCRIPTOR_INVALID_OFFSET != offset);
+    memcpy((uint8_t*)data + offset, &buffer_view, sizeof(VkBufferView));
+}
+
+void LAVA_API lava_update_descriptor_set(const lava_descriptor_layout* layout, VkDescriptorSet set, const void* data)
+{
+    assert(LAVA_NULL != layout);
+    assert(0 == (layout->flags & LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT));
+    assert(LAVA_NULL != data);
+    if(VK_NULL_HANDLE != layout->update_template) {
+        vkUpdateDescriptorSetWithTemplate(layout->device->device_, set, layout->update_template, data);
+    }
+}
+
+VkResult LAVA_API lava_prepare_push_descriptors(lava_descriptor_layout* layout, VkPipelineLayout pipeline_layout)
+{
+    assert(LAVA_NULL != layout);
+    if(0 == (layout->flags & LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT) || VK_NULL_HANDLE != layout->update_template) {
+        return VK_ERROR_UNKNOWN;
+    }
+    if(LAVA_NULL == layout->device->vkCmdPushDescriptorSetWithTemplateKHR) {
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+    if(0 == layout->range_count) {
+        return VK_SUCCESS;
+    }
+    VkDescriptorUpdateTemplateCreateInfo template_info = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+        LAVA_NULL,
+        0,
+        layout->range_count,
+        layout->entries,
+        VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR,
+        VK_NULL_HANDLE,
+        layout->pipeline_bind_point,
+        pipeline_layout,
+        layout->set,
+    };
+    return vkCreateDescriptorUpdateTemplate(layout->device->device_, &template_info, layout->allocator, &layout->update_template);
+}
+
+void LAVA_API lava_cmd_push_descriptors(VkCommandBuffer command_buffer, const lava_descriptor_layout* layout, VkPipelineLayout pipeline_layout, const void* data)
+{
+    assert(LAVA_NULL != layout);
+    assert(0 != (layout->flags & LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT));
+    assert(LAVA_NULL != data);
+    if(VK_NULL_HANDLE != layout->update_template) {
+        layout->device->vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, layout->update_template, pipeline_layout, layout->set, data);
+    }
+}
+
+//--- Bindless heap
+//--------------------------------------------------------------------
+typedef struct lava_bindless_write_t
+{
+    lava_bindless_type type;
+    uint32_t index;
+    VkDescriptorImageInfo image_info;
+    VkDescriptorBufferInfo buffer_info;
+} lava_bindless_write;
+
+typedef struct lava_bindless_retired_t
+{
+    uint32_t* indices; //!< Type in the top bits.
+    uint32_t count;
+    uint32_t capacity;
+} lava_bindless_retired;
+
+typedef struct lava_bindless_array_t
+{
+    uint32_t capacity;
+    uint32_t used; //!< Indices below were handed out at least once.
+    uint8_t* freed; //!< Per index, set from lava_bindless_free until the index is handed out again.
+    uint32_t* free_indices;
+    uint32_t free_count;
+    uint32_t free_capacity;
+} lava_bindless_array;
+
+struct lava_bindless_heap_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_mutex mutex;
+    VkDescriptorSetLayout set_layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    lava_bindless_array arrays[LAVA_BINDLESS_TYPE_COUNT];
+    lava_bindless_write* writes;
+    uint32_t write_count;
+    uint32_t write_capacity;
+    VkWriteDescriptorSet* vk_writes;
+    uint32_t vk_write_capacity;
+    uint32_t frame_count;
+    uint64_t frame_index;
+    lava_bindless_retired* retired; //!< Per frame slot.
+};
+
+#define LAVA_BINDLESS_TYPE_SHIFT (30)
+
+static const VkDescriptorType lava_bindless_descriptor_types[LAVA_BINDLESS_TYPE_COUNT] = {
+    VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+    VK_DESCRIPTOR_TYPE_SAMPLER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+};
+
+VkResult LAVA_API lava_create_bindless_heap(const lava_bindless_heap_create_info* create_info, lava_bindless_heap** heap)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != heap);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_bindless_heap* new_heap = (lava_bindless_heap*)lava_calloc(allocator, sizeof(lava_bindless_heap));
+    if(LAVA_NULL == new_heap) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_heap->device = create_info->device;
+    new_heap->allocator = allocator;
+    new_heap->frame_count = (0 < create_info->frame_count) ? create_info->frame_count : 1;
+    lava_mutex_initialize(&new_heap->mutex);
+    new_heap->retired = (lava_bindless_retired*)lava_calloc(allocator, sizeof(lava_bindless_retired) * new_heap->frame_count);
+    if(LAVA_NULL == new_heap->retired) {
+        lava_destroy_bindless_heap(new_heap);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[LAVA_BINDLESS_TYPE_COUNT];
+    VkDescriptorBindingFlags binding_flags[LAVA_BINDLESS_TYPE_COUNT];
+    VkDescriptorPoolSize pool_sizes[LAVA_BINDLESS_TYPE_COUNT];
+    uint32_t pool_size_count = 0;
+    for(uint32_t i = 0; i < LAVA_BINDLESS_TYPE_COUNT; ++i) {
+        new_heap->arrays[i].capacity = create_info->counts[i];
+        new_heap->arrays[i].freed = (uint8_t*)lava_calloc(allocator, create_info->counts[i] + 1);
+        if(LAVA_NULL == new_heap->arrays[i].freed) {
+            lava_destroy_bindless_heap(new_heap);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        bindings[i].binding = i;
+        bindings[i].descriptorType = lava_bindless_descriptor_types[i];
+        bindings[i].descriptorCount = create_info->counts[i];
+        bindings[i].stageFlags = create_info->stage_flags;
+        bindings[i].pImmutableSamplers = LAVA_NULL;
+        binding_flags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        if(0 < create_info->counts[i]) {
+            pool_sizes[pool_size_count].type = lava_bindless_descriptor_types[i];
+            pool_sizes[pool_size_count].descriptorCount = create_info->counts[i];
+            ++pool_size_count;
+        }
+    }
+    //Only the highest binding may have a variable count
+    binding_flags[LAVA_BINDLESS_TYPE_COUNT - 1] |= VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO, LAVA_NULL, LAVA_BINDLESS_TYPE_COUNT, binding_flags};
+    VkDescriptorSetLayoutCreateInfo layout_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, &binding_flags_info, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT, LAVA_BINDLESS_TYPE_COUNT, bindings};
+    VkResult result = vkCreateDescriptorSetLayout(new_heap->device->device_, &layout_info, allocator, &new_heap->set_layout);
+    if(VK_SUCCESS != result) {
+        lava_destroy_bindless_heap(new_heap);
+        return result;
+    }
+    VkDescriptorPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO, LAVA_NULL, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT, 1, pool_size_count, pool_sizes};
+    result = vkCreateDescriptorPool(new_heap->device->device_, &pool_info, allocator, &new_heap->pool);
+    if(VK_SUCCESS != result) {
+        lava_destroy_bindless_heap(new_heap);
+        return result;
+    }
+    uint32_t variable_count = create_info->counts[LAVA_BINDLESS_TYPE_COUNT - 1];
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variable_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO, LAVA_NULL, 1, &variable_count};
+    VkDescriptorSetAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, &variable_info, new_heap->pool, 1, &new_heap->set_layout};
+    result = vkAllocateDescriptorSets(new_heap->device->device_, &allocate_info, &new_heap->set);
+    if(VK_SUCCESS != result) {
+        lava_destroy_bindless_heap(new_heap);
+        return result;
+    }
+    *heap = new_heap;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_bindless_heap(lava_bindless_heap* heap)
+{
+    if(LAVA_NULL == heap) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = heap->allocator;
+    if(VK_NULL_HANDLE != heap->pool) {
+        vkDestroyDescriptorPool(heap->device->device_, heap->pool, allocator);
+    }
+    if(VK_NULL_HANDLE != heap->set_layout) {
+        vkDestroyDescriptorSetLayout(heap->device->device_, heap->set_layout, allocator);
+    }
+    for(uint32_t i = 0; i < LAVA_BINDLESS_TYPE_COUNT; ++i) {
+        lava_free(allocator, heap->arrays[i].freed);
+        lava_free(allocator, heap->arrays[i].free_indices);
+    }
+    if(LAVA_NULL != heap->retired) {
+        for(uint32_t i = 0; i < heap->frame_count; ++i) {
+            lava_free(allocator, heap->retired[i].indices);
+        }
+    }
+    lava_free(allocator, heap->retired);
+    lava_free(allocator, heap->writes);
+    lava_free(allocator, heap->vk_writes);
+    lava_mutex_terminate(&heap->mutex);
+    lava_free(allocator, heap);
+}
+
+VkDescriptorSetLayout LAVA_API lava_get_bindless_set_layout(const lava_bindless_heap* heap)
+{
+    assert(LAVA_NULL != heap);
+    return heap->set_layout;
+}
+
+VkDescriptorSet LAVA_API lava_get_bindless_set(const lava_bindless_heap* heap)
+{
+    assert(LAVA_NULL != heap);
+    return heap->set;
+}
+
+uint32_t LAVA_API lava_bindless_allocate(lava_bindless_heap* heap, lava_bindless_type type)
+{
+    assert(LAVA_NULL != heap);
+    assert(type < LAVA_BINDLESS_TYPE_COUNT);
+    lava_bindless_array* array = &heap->arrays[type];
+    uint32_t index = LAVA_BINDLESS_INVALID_INDEX;
+    lava_mutex_lock(&heap->mutex);
+    if(0 < array->free_count) {
+        index = array->free_indices[--array->free_count];
+        array->freed[index] = 0;
+    } else if(array->used < array->capacity) {
+        index = array->used++;
+    }
+    lava_mutex_unlock(&heap->mutex);
+    return index;
+}
+
+void LAVA_API lava_bindless_free(lava_bindless_heap* heap, lava_bindless_type type, uint32_t index)
+{
+    assert(LAVA_NULL != heap);
+    assert(type < LAVA_BINDLESS_TYPE_COUNT);
+    lava_bindless_array* array = &heap->arrays[type];
+    lava_mutex_lock(&heap->mutex);
+    //Another thread may be handing out indices, so check them under the lock
+    bool valid = index < array->used && 0 == array->freed[index];
+    assert(valid);
+    lava_bindless_retired* retired = &heap->retired[heap->frame_index % heap->frame_count];
+    if(valid && lava_reserve(heap->allocator, (void**)&retired->indices, &retired->capacity, retired->count + 1, sizeof(uint32_t))) {
+        array->freed[index] = 1;
+        retired->indices[retired->count++] = ((uint32_t)type << LAVA_BINDLESS_TYPE_SHIFT) | index;
+    }
+    lava_mutex_unlock(&heap->mutex);
+}
+
+static void lava_bindless_queue_write(lava_bindless_heap* heap, const lava_bindless_write* write)
+{
+    assert(write->index < heap->arrays[write->type].capacity);
+    lava_mutex_lock(&heap->mutex);
+    if(lava_reserve(heap->allocator, (void**)&heap->writes, &heap->write_capacity, heap->write_count + 1, sizeof(lava_bindless_write))) {
+        heap->writes[heap->write_count++] = *write;
+    }
+    lava_mutex_unlock(&heap->mutex);
+}
+
+void LAVA_API lava_bindless_write_image(lava_bindless_heap* heap, lava_bindless_type type, uint32_t index, VkImageView image_view, VkImageLayout image_layout)
+{
+    assert(LAVA_NULL != heap);
+    assert(LAVA_BINDLESS_SAMPLED_IMAGE == type || LAVA_BINDLESS_STORAGE_IMAGE == type);
+    lava_bindless_write write;
+    memset(&write, 0, sizeof(lava_bindless_write));
+    write.type = type;
+    write.index = index;
+    write.image_info.imageView = image_view;
+    write.image_info.imageLayout = image_layout;
+    lava_bindless_queue_write(heap, &write);
+}
+
+void LAVA_API lava_bindless_write_sampler(lava_bindless_heap* heap, uint32_t index, VkSampler sampler)
+{
+    assert(LAVA_NULL != heap);
+    lava_bindless_write write;
+    memset(&write, 0, sizeof(lava_bindless_write));
+    write.type = LAVA_BINDLESS_SAMPLER;
+    write.index = index;
+    write.image_info.sampler = sampler;
+    lava_bindless_queue_write(heap, &write);
+}
+
+void LAVA_API lava_bindless_write_buffer(lava_bindless_heap* heap, uint32_t index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    assert(LAVA_NULL != heap);
+    lava_bindless_write write;
+    memset(&write, 0, sizeof(lava_bindless_write));
+    write.type = LAVA_BINDLESS_STORAGE_BUFFER;
+    write.index = index;
+    write.buffer_info.buffer = buffer;
+    write.buffer_info.offset = offset;
+    write.buffer_info.range = range;
+    lava_bindless_queue_write(heap, &write);
+}
+
+static void lava_bindless_flush(lava_bindless_heap* heap)
+{
+    if(0 == heap->write_count) {
+        return;
+    }
+    if(!lava_reserve(heap->allocator, (void**)&heap->vk_writes, &heap->vk_write_capacity, heap->write_count, sizeof(VkWriteDescriptorSet))) {
+        return;
+    }
+    for(uint32_t i = 0; i < heap->write_count; ++i) {
+        const lava_bindless_write* write = &heap->writes[i];
+        VkWriteDescriptorSet* vk_write = &heap->vk_writes[i];
+        vk_write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        vk_write->pNext = LAVA_NULL;
+        vk_write->dstSet = heap->set;
+        vk_write->dstBinding = (uint32_t)write->type;
+        vk_write->dstArrayElement = write->index;
+        vk_write->descriptorCount = 1;
+        vk_write->descriptorType = lava_bindless_descriptor_types[write->type];
+        vk_write->pImageInfo = &write->image_info;
+        vk_write->pBufferInfo = &write->buffer_info;
+        vk_write->pTexelBufferView = LAVA_NULL;
+    }
+    vkUpdateDescriptorSets(heap->device->device_, heap->write_count, heap->vk_writes, 0, LAVA_NULL);
+    heap->write_count = 0;
+}
+
+void LAVA_API lava_flush_bindless_writes(lava_bindless_heap* heap)
+{
+    assert(LAVA_NULL != heap);
+    lava_mutex_lock(&heap->mutex);
+    lava_bindless_flush(heap);
+    lava_mutex_unlock(&heap->mutex);
+}
+
+void LAVA_API lava_begin_bindless_frame(lava_bindless_heap* heap, uint64_t frame_index)
+{
+    assert(LAVA_NULL != heap);
+    lava_mutex_lock(&heap->mutex);
+    lava_bindless_flush(heap);
+    heap->frame_index = frame_index;
+    lava_bindless_retired* retired = &heap->retired[frame_index % heap->frame_count];
+    for(uint32_t i = 0; i < retired->count; ++i) {
+        uint32_t type = retired->indices[i] >> LAVA_BINDLESS_TYPE_SHIFT;
+        lava_bindless_array* array = &heap->arrays[type];
+        if(lava_reserve(heap->allocator, (void**)&array->free_indices, &array->free_capacity, array->free_count + 1, sizeof(uint32_t))) {
+            array->free_indices[array->free_count++] = retired->indices[i] & ((1U << LAVA_BINDLESS_TYPE_SHIFT) - 1);
+        }
+    }
+    retired->count = 0;
+    lava_mutex_unlock(&heap->mutex);
+}
+
+void LAVA_API lava_cmd_bind_bindless_heap(VkCommandBuffer command_buffer, const lava_bindless_heap* heap, VkPipelineBindPoint pipeline_bind_point, VkPipelineLayout pipeline_layout, uint32_t set)
+{
+    assert(LAVA_NULL != heap);
+    vkCmdBindDescriptorSets(command_buffer, pipeline_bind_point, pipeline_layout, set, 1, &heap->set, 0, LAVA_NULL);
+}
+
+//--- Descriptor buffers
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_DESCRIPTOR_RING_FRAME_SIZE (1024ULL * 1024ULL)
+
+struct lava_descriptor_ring_t
+{
+    lava_memory_allocator* memory_allocator;
+    crater_device* device;
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT properties;
+    PFN_vkGetDescriptorEXT get_descriptor;
+    PFN_vkCmdBindDescriptorBuffersEXT cmd_bind_descriptor_buffers;
+    PFN_vkCmdSetDescriptorBufferOffsetsEXT cmd_set_descriptor_buffer_offsets;
+    VkBuffer buffer;
+    lava_allocation* allocation;
+    uint8_t* mapped;
+    VkDeviceAddress address;
+    VkBufferUsageFlags usage;
+    uint32_t frame_count;
+    VkDeviceSize frame_size;
+    VkDeviceSize frame_begin;
+    volatile int64_t head; //!< Next free byte of the current frame region.
+};
+
+static bool lava_has_device_extension(VkPhysicalDevice physical_device, const char* name)
+{
+    uint32_t extension_count = 0;
+    if(VK_SUCCESS != vkEnumerateDeviceExtensionProperties(physical_device, LAVA_NULL, &extension_count, LAVA_NULL) || 0 == extension_count) {
+        return false;
+    }
+    VkExtensionProperties* extensions = (VkExtensionProperties*)lava_malloc(LAVA_NULL, sizeof(VkExtensionProperties) * extension_count);
+    if(LAVA_NULL == extensions) {
+        return false;
+    }
+    bool found = false;
+    if(VK_SUCCESS == vkEnumerateDeviceExtensionProperties(physical_device, LAVA_NULL, &extension_count, extensions)) {
+        for(uint32_t i = 0; i < extension_count && !found; ++i) {
+            found = 0 == strcmp(extensions[i].extensionName, name);
+        }
+    }
+    lava_free(LAVA_NULL, extensions);
+    return found;
+}
+
+lava_descriptor_backend LAVA_API lava_select_descriptor_backend(VkPhysicalDevice physical_device)
+{
+    if(!lava_has_device_extension(physical_device, VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)) {
+        return LAVA_DESCRIPTOR_BACKEND_SETS;
+    }
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer_features;
+    memset(&descriptor_buffer_features, 0, sizeof(descriptor_buffer_features));
+    descriptor_buffer_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features;
+    memset(&features, 0, sizeof(features));
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &descriptor_buffer_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    return (VK_TRUE == descriptor_buffer_features.descriptorBuffer) ? LAVA_DESCRIPTOR_BACKEND_BUFFER : LAVA_DESCRIPTOR_BACKEND_SETS;
+}
+
+VkResult LAVA_API lava_create_descriptor_ring(const lava_descriptor_ring_create_info* create_info, lava_descriptor_ring** ring)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->memory_allocator);
+    assert(LAVA_NULL != ring);
+    lava_memory_allocator* memory_allocator = create_info->memory_allocator;
+    const VkAllocationCallbacks* allocator = memory_allocator->allocator;
+    VkDevice device = memory_allocator->device->device_;
+    lava_descriptor_ring* new_ring = (lava_descriptor_ring*)lava_calloc(allocator, sizeof(lava_descriptor_ring));
+    if(LAVA_NULL == new_ring) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_ring->memory_allocator = memory_allocator;
+    new_ring->device = memory_allocator->device;
+    new_ring->get_descriptor = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorEXT");
+    new_ring->cmd_bind_descriptor_buffers = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(device, "vkCmdBindDescriptorBuffersEXT");
+    new_ring->cmd_set_descriptor_buffer_offsets = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(device, "vkCmdSetDescriptorBufferOffsetsEXT");
+    if(LAVA_NULL == new_ring->get_descriptor || LAVA_NULL == new_ring->cmd_bind_descriptor_buffers || LAVA_NULL == new_ring->cmd_set_descriptor_buffer_offsets) {
+        lava_free(allocator, new_ring);
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+    new_ring->properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties;
+    memset(&properties, 0, sizeof(properties));
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &new_ring->properties;
+    vkGetPhysicalDeviceProperties2(create_info->physical_device, &properties);
+    new_ring->properties.pNext = LAVA_NULL;
+
+    VkDeviceSize alignment = (0 < new_ring->properties.descriptorBufferOffsetAlignment) ? new_ring->properties.descriptorBufferOffsetAlignment : 1;
+    VkDeviceSize frame_size = (0 < create_info->frame_size) ? create_info->frame_size : LAVA_DEFAULT_DESCRIPTOR_RING_FRAME_SIZE;
+    new_ring->frame_count = (0 < create_info->frame_count) ? create_info->frame_count : 1;
+    new_ring->frame_size = lava_align_up(frame_size, alignment);
+    new_ring->usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VkBufferCreateInfo buffer_info = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        LAVA_NULL,
+        0,
+        new_ring->frame_size * new_ring->frame_count,
+        new_ring->usage,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        LAVA_NULL,
+    };
+    lava_allocation_create_info allocation_info;
+    memset(&allocation_info, 0, sizeof(lava_allocation_create_info));
+    allocation_info.flags = LAVA_ALLOCATION_CREATE_MAPPED_BIT;
+    allocation_info.required_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    allocation_info.preferred_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VkResult result = lava_create_buffer(memory_allocator, &buffer_info, &allocation_info, &new_ring->buffer, &new_ring->allocation);
+    if(VK_SUCCESS != result) {
+        lava_free(allocator, new_ring);
+        return result;
+    }
+    lava_allocation_info info;
+    lava_get_allocation_info(new_ring->allocation, &info);
+    new_ring->mapped = (uint8_t*)info.mapped;
+    new_ring->address = info.device_address;
+    *ring = new_ring;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_descriptor_ring(lava_descriptor_ring* ring)
+{
+    if(LAVA_NULL == ring) {
+        return;
+    }
+    lava_destroy_buffer(ring->memory_allocator, ring->buffer, ring->allocation);
+    lava_free(ring->memory_allocator->allocator, ring);
+}
+
+void LAVA_API lava_begin_descriptor_ring_frame(lava_descriptor_ring* ring, uint64_t frame_index)
+{
+    assert(LAVA_NULL != ring);
+    ring->frame_begin = (frame_index % ring->frame_count) * ring->frame_size;
+    lava_atomic_store64(&ring->head, (int64_t)ring->frame_begin);
+}
+
+static size_t lava_descriptor_buffer_size(const VkPhysicalDeviceDescriptorBufferPropertiesEXT* properties, VkDescriptorType type)
+{
+    switch(type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+        return properties->samplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+        return properties->combinedImageSamplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        return properties->sampledImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+        return properties->storageImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+        return properties->inputAttachmentDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+        return properties->uniformBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+        return properties->storageBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+        return properties->accelerationStructureDescriptorSize;
+    default:
+        return 0;
+    }
+}
+
+VkResult LAVA_API lava_write_descriptor_ring(lava_descriptor_ring* ring, const lava_descriptor_layout* layout, const void* data, VkDeviceSize* offset)
+{
+    assert(LAVA_NULL != ring);
+    assert(LAVA_NULL != layout);
+    assert(0 != (layout->flags & LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT));
+    assert(LAVA_NULL != data);
+    assert(LAVA_NULL != offset);
+    //Reserve the set in the frame region
+    VkDeviceSize alignment = (0 < ring->properties.descriptorBufferOffsetAlignment) ? ring->properties.descriptorBufferOffsetAlignment : 1;
+    VkDeviceSize frame_end = ring->frame_begin + ring->frame_size;
+    VkDeviceSize set_offset;
+    for(;;) {
+        int64_t head = lava_atomic_load64(&ring->head);
+        set_offset = lava_align_up((VkDeviceSize)head, alignment);
+        if(frame_end < (set_offset + layout->buffer_size)) {
+            return VK_ERROR_OUT_OF_POOL_MEMORY;
+        }
+        if(lava_atomic_cas64(&ring->head, head, (int64_t)(set_offset + layout->buffer_size))) {
+            break;
+        }
+    }
+
+    VkDevice device = ring->device->device_;
+    uint8_t* set_data = ring->mapped + set_offset;
+    const uint8_t* packed = (const uint8_t*)data;
+    for(uint32_t i = 0; i < layout->range_count; ++i) {
+        const lava_descriptor_range* range = &layout->ranges[i];
+        if(VK_DESCRIPTOR_TYPE_INLINE_UNIFORM_BLOCK == range->type) {
+            memcpy(set_data + range->buffer_offset, packed + range->offset, range->count);
+            continue;
+        }
+        size_t size = lava_descriptor_buffer_size(&ring->properties, range->type);
+        assert(0 < size);
+        for(uint32_t j = 0; j < range->count; ++j) {
+            const uint8_t* element = packed + range->offset + range->stride * j;
+            VkDescriptorAddressInfoEXT address_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT, LAVA_NULL, 0, 0, VK_FORMAT_UNDEFINED};
+            VkDescriptorGetInfoEXT get_info;
+            memset(&get_info, 0, sizeof(VkDescriptorGetInfoEXT));
+            get_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+            get_info.type = range->type;
+            switch(range->type) {
+            case VK_DESCRIPTOR_TYPE_SAMPLER:
+                get_info.data.pSampler = &((const VkDescriptorImageInfo*)element)->sampler;
+                break;
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+                get_info.data.pCombinedImageSampler = (const VkDescriptorImageInfo*)element;
+                break;
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+                get_info.data.pSampledImage = (const VkDescriptorImageInfo*)element;
+                break;
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+                get_info.data.pStorageImage = (const VkDescriptorImageInfo*)element;
+                break;
+            case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+                get_info.data.pInputAttachmentImage = (const VkDescriptorImageInfo*)element;
+                break;
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: {
+                const VkDescriptorBufferInfo* buffer_info = (const VkDescriptorBufferInfo*)element;
+                assert(VK_WHOLE_SIZE != buffer_info->range);
+                if(VK_NULL_HANDLE != buffer_info->buffer) {
+                    VkBufferDeviceAddressInfo device_address_info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, LAVA_NULL, buffer_info->buffer};
+                    address_info.address = vkGetBufferDeviceAddress(device, &device_address_info) + buffer_info->offset;
+                    address_info.range = buffer_info->range;
+                }
+                //A null pointer writes a null descriptor
+                const VkDescriptorAddressInfoEXT* pointer = (VK_NULL_HANDLE != buffer_info->buffer) ? &address_info : LAVA_NULL;
+                if(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER == range->type) {
+                    get_info.data.pUniformBuffer = pointer;
+                } else {
+                    get_info.data.pStorageBuffer = pointer;
+                }
+            } break;
+            case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+                memcpy(&get_info.data.accelerationStructure, element, sizeof(VkDeviceAddress));
+                break;
+            default:
+                //Rejected by lava_create_descriptor_layout
+                assert(false);
+                break;
+            }
+            ring->get_descriptor(device, &get_info, size, set_data + range->buffer_offset + size * j);
+        }
+    }
+    *offset = set_offset;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_cmd_bind_descriptor_ring(VkCommandBuffer command_buffer, const lava_descriptor_ring* ring)
+{
+    assert(LAVA_NULL != ring);
+    VkDescriptorBufferBindingInfoEXT binding_info;
+    memset(&binding_info, 0, sizeof(VkDescriptorBufferBindingInfoEXT));
+    binding_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+    binding_info.address = ring->address;
+    binding_info.usage = ring->usage;
+    ring->cmd_bind_descriptor_buffers(command_buffer, 1, &binding_info);
+}
+
+void LAVA_API lava_cmd_set_descriptor_ring_offset(VkCommandBuffer command_buffer, const lava_descriptor_ring* ring, VkPipelineBindPoint pipeline_bind_point, VkPipelineLayout pipeline_layout, uint32_t set, VkDeviceSize offset)
+{
+    assert(LAVA_NULL != ring);
+    uint32_t buffer_index = 0;
+    ring->cmd_set_descriptor_buffer_offsets(command_buffer, pipeline_bind_point, pipeline_layout, set, 1, &buffer_index, &offset);
+}
+
+//--- Sampler cache
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_MAX_SAMPLERS (4000)
+
+/**
+ @brief Everything a sampler is created from, zero filled so that it can be hashed and compared as words.
+ */
+typedef struct lava_sampler_key_t
+{
+    VkSamplerCreateInfo info; //!< pNext is always null.
+    uint64_t conversion;
+    uint32_t reduction_mode;
+    uint32_t chain; //!< Bits of the chained structs.
+} lava_sampler_key;
+
+typedef struct lava_sampler_entry_t
+{
+    lava_sampler_key key;
+    VkSampler sampler;
+    volatile int32_t references;
+} lava_sampler_entry;
+
+struct lava_sampler_cache_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_mutex mutex;
+    uint32_t max_sampler_count;
+    uint32_t entry_count;
+    lava_sampler_entry* entries; //!< Never reallocated, readers access it without the lock.
+    uint32_t slot_mask;
+    volatile int64_t* slots; //!< Upper hash bits and entry index plus one, 0 is empty.
+    lava_handle_map sampler_entries; //!< Sampler to entry, for releases.
+    volatile int64_t requests;
+    volatile int64_t hits;
+    volatile int32_t uncached_count;
+};
+
+static bool lava_sampler_key_initialize(lava_sampler_key* key, const VkSamplerCreateInfo* create_info)
+{
+    memset(key, 0, sizeof(lava_sampler_key));
+    key->info.sType = create_info->sType;
+    memcpy(&key->info.flags, &create_info->flags, sizeof(VkSamplerCreateInfo) - offsetof(VkSamplerCreateInfo, flags));
+    for(const VkBaseInStructure* next = (const VkBaseInStructure*)create_info->pNext; LAVA_NULL != next; next = next->pNext) {
+        switch(next->sType) {
+        case VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO:
+            key->conversion = LAVA_OBJECT_HANDLE(((const VkSamplerYcbcrConversionInfo*)next)->conversion);
+            key->chain |= 0x01U;
+            break;
+        case VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO:
+            key->reduction_mode = (uint32_t)((const VkSamplerReductionModeCreateInfo*)next)->reductionMode;
+            key->chain |= 0x02U;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t lava_sampler_key_hash(const lava_sampler_key* key)
+{
+    const uint64_t* words = (const uint64_t*)key;
+    uint64_t hash = 0;
+    for(uint32_t i = 0; i < (sizeof(lava_sampler_key) / sizeof(uint64_t)); ++i) {
+        hash = lava_hash_combine(hash, words[i]);
+    }
+    return hash;
+}
+
+/**
+ @brief Lock free lookup, entries are published after they are written and never removed while acquires can run.
+ */
+static lava_sampler_entry* lava_sampler_cache_find(lava_sampler_cache* cache, const lava_sampler_key* key, uint64_t hash)
+{
+    uint32_t slot = (uint32_t)hash & cache->slot_mask;
+    for(;;) {
+        int64_t value = lava_atomic_load64(&cache->slots[slot]);
+        if(0 == value) {
+            return LAVA_NULL;
+        }
+        if((uint32_t)((uint64_t)value >> 32) == (uint32_t)(hash >> 32)) {
+            lava_sampler_entry* entry = &cache->entries[(uint32_t)value - 1];
+            if(0 == memcmp(&entry->key, key, sizeof(lava_sampler_key))) {
+                return entry;
+            }
+        }
+        slot = (slot + 1) & cache->slot_mask;
+    }
+}
+
+static void lava_sampler_cache_publish(lava_sampler_cache* cache, uint64_t hash, uint32_t index)
+{
+    uint32_t slot = (uint32_t)hash & cache->slot_mask;
+    while(0 != cache->slots[slot]) {
+        slot = (slot + 1) & cache->slot_mask;
+    }
+    lava_atomic_store64(&cache->slots[slot], (int64_t)((hash & 0xFFFFFFFF00000000ULL) | (uint64_t)(index + 1)));
+}
+
+VkResult LAVA_API lava_create_sampler_cache(const lava_sampler_cache_create_info* create_info, lava_sampler_cache** cache)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != cache);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_sampler_cache* new_cache = (lava_sampler_cache*)lava_calloc(allocator, sizeof(lava_sampler_cache));
+    if(LAVA_NULL == new_cache) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_cache->device = create_info->device;
+    new_cache->allocator = allocator;
+    new_cache->max_sampler_count = (0 < create_info->max_sampler_count) ? create_info->max_sampler_count : LAVA_DEFAULT_MAX_SAMPLERS;
+    lava_mutex_initialize(&new_cache->mutex);
+    //Keep the load under one half
+    uint32_t slot_count = 64;
+    while(slot_count < (new_cache->max_sampler_count * 2)) {
+        slot_count <<= 1;
+    }
+    new_cache->slot_mask = slot_count - 1;
+    new_cache->entries = (lava_sampler_entry*)lava_calloc(allocator, sizeof(lava_sampler_entry) * new_cache->max_sampler_count);
+    new_cache->slots = (volatile int64_t*)lava_calloc(allocator, sizeof(int64_t) * slot_count);
+    if(LAVA_NULL == new_cache->entries || LAVA_NULL == new_cache->slots) {
+        lava_destroy_sampler_cache(new_cache);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    *cache = new_cache;
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_destroy_sampler_cache(lava_sampler_cache* cache)
+{
+    if(LAVA_NULL == cache) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = cache->allocator;
+    if(LAVA_NULL != cache->entries) {
+        for(uint32_t i = 0; i < cache->entry_count; ++i) {
+            vkDestroySampler(cache->device->device_, cache->entries[i].sampler, allocator);
+        }
+    }
+    lava_handle_map_terminate(allocator, &cache->sampler_entries);
+    lava_free(allocator, (void*)cache->slots);
+    lava_free(allocator, cache->entries);
+    lava_mutex_terminate(&cache->mutex);
+    lava_free(allocator, cache);
+}
+
+VkResult LAVA_API lava_acquire_sampler(lava_sampler_cache* cache, const VkSamplerCreateInfo* create_info, VkSampler* sampler)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != sampler);
+    lava_atomic_add64(&cache->requests, 1);
+    lava_sampler_key key;
+    if(!lava_sampler_key_initialize(&key, create_info)) {
+        //Unknown chained structs cannot be told apart, such samplers are not shared
+        VkResult result = vkCreateSampler(cache->device->device_, create_info, cache->allocator, sampler);
+        if(VK_SUCCESS == result) {
+            lava_atomic_add32(&cache->uncached_count, 1);
+        }
+        return result;
+    }
+    uint64_t hash = lava_sampler_key_hash(&key);
+    lava_sampler_entry* entry = lava_sampler_cache_find(cache, &key, hash);
+    if(LAVA_NULL != entry) {
+        lava_atomic_add32(&entry->references, 1);
+        lava_atomic_add64(&cache->hits, 1);
+        *sampler = entry->sampler;
+        return VK_SUCCESS;
+    }
+
+    lava_mutex_lock(&cache->mutex);
+    //Another thread may have created it meanwhile
+    entry = lava_sampler_cache_find(cache, &key, hash);
+    if(LAVA_NULL != entry) {
+        lava_atomic_add32(&entry->references, 1);
+        lava_atomic_add64(&cache->hits, 1);
+        *sampler = entry->sampler;
+        lava_mutex_unlock(&cache->mutex);
+        return VK_SUCCESS;
+    }
+    if(cache->max_sampler_count <= cache->entry_count) {
+        lava_mutex_unlock(&cache->mutex);
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+    uint32_t index = cache->entry_count;
+    entry = &cache->entries[index];
+    VkResult result = vkCreateSampler(cache->device->device_, create_info, cache->allocator, &entry->sampler);
+    if(VK_SUCCESS != result) {
+        lava_mutex_unlock(&cache->mutex);
+        return result;
+    }
+    if(!lava_handle_map_insert(cache->allocator, &cache->sampler_entries, LAVA_OBJECT_HANDLE(entry->sampler), index)) {
+        vkDestroySampler(cache->device->device_, entry->sampler, cache->allocator);
+        lava_mutex_unlock(&cache->mutex);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    entry->key = key;
+    entry->references = 1;
+    ++cache->entry_count;
+    lava_sampler_cache_publish(cache, hash, index);
+    *sampler = entry->sampler;
+    lava_mutex_unlock(&cache->mutex);
+    return VK_SUCCESS;
+}
+
+void LAVA_API lava_release_sampler(lava_sampler_cache* cache, VkSampler sampler)
+{
+    assert(LAVA_NULL != cache);
+    if(VK_NULL_HANDLE == sampler) {
+        return;
+    }
+    //Decrement under the mutex, lava_trim_sampler_cache moves entries to other indices
+    lava_mutex_lock(&cache->mutex);
+    uint32_t index = lava_handle_map_find(&cache->sampler_entries, LAVA_OBJECT_HANDLE(sampler));
+    if(LAVA_HANDLE_MAP_EMPTY != index) {
+        int32_t references = lava_atomic_add32(&cache->entries[index].references, -1);
+        assert(0 < references);
+        (void)references;
+        lava_mutex_unlock(&cache->mutex);
+        return;
+    }
+    lava_mutex_unlock(&cache->mutex);
+    vkDestroySampler(cache->device->device_, sampler, cache->allocator);
+    lava_atomic_add32(&cache->uncached_count, -1);
+}
+
+void LAVA_API lava_trim_sampler_cache(lava_sampler_cache* cache)
+{
+    assert(LAVA_NULL != cache);
+    lava_mutex_lock(&cache->mutex);
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < cache->entry_count; ++i) {
+        lava_sampler_entry* entry = &cache->entries[i];
+        if(lava_atomic_load32(&entry->references) <= 0) {
+            lava_handle_map_erase(&cache->sampler_entries, LAVA_OBJECT_HANDLE(entry->sampler));
+            vkDestroySampler(cache->device->device_, entry->sampler, cache->allocator);
+            continue;
+        }
+        if(count != i) {
+            cache->entries[count].key = entry->key;
+            cache->entries[count].sampler = entry->sampler;
+            cache->entries[count].references = entry->references;
+            lava_handle_map_assign(&cache->sampler_entries, LAVA_OBJECT_HANDLE(entry->sampler), count);
+        }
+        ++count;
+    }
+    cache->entry_count = count;
+    memset((void*)cache->slots, 0, sizeof(int64_t) * (cache->slot_mask + 1));
+    for(uint32_t i = 0; i < count; ++i) {
+        lava_sampler_cache_publish(cache, lava_sampler_key_hash(&cache->entries[i].key), i);
+    }
+    lava_mutex_unlock(&cache->mutex);
+}
+
+void LAVA_API lava_get_sampler_cache_stats(lava_sampler_cache* cache, lava_sampler_cache_stats* stats)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != stats);
+    stats->requests = (uint64_t)lava_atomic_load64(&cache->requests);
+    stats->hits = (uint64_t)lava_atomic_load64(&cache->hits);
+    lava_mutex_lock(&cache->mutex);
+    stats->sampler_count = cache->entry_count;
+    lava_mutex_unlock(&cache->mutex);
+    stats->uncached_count = (uint32_t)lava_atomic_load32(&cache->uncached_count);
+}
+
+//--- Pipeline cache
+//--------------------------------------------------------------------
+#define LAVA_DEFAULT_MAX_PIPELINES (4096)
+
+typedef enum lava_pipeline_kind_t
+{
+    LAVA_PIPELINE_KIND_GRAPHICS = 0,
+    LAVA_PIPELINE_KIND_COMPUTE = 1,
+    //Graphics pipeline library parts, the key is the subset of a graphics state they depend on
+    LAVA_PIPELINE_KIND_VERTEX_INPUT = 2,
+    LAVA_PIPELINE_KIND_PRE_RASTERIZATION = 3,
+    LAVA_PIPELINE_KIND_FRAGMENT_SHADER = 4,
+    LAVA_PIPELINE_KIND_FRAGMENT_OUTPUT = 5,
+} lava_pipeline_kind;
+
+#define LAVA_PIPELINE_LIBRARY_PARTS (4)
+
+typedef enum lava_pipeline_status_t
+{
+    LAVA_PIPELINE_STATUS_PENDING = 0,
+    LAVA_PIPELINE_STATUS_READY = 1,
+    LAVA_PIPELINE_STATUS_FAILED = 2,
+} lava_pipeline_status;
+
+typedef struct lava_pipeline_entry_t
+{
+    lava_pipeline_kind kind;
+    void* state; //!< Copy of the key.
+    uint64_t hash;
+    VkPipeline pipeline;
+    VkResult result;
+    uint64_t compile_time; //!< Nanoseconds, valid once the status is not pending.
+    volatile int32_t status;
+    VkPipeline optimized_pipeline; //!< Link time optimized replacement of a fast linked pipeline.
+    volatile int32_t optimized;
+} lava_pipeline_entry;
+
+typedef enum lava_pipeline_object_kind_t
+{
+    LAVA_PIPELINE_OBJECT_OPAQUE = 0, //!< Only known by its id.
+    LAVA_PIPELINE_OBJECT_SHADER_MODULE,
+    LAVA_PIPELINE_OBJECT_PIPELINE_LAYOUT,
+} lava_pipeline_object_kind;
+
+typedef struct lava_pipeline_object_t
+{
+    uint64_t handle;
+    uint64_t id;
+    lava_pipeline_object_kind kind;
+    uint32_t description_size;
+    uint32_t* description; //!< SPIR-V of a module or the words of a layout, written to manifests.
+    VkDescriptorSetLayout* set_layouts; //!< Of a layout created from a manifest.
+    uint32_t set_layout_count;
+    bool owned; //!< Created from a manifest, destroyed with the cache.
+} lava_pipeline_object;
+
+typedef struct lava_pipeline_worker_t
+{
+    lava_pipeline_cache* cache;
+    lava_thread thread;
+    VkPipelineCache pipeline_cache; //!< Own driver cache, drivers lock a shared one for every creation.
+} lava_pipeline_worker;
+
+struct lava_pipeline_cache_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    VkPipelineCache pipeline_cache;
+    lava_pipeline_cache_flags flags;
+    lava_dynamic_state_flags dynamic_state_flags;
+    lava_mutex mutex;
+    lava_condition queued; //!< Work for the compiling threads.
+    lava_condition compiled; //!< A compilation finished.
+    volatile int32_t quit;
+    uint32_t thread_count;
+    lava_pipeline_worker* workers;
+    uint32_t max_pipeline_count;
+    uint32_t entry_count;
+    lava_pipeline_entry* entries; //!< Never reallocated, readers access it without the lock.
+    uint32_t slot_mask;
+    volatile int64_t* slots; //!< Upper hash bits and entry index plus one, 0 is empty.
+    uint32_t* queue; //!< Entries to compile, from queue_head.
+    uint32_t queue_head;
+    uint32_t queue_count;
+    uint32_t queue_capacity;
+    uint32_t* optimize_queue; //!< Fast linked entries to link again with optimizations, after the queue.
+    uint32_t optimize_head;
+    uint32_t optimize_count;
+    uint32_t optimize_capacity;
+    uint32_t pending_count;
+    uint32_t failed_count;
+    uint32_t library_count;
+    uint32_t optimized_count;
+    uint64_t compile_time;
+    uint32_t object_count;
+    uint32_t object_capacity;
+    lava_pipeline_object* objects; //!< Stable ids of the handles, for manifests.
+    lava_handle_map object_handles;
+    lava_handle_map object_ids;
+    volatile int64_t requests;
+    volatile int64_t hits;
+    volatile int64_t not_ready;
+};
+
+void LAVA_API lava_graphics_pipeline_state_initialize(lava_graphics_pipeline_state* state)
+{
+    assert(LAVA_NULL != state);
+    memset(state, 0, sizeof(lava_graphics_pipeline_state));
+    state->topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state->polygon_mode = VK_POLYGON_MODE_FILL;
+    state->cull_mode = VK_CULL_MODE_NONE;
+    state->front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    state->samples = VK_SAMPLE_COUNT_1_BIT;
+    state->depth_compare = VK_COMPARE_OP_ALWAYS;
+    for(uint32_t i = 0; i < LAVA_MAX_COLOR_ATTACHMENTS; ++i) {
+        state->blend[i].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    }
+}
+
+void LAVA_API lava_compute_pipeline_state_initialize(lava_compute_pipeline_state* state)
+{
+    assert(LAVA_NULL != state);
+    memset(state, 0, sizeof(lava_compute_pipeline_state));
+    state->stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+}
+
+static size_t lava_pipeline_state_size(lava_pipeline_kind kind)
+{
+    return (LAVA_PIPELINE_KIND_COMPUTE == kind) ? sizeof(lava_compute_pipeline_state) : sizeof(lava_graphics_pipeline_state);
+}
+
+VkBool32 LAVA_API lava_supports_graphics_pipeline_library(VkPhysicalDevice physical_device)
+{
+    if(!lava_has_device_extension(physical_device, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+        return VK_FALSE;
+    }
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library_features;
+    memset(&library_features, 0, sizeof(library_features));
+    library_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features;
+    memset(&features, 0, sizeof(features));
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &library_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    //Without fast linking, linking is not cheaper than a full compile
+    VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT library_properties;
+    memset(&library_properties, 0, sizeof(library_properties));
+    library_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties;
+    memset(&properties, 0, sizeof(properties));
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &library_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+    return (VK_TRUE == library_features.graphicsPipelineLibrary && VK_TRUE == library_properties.graphicsPipelineLibraryFastLinking) ? VK_TRUE : VK_FALSE;
+}
+
+static void lava_pipeline_specialization(uint32_t count, const lava_specialization_constant* constants, VkSpecializationMapEntry* map_entries, VkSpecializationInfo* info)
+{
+    for(uint32_t i = 0; i < count; ++i) {
+        map_entries[i].constantID = constants[i].constant_id;
+        map_entries[i].offset = (uint32_t)(sizeof(lava_specialization_constant) * i + offsetof(lava_specialization_constant, value));
+        map_entries[i].size = sizeof(uint32_t);
+    }
+    info->mapEntryCount = count;
+    info->pMapEntries = map_entries;
+    info->dataSize = sizeof(lava_specialization_constant) * count;
+    info->pData = constants;
+}
+
+static void lava_pipeline_shader_stage(const lava_shader_stage* stage, const VkSpecializationInfo* specialization, VkPipelineShaderStageCreateInfo* info)
+{
+    info->sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info->pNext = LAVA_NULL;
+    info->flags = 0;
+    info->stage = stage->stage;
+    info->module = stage->module;
+    info->pName = ('\0' != stage->entry_point[0]) ? stage->entry_point : "main";
+    info->pSpecializationInfo = (0 < specialization->mapEntryCount) ? specialization : LAVA_NULL;
+}
+
+static bool lava_has_dynamic_state(const lava_graphics_pipeline_state* state, VkDynamicState dynamic_state)
+{
+    for(uint32_t i = 0; i < state->dynamic_state_count; ++i) {
+        if(dynamic_state == state->dynamic_states[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+lava_dynamic_state_flags LAVA_API lava_get_dynamic_state_support(VkPhysicalDevice physical_device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    if(properties.apiVersion < VK_API_VERSION_1_3) {
+        return 0;
+    }
+    //Extended dynamic state 1 and 2 are core in 1.3
+    lava_dynamic_state_flags flags = LAVA_DYNAMIC_STATE_CORE_BIT;
+    VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamic_state2_features;
+    memset(&dynamic_state2_features, 0, sizeof(dynamic_state2_features));
+    dynamic_state2_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+    VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT vertex_input_features;
+    memset(&vertex_input_features, 0, sizeof(vertex_input_features));
+    vertex_input_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_INPUT_DYNAMIC_STATE_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features;
+    memset(&features, 0, sizeof(features));
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    if(lava_has_device_extension(physical_device, VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)) {
+        dynamic_state2_features.pNext = features.pNext;
+        features.pNext = &dynamic_state2_features;
+    }
+    if(lava_has_device_extension(physical_device, VK_EXT_VERTEX_INPUT_DYNAMIC_STATE_EXTENSION_NAME)) {
+        vertex_input_features.pNext = features.pNext;
+        features.pNext = &vertex_input_features;
+    }
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    if(VK_TRUE == dynamic_state2_features.extendedDynamicState2PatchControlPoints) {
+        flags |= LAVA_DYNAMIC_STATE_PATCH_CONTROL_POINTS_BIT;
+    }
+    if(VK_TRUE == vertex_input_features.vertexInputDynamicState) {
+        flags |= LAVA_DYNAMIC_STATE_VERTEX_INPUT_BIT;
+    }
+    return flags;
+}
+
+static void lava_add_dynamic_state(lava_graphics_pipeline_state* state, VkDynamicState dynamic_state)
+{
+    if(!lava_has_dynamic_state(state, dynamic_state)) {
+        assert(state->dynamic_state_count < LAVA_MAX_DYNAMIC_STATES);
+        state->dynamic_states[state->dynamic_state_count++] = dynamic_state;
+    }
+}
+
+static VkPrimitiveTopology lava_topology_class(VkPrimitiveTopology topology)
+{
+    //Without dynamicPrimitiveTopologyUnrestricted, the pipeline fixes the class
+    switch(topology) {
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+        return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+        return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+    case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+        return VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+    default:
+        return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    }
+}
+
+void LAVA_API lava_get_dynamic_pipeline_key(lava_dynamic_state_flags flags, const lava_graphics_pipeline_state* state, lava_graphics_pipeline_state* key)
+{
+    assert(LAVA_NULL != state);
+    assert(LAVA_NULL != key);
+    if(key != state) {
+        memcpy(key, state, sizeof(lava_graphics_pipeline_state));
+    }
+    //The dynamic states are appended in a fixed order, so that equal states get equal keys
+    if(0 != (flags & LAVA_DYNAMIC_STATE_CORE_BIT)) {
+        key->cull_mode = VK_CULL_MODE_NONE;
+        key->front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        key->topology = lava_topology_class(state->topology);
+        key->primitive_restart = VK_FALSE;
+        key->rasterizer_discard = VK_FALSE;
+        key->depth_bias = VK_FALSE;
+        key->depth_test = VK_FALSE;
+        key->depth_write = VK_FALSE;
+        key->depth_compare = VK_COMPARE_OP_NEVER;
+        key->stencil_test = VK_FALSE;
+        //Masks and reference stay static
+        key->stencil_front.failOp = key->stencil_front.passOp = key->stencil_front.depthFailOp = VK_STENCIL_OP_KEEP;
+        key->stencil_front.compareOp = VK_COMPARE_OP_NEVER;
+        key->stencil_back.failOp = key->stencil_back.passOp = key->stencil_back.depthFailOp = VK_STENCIL_OP_KEEP;
+        key->stencil_back.compareOp = VK_COMPARE_OP_NEVER;
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_CULL_MODE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_FRONT_FACE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE);
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_STENCIL_OP);
+    }
+    if(0 != (flags & LAVA_DYNAMIC_STATE_PATCH_CONTROL_POINTS_BIT) && 0 < key->patch_control_points) {
+        //Tessellated pipelines still need a tessellation state, its count is ignored
+        key->patch_control_points = 1;
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_PATCH_CONTROL_POINTS_EXT);
+    }
+    if(0 != (flags & LAVA_DYNAMIC_STATE_VERTEX_INPUT_BIT)) {
+        key->vertex_binding_count = 0;
+        memset(key->vertex_bindings, 0, sizeof(key->vertex_bindings));
+        key->vertex_attribute_count = 0;
+        memset(key->vertex_attributes, 0, sizeof(key->vertex_attributes));
+        lava_add_dynamic_state(key, VK_DYNAMIC_STATE_VERTEX_INPUT_EXT);
+    }
+}
+
+/**
+ @param library_flags Non zero to create a library of these parts, the other parts of the state are ignored.
+ */
+static VkResult lava_compile_graphics_pipeline(lava_pipeline_cache* cache, VkPipelineCache pipeline_cache, const lava_graphics_pipeline_state* state, VkGraphicsPipelineLibraryFlagsEXT library_flags, VkPipeline* pipeline)
+{
+    VkSpecializationMapEntry map_entries[LAVA_MAX_SPECIALIZATION_CONSTANTS];
+    VkSpecializationInfo specialization;
+    lava_pipeline_specialization(state->specialization_count, state->specializations, map_entries, &specialization);
+    VkPipelineShaderStageCreateInfo stages[LAVA_MAX_SHADER_STAGES];
+    for(uint32_t i = 0; i < state->stage_count; ++i) {
+        lava_pipeline_shader_stage(&state->stages[i], &specialization, &stages[i]);
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO, LAVA_NULL, 0, state->vertex_binding_count, state->vertex_bindings, state->vertex_attribute_count, state->vertex_attributes};
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO, LAVA_NULL, 0, state->topology, state->primitive_restart};
+    VkPipelineTessellationStateCreateInfo tessellation = {VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO, LAVA_NULL, 0, state->patch_control_points};
+    //Viewports and scissors are dynamic, with or without their counts
+    uint32_t viewport_count = lava_has_dynamic_state(state, VK_DYNAMIC_STATE_VIEWPORT_WITH_COUNT) ? 0 : 1;
+    uint32_t scissor_count = lava_has_dynamic_state(state, VK_DYNAMIC_STATE_SCISSOR_WITH_COUNT) ? 0 : 1;
+    VkPipelineViewportStateCreateInfo viewport = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO, LAVA_NULL, 0, viewport_count, LAVA_NULL, scissor_count, LAVA_NULL};
+    VkPipelineRasterizationStateCreateInfo rasterization = {
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        LAVA_NULL,
+        0,
+        state->depth_clamp,
+        state->rasterizer_discard,
+        state->polygon_mode,
+        state->cull_mode,
+        state->front_face,
+        state->depth_bias,
+        state->depth_bias_constant,
+        state->depth_bias_clamp,
+        state->depth_bias_slope,
+        1.0f,
+    };
+    VkPipelineMultisampleStateCreateInfo multisample = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO, LAVA_NULL, 0, state->samples, VK_FALSE, 0.0f, LAVA_NULL, state->alpha_to_coverage, VK_FALSE};
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        LAVA_NULL,
+        0,
+        state->depth_test,
+        state->depth_write,
+        state->depth_compare,
+        VK_FALSE,
+        state->stencil_test,
+        state->stencil_front,
+        state->stencil_back,
+        0.0f,
+        1.0f,
+    };
+    VkPipelineColorBlendStateCreateInfo color_blend = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO, LAVA_NULL, 0, VK_FALSE, VK_LOGIC_OP_COPY, state->color_attachment_count, state->blend, {0.0f, 0.0f, 0.0f, 0.0f}};
+    VkDynamicState dynamic_states[LAVA_MAX_DYNAMIC_STATES + 2];
+    uint32_t dynamic_state_count = 0;
+    if(0 < viewport_count) {
+        dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_VIEWPORT;
+    }
+    if(0 < scissor_count) {
+        dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_SCISSOR;
+    }
+    for(uint32_t i = 0; i < state->dynamic_state_count; ++i) {
+        if(VK_DYNAMIC_STATE_VIEWPORT != state->dynamic_states[i] && VK_DYNAMIC_STATE_SCISSOR != state->dynamic_states[i]) {
+            dynamic_states[dynamic_state_count++] = state->dynamic_states[i];
+        }
+    }
+    VkPipelineDynamicStateCreateInfo dynamic = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO, LAVA_NULL, 0, dynamic_state_count, dynamic_states};
+    VkPipelineRenderingCreateInfo rendering = {
+        VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        LAVA_NULL,
+        state->view_mask,
+        state->color_attachment_count,
+        state->color_formats,
+        state->depth_format,
+        state->stencil_format,
+    };
+    VkGraphicsPipelineLibraryCreateInfoEXT library_info = {
+        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+        (VK_NULL_HANDLE == state->render_pass) ? &rendering : LAVA_NULL,
+        library_flags,
+    };
+    VkGraphicsPipelineCreateInfo pipeline_info = {
+        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        (0 != library_flags) ? &library_info : library_info.pNext,
+        (0 != library_flags) ? (state->flags | VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT) : state->flags,
+        state->stage_count,
+        stages,
+        &vertex_input,
+        &input_assembly,
+        (0 < state->patch_control_points) ? &tessellation : LAVA_NULL,
+        &viewport,
+        &rasterization,
+        &multisample,
+        &depth_stencil,
+        &color_blend,
+        &dynamic,
+        state->layout,
+        state->render_pass,
+        state->subpass,
+        VK_NULL_HANDLE,
+        -1,
+    };
+    return vkCreateGraphicsPipelines(cache->device->device_, pipeline_cache, 1, &pipeline_info, cache->allocator, pipeline);
+}
+
+static VkResult lava_link_graphics_pipeline(lava_pipeline_cache* cache, VkPipelineCache pipeline_cache, const lava_graphics_pipeline_state* state, uint32_t library_count, const VkPipeline* libraries, VkPipelineCreateFlags flags, VkPipeline* pipeline)
+{
+    VkPipelineLibraryCreateInfoKHR library_info = {VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR, LAVA_NULL, library_count, libraries};
+    VkGraphicsPipelineCreateInfo pipeline_info;
+    memset(&pipeline_info, 0, sizeof(pipeline_info));
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = &library_info;
+    pipeline_info.flags = state->flags | flags;
+    pipeline_info.layout = state->layout;
+    pipeline_info.basePipelineIndex = -1;
+    return vkCreateGraphicsPipelines(cache->device->device_, pipeline_cache, 1, &pipeline_info, cache->allocator, pipeline);
+}
+
+static VkGraphicsPipelineLibraryFlagsEXT lava_pipeline_library_flags(lava_pipeline_kind kind)
+{
+    switch(kind) {
+    case LAVA_PIPELINE_KIND_VERTEX_INPUT:
+        return VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+    case LAVA_PIPELINE_KIND_PRE_RASTERIZATION:
+        return VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+    case LAVA_PIPELINE_KIND_FRAGMENT_SHADER:
+        return VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+    case LAVA_PIPELINE_KIND_FRAGMENT_OUTPUT:
+        return VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+    default:
+        return 0;
+    }
+}
+
+/**
+ @brief Copy the part of a graphics state a library depends on, so that materials sharing it share the library.
+ */
+static void lava_pipeline_library_state(lava_pipeline_kind kind, const lava_graphics_pipeline_state* state, lava_graphics_pipeline_state* part)
+{
+    memset(part, 0, sizeof(lava_graphics_pipeline_state));
+    part->flags = state->flags;
+    part->dynamic_state_count = state->dynamic_state_count;
+    memcpy(part->dynamic_states, state->dynamic_states, sizeof(VkDynamicState) * state->dynamic_state_count);
+    if(LAVA_PIPELINE_KIND_VERTEX_INPUT == kind) {
+        part->vertex_binding_count = state->vertex_binding_count;
+        memcpy(part->vertex_bindings, state->vertex_bindings, sizeof(VkVertexInputBindingDescription) * state->vertex_binding_count);
+        part->vertex_attribute_count = state->vertex_attribute_count;
+        memcpy(part->vertex_attributes, state->vertex_attributes, sizeof(VkVertexInputAttributeDescription) * state->vertex_attribute_count);
+        part->topology = state->topology;
+        part->primitive_restart = state->primitive_restart;
+        return;
+    }
+    part->render_pass = state->render_pass;
+    part->subpass = state->subpass;
+    part->view_mask = state->view_mask;
+    if(LAVA_PIPELINE_KIND_FRAGMENT_OUTPUT != kind) {
+        part->layout = state->layout;
+        part->specialization_count = state->specialization_count;
+        memcpy(part->specializations, state->specializations, sizeof(lava_specialization_constant) * state->specialization_count);
+        for(uint32_t i = 0; i < state->stage_count; ++i) {
+            if((VK_SHADER_STAGE_FRAGMENT_BIT == state->stages[i].stage) == (LAVA_PIPELINE_KIND_FRAGMENT_SHADER == kind)) {
+                part->stages[part->stage_count++] = state->stages[i];
+            }
+        }
+    }
+    switch(kind) {
+    case LAVA_PIPELINE_KIND_PRE_RASTERIZATION:
+        part->patch_control_points = state->patch_control_points;
+        part->depth_clamp = state->depth_clamp;
+        part->rasterizer_discard = state->rasterizer_discard;
+        part->polygon_mode = state->polygon_mode;
+        part->cull_mode = state->cull_mode;
+        part->front_face = state->front_face;
+        part->depth_bias = state->depth_bias;
+        part->depth_bias_constant = state->depth_bias_constant;
+        part->depth_bias_clamp = state->depth_bias_clamp;
+        part->depth_bias_slope = state->depth_bias_slope;
+        break;
+    case LAVA_PIPELINE_KIND_FRAGMENT_SHADER:
+        part->samples = state->samples;
+        part->alpha_to_coverage = state->alpha_to_coverage;
+        part->depth_test = state->depth_test;
+        part->depth_write = state->depth_write;
+        part->depth_compare = state->depth_compare;
+        part->stencil_test = state->stencil_test;
+        part->stencil_front = state->stencil_front;
+        part->stencil_back = state->stencil_back;
+        break;
+    default:
+        part->samples = state->samples;
+        part->alpha_to_coverage = state->alpha_to_coverage;
+        part->color_attachment_count = state->color_attachment_count;
+        memcpy(part->blend, state->blend, sizeof(VkPipelineColorBlendAttachmentState) * state->color_attachment_count);
+        memcpy(part->color_formats, state->color_formats, sizeof(VkFormat) * state->color_attachment_count);
+        part->depth_format = state->depth_format;
+        part->stencil_format = state->stencil_format;
+        break;
+    }
+}
+
+static VkResult lava_compile_compute_pipeline(lava_pipeline_cache* cache, VkPipelineCache pipeline_cache, const lava_compute_pipeline_state* state, VkPipeline* pipeline)
+{
+    VkSpecializationMapEntry map_entries[LAVA_MAX_SPECIALIZATION_CONSTANTS];
+    VkSpecializationInfo specialization;
+    lava_pipeline_specialization(state->specialization_count, state->specializations, map_entries, &specialization);
+    VkComputePipelineCreateInfo pipeline_info;
+    memset(&pipeline_info, 0, sizeof(pipeline_info));
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.flags = state->flags;
+    lava_pipeline_shader_stage(&state->stage, &specialization, &pipeline_info.stage);
+    pipeline_info.layout = state->layout;
+    pipeline_info.basePipelineIndex = -1;
+    return vkCreateComputePipelines(cache->device->device_, pipeline_cache, 1, &pipeline_info, cache->allocator, pipeline);
+}
+
+static VkResult lava_acquire_pipeline_library(lava_pipeline_worker* worker, lava_pipeline_kind kind, const lava_graphics_pipeline_state* state, VkPipeline* library);
+
+static VkResult lava_acquire_pipeline_libraries(lava_pipeline_worker* worker, const lava_graphics_pipeline_state* state, VkPipeline* libraries, uint32_t* library_count)
+{
+    //Nothing is rasterized without fragment parts
+    uint32_t count = (VK_TRUE == state->rasterizer_discard) ? 2 : LAVA_PIPELINE_LIBRARY_PARTS;
+    for(uint32_t i = 0; i < count; ++i) {
+        VkResult result = lava_acquire_pipeline_library(worker, (lava_pipeline_kind)(LAVA_PIPELINE_KIND_VERTEX_INPUT + i), state, &libraries[i]);
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+    }
+    *library_count = count;
+    return VK_SUCCESS;
+}
+
+static void lava_compile_pipeline_entry(lava_pipeline_worker* worker, lava_pipeline_entry* entry)
+{
+    lava_pipeline_cache* cache = worker->cache;
+    const lava_graphics_pipeline_state* graphics = (const lava_graphics_pipeline_state*)entry->state;
+    VkPipeline libraries[LAVA_PIPELINE_LIBRARY_PARTS];
+    uint32_t library_count = 0;
+    VkResult result = VK_SUCCESS;
+    //Parts compiled here are timed as their own entries
+    if(LAVA_PIPELINE_KIND_GRAPHICS == entry->kind && 0 != (cache->flags & LAVA_PIPELINE_CACHE_GRAPHICS_PIPELINE_LIBRARY_BIT)) {
+        result = lava_acquire_pipeline_libraries(worker, graphics, libraries, &library_count);
+    }
+    uint64_t start = lava_timestamp();
+    if(VK_SUCCESS == result) {
+        if(0 < library_count) {
+            result = lava_link_graphics_pipeline(cache, worker->pipeline_cache, graphics, library_count, libraries, 0, &entry->pipeline);
+        } else if(LAVA_PIPELINE_KIND_COMPUTE == entry->kind) {
+            result = lava_compile_compute_pipeline(cache, worker->pipeline_cache, (const lava_compute_pipeline_state*)entry->state, &entry->pipeline);
+        } else {
+            result = lava_compile_graphics_pipeline(cache, worker->pipeline_cache, graphics, lava_pipeline_library_flags(entry->kind), &entry->pipeline);
+        }
+    }
+    entry->result = result;
+    entry->compile_time = lava_timestamp() - start;
+    lava_mutex_lock(&cache->mutex);
+    --cache->pending_count;
+    cache->compile_time += entry->compile_time;
+    if(VK_SUCCESS != result) {
+        ++cache->failed_count;
+    } else if(0 < library_count) {
+        //The fast link is usable now, the optimized one is built when nothing new waits
+        if(lava_reserve(cache->allocator, (void**)&cache->optimize_queue, &cache->optimize_capacity, cache->optimize_count + 1, sizeof(uint32_t))) {
+            cache->optimize_queue[cache->optimize_count++] = (uint32_t)(entry - cache->entries);
+            lava_condition_broadcast(&cache->queued);
+        }
+    }
+    lava_atomic_add32(&entry->status, (VK_SUCCESS == result) ? LAVA_PIPELINE_STATUS_READY : LAVA_PIPELINE_STATUS_FAILED);
+    lava_condition_broadcast(&cache->compiled);
+    lava_mutex_unlock(&cache->mutex);
+}
+
+static void lava_optimize_pipeline_entry(lava_pipeline_worker* worker, lava_pipeline_entry* entry)
+{
+    lava_pipeline_cache* cache = worker->cache;
+    const lava_graphics_pipeline_state* graphics = (const lava_graphics_pipeline_state*)entry->state;
+    VkPipeline libraries[LAVA_PIPELINE_LIBRARY_PARTS];
+    uint32_t library_count = 0;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if(VK_SUCCESS != lava_acquire_pipeline_libraries(worker, graphics, libraries, &library_count)
+       || VK_SUCCESS != lava_link_graphics_pipeline(cache, worker->pipeline_cache, graphics, library_count, libraries, VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT, &pipeline)) {
+        return;
+    }
+    //Command buffers may still use the fast linked pipeline, it lives as long as the cache
+    entry->optimized_pipeline = pipeline;
+    lava_atomic_add32(&entry->optimized, 1);
+    lava_mutex_lock(&cache->mutex);
+    ++cache->optimized_count;
+    lava_mutex_unlock(&cache->mutex);
+}
+
+static LAVA_THREAD_PROC(lava_pipeline_compile_proc)
+{
+    lava_pipeline_worker* worker = (lava_pipeline_worker*)argument;
+    lava_pipeline_cache* cache = worker->cache;
+    for(;;) {
+        lava_mutex_lock(&cache->mutex);
+        while(cache->queue_head == cache->queue_count && cache->optimize_head == cache->optimize_count && 0 == lava_atomic_load32(&cache->quit)) {
+            lava_condition_wait(&cache->queued, &cache->mutex);
+        }
+        //New pipelines first, optimizations are dropped when quitting
+        lava_pipeline_entry* entry = LAVA_NULL;
+        bool optimize = false;
+        if(cache->queue_head != cache->queue_count) {
+            entry = &cache->entries[cache->queue[cache->queue_head++]];
+            if(cache->queue_head == cache->queue_count) {
+                cache->queue_head = cache->queue_count = 0;
+            }
+        } else if(cache->optimize_head != cache->optimize_count && 0 == lava_atomic_load32(&cache->quit)) {
+            entry = &cache->entries[cache->optimize_queue[cache->optimize_head++]];
+            if(cache->optimize_head == cache->optimize_count) {
+                cache->optimize_head = cache->optimize_count = 0;
+            }
+            optimize = true;
+        }
+        lava_mutex_unlock(&cache->mutex);
+        if(LAVA_NULL == entry) {
+            break;
+        }
+        if(optimize) {
+            lava_optimize_pipeline_entry(worker, entry);
+        } else {
+            lava_compile_pipeline_entry(worker, entry);
+        }
+    }
+    return LAVA_THREAD_RETURN;
+}
+
+static lava_pipeline_entry* lava_pipeline_cache_find(lava_pipeline_cache* cache, lava_pipeline_kind kind, const void* state, uint64_t hash)
+{
+    uint32_t slot = (uint32_t)hash & cache->slot_mask;
+    for(;;) {
+        int64_t value = lava_atomic_load64(&cache->slots[slot]);
+        if(0 == value) {
+            return LAVA_NULL;
+        }
+        if((uint32_t)((uint64_t)value >> 32) == (uint32_t)(hash >> 32)) {
+            lava_pipeline_entry* entry = &cache->entries[(uint32_t)value - 1];
+            if(kind == entry->kind && 0 == memcmp(entry->state, state, lava_pipeline_state_size(kind))) {
+                return entry;
+            }
+        }
+        slot = (slot + 1) & cache->slot_mask;
+    }
+}
+
+static VkResult lava_pipeline_entry_result(lava_pipeline_cache* cache, lava_pipeline_entry* entry, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline)
+{
+    int32_t status = lava_atomic_load32(&entry->status);
+    if(LAVA_PIPELINE_STATUS_PENDING == status && 0 != (flags & LAVA_PIPELINE_REQUEST_WAIT_BIT)) {
+        lava_mutex_lock(&cache->mutex);
+        while(LAVA_PIPELINE_STATUS_PENDING == (status = lava_atomic_load32(&entry->status))) {
+            lava_condition_wait(&cache->compiled, &cache->mutex);
+        }
+        lava_mutex_unlock(&cache->mutex);
+    }
+    switch(status) {
+    case LAVA_PIPELINE_STATUS_READY:
+        lava_atomic_add64(&cache->hits, 1);
+        *pipeline = (0 != lava_atomic_load32(&entry->optimized)) ? entry->optimized_pipeline : entry->pipeline;
+        return VK_SUCCESS;
+    case LAVA_PIPELINE_STATUS_PENDING:
+        lava_atomic_add64(&cache->not_ready, 1);
+        *pipeline = fallback;
+        return VK_NOT_READY;
+    default:
+        *pipeline = fallback;
+        return entry->result;
+    }
+}
+
+/**
+ @brief Add a pending entry, the caller compiles it or queues it. Call with the mutex locked.
+ */
+static VkResult lava_add_pipeline_entry(lava_pipeline_cache* cache, lava_pipeline_kind kind, const void* state, uint64_t hash, lava_pipeline_entry** added)
+{
+    if(cache->max_pipeline_count <= cache->entry_count) {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+    size_t size = lava_pipeline_state_size(kind);
+    uint32_t index = cache->entry_count;
+    lava_pipeline_entry* entry = &cache->entries[index];
+    entry->state = lava_malloc(cache->allocator, size);
+    if(LAVA_NULL == entry->state) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    memcpy(entry->state, state, size);
+    entry->kind = kind;
+    entry->hash = hash;
+    entry->pipeline = VK_NULL_HANDLE;
+    entry->result = VK_NOT_READY;
+    entry->status = LAVA_PIPELINE_STATUS_PENDING;
+    ++cache->entry_count;
+    ++cache->pending_count;
+    uint32_t slot = (uint32_t)hash & cache->slot_mask;
+    while(0 != cache->slots[slot]) {
+        slot = (slot + 1) & cache->slot_mask;
+    }
+    lava_atomic_store64(&cache->slots[slot], (int64_t)((hash & 0xFFFFFFFF00000000ULL) | (uint64_t)(index + 1)));
+    *added = entry;
+    return VK_SUCCESS;
+}
+
+/**
+ @brief Find the entry of a state, or queue its compilation. Call with the mutex locked.
+ */
+static VkResult lava_queue_pipeline(lava_pipeline_cache* cache, lava_pipeline_kind kind, const void* state, uint64_t hash, lava_pipeline_entry** found)
+{
+    //Another thread may have queued it meanwhile
+    lava_pipeline_entry* entry = lava_pipeline_cache_find(cache, kind, state, hash);
+    if(LAVA_NULL == entry) {
+        if(!lava_reserve(cache->allocator, (void**)&cache->queue, &cache->queue_capacity, cache->queue_count + 1, sizeof(uint32_t))) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        VkResult result = lava_add_pipeline_entry(cache, kind, state, hash, &entry);
+        if(VK_SUCCESS != result) {
+            return result;
+        }
+        cache->queue[cache->queue_count++] = (uint32_t)(entry - cache->entries);
+        lava_condition_broadcast(&cache->queued);
+    }
+    *found = entry;
+    return VK_SUCCESS;
+}
+
+/**
+ @brief Find a compiled library part, or compile it on this thread.
+
+ A thread compiles the parts it adds before it waits for any other, so that no two threads wait for each other.
+ */
+static VkResult lava_acquire_pipeline_library(lava_pipeline_worker* worker, lava_pipeline_kind kind, const lava_graphics_pipeline_state* state, VkPipeline* library)
+{
+    lava_pipeline_cache* cache = worker->cache;
+    lava_graphics_pipeline_state part;
+    lava_pipeline_library_state(kind, state, &part);
+    uint64_t hash = lava_hash_bytes((uint64_t)kind, &part, sizeof(lava_graphics_pipeline_state));
+    lava_pipeline_entry* entry = lava_pipeline_cache_find(cache, kind, &part, hash);
+    bool added = false;
+    if(LAVA_NULL == entry || LAVA_PIPELINE_STATUS_PENDING == lava_atomic_load32(&entry->status)) {
+        lava_mutex_lock(&cache->mutex);
+        entry = lava_pipeline_cache_find(cache, kind, &part, hash);
+        if(LAVA_NULL == entry) {
+            VkResult result = lava_add_pipeline_entry(cache, kind, &part, hash, &entry);
+            if(VK_SUCCESS != result) {
+                lava_mutex_unlock(&cache->mutex);
+                return result;
+            }
+            ++cache->library_count;
+            added = true;
+        } else {
+            while(LAVA_PIPELINE_STATUS_PENDING == lava_atomic_load32(&entry->status)) {
+                lava_condition_wait(&cache->compiled, &cache->mutex);
+            }
+        }
+        lava_mutex_unlock(&cache->mutex);
+    }
+    if(added) {
+        lava_compile_pipeline_entry(worker, entry);
+    }
+    *library = entry->pipeline;
+    return entry->result;
+}
+
+static VkResult lava_request_pipeline(lava_pipeline_cache* cache, lava_pipeline_kind kind, const void* state, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline)
+{
+    lava_atomic_add64(&cache->requests, 1);
+    uint64_t hash = lava_hash_bytes((uint64_t)kind, state, lava_pipeline_state_size(kind));
+    lava_pipeline_entry* entry = lava_pipeline_cache_find(cache, kind, state, hash);
+    if(LAVA_NULL != entry) {
+        return lava_pipeline_entry_result(cache, entry, flags, fallback, pipeline);
+    }
+
+    lava_mutex_lock(&cache->mutex);
+    VkResult result = lava_queue_pipeline(cache, kind, state, hash, &entry);
+    lava_mutex_unlock(&cache->mutex);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    return lava_pipeline_entry_result(cache, entry, flags, fallback, pipeline);
+}
+
+VkResult LAVA_API lava_create_pipeline_cache(const lava_pipeline_cache_create_info* create_info, lava_pipeline_cache** cache)
+{
+    assert(LAVA_NULL != create_info);
+    assert(LAVA_NULL != create_info->device);
+    assert(LAVA_NULL != cache);
+    const VkAllocationCallbacks* allocator = create_info->allocator;
+    lava_pipeline_cache* new_cache = (lava_pipeline_cache*)lava_calloc(allocator, sizeof(lava_pipeline_cache));
+    if(LAVA_NULL == new_cache) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    new_cache->device = create_info->device;
+    new_cache->allocator = allocator;
+    new_cache->pipeline_cache = create_info->pipeline_cache;
+    new_cache->flags = create_info->flags;
+    new_cache->dynamic_state_flags = create_info->dynamic_state_flags;
+    new_cache->max_pipeline_count = (0 < create_info->max_pipeline_count) ? create_info->max_pipeline_count : LAVA_DEFAULT_MAX_PIPELINES;
+    lava_mutex_initialize(&new_cache->mutex);
+    lava_condition_initialize(&new_cache->queued);
+    lava_condition_initialize(&new_cache->compiled);
+    //Keep the load under one half
+    uint32_t slot_count = 64;
+    while(slot_count < (new_cache->max_pipeline_count * 2)) {
+        slot_count <<= 1;
+    }
+    new_cache->slot_mask = slot_count - 1;
+    new_cache->entries = (lava_pipeline_entry*)lava_calloc(allocator, sizeof(lava_pipeline_entry) * new_cache->max_pipeline_count);
+    new_cache->slots = (volatile int64_t*)lava_calloc(allocator, sizeof(int64_t) * slot_count);
+    uint32_t thread_count = (0 < create_info->thread_count) ? create_info->thread_count : lava_core_count() / 2;
+    thread_count = (0 < thread_count) ? thread_count : 1;
+    new_cache->workers = (lava_pipeline_worker*)lava_calloc(allocator, sizeof(lava_pipeline_worker) * thread_count);
+    if(LAVA_NULL == new_cache->entries || LAVA_NULL == new_cache->slots || LAVA_NULL == new_cache->workers) {
+        lava_destroy_pipeline_cache(new_cache);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    //Every thread starts from the contents of the shared cache, lava_merge_pipeline_caches gathers them back
+    size_t initial_size = 0;
+    void* initial_data = LAVA_NULL;
+    if(VK_NULL_HANDLE != create_info->pipeline_cache) {
+        VkResult result = vkGetPipelineCacheData(create_info->device->device_, create_info->pipeline_cache, &initial_size, LAVA_NULL);
+        if(VK_SUCCESS == result && 0 < initial_size) {
+            initial_data = lava_malloc(allocator, initial_size);
+            result = (LAVA_NULL != initial_data) ? vkGetPipelineCacheData(create_info->device->device_, create_info->pipeline_cache, &initial_size, initial_data) : VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        if(VK_SUCCESS != result) {
+            initial_size = 0;
+        }
+    }
+    VkResult result = VK_SUCCESS;
+    for(uint32_t i = 0; i < thread_count && VK_SUCCESS == result; ++i) {
+        lava_pipeline_worker* worker = &new_cache->workers[i];
+        worker->cache = new_cache;
+        if(VK_NULL_HANDLE != create_info->pipeline_cache) {
+            VkPipelineCacheCreateInfo pipeline_cache_info = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, LAVA_NULL, 0, initial_size, initial_data};
+            result = vkCreatePipelineCache(create_info->device->device_, &pipeline_cache_info, allocator, &worker->pipeline_cache);
+            if(VK_SUCCESS != result) {
+                break;
+            }
+        }
+        if(!lava_thread_create(&worker->thread, lava_pipeline_compile_proc, worker)) {
+            vkDestroyPipelineCache(create_info->device->device_, worker->pipeline_cache, allocator);
+            result = VK_ERROR_INITIALIZATION_FAILED;
+            break;
+        }
+        ++new_cache->thread_count;
+    }
+    lava_free(allocator, initial_data);
+    if(VK_SUCCESS != result) {
+        lava_destroy_pipeline_cache(new_cache);
+        return result;
+    }
+    *cache = new_cache;
+    return VK_SUCCESS;
+}
+
+static void lava_destroy_described_object(lava_pipeline_cache* cache, lava_pipeline_object* object)
+{
+    VkDevice device = cache->device->device_;
+    const VkAllocationCallbacks* allocator = cache->allocator;
+    if(0 != object->handle && LAVA_PIPELINE_OBJECT_SHADER_MODULE == object->kind) {
+        vkDestroyShaderModule(device, LAVA_HANDLE_FROM_KEY(VkShaderModule, object->handle), allocator);
+    } else if(0 != object->handle) {
+        vkDestroyPipelineLayout(device, LAVA_HANDLE_FROM_KEY(VkPipelineLayout, object->handle), allocator);
+    }
+    for(uint32_t i = 0; i < object->set_layout_count; ++i) {
+        vkDestroyDescriptorSetLayout(device, object->set_layouts[i], allocator);
+    }
+    lava_free(allocator, object->set_layouts);
+    lava_free(allocator, object->description);
+}
+
+void LAVA_API lava_destroy_pipeline_cache(lava_pipeline_cache* cache)
+{
+    if(LAVA_NULL == cache) {
+        return;
+    }
+    const VkAllocationCallbacks* allocator = cache->allocator;
+    //Threads finish the queue before they quit
+    lava_mutex_lock(&cache->mutex);
+    lava_atomic_add32(&cache->quit, 1);
+    lava_condition_broadcast(&cache->queued);
+    lava_mutex_unlock(&cache->mutex);
+    for(uint32_t i = 0; i < cache->thread_count; ++i) {
+        lava_thread_join(cache->workers[i].thread);
+        if(VK_NULL_HANDLE != cache->workers[i].pipeline_cache) {
+            vkDestroyPipelineCache(cache->device->device_, cache->workers[i].pipeline_cache, allocator);
+        }
+    }
+    if(LAVA_NULL != cache->entries) {
+        for(uint32_t i = 0; i < cache->entry_count; ++i) {
+            if(VK_NULL_HANDLE != cache->entries[i].pipeline) {
+                vkDestroyPipeline(cache->device->device_, cache->entries[i].pipeline, allocator);
+            }
+            if(VK_NULL_HANDLE != cache->entries[i].optimized_pipeline) {
+                vkDestroyPipeline(cache->device->device_, cache->entries[i].optimized_pipeline, allocator);
+            }
+            lava_free(allocator, cache->entries[i].state);
+        }
+    }
+    for(uint32_t i = 0; i < cache->object_count; ++i) {
+        if(cache->objects[i].owned) {
+            lava_destroy_described_object(cache, &cache->objects[i]);
+        } else {
+            lava_free(allocator, cache->objects[i].description);
+        }
+    }
+    lava_handle_map_terminate(allocator, &cache->object_ids);
+    lava_handle_map_terminate(allocator, &cache->object_handles);
+    lava_free(allocator, cache->objects);
+    lava_free(allocator, cache->optimize_queue);
+    lava_free(allocator, cache->queue);
+    lava_free(allocator, cache->workers);
+    lava_free(allocator, (void*)cache->slots);
+    lava_free(allocator, cache->entries);
+    lava_condition_terminate(&cache->compiled);
+    lava_condition_terminate(&cache->queued);
+    lava_mutex_terminate(&cache->mutex);
+    lava_free(allocator, cache);
+}
+
+VkResult LAVA_API lava_request_graphics_pipeline(lava_pipeline_cache* cache, const lava_graphics_pipeline_state* state, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != state);
+    assert(state->stage_count <= LAVA_MAX_SHADER_STAGES);
+    assert(state->color_attachment_count <= LAVA_MAX_COLOR_ATTACHMENTS);
+    assert(LAVA_NULL != pipeline);
+    if(0 != cache->dynamic_state_flags) {
+        lava_graphics_pipeline_state key;
+        lava_get_dynamic_pipeline_key(cache->dynamic_state_flags, state, &key);
+        return lava_request_pipeline(cache, LAVA_PIPELINE_KIND_GRAPHICS, &key, flags, fallback, pipeline);
+    }
+    return lava_request_pipeline(cache, LAVA_PIPELINE_KIND_GRAPHICS, state, flags, fallback, pipeline);
+}
+
+VkResult LAVA_API lava_request_compute_pipeline(lava_pipeline_cache* cache, const lava_compute_pipeline_state* state, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != state);
+    assert(LAVA_NULL != pipeline);
+    return lava_request_pipeline(cache, LAVA_PIPELINE_KIND_COMPUTE, state, flags, fallback, pipeline);
+}
+
+void LAVA_API lava_wait_pipeline_compiles(lava_pipeline_cache* cache)
+{
+    assert(LAVA_NULL != cache);
+    lava_mutex_lock(&cache->mutex);
+    while(0 < cache->pending_count) {
+        lava_condition_wait(&cache->compiled, &cache->mutex);
+    }
+    lava_mutex_unlock(&cache->mutex);
+}
+
+void LAVA_API lava_get_pipeline_cache_stats(lava_pipeline_cache* cache, lava_pipeline_cache_stats* stats)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != stats);
+    stats->requests = (uint64_t)lava_atomic_load64(&cache->requests);
+    stats->hits = (uint64_t)lava_atomic_load64(&cache->hits);
+    stats->not_ready = (uint64_t)lava_atomic_load64(&cache->not_ready);
+    lava_mutex_lock(&cache->mutex);
+    stats->pipeline_count = cache->entry_count - cache->pending_count - cache->failed_count;
+    stats->pending_count = cache->pending_count;
+    stats->failed_count = cache->failed_count;
+    stats->library_count = cache->library_count;
+    stats->optimized_count = cache->optimized_count;
+    stats->compile_time = cache->compile_time;
+    lava_mutex_unlock(&cache->mutex);
+}
+
+//--- Pipeline cache files
+//--------------------------------------------------------------------
+#define LAVA_PIPELINE_CACHE_HEADER_SIZE (16 + VK_UUID_SIZE)
+
+static bool lava_is_pipeline_cache_compatible(VkPhysicalDevice physical_device, const void* data, size_t size)
+{
+    //VkPipelineCacheHeaderVersionOne is read field by field, it may not be aligned in the file
+    if(size < LAVA_PIPELINE_CACHE_HEADER_SIZE) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t header_size;
+    uint32_t header_version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    memcpy(&header_size, bytes, sizeof(uint32_t));
+    memcpy(&header_version, bytes + 4, sizeof(uint32_t));
+    memcpy(&vendor_id, bytes + 8, sizeof(uint32_t));
+    memcpy(&device_id, bytes + 12, sizeof(uint32_t));
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    return LAVA_PIPELINE_CACHE_HEADER_SIZE <= header_size
+           && header_size <= size
+           && VK_PIPELINE_CACHE_HEADER_VERSION_ONE == header_version
+           && properties.vendorID == vendor_id
+           && properties.deviceID == device_id
+           && 0 == memcmp(bytes + 16, properties.pipelineCacheUUID, VK_UUID_SIZE);
+}
+
+/**
+ @brief Write through "<path>.tmp", readers see either the old or the new file.
+ */
+static VkResult lava_save_file(const VkAllocationCallbacks* allocator, const char* path, const void* data, size_t size)
+{
+    size_t path_length = strlen(path);
+    char* temporary_path = (char*)lava_malloc(allocator, path_length + 5);
+    if(LAVA_NULL == temporary_path) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", 5);
+    bool written = lava_write_file(path, temporary_path, data, size);
+    lava_free(allocator, temporary_path);
+    return written ? VK_SUCCESS : VK_ERROR_INITIALIZATION_FAILED;
+}
+
+VkResult LAVA_API lava_load_pipeline_cache(const lava_pipeline_cache_file_info* file_info, VkPipelineCache* pipeline_cache, VkBool32* loaded)
+{
+    assert(LAVA_NULL != file_info);
+    assert(LAVA_NULL != file_info->device);
+    assert(LAVA_NULL != file_info->path);
+    assert(LAVA_NULL != pipeline_cache);
+    VkPipelineCacheCreateInfo pipeline_cache_info = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, LAVA_NULL, 0, 0, LAVA_NULL};
+    lava_mapped_file mapped_file;
+    bool mapped = lava_map_file(file_info->path, &mapped_file);
+    //Data of another driver, device or version would at best be ignored, do not hand it over
+    if(mapped && lava_is_pipeline_cache_compatible(file_info->physical_device, mapped_file.data, mapped_file.size)) {
+        pipeline_cache_info.initialDataSize = mapped_file.size;
+        pipeline_cache_info.pInitialData = mapped_file.data;
+    }
+    VkResult result = vkCreatePipelineCache(file_info->device->device_, &pipeline_cache_info, file_info->allocator, pipeline_cache);
+    if(VK_SUCCESS != result && 0 < pipeline_cache_info.initialDataSize) {
+        pipeline_cache_info.initialDataSize = 0;
+        pipeline_cache_info.pInitialData = LAVA_NULL;
+        result = vkCreatePipelineCache(file_info->device->device_, &pipeline_cache_info, file_info->allocator, pipeline_cache);
+    }
+    if(LAVA_NULL != loaded) {
+        *loaded = (VK_SUCCESS == result && 0 < pipeline_cache_info.initialDataSize) ? VK_TRUE : VK_FALSE;
+    }
+    if(mapped) {
+        lava_unmap_file(&mapped_file);
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_save_pipeline_cache(const lava_pipeline_cache_file_info* file_info, VkPipelineCache pipeline_cache)
+{
+    assert(LAVA_NULL != file_info);
+    assert(LAVA_NULL != file_info->device);
+    assert(LAVA_NULL != file_info->path);
+    VkDevice device = file_info->device->device_;
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(device, pipeline_cache, &size, LAVA_NULL);
+    if(VK_SUCCESS != result) {
+        return result;
+    }
+    void* data = lava_malloc(file_info->allocator, size);
+    if(LAVA_NULL == data) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    result = vkGetPipelineCacheData(device, pipeline_cache, &size, data);
+    if(VK_SUCCESS == result) {
+        result = lava_save_file(file_info->allocator, file_info->path, data, size);
+    }
+    lava_free(file_info->allocator, data);
+    return result;
+}
+
+VkResult LAVA_API lava_merge_pipeline_caches(lava_pipeline_cache* cache)
+{
+    assert(LAVA_NULL != cache);
+    if(VK_NULL_HANDLE == cache->pipeline_cache || 0 == cache->thread_count) {
+        return VK_SUCCESS;
+    }
+    VkPipelineCache* sources = (VkPipelineCache*)lava_malloc(cache->allocator, sizeof(VkPipelineCache) * cache->thread_count);
+    if(LAVA_NULL == sources) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < cache->thread_count; ++i) {
+        sources[i] = cache->workers[i].pipeline_cache;
+    }
+    //Sources are internally synchronized, compilations can keep running
+    VkResult result = vkMergePipelineCaches(cache->device->device_, cache->pipeline_cache, cache->thread_count, sources);
+    lava_free(cache->allocator, sources);
+    return result;
+}
+
+//--- Pipeline manifest
+//--------------------------------------------------------------------
+#define LAVA_PIPELINE_MANIFEST_MAGIC (0x4D50564CU) //!< "LVPM"
+#define LAVA_PIPELINE_MANIFEST_VERSION (2)
+
+/**
+ @brief Followed by object_count object records, then count records of a uint32_t kind and the bytes of its state with ids in place of handles.
+ */
+typedef struct lava_pipeline_manifest_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t object_count;
+    uint32_t count;
+    uint32_t graphics_state_size; //!< Rejects manifests of another build of the state structures.
+    uint32_t compute_state_size;
+} lava_pipeline_manifest_header;
+
+/**
+ @brief Followed by the description of the object.
+ */
+typedef struct lava_pipeline_manifest_object_t
+{
+    uint32_t kind;
+    uint32_t size; //!< Bytes of the description.
+    uint64_t id;
+} lava_pipeline_manifest_object;
+
+static bool lava_read_pipeline_manifest_header(const lava_mapped_file* mapped_file, lava_pipeline_manifest_header* header)
+{
+    memset(header, 0, sizeof(lava_pipeline_manifest_header));
+    if(mapped_file->size < sizeof(lava_pipeline_manifest_header)) {
+        return false;
+    }
+    memcpy(header, mapped_file->data, sizeof(lava_pipeline_manifest_header));
+    return LAVA_PIPELINE_MANIFEST_MAGIC == header->magic
+           && LAVA_PIPELINE_MANIFEST_VERSION == header->version
+           && sizeof(lava_graphics_pipeline_state) == header->graphics_state_size
+           && sizeof(lava_compute_pipeline_state) == header->compute_state_size;
+}
+
+static bool lava_translate_pipeline_object(const lava_pipeline_cache* cache, void* handle, bool to_id)
+{
+    //Non dispatchable handles are 64 bits on every platform
+    uint64_t key;
+    memcpy(&key, handle, sizeof(uint64_t));
+    if(0 == key) {
+        return true;
+    }
+    uint32_t index = lava_handle_map_find(to_id ? &cache->object_handles : &cache->object_ids, key);
+    if(LAVA_HANDLE_MAP_EMPTY == index) {
+        return false;
+    }
+    //Registering a handle again leaves its previous id behind in the map
+    const lava_pipeline_object* object = &cache->objects[index];
+    if(key != (to_id ? object->handle : object->id)) {
+        return false;
+    }
+    uint64_t value = to_id ? object->id : object->handle;
+    memcpy(handle, &value, sizeof(uint64_t));
+    return true;
+}
+
+/**
+ @brief Whether the counts of a state read from a file fit in its arrays.
+ */
+static bool lava_check_pipeline_state_counts(lava_pipeline_kind kind, const void* state)
+{
+    if(LAVA_PIPELINE_KIND_GRAPHICS == kind) {
+        const lava_graphics_pipeline_state* graphics = (const lava_graphics_pipeline_state*)state;
+        return graphics->stage_count <= LAVA_MAX_SHADER_STAGES
+               && graphics->specialization_count <= LAVA_MAX_SPECIALIZATION_CONSTANTS
+               && graphics->vertex_binding_count <= LAVA_MAX_VERTEX_BINDINGS
+               && graphics->vertex_attribute_count <= LAVA_MAX_VERTEX_ATTRIBUTES
+               && graphics->color_attachment_count <= LAVA_MAX_COLOR_ATTACHMENTS
+               && graphics->dynamic_state_count <= LAVA_MAX_DYNAMIC_STATES;
+    }
+    const lava_compute_pipeline_state* compute = (const lava_compute_pipeline_state*)state;
+    return compute->specialization_count <= LAVA_MAX_SPECIALIZATION_CONSTANTS;
+}
+
+static bool lava_translate_pipeline_state(const lava_pipeline_cache* cache, lava_pipeline_kind kind, void* state, bool to_id)
+{
+    if(!lava_check_pipeline_state_counts(kind, state)) {
+        return false;
+    }
+    if(LAVA_PIPELINE_KIND_GRAPHICS == kind) {
+        lava_graphics_pipeline_state* graphics = (lava_graphics_pipeline_state*)state;
+        for(uint32_t i = 0; i < graphics->stage_count; ++i) {
+            if(!lava_translate_pipeline_object(cache, &graphics->stages[i].module, to_id)) {
+                return false;
+            }
+        }
+        return lava_translate_pipeline_object(cache, &graphics->layout, to_id)
+               && lava_translate_pipeline_object(cache, &graphics->render_pass, to_id);
+    }
+    lava_compute_pipeline_state* compute = (lava_compute_pipeline_state*)state;
+    return lava_translate_pipeline_object(cache, &compute->stage.module, to_id)
+           && lava_translate_pipeline_object(cache, &compute->layout, to_id);
+}
+
+/**
+ @brief Map the handle of an object to its id, the cache takes over its description on success.
+ */
+static VkResult lava_insert_pipeline_object(lava_pipeline_cache* cache, const lava_pipeline_object* new_object)
+{
+    VkResult result = VK_SUCCESS;
+    lava_mutex_lock(&cache->mutex);
+    uint32_t index = lava_handle_map_find(&cache->object_handles, new_object->handle);
+    if(LAVA_HANDLE_MAP_EMPTY == index) {
+        index = cache->object_count;
+        if(!lava_reserve(cache->allocator, (void**)&cache->objects, &cache->object_capacity, index + 1, sizeof(lava_pipeline_object))
+           || !lava_handle_map_insert(cache->allocator, &cache->object_handles, new_object->handle, index)) {
+            result = VK_ERROR_OUT_OF_HOST_MEMORY;
+        } else {
+            memset(&cache->objects[index], 0, sizeof(lava_pipeline_object));
+            ++cache->object_count;
+        }
+    }
+    if(VK_SUCCESS == result && !lava_handle_map_insert(cache->allocator, &cache->object_ids, new_object->id, index)) {
+        result = VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if(VK_SUCCESS == result) {
+        lava_free(cache->allocator, cache->objects[index].description);
+        cache->objects[index] = *new_object;
+    }
+    lava_mutex_unlock(&cache->mutex);
+    return result;
+}
+
+VkResult LAVA_API lava_register_pipeline_object(lava_pipeline_cache* cache, uint64_t handle, uint64_t id)
+{
+    assert(LAVA_NULL != cache);
+    assert(0 != handle);
+    assert(0 != id);
+    lava_pipeline_object object;
+    memset(&object, 0, sizeof(lava_pipeline_object));
+    object.handle = handle;
+    object.id = id;
+    object.kind = LAVA_PIPELINE_OBJECT_OPAQUE;
+    return lava_insert_pipeline_object(cache, &object);
+}
+
+VkResult LAVA_API lava_register_shader_module(lava_pipeline_cache* cache, VkShaderModule module, size_t code_size, const uint32_t* code)
+{
+    assert(LAVA_NULL != cache);
+    assert(VK_NULL_HANDLE != module);
+    assert(0 < code_size && 0 == code_size % sizeof(uint32_t));
+    assert(LAVA_NULL != code);
+    lava_pipeline_object object;
+    memset(&object, 0, sizeof(lava_pipeline_object));
+    object.handle = LAVA_OBJECT_HANDLE(module);
+    object.id = lava_hash_bytes(LAVA_PIPELINE_OBJECT_SHADER_MODULE, code, code_size);
+    object.kind = LAVA_PIPELINE_OBJECT_SHADER_MODULE;
+    object.description_size = (uint32_t)code_size;
+    object.description = (uint32_t*)lava_malloc(cache->allocator, code_size);
+    if(LAVA_NULL == object.description) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    memcpy(object.description, code, code_size);
+    VkResult result = lava_insert_pipeline_object(cache, &object);
+    if(VK_SUCCESS != result) {
+        lava_free(cache->allocator, object.description);
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_register_pipeline_layout(
+    lava_pipeline_cache* cache,
+    VkPipelineLayout layout,
+    uint32_t set_layout_count,
+    const VkDescriptorSetLayoutCreateInfo* set_layout_infos,
+    uint32_t push_constant_range_count,
+    const VkPushConstantRange* push_constant_ranges)
+{
+    assert(LAVA_NULL != cache);
+    assert(VK_NULL_HANDLE != layout);
+    assert(0 == set_layout_count || LAVA_NULL != set_layout_infos);
+    assert(0 == push_constant_range_count || LAVA_NULL != push_constant_ranges);
+    //Words: set and range counts, the ranges, then the flags, binding count and bindings of every set
+    uint32_t word_count = 2 + 3 * push_constant_range_count;
+    for(uint32_t i = 0; i < set_layout_count; ++i) {
+        word_count += 2 + 4 * set_layout_infos[i].bindingCount;
+        for(uint32_t j = 0; j < set_layout_infos[i].bindingCount; ++j) {
+            const VkDescriptorSetLayoutBinding* binding = &set_layout_infos[i].pBindings[j];
+            if(LAVA_NULL != binding->pImmutableSamplers && (VK_DESCRIPTOR_TYPE_SAMPLER == binding->descriptorType || VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER == binding->descriptorType)) {
+                return VK_ERROR_FEATURE_NOT_PRESENT;
+            }
+        }
+    }
+    lava_pipeline_object object;
+    memset(&object, 0, sizeof(lava_pipeline_object));
+    object.description_size = (uint32_t)(sizeof(uint32_t) * word_count);
+    object.description = (uint32_t*)lava_malloc(cache->allocator, object.description_size);
+    if(LAVA_NULL == object.description) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    uint32_t* word = object.description;
+    *word++ = set_layout_count;
+    *word++ = push_constant_range_count;
+    for(uint32_t i = 0; i < push_constant_range_count; ++i) {
+        *word++ = push_constant_ranges[i].stageFlags;
+        *word++ = push_constant_ranges[i].offset;
+        *word++ = push_constant_ranges[i].size;
+    }
+    for(uint32_t i = 0; i < set_layout_count; ++i) {
+        *word++ = set_layout_infos[i].flags;
+        *word++ = set_layout_infos[i].bindingCount;
+        for(uint32_t j = 0; j < set_layout_infos[i].bindingCount; ++j) {
+            const VkDescriptorSetLayoutBinding* binding = &set_layout_infos[i].pBindings[j];
+            *word++ = binding->binding;
+            *word++ = (uint32_t)binding->descriptorType;
+            *word++ = binding->descriptorCount;
+            *word++ = binding->stageFlags;
+        }
+    }
+    object.handle = LAVA_OBJECT_HANDLE(layout);
+    object.id = lava_hash_bytes(LAVA_PIPELINE_OBJECT_PIPELINE_LAYOUT, object.description, object.description_size);
+    object.kind = LAVA_PIPELINE_OBJECT_PIPELINE_LAYOUT;
+    VkResult result = lava_insert_pipeline_object(cache, &object);
+    if(VK_SUCCESS != result) {
+        lava_free(cache->allocator, object.description);
+    }
+    return result;
+}
+
+/**
+ @brief Whether the words of a layout description are consistent with their size.
+ */
+static bool lava_check_layout_description(const uint32_t* words, uint32_t word_count)
+{
+    if(word_count < 2 || (word_count - 2) / 3 < words[1]) {
+        return false;
+    }
+    uint32_t offset = 2 + 3 * words[1];
+    for(uint32_t i = 0; i < words[0]; ++i) {
+        if(word_count - offset < 2 || (word_count - offset - 2) / 4 < words[offset + 1]) {
+            return false;
+        }
+        offset += 2 + 4 * words[offset + 1];
+    }
+    return offset == word_count;
+}
+
+/**
+ @brief Create the shader module or pipeline layout of a checked description.
+ */
+static VkResult lava_create_described_object(lava_pipeline_cache* cache, lava_pipeline_object* object)
+{
+    VkDevice device = cache->device->device_;
+    const VkAllocationCallbacks* allocator = cache->allocator;
+    if(LAVA_PIPELINE_OBJECT_SHADER_MODULE == object->kind) {
+        VkShaderModuleCreateInfo module_info = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, LAVA_NULL, 0, object->description_size, object->description};
+        VkShaderModule module = VK_NULL_HANDLE;
+        VkResult result = vkCreateShaderModule(device, &module_info, allocator, &module);
+        object->handle = LAVA_OBJECT_HANDLE(module);
+        return result;
+    }
+    const uint32_t* words = object->description;
+    uint32_t set_layout_count = words[0];
+    uint32_t range_count = words[1];
+    VkPushConstantRange* ranges = (VkPushConstantRange*)lava_malloc(allocator, sizeof(VkPushConstantRange) * (range_count + 1));
+    object->set_layouts = (VkDescriptorSetLayout*)lava_calloc(allocator, sizeof(VkDescriptorSetLayout) * (set_layout_count + 1));
+    if(LAVA_NULL == ranges || LAVA_NULL == object->set_layouts) {
+        lava_free(allocator, ranges);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    const uint32_t* word = words + 2;
+    for(uint32_t i = 0; i < range_count; ++i) {
+        ranges[i].stageFlags = *word++;
+        ranges[i].offset = *word++;
+        ranges[i].size = *word++;
+    }
+    VkResult result = VK_SUCCESS;
+    for(uint32_t i = 0; i < set_layout_count && VK_SUCCESS == result; ++i) {
+        VkDescriptorSetLayoutCreateInfo set_layout_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, LAVA_NULL, word[0], word[1], LAVA_NULL};
+        word += 2;
+        VkDescriptorSetLayoutBinding* bindings = (VkDescriptorSetLayoutBinding*)lava_malloc(allocator, sizeof(VkDescriptorSetLayoutBinding) * (set_layout_info.bindingCount + 1));
+        if(LAVA_NULL == bindings) {
+            result = VK_ERROR_OUT_OF_HOST_MEMORY;
+            break;
+        }
+        for(uint32_t j = 0; j < set_layout_info.bindingCount; ++j) {
+            bindings[j].binding = *word++;
+            bindings[j].descriptorType = (VkDescriptorType)*word++;
+            bindings[j].descriptorCount = *word++;
+            bindings[j].stageFlags = *word++;
+            bindings[j].pImmutableSamplers = LAVA_NULL;
+        }
+        set_layout_info.pBindings = bindings;
+        result = vkCreateDescriptorSetLayout(device, &set_layout_info, allocator, &object->set_layouts[i]);
+        if(VK_SUCCESS == result) {
+            ++object->set_layout_count;
+        }
+        lava_free(allocator, bindings);
+    }
+    if(VK_SUCCESS == result) {
+        VkPipelineLayoutCreateInfo layout_info = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO, LAVA_NULL, 0, set_layout_count, object->set_layouts, range_count, ranges};
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        result = vkCreatePipelineLayout(device, &layout_info, allocator, &layout);
+        object->handle = LAVA_OBJECT_HANDLE(layout);
+    }
+    lava_free(allocator, ranges);
+    return result;
+}
+
+VkResult LAVA_API lava_create_pipeline_manifest_objects(lava_pipeline_cache* cache, const char* path, uint32_t* created)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != path);
+    uint32_t created_count = 0;
+    VkResult result = VK_SUCCESS;
+    lava_mapped_file mapped_file;
+    if(lava_map_file(path, &mapped_file)) {
+        const uint8_t* data = (const uint8_t*)mapped_file.data;
+        lava_pipeline_manifest_header header;
+        size_t offset = sizeof(lava_pipeline_manifest_header);
+        bool valid = lava_read_pipeline_manifest_header(&mapped_file, &header);
+        for(uint32_t i = 0; valid && i < header.object_count && VK_SUCCESS == result; ++i) {
+            lava_pipeline_manifest_object record;
+            if(mapped_file.size - offset < sizeof(lava_pipeline_manifest_object)) {
+                break;
+            }
+            memcpy(&record, data + offset, sizeof(lava_pipeline_manifest_object));
+            offset += sizeof(lava_pipeline_manifest_object);
+            if(mapped_file.size - offset < record.size) {
+                break;
+            }
+            const uint8_t* description = data + offset;
+            offset += record.size;
+            if((LAVA_PIPELINE_OBJECT_SHADER_MODULE != record.kind && LAVA_PIPELINE_OBJECT_PIPELINE_LAYOUT != record.kind) || 0 == record.size || 0 != record.size % sizeof(uint32_t)) {
+                continue;
+            }
+            //Objects the application registered are used as they are
+            lava_mutex_lock(&cache->mutex);
+            uint32_t index = lava_handle_map_find(&cache->object_ids, record.id);
+            bool registered = LAVA_HANDLE_MAP_EMPTY != index && record.id == cache->objects[index].id;
+            lava_mutex_unlock(&cache->mutex);
+            if(registered) {
+                continue;
+            }
+            lava_pipeline_object object;
+            memset(&object, 0, sizeof(lava_pipeline_object));
+            object.id = record.id;
+            object.kind = (lava_pipeline_object_kind)record.kind;
+            object.description_size = record.size;
+            object.owned = true;
+            //Copied out of the mapping, which has no alignment guarantee
+            object.description = (uint32_t*)lava_malloc(cache->allocator, record.size);
+            if(LAVA_NULL == object.description) {
+                result = VK_ERROR_OUT_OF_HOST_MEMORY;
+                break;
+            }
+            memcpy(object.description, description, record.size);
+            if(LAVA_PIPELINE_OBJECT_PIPELINE_LAYOUT == object.kind && !lava_check_layout_description(object.description, record.size / sizeof(uint32_t))) {
+                lava_free(cache->allocator, object.description);
+                continue;
+            }
+            result = lava_create_described_object(cache, &object);
+            if(VK_SUCCESS == result) {
+                result = lava_insert_pipeline_object(cache, &object);
+            }
+            if(VK_SUCCESS != result) {
+                lava_destroy_described_object(cache, &object);
+                break;
+            }
+            ++created_count;
+        }
+        lava_unmap_file(&mapped_file);
+    }
+    if(LAVA_NULL != created) {
+        *created = created_count;
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_save_pipeline_manifest(lava_pipeline_cache* cache, const char* path, uint32_t* written)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != path);
+    size_t record_size = sizeof(uint32_t) + sizeof(lava_graphics_pipeline_state);
+    lava_mutex_lock(&cache->mutex);
+    size_t capacity = sizeof(lava_pipeline_manifest_header) + record_size * cache->entry_count;
+    for(uint32_t i = 0; i < cache->object_count; ++i) {
+        if(LAVA_NULL != cache->objects[i].description) {
+            capacity += sizeof(lava_pipeline_manifest_object) + cache->objects[i].description_size;
+        }
+    }
+    uint8_t* data = (uint8_t*)lava_malloc(cache->allocator, capacity);
+    if(LAVA_NULL == data) {
+        lava_mutex_unlock(&cache->mutex);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    lava_pipeline_manifest_header header = {LAVA_PIPELINE_MANIFEST_MAGIC, LAVA_PIPELINE_MANIFEST_VERSION, 0, 0, sizeof(lava_graphics_pipeline_state), sizeof(lava_compute_pipeline_state)};
+    size_t size = sizeof(lava_pipeline_manifest_header);
+    //Described objects first, so that a tool can create them without the application
+    for(uint32_t i = 0; i < cache->object_count; ++i) {
+        const lava_pipeline_object* object = &cache->objects[i];
+        if(LAVA_NULL == object->description) {
+            continue;
+        }
+        lava_pipeline_manifest_object record = {(uint32_t)object->kind, object->description_size, object->id};
+        memcpy(data + size, &record, sizeof(lava_pipeline_manifest_object));
+        memcpy(data + size + sizeof(lava_pipeline_manifest_object), object->description, object->description_size);
+        size += sizeof(lava_pipeline_manifest_object) + object->description_size;
+        ++header.object_count;
+    }
+    lava_graphics_pipeline_state graphics;
+    lava_compute_pipeline_state compute;
+    for(uint32_t i = 0; i < cache->entry_count; ++i) {
+        const lava_pipeline_entry* entry = &cache->entries[i];
+        if(LAVA_PIPELINE_KIND_COMPUTE < entry->kind || LAVA_PIPELINE_STATUS_FAILED == lava_atomic_load32((volatile int32_t*)&entry->status)) {
+            continue;
+        }
+        //Pipelines of unregistered objects cannot be found again in another run
+        uint32_t kind = (uint32_t)entry->kind;
+        size_t state_size = lava_pipeline_state_size(entry->kind);
+        void* state = (LAVA_PIPELINE_KIND_GRAPHICS == entry->kind) ? (void*)&graphics : (void*)&compute;
+        memcpy(state, entry->state, state_size);
+        if(!lava_translate_pipeline_state(cache, entry->kind, state, true)) {
+            continue;
+        }
+        memcpy(data + size, &kind, sizeof(uint32_t));
+        memcpy(data + size + sizeof(uint32_t), state, state_size);
+        size += sizeof(uint32_t) + state_size;
+        ++header.count;
+    }
+    lava_mutex_unlock(&cache->mutex);
+    memcpy(data, &header, sizeof(lava_pipeline_manifest_header));
+    VkResult result = lava_save_file(cache->allocator, path, data, size);
+    lava_free(cache->allocator, data);
+    if(LAVA_NULL != written) {
+        *written = (VK_SUCCESS == result) ? header.count : 0;
+    }
+    return result;
+}
+
+VkResult LAVA_API lava_load_pipeline_manifest(lava_pipeline_cache* cache, const char* path, uint32_t* queued, uint32_t* skipped)
+{
+    assert(LAVA_NULL != cache);
+    assert(LAVA_NULL != path);
+    uint32_t queued_count = 0;
+    uint32_t skipped_count = 0;
+    VkResult result = VK_SUCCESS;
+    lava_mapped_file mapped_file;
+    if(lava_map_file(path, &mapped_file)) {
+        const uint8_t* data = (const uint8_t*)mapped_file.data;
+        lava_pipeline_manifest_header header;
+        //A missing or outdated manifest queues nothing, it is written again at the end of the run
+        if(lava_read_pipeline_manifest_header(&mapped_file, &header)) {
+            lava_graphics_pipeline_state graphics;
+            lava_compute_pipeline_state compute;
+            size_t offset = sizeof(lava_pipeline_manifest_header);
+            //Skip the object descriptions, lava_create_pipeline_manifest_objects reads them
+            uint32_t count = header.count;
+            for(uint32_t i = 0; i < header.object_count; ++i) {
+                lava_pipeline_manifest_object record;
+                if(mapped_file.size - offset < sizeof(lava_pipeline_manifest_object)) {
+                    count = 0;
+                    break;
+                }
+                memcpy(&record, data + offset, sizeof(lava_pipeline_manifest_object));
+                offset += sizeof(lava_pipeline_manifest_object);
+                if(mapped_file.size - offset < record.size) {
+                    count = 0;
+                    break;
+                }
+                offset += record.size;
+            }
+            lava_mutex_lock(&cache->mutex);
+            for(uint32_t i = 0; i < count && VK_SUCCESS == result; ++i) {
+                uint32_t kind;
+                if(mapped_file.size < offset + sizeof(uint32_t)) {
+                    break;
+                }
+                memcpy(&kind, data + offset, sizeof(uint32_t));
+                if(LAVA_PIPELINE_KIND_GRAPHICS != kind && LAVA_PIPELINE_KIND_COMPUTE != kind) {
+                    break;
+                }
+                size_t size = lava_pipeline_state_size((lava_pipeline_kind)kind);
+                if(mapped_file.size < offset + sizeof(uint32_t) + size) {
+                    break;
+                }
+                void* state = (LAVA_PIPELINE_KIND_GRAPHICS == kind) ? (void*)&graphics : (void*)&compute;
+                memcpy(state, data + offset + sizeof(uint32_t), size);
+                offset += sizeof(uint32_t) + size;
+                if(!lava_translate_pipeline_state(cache, (lava_pipeline_kind)kind, state, false)) {
+                    ++skipped_count;
+                    continue;
+                }
+                lava_pipeline_entry* entry;
+                result = lava_queue_pipeline(cache, (lava_pipeline_kind)kind, state, lava_hash_bytes((uint64_t)kind, state, size), &entry);
+                if(VK_SUCCESS == result) {
+                    ++queued_count;
+                }
+            }
+            lava_mutex_unlock(&cache->mutex);
+        }
+        lava_unmap_file(&mapped_file);
+    }
+    if(LAVA_NULL != queued) {
+        *queued = queued_count;
+    }
+    if(LAVA_NULL != skipped) {
+        *skipped = skipped_count;
+    }
+    return result;
+}
+
+uint32_t LAVA_API lava_get_pipeline_compile_times(lava_pipeline_cache* cache, uint32_t max_count, lava_pipeline_compile_time* times)
+{
+    assert(LAVA_NULL != cache);
+    assert(0 == max_count || LAVA_NULL != times);
+    uint32_t count = 0;
+    lava_mutex_lock(&cache->mutex);
+    for(uint32_t i = 0; i < cache->entry_count && count < max_count; ++i) {
+        const lava_pipeline_entry* entry = &cache->entries[i];
+        if(LAVA_PIPELINE_STATUS_PENDING == lava_atomic_load32((volatile int32_t*)&entry->status)) {
+            continue;
+        }
+        times[count].key = entry->hash;
+        times[count].bind_point = (LAVA_PIPELINE_KIND_COMPUTE == entry->kind) ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_GRAPHICS;
+        times[count].result = entry->result;
+        times[count].time = entry->compile_time;
+        ++count;
+    }
+    lava_mutex_unlock(&cache->mutex);
+    return count;
+}
+
+//--- Dynamic state
+//--------------------------------------------------------------------
+typedef enum lava_dynamic_state_valid_bits_t
+{
+    LAVA_DYNAMIC_VALID_CULL_MODE = 0x0001U,
+    LAVA_DYNAMIC_VALID_FRONT_FACE = 0x0002U,
+    LAVA_DYNAMIC_VALID_TOPOLOGY = 0x0004U,
+    LAVA_DYNAMIC_VALID_PRIMITIVE_RESTART = 0x0008U,
+    LAVA_DYNAMIC_VALID_RASTERIZER_DISCARD = 0x0010U,
+    LAVA_DYNAMIC_VALID_DEPTH_BIAS = 0x0020U,
+    LAVA_DYNAMIC_VALID_DEPTH_TEST = 0x0040U,
+    LAVA_DYNAMIC_VALID_DEPTH_WRITE = 0x0080U,
+    LAVA_DYNAMIC_VALID_DEPTH_COMPARE = 0x0100U,
+    LAVA_DYNAMIC_VALID_STENCIL_TEST = 0x0200U,
+    LAVA_DYNAMIC_VALID_STENCIL_OP = 0x0400U,
+    LAVA_DYNAMIC_VALID_PATCH_CONTROL_POINTS = 0x0800U,
+    LAVA_DYNAMIC_VALID_VERTEX_INPUT = 0x1000U,
+} lava_dynamic_state_valid_bits;
+
+void LAVA_API lava_reset_dynamic_state(lava_dynamic_state* dynamic_state, const crater_device* device, lava_dynamic_state_flags flags)
+{
+    assert(LAVA_NULL != dynamic_state);
+    assert(LAVA_NULL != device);
+    memset(dynamic_state, 0, sizeof(lava_dynamic_state));
+    dynamic_state->device = device;
+    dynamic_state->flags = flags;
+}
+
+void LAVA_API lava_invalidate_dynamic_state(lava_dynamic_state* dynamic_state)
+{
+    assert(LAVA_NULL != dynamic_state);
+    dynamic_state->valid = 0;
+}
+
+/**
+ @brief Whether a value has to be recorded, then remember it as set.
+ */
+static bool lava_update_dynamic_value(lava_dynamic_state* dynamic_state, uint32_t valid_bit, void* value, const void* new_value, size_t size)
+{
+    if(0 != (dynamic_state->valid & valid_bit) && 0 == memcmp(value, new_value, size)) {
+        ++dynamic_state->skipped_count;
+        return false;
+    }
+    memcpy(value, new_value, size);
+    dynamic_state->valid |= valid_bit;
+    ++dynamic_state->set_count;
+    return true;
+}
+
+static bool lava_is_same_stencil_op(const VkStencilOpState* x0, const VkStencilOpState* x1)
+{
+    return x0->failOp == x1->failOp && x0->passOp == x1->passOp && x0->depthFailOp == x1->depthFailOp && x0->compareOp == x1->compareOp;
+}
+
+static void lava_cmd_set_vertex_input(lava_dynamic_state* dynamic_state, VkCommandBuffer command_buffer, const lava_graphics_pipeline_state* state)
+{
+    if(0 != (dynamic_state->valid & LAVA_DYNAMIC_VALID_VERTEX_INPUT)
+       && dynamic_state->vertex_binding_count == state->vertex_binding_count
+       && dynamic_state->vertex_attribute_count == state->vertex_attribute_count
+       && 0 == memcmp(dynamic_state->vertex_bindings, state->vertex_bindings, sizeof(VkVertexInputBindingDescription) * state->vertex_binding_count)
+       && 0 == memcmp(dynamic_state->vertex_attributes, state->vertex_attributes, sizeof(VkVertexInputAttributeDescription) * state->vertex_attribute_count)) {
+        ++dynamic_state->skipped_count;
+        return;
+    }
+    dynamic_state->vertex_binding_count = state->vertex_binding_count;
+    memcpy(dynamic_state->vertex_bindings, state->vertex_bindings, sizeof(VkVertexInputBindingDescription) * state->vertex_binding_count);
+    dynamic_state->vertex_attribute_count = state->vertex_attribute_count;
+    memcpy(dynamic_state->vertex_attributes, state->vertex_attributes, sizeof(VkVertexInputAttributeDescription) * state->vertex_attribute_count);
+    dynamic_state->valid |= LAVA_DYNAMIC_VALID_VERTEX_INPUT;
+    ++dynamic_state->set_count;
+
+    VkVertexInputBindingDescription2EXT bindings[LAVA_MAX_VERTEX_BINDINGS];
+    for(uint32_t i = 0; i < state->vertex_binding_count; ++i) {
+        bindings[i].sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT;
+        bindings[i].pNext = LAVA_NULL;
+        bindings[i].binding = state->vertex_bindings[i].binding;
+        bindings[i].stride = state->vertex_bindings[i].stride;
+        bindings[i].inputRate = state->vertex_bindings[i].inputRate;
+        bindings[i].divisor = 1;
+    }
+    VkVertexInputAttributeDescription2EXT attributes[LAVA_MAX_VERTEX_ATTRIBUTES];
+    for(uint32_t i = 0; i < state->vertex_attribute_count; ++i) {
+        attributes[i].sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+        attributes[i].pNext = LAVA_NULL;
+        attributes[i].location = state->vertex_attributes[i].location;
+        attributes[i].binding = state->vertex_attributes[i].binding;
+        attributes[i].format = state->vertex_attributes[i].format;
+        attributes[i].offset = state->vertex_attributes[i].offset;
+    }
+    dynamic_state->device->vkCmdSetVertexInputEXT(command_buffer, state->vertex_binding_count, bindings, state->vertex_attribute_count, attributes);
+}
+
+void LAVA_API lava_cmd_set_dynamic_state(lava_dynamic_state* dynamic_state, VkCommandBuffer command_buffer, const lava_graphics_pipeline_state* state)
+{
+    assert(LAVA_NULL != dynamic_state);
+    assert(LAVA_NULL != state);
+    if(0 != (dynamic_state->flags & LAVA_DYNAMIC_STATE_CORE_BIT)) {
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_CULL_MODE, &dynamic_state->cull_mode, &state->cull_mode, sizeof(VkCullModeFlags))) {
+            vkCmdSetCullMode(command_buffer, state->cull_mode);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_FRONT_FACE, &dynamic_state->front_face, &state->front_face, sizeof(VkFrontFace))) {
+            vkCmdSetFrontFace(command_buffer, state->front_face);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_TOPOLOGY, &dynamic_state->topology, &state->topology, sizeof(VkPrimitiveTopology))) {
+            vkCmdSetPrimitiveTopology(command_buffer, state->topology);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_PRIMITIVE_RESTART, &dynamic_state->primitive_restart, &state->primitive_restart, sizeof(VkBool32))) {
+            vkCmdSetPrimitiveRestartEnable(command_buffer, state->primitive_restart);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_RASTERIZER_DISCARD, &dynamic_state->rasterizer_discard, &state->rasterizer_discard, sizeof(VkBool32))) {
+            vkCmdSetRasterizerDiscardEnable(command_buffer, state->rasterizer_discard);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_DEPTH_BIAS, &dynamic_state->depth_bias, &state->depth_bias, sizeof(VkBool32))) {
+            vkCmdSetDepthBiasEnable(command_buffer, state->depth_bias);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_DEPTH_TEST, &dynamic_state->depth_test, &state->depth_test, sizeof(VkBool32))) {
+            vkCmdSetDepthTestEnable(command_buffer, state->depth_test);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_DEPTH_WRITE, &dynamic_state->depth_write, &state->depth_write, sizeof(VkBool32))) {
+            vkCmdSetDepthWriteEnable(command_buffer, state->depth_write);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_DEPTH_COMPARE, &dynamic_state->depth_compare, &state->depth_compare, sizeof(VkCompareOp))) {
+            vkCmdSetDepthCompareOp(command_buffer, state->depth_compare);
+        }
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_STENCIL_TEST, &dynamic_state->stencil_test, &state->stencil_test, sizeof(VkBool32))) {
+            vkCmdSetStencilTestEnable(command_buffer, state->stencil_test);
+        }
+        //Only the operations are dynamic, masks and reference come from the pipeline
+        if(0 == (dynamic_state->valid & LAVA_DYNAMIC_VALID_STENCIL_OP)
+           || !lava_is_same_stencil_op(&dynamic_state->stencil_front, &state->stencil_front)
+           || !lava_is_same_stencil_op(&dynamic_state->stencil_back, &state->stencil_back)) {
+            const VkStencilOpState* front = &state->stencil_front;
+            const VkStencilOpState* back = &state->stencil_back;
+            if(lava_is_same_stencil_op(front, back)) {
+                vkCmdSetStencilOp(command_buffer, VK_STENCIL_FACE_FRONT_AND_BACK, front->failOp, front->passOp, front->depthFailOp, front->compareOp);
+            } else {
+                vkCmdSetStencilOp(command_buffer, VK_STENCIL_FACE_FRONT_BIT, front->failOp, front->passOp, front->depthFailOp, front->compareOp);
+                vkCmdSetStencilOp(command_buffer, VK_STENCIL_FACE_BACK_BIT, back->failOp, back->passOp, back->depthFailOp, back->compareOp);
+            }
+            dynamic_state->stencil_front = *front;
+            dynamic_state->stencil_back = *back;
+            dynamic_state->valid |= LAVA_DYNAMIC_VALID_STENCIL_OP;
+            ++dynamic_state->set_count;
+        } else {
+            ++dynamic_state->skipped_count;
+        }
+    }
+    if(0 != (dynamic_state->flags & LAVA_DYNAMIC_STATE_PATCH_CONTROL_POINTS_BIT) && 0 < state->patch_control_points) {
+        if(lava_update_dynamic_value(dynamic_state, LAVA_DYNAMIC_VALID_PATCH_CONTROL_POINTS, &dynamic_state->patch_control_points, &state->patch_control_points, sizeof(uint32_t))) {
+            dynamic_state->device->vkCmdSetPatchControlPointsEXT(command_buffer, state->patch_control_points);
+        }
+    }
+    if(0 != (dynamic_state->flags & LAVA_DYNAMIC_STATE_VERTEX_INPUT_BIT)) {
+        lava_cmd_set_vertex_input(dynamic_state, command_buffer, state);
+    }
+}
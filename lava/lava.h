@@ -4,5 +4,1655 @@
  */
 #include <crater.h>
 
-#endif //INC_LAVA_H_
+#ifdef _WIN32
+#define LAVA_API __cdecl
+#else
+#define LAVA_API
+#endif
+
+//--- Memory
+//--------------------------------------------------------------------
+typedef struct lava_memory_allocator_t lava_memory_allocator;
+typedef struct lava_allocation_t lava_allocation;
+typedef struct lava_defragment_context_t lava_defragment_context;
+
+typedef enum lava_memory_allocator_create_flag_bits_t
+{
+    LAVA_MEMORY_ALLOCATOR_CREATE_MEMORY_BUDGET_BIT = 0x00000001, //!< VK_EXT_memory_budget is enabled on the device.
+    LAVA_MEMORY_ALLOCATOR_CREATE_MEMORY_PRIORITY_BIT = 0x00000002, //!< VK_EXT_memory_priority is enabled on the device.
+    LAVA_MEMORY_ALLOCATOR_CREATE_PAGEABLE_DEVICE_LOCAL_MEMORY_BIT = 0x00000004, //!< VK_EXT_pageable_device_local_memory is enabled on the device.
+    LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT = 0x00000008, //!< The bufferDeviceAddress feature is enabled, every block is allocated with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT.
+} lava_memory_allocator_create_flag_bits;
+typedef uint32_t lava_memory_allocator_create_flags;
+
+typedef struct lava_memory_allocator_create_info_t
+{
+    crater_device* device;
+    VkPhysicalDevice physical_device;
+    const VkAllocationCallbacks* allocator;
+    VkDeviceSize block_size; //!< Size of a pooled VkDeviceMemory block. 0 selects the default.
+    lava_memory_allocator_create_flags flags;
+    uint32_t budget_update_interval; //!< Frames between budget queries. 0 selects the default.
+    float eviction_threshold; //!< Fraction of a heap budget above which eviction callbacks run. 0 selects the default.
+} lava_memory_allocator_create_info;
+
+typedef enum lava_allocation_create_flag_bits_t
+{
+    LAVA_ALLOCATION_CREATE_DEDICATED_BIT = 0x00000001, //!< Always use an own VkDeviceMemory.
+    LAVA_ALLOCATION_CREATE_MAPPED_BIT = 0x00000002, //!< Require a persistently mapped pointer.
+    LAVA_ALLOCATION_CREATE_MOVABLE_BIT = 0x00000004, //!< The defragmenter may move this allocation.
+} lava_allocation_create_flag_bits;
+typedef uint32_t lava_allocation_create_flags;
+
+typedef struct lava_allocation_create_info_t
+{
+    lava_allocation_create_flags flags;
+    VkMemoryPropertyFlags required_flags;
+    VkMemoryPropertyFlags preferred_flags;
+    void* user_data;
+    float priority; //!< Residency priority in [0, 1] when memory priorities are enabled. 0 selects the default 0.5.
+} lava_allocation_create_info;
+
+typedef struct lava_allocation_info_t
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t memory_type_index;
+    void* mapped; //!< Pointer to the first byte of the allocation, or NULL if not host visible.
+    void* user_data;
+    VkDeviceAddress device_address; //!< Address of a buffer created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, otherwise 0.
+} lava_allocation_info;
+
+typedef struct lava_memory_stats_t
+{
+    uint32_t block_count;
+    uint32_t allocation_count;
+    VkDeviceSize block_bytes;
+    VkDeviceSize allocation_bytes;
+} lava_memory_stats;
+
+VkResult LAVA_API lava_create_memory_allocator(const lava_memory_allocator_create_info* create_info, lava_memory_allocator** memory_allocator);
+void LAVA_API lava_destroy_memory_allocator(lava_memory_allocator* memory_allocator);
+
+VkResult LAVA_API lava_allocate_memory(lava_memory_allocator* memory_allocator, const VkMemoryRequirements* requirements, const lava_allocation_create_info* create_info, lava_allocation** allocation);
+void LAVA_API lava_free_memory(lava_memory_allocator* memory_allocator, lava_allocation* allocation);
+
+/**
+ @brief Create a buffer and bind it to a new allocation.
+
+ The create info is remembered so that movable allocations can be recreated by the defragmenter.
+ */
+VkResult LAVA_API lava_create_buffer(lava_memory_allocator* memory_allocator, const VkBufferCreateInfo* buffer_create_info, const lava_allocation_create_info* create_info, VkBuffer* buffer, lava_allocation** allocation);
+void LAVA_API lava_destroy_buffer(lava_memory_allocator* memory_allocator, VkBuffer buffer, lava_allocation* allocation);
+
+VkResult LAVA_API lava_create_image(lava_memory_allocator* memory_allocator, const VkImageCreateInfo* image_create_info, const lava_allocation_create_info* create_info, VkImage* image, lava_allocation** allocation);
+void LAVA_API lava_destroy_image(lava_memory_allocator* memory_allocator, VkImage image, lava_allocation* allocation);
+
+void LAVA_API lava_get_allocation_info(const lava_allocation* allocation, lava_allocation_info* info);
+/**
+ @brief Tell the defragmenter which layout a movable image is in between frames.
+ */
+void LAVA_API lava_set_allocation_image_layout(lava_allocation* allocation, VkImageLayout layout);
+void LAVA_API lava_get_memory_stats(lava_memory_allocator* memory_allocator, lava_memory_stats* stats);
+
+//--- Memory budget
+//--------------------------------------------------------------------
+typedef struct lava_memory_budget_t
+{
+    VkDeviceSize block_bytes; //!< VkDeviceMemory allocated by lava in this heap.
+    VkDeviceSize allocation_bytes; //!< Bytes handed out from those blocks.
+    VkDeviceSize usage; //!< Estimated usage of the whole process.
+    VkDeviceSize budget; //!< Amount the process can use before the driver starts paging.
+} lava_memory_budget;
+
+/**
+ @brief Ask a cache to release memory from a heap.
+ @return Number of bytes actually released.
+ */
+typedef VkDeviceSize(VKAPI_PTR* PFN_lava_memory_evict)(void* user_data, uint32_t heap_index, VkDeviceSize bytes_to_free);
+
+typedef struct lava_eviction_callback_info_t
+{
+    PFN_lava_memory_evict callback;
+    void* user_data;
+    int32_t priority; //!< Callbacks with lower priority are asked first.
+} lava_eviction_callback_info;
+
+/**
+ @brief Refresh budgets every budget_update_interval frames and run eviction callbacks for heaps over the threshold.
+
+ Lava's own allocations since the last query are added to the driver-reported usage, so the estimate stays current between queries.
+ */
+void LAVA_API lava_update_memory_budget(lava_memory_allocator* memory_allocator, uint64_t frame_index);
+/**
+ @brief Copy the current estimate of every heap into `budgets`, which holds VK_MAX_MEMORY_HEAPS entries.
+ */
+void LAVA_API lava_get_memory_budget(lava_memory_allocator* memory_allocator, lava_memory_budget* budgets);
+
+VkResult LAVA_API lava_register_eviction_callback(lava_memory_allocator* memory_allocator, const lava_eviction_callback_info* info);
+void LAVA_API lava_unregister_eviction_callback(lava_memory_allocator* memory_allocator, PFN_lava_memory_evict callback, void* user_data);
+
+/**
+ @brief Change the residency priority of a dedicated allocation with vkSetDeviceMemoryPriorityEXT.
+
+ Pooled allocations share their block's priority and are left unchanged.
+ */
+void LAVA_API lava_set_allocation_priority(lava_memory_allocator* memory_allocator, lava_allocation* allocation, float priority);
+
+//--- Device address
+//--------------------------------------------------------------------
+typedef struct lava_address_pool_t lava_address_pool;
+
+typedef struct lava_address_pool_create_info_t
+{
+    lava_memory_allocator* memory_allocator; //!< Must be created with LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT.
+    VkBufferUsageFlags usage; //!< VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT is added.
+    VkMemoryPropertyFlags required_flags;
+    VkMemoryPropertyFlags preferred_flags;
+    VkDeviceSize chunk_size; //!< Size of a shared buffer. 0 selects the default.
+    uint32_t pointer_table_capacity; //!< Entries of the pointer table, 0 disables it.
+    uint32_t frame_count; //!< Freed ranges and their table entries are reused after this many frames. 0 reuses them at once.
+} lava_address_pool_create_info;
+
+/**
+ @brief A range of a shared buffer, addressed by shaders through a raw pointer.
+ */
+typedef struct lava_address_range_t
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    VkDeviceAddress address;
+    void* mapped; //!< Pointer to the first byte of the range, or NULL if not host visible.
+    uint32_t chunk;
+    uint32_t slot; //!< Entry of the pointer table holding address, or UINT32_MAX.
+} lava_address_range;
+
+typedef struct lava_address_pool_stats_t
+{
+    uint32_t chunk_count;
+    uint32_t range_count;
+    VkDeviceSize chunk_bytes;
+    VkDeviceSize range_bytes;
+} lava_address_pool_stats;
+
+VkResult LAVA_API lava_create_address_pool(const lava_address_pool_create_info* create_info, lava_address_pool** pool);
+void LAVA_API lava_destroy_address_pool(lava_address_pool* pool);
+
+/**
+ @brief Suballocate a range of a shared buffer. Thread safe.
+
+ When the pool has a pointer table, the address is also written to a free entry so shaders can reach the range by index.
+ */
+VkResult LAVA_API lava_address_allocate(lava_address_pool* pool, VkDeviceSize size, VkDeviceSize alignment, lava_address_range* range);
+/**
+ @brief Return a range. With a frame count it stays allocated, and keeps its table entry, until its frame slot comes back.
+ */
+void LAVA_API lava_address_free(lava_address_pool* pool, const lava_address_range* range);
+/**
+ @brief Recycle the ranges freed in the slot of frame_index. The GPU must be done with that frame.
+ */
+void LAVA_API lava_begin_address_frame(lava_address_pool* pool, uint64_t frame_index);
+void LAVA_API lava_get_address_pool_stats(lava_address_pool* pool, lava_address_pool_stats* stats);
+
+/**
+ @brief Address of the pointer table, an array of VkDeviceAddress to pass through push constants.
+ */
+VkDeviceAddress LAVA_API lava_get_pointer_table_address(const lava_address_pool* pool);
+
+//--- Transient resources
+//--------------------------------------------------------------------
+typedef struct lava_transient_pool_t lava_transient_pool;
+
+/**
+ @brief A resource which only lives between two passes of a frame.
+
+ Exactly one of image_info or buffer_info is non-null. Pass indices are inclusive.
+ */
+typedef struct lava_transient_resource_info_t
+{
+    const VkImageCreateInfo* image_info;
+    const VkBufferCreateInfo* buffer_info;
+    uint32_t first_use;
+    uint32_t last_use;
+    VkPipelineStageFlags2 first_stage; //!< Stage and access of the first pass, the destination of the aliasing barrier.
+    VkAccessFlags2 first_access;
+    VkImageLayout first_layout;
+    VkPipelineStageFlags2 last_stage; //!< Stages and accesses of every pass, the source scope of whatever reuses the memory after it. 0 means all commands.
+    VkAccessFlags2 last_access;
+} lava_transient_resource_info;
+
+typedef struct lava_transient_pool_create_info_t
+{
+    lava_memory_allocator* memory_allocator;
+    uint32_t resource_count;
+    const lava_transient_resource_info* resources;
+} lava_transient_pool_create_info;
+
+typedef struct lava_transient_pool_stats_t
+{
+    VkDeviceSize resource_bytes; //!< Sum of every resource size, the footprint without aliasing.
+    VkDeviceSize heap_bytes; //!< Memory actually allocated.
+    VkDeviceSize lazy_bytes; //!< Part of heap_bytes in lazily allocated memory.
+    uint32_t heap_count;
+} lava_transient_pool_stats;
+
+/**
+ @brief Create every resource and place those with disjoint lifetimes at overlapping offsets of shared heaps.
+
+ Images whose usage includes VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT go to lazily allocated memory when the device has it.
+ */
+VkResult LAVA_API lava_create_transient_pool(const lava_transient_pool_create_info* create_info, lava_transient_pool** pool);
+void LAVA_API lava_destroy_transient_pool(lava_transient_pool* pool);
+
+VkImage LAVA_API lava_get_transient_image(const lava_transient_pool* pool, uint32_t index);
+VkBuffer LAVA_API lava_get_transient_buffer(const lava_transient_pool* pool, uint32_t index);
+void LAVA_API lava_get_transient_pool_stats(const lava_transient_pool* pool, lava_transient_pool_stats* stats);
+
+/**
+ @brief Barriers making the resources first used by a pass valid, with the memory they alias.
+
+ A resource sharing memory with an earlier one of the frame waits for the last stages of that one.
+ The first user of a memory range waits for the last stages of every resource on that range, which orders it after the previous frame.
+ Follows the Vulkan two-call idiom: when the barrier pointers are null, only the counts are written.
+ */
+void LAVA_API lava_get_transient_barriers(
+    const lava_transient_pool* pool,
+    uint32_t pass_index,
+    uint32_t* image_barrier_count,
+    VkImageMemoryBarrier2* image_barriers,
+    uint32_t* buffer_barrier_count,
+    VkBufferMemoryBarrier2* buffer_barriers);
+/**
+ @brief Record the barriers of lava_get_transient_barriers with one vkCmdPipelineBarrier2.
+ */
+void LAVA_API lava_cmd_transient_barriers(const lava_transient_pool* pool, VkCommandBuffer command_buffer, uint32_t pass_index);
+
+//--- Sparse images
+//--------------------------------------------------------------------
+typedef struct lava_sparse_image_t lava_sparse_image;
+
+typedef struct lava_sparse_image_create_info_t
+{
+    lava_memory_allocator* memory_allocator;
+    VkQueue queue; //!< A queue of a family with VK_QUEUE_SPARSE_BINDING_BIT.
+    const VkImageCreateInfo* image_info; //!< Sparse binding and residency flags are added by lava.
+    uint32_t max_resident_pages; //!< Size of the page heap, the memory budget of the image.
+    uint32_t keep_frames; //!< Frames a tile stays resident after its last request before it can be evicted.
+} lava_sparse_image_create_info;
+
+typedef struct lava_sparse_image_properties_t
+{
+    VkExtent3D tile_extent; //!< Texels covered by one page.
+    VkDeviceSize page_size;
+    uint32_t mip_tail_first_lod; //!< Levels from this one on are always resident.
+    uint32_t tile_count;
+    uint32_t max_resident_pages;
+} lava_sparse_image_properties;
+
+typedef struct lava_sparse_stats_t
+{
+    uint32_t resident_pages;
+    uint32_t pending_requests;
+    uint64_t binds;
+    uint64_t unbinds;
+    uint64_t bind_calls;
+} lava_sparse_stats;
+
+typedef struct lava_sparse_update_info_t
+{
+    uint64_t frame_index;
+    uint32_t max_binds; //!< Upper bound of binds in this update. 0 means unlimited.
+    uint32_t wait_semaphore_count;
+    const VkSemaphore* wait_semaphores;
+    uint32_t signal_semaphore_count;
+    const VkSemaphore* signal_semaphores;
+    VkFence fence;
+} lava_sparse_update_info;
+
+/**
+ @brief Create a partially resident image backed by a fixed heap of pages.
+
+ The mip tails of every aspect and the metadata are bound once at creation, every other level starts non resident.
+ A page holds a tile of each aspect, depth and stencil being bound separately.
+ */
+VkResult LAVA_API lava_create_sparse_image(const lava_sparse_image_create_info* create_info, lava_sparse_image** image);
+void LAVA_API lava_destroy_sparse_image(lava_sparse_image* image);
+
+VkImage LAVA_API lava_get_sparse_image(const lava_sparse_image* image);
+void LAVA_API lava_get_sparse_image_properties(const lava_sparse_image* image, lava_sparse_image_properties* properties);
+void LAVA_API lava_get_sparse_stats(const lava_sparse_image* image, lava_sparse_stats* stats);
+
+/**
+ @brief Linear index of the tile containing a texel, or UINT32_MAX inside the mip tail.
+ */
+uint32_t LAVA_API lava_sparse_tile_index(const lava_sparse_image* image, uint32_t mip_level, uint32_t array_layer, uint32_t x, uint32_t y, uint32_t z);
+/**
+ @brief Feed back tiles sampled this frame, typically read back from a GPU feedback buffer.
+ */
+void LAVA_API lava_sparse_request_tiles(lava_sparse_image* image, uint64_t frame_index, uint32_t count, const uint32_t* tiles);
+bool LAVA_API lava_sparse_is_resident(const lava_sparse_image* image, uint32_t tile);
+
+/**
+ @brief Page table of the image, one page index per tile or UINT32_MAX when not resident.
+ */
+const uint32_t* LAVA_API lava_sparse_get_page_table(const lava_sparse_image* image, uint32_t* tile_count);
+
+/**
+ @brief Bind pages to requested tiles, evicting the least recently requested ones, in one vkQueueBindSparse call.
+
+ The page table and requests are left untouched when the call fails.
+ @return VK_INCOMPLETE if requests remain because of max_binds.
+ */
+VkResult LAVA_API lava_sparse_update(lava_sparse_image* image, const lava_sparse_update_info* update_info);
+
+//--- Defragmentation
+//--------------------------------------------------------------------
+/**
+ @brief Called once a move has been copied on the GPU, before the old resource is destroyed.
+
+ Exactly one of the buffer or image pairs is non-null. Update descriptors, cached handles and device addresses taken from the old buffer here.
+ Runs with the allocator lock held, so it must not allocate or free from the same allocator.
+ */
+typedef void(VKAPI_PTR* PFN_lava_defragment_move)(void* user_data, lava_allocation* allocation, VkBuffer old_buffer, VkBuffer new_buffer, VkImage old_image, VkImage new_image);
+
+typedef struct lava_defragment_create_info_t
+{
+    VkQueue queue; //!< Queue the copies are submitted to, usually a transfer queue.
+    uint32_t queue_family_index;
+    VkDeviceSize max_bytes_per_step; //!< Copy budget of a step. 0 means unlimited.
+    uint32_t max_moves_per_step; //!< 0 means unlimited.
+    PFN_lava_defragment_move move_callback;
+    void* user_data;
+} lava_defragment_create_info;
+
+typedef struct lava_defragment_stats_t
+{
+    VkDeviceSize bytes_moved;
+    uint32_t allocations_moved;
+    uint32_t blocks_freed;
+    VkDeviceSize bytes_freed;
+} lava_defragment_stats;
+
+/**
+ @brief Start an incremental defragmentation of every memory type.
+
+ Only allocations created with LAVA_ALLOCATION_CREATE_MOVABLE_BIT through lava_create_buffer or lava_create_image are moved.
+ Movable resources must not be written by the GPU while a step is in flight, and must be accessible from the given queue family.
+ */
+VkResult LAVA_API lava_begin_defragment(lava_memory_allocator* memory_allocator, const lava_defragment_create_info* create_info, lava_defragment_context** context);
+
+/**
+ @brief Advance the defragmentation without blocking.
+
+ Commits the previous step once its copies have finished, then plans and submits the next one.
+ Committing destroys the old buffers and images of the moves right away, so work that still uses them must have completed,
+ for example by waiting for the frames in flight or for the device to idle before the call that commits.
+ Movable resources must be destroyed through lava_destroy_buffer or lava_destroy_image, which keep a source being copied alive until the step completes.
+ @return VK_NOT_READY while the previous step is still executing, VK_INCOMPLETE when more moves remain, VK_SUCCESS when done.
+ */
+VkResult LAVA_API lava_defragment_step(lava_defragment_context* context);
+
+/**
+ @brief Wait for the step in flight, commit it and release the context.
+ */
+void LAVA_API lava_end_defragment(lava_defragment_context* context, lava_defragment_stats* stats);
+
+//--- Command pools
+//--------------------------------------------------------------------
+typedef struct lava_command_pool_set_t lava_command_pool_set;
+
+typedef struct lava_command_pool_set_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t queue_family_index;
+    uint32_t thread_count; //!< One pool per recording thread and frame in flight.
+    uint32_t frame_count; //!< Frames in flight.
+} lava_command_pool_set_create_info;
+
+/**
+ @brief What signals that the work recorded in a frame has finished.
+
+ Either a fence, or a timeline semaphore and the value it reaches, or nothing when the caller waits by itself.
+ */
+typedef struct lava_command_frame_end_info_t
+{
+    VkFence fence;
+    VkSemaphore timeline_semaphore;
+    uint64_t timeline_value;
+} lava_command_frame_end_info;
+
+VkResult LAVA_API lava_create_command_pool_set(const lava_command_pool_set_create_info* create_info, lava_command_pool_set** set);
+void LAVA_API lava_destroy_command_pool_set(lava_command_pool_set* set);
+
+/**
+ @brief Make the frame slot of frame_index current, waiting until the work last recorded in it has retired.
+
+ Pools of the slot are reset lazily by their own thread on its first allocation.
+ */
+VkResult LAVA_API lava_begin_command_frame(lava_command_pool_set* set, uint64_t frame_index);
+/**
+ @brief Remember how the current frame retires, so that its slot can be reused frame_count frames later.
+ */
+void LAVA_API lava_end_command_frame(lava_command_pool_set* set, const lava_command_frame_end_info* end_info);
+
+/**
+ @brief Get a command buffer of the current frame from the pool of a thread.
+
+ Lock free as long as each thread_index is used by one thread at a time. Buffers are recycled, so steady frames do not allocate.
+ */
+VkResult LAVA_API lava_allocate_command_buffer(lava_command_pool_set* set, uint32_t thread_index, VkCommandBufferLevel level, VkCommandBuffer* command_buffer);
+
+//--- Jobs
+//--------------------------------------------------------------------
+typedef struct lava_job_system_t lava_job_system;
+
+/**
+ @brief A job function. worker_index identifies the thread running it, 0 being the thread which waits on the system.
+ */
+typedef void(VKAPI_PTR* PFN_lava_job)(void* user_data, uint32_t worker_index);
+
+/**
+ @brief Number of jobs not finished yet, decremented as they complete.
+ */
+typedef struct lava_job_counter_t
+{
+    volatile int32_t value;
+} lava_job_counter;
+
+typedef struct lava_job_t
+{
+    PFN_lava_job function;
+    void* user_data;
+    lava_job_counter* counter; //!< May be null.
+} lava_job;
+
+typedef struct lava_job_system_create_info_t
+{
+    const VkAllocationCallbacks* allocator;
+    uint32_t worker_count; //!< Workers including the calling thread. 0 selects the number of cores.
+    uint32_t queue_capacity; //!< Jobs per worker deque, rounded up to a power of two. 0 selects the default.
+} lava_job_system_create_info;
+
+/**
+ @brief Start worker_count - 1 threads, each with its own work-stealing deque. Idle workers steal from the others before sleeping.
+ */
+VkResult LAVA_API lava_create_job_system(const lava_job_system_create_info* create_info, lava_job_system** job_system);
+void LAVA_API lava_destroy_job_system(lava_job_system* job_system);
+uint32_t LAVA_API lava_get_job_worker_count(const lava_job_system* job_system);
+
+/**
+ @brief Push jobs on the deque of worker_index, which must be the worker calling. A full deque runs the remaining jobs inline.
+ */
+void LAVA_API lava_submit_jobs(lava_job_system* job_system, uint32_t worker_index, uint32_t job_count, const lava_job* jobs);
+/**
+ @brief Run jobs on the calling worker until the counter reaches zero.
+ */
+void LAVA_API lava_wait_jobs(lava_job_system* job_system, uint32_t worker_index, lava_job_counter* counter);
+
+//--- Parallel recording
+//--------------------------------------------------------------------
+#define LAVA_MAX_PARALLEL_RECORD_CHUNKS (64)
+
+/**
+ @brief Record draws [first_draw, first_draw + draw_count) into a secondary command buffer which has already begun.
+ */
+typedef void(VKAPI_PTR* PFN_lava_record_draws)(void* user_data, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, uint32_t worker_index);
+
+typedef struct lava_parallel_record_info_t
+{
+    lava_job_system* job_system;
+    lava_command_pool_set* command_pool_set; //!< Needs a pool per worker of the job system, in the current frame.
+    uint32_t worker_index; //!< The calling worker.
+    /**
+     Render pass and subpass, or a VkCommandBufferInheritanceRenderingInfo in pNext for dynamic rendering.
+     VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT is always set.
+     */
+    const VkCommandBufferInheritanceInfo* inheritance_info;
+    uint32_t draw_count;
+    uint32_t chunk_size; //!< Draws per secondary command buffer. 0 splits evenly between workers.
+    PFN_lava_record_draws record;
+    void* user_data;
+} lava_parallel_record_info;
+
+/**
+ @brief Split the draws in chunks and record them on the job system, one secondary command buffer per chunk.
+
+ command_buffers receives up to LAVA_MAX_PARALLEL_RECORD_CHUNKS buffers in draw order.
+ */
+VkResult LAVA_API lava_record_parallel(const lava_parallel_record_info* record_info, uint32_t* command_buffer_count, VkCommandBuffer* command_buffers);
+/**
+ @brief Record the draws in parallel and execute them in a primary command buffer inside a render pass or dynamic rendering begun with secondary contents.
+ */
+VkResult LAVA_API lava_cmd_record_parallel(VkCommandBuffer command_buffer, const lava_parallel_record_info* record_info);
+
+//--- Barriers
+//--------------------------------------------------------------------
+typedef struct lava_barrier_tracker_t lava_barrier_tracker;
+
+/**
+ @brief How a command accesses a resource. layout is ignored for buffers.
+ */
+typedef struct lava_resource_state_t
+{
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    uint32_t queue_family_index; //!< VK_QUEUE_FAMILY_IGNORED keeps the current owner.
+} lava_resource_state;
+
+typedef struct lava_barrier_tracker_create_info_t
+{
+    const VkAllocationCallbacks* allocator;
+} lava_barrier_tracker_create_info;
+
+typedef struct lava_barrier_stats_t
+{
+    uint64_t requests; //!< Calls to lava_require_image and lava_require_buffer.
+    uint64_t transitions; //!< Subresources and buffers which needed a barrier.
+    uint64_t barriers; //!< Memory, buffer and image barriers actually recorded after merging.
+    uint64_t dependencies; //!< Calls to vkCmdPipelineBarrier2.
+} lava_barrier_stats;
+
+VkResult LAVA_API lava_create_barrier_tracker(const lava_barrier_tracker_create_info* create_info, lava_barrier_tracker** tracker);
+void LAVA_API lava_destroy_barrier_tracker(lava_barrier_tracker* tracker);
+
+/**
+ @brief Start tracking an image, every subresource being in the initial state.
+ */
+VkResult LAVA_API lava_track_image(lava_barrier_tracker* tracker, VkImage image, VkImageAspectFlags aspect, uint32_t mip_levels, uint32_t array_layers, const lava_resource_state* initial_state);
+VkResult LAVA_API lava_track_buffer(lava_barrier_tracker* tracker, VkBuffer buffer, const lava_resource_state* initial_state);
+void LAVA_API lava_untrack_image(lava_barrier_tracker* tracker, VkImage image);
+void LAVA_API lava_untrack_buffer(lava_barrier_tracker* tracker, VkBuffer buffer);
+
+/**
+ @brief Declare the access of the next command to a range of an image. The barrier, if any, is deferred until lava_cmd_flush_barriers.
+
+ Requests for the same subresource before a flush are folded into one barrier.
+ */
+void LAVA_API lava_require_image(lava_barrier_tracker* tracker, VkImage image, const VkImageSubresourceRange* range, const lava_resource_state* state);
+/**
+ @brief Declare the access of the next command to a buffer.
+
+ Buffer hazards are resolved with one global memory barrier, except for queue family transfers.
+ */
+void LAVA_API lava_require_buffer(lava_barrier_tracker* tracker, VkBuffer buffer, const lava_resource_state* state);
+
+/**
+ @brief Record every deferred transition with a single vkCmdPipelineBarrier2. Call before the draw or dispatch which needs them.
+ */
+void LAVA_API lava_cmd_flush_barriers(lava_barrier_tracker* tracker, VkCommandBuffer command_buffer);
+bool LAVA_API lava_get_image_state(const lava_barrier_tracker* tracker, VkImage image, uint32_t mip_level, uint32_t array_layer, lava_resource_state* state);
+void LAVA_API lava_get_barrier_stats(const lava_barrier_tracker* tracker, lava_barrier_stats* stats);
+
+//--- Render graph
+//--------------------------------------------------------------------
+typedef struct lava_render_graph_t lava_render_graph;
+typedef uint32_t lava_graph_resource;
+
+#define LAVA_GRAPH_NULL_RESOURCE (0xFFFFFFFFU)
+
+typedef enum lava_graph_queue_t
+{
+    LAVA_GRAPH_QUEUE_GRAPHICS = 0,
+    LAVA_GRAPH_QUEUE_ASYNC_COMPUTE = 1, //!< Runs on the graphics queue when the graph has no compute queue family.
+} lava_graph_queue;
+
+typedef enum lava_graph_pass_flag_bits_t
+{
+    LAVA_GRAPH_PASS_SIDE_EFFECT_BIT = 0x00000001, //!< Never culled, for passes writing outside of the graph.
+} lava_graph_pass_flag_bits;
+typedef uint32_t lava_graph_pass_flags;
+
+/**
+ @brief Record the commands of a pass. Barriers for the declared accesses are already recorded.
+ */
+typedef void(VKAPI_PTR* PFN_lava_graph_execute)(void* user_data, lava_render_graph* graph, uint32_t pass_index, VkCommandBuffer command_buffer);
+
+typedef struct lava_graph_pass_info_t
+{
+    const char* name; //!< Debug label, may be null.
+    lava_graph_queue queue;
+    lava_graph_pass_flags flags;
+    PFN_lava_graph_execute execute;
+    void* user_data;
+} lava_graph_pass_info;
+
+typedef struct lava_render_graph_create_info_t
+{
+    lava_memory_allocator* memory_allocator;
+    uint32_t graphics_queue_family_index;
+    uint32_t compute_queue_family_index; //!< VK_QUEUE_FAMILY_IGNORED or the graphics family disables async compute.
+} lava_render_graph_create_info;
+
+typedef struct lava_graph_execute_info_t
+{
+    lava_command_pool_set* graphics_command_pool_set; //!< Current frame of a set for the graphics queue family.
+    lava_command_pool_set* compute_command_pool_set; //!< Same for the compute queue family, may be null without async compute.
+    uint32_t thread_index;
+    VkQueue graphics_queue;
+    VkQueue compute_queue;
+    uint32_t wait_semaphore_count; //!< Waited by the first graphics submission.
+    const VkSemaphoreSubmitInfo* wait_semaphores;
+    uint32_t signal_semaphore_count; //!< Signaled by the last submission, once every pass has finished.
+    const VkSemaphoreSubmitInfo* signal_semaphores;
+    VkFence fence;
+} lava_graph_execute_info;
+
+typedef struct lava_graph_stats_t
+{
+    uint32_t pass_count;
+    uint32_t culled_pass_count;
+    uint32_t level_count; //!< Passes of a level do not depend on each other.
+    uint32_t submit_count;
+    uint32_t barrier_count;
+    uint32_t dependency_count; //!< vkCmdPipelineBarrier2 calls per execution.
+    uint32_t reuse_count; //!< Compiles in a row which reused the previous result.
+    uint64_t structure_hash; //!< Hash of the declared passes, resources and accesses.
+    lava_transient_pool_stats transient;
+} lava_graph_stats;
+
+VkResult LAVA_API lava_create_render_graph(const lava_render_graph_create_info* create_info, lava_render_graph** graph);
+void LAVA_API lava_destroy_render_graph(lava_render_graph* graph);
+
+/**
+ @brief Forget the passes and resources declared for the previous frame. Compiled transient resources are kept until the next compile.
+ */
+void LAVA_API lava_graph_reset(lava_render_graph* graph);
+
+/**
+ @brief Declare a resource created and aliased by the graph. Usage flags must cover every access.
+ */
+lava_graph_resource LAVA_API lava_graph_create_image(lava_render_graph* graph, const VkImageCreateInfo* image_info);
+lava_graph_resource LAVA_API lava_graph_create_buffer(lava_render_graph* graph, const VkBufferCreateInfo* buffer_info);
+/**
+ @brief Declare a resource owned by the caller, in the given state. Resources used on both queues must be created concurrent.
+ */
+lava_graph_resource LAVA_API lava_graph_import_image(lava_render_graph* graph, VkImage image, VkImageAspectFlags aspect, uint32_t mip_levels, uint32_t array_layers, const lava_resource_state* state);
+lava_graph_resource LAVA_API lava_graph_import_buffer(lava_render_graph* graph, VkBuffer buffer, const lava_resource_state* state);
+/**
+ @brief Mark a resource as an output of the frame, left in final_state once the graph has executed. Only passes contributing to outputs are kept.
+ */
+void LAVA_API lava_graph_export(lava_render_graph* graph, lava_graph_resource resource, const lava_resource_state* final_state);
+
+uint32_t LAVA_API lava_graph_add_pass(lava_render_graph* graph, const lava_graph_pass_info* pass_info);
+/**
+ @brief Declare an access of a pass to the whole resource. Queue family indices of the states are ignored.
+ */
+void LAVA_API lava_graph_read(lava_render_graph* graph, uint32_t pass_index, lava_graph_resource resource, const lava_resource_state* state);
+void LAVA_API lava_graph_write(lava_render_graph* graph, uint32_t pass_index, lava_graph_resource resource, const lava_resource_state* state);
+
+/**
+ @brief Cull, schedule, allocate transient resources and place barriers and queue synchronization.
+
+ The declaration is hashed, without the imported handles and pass callbacks. When the hash matches the previous compile,
+ its schedule, barriers and transient resources are kept and only the handles are patched.
+ Otherwise transient resources of the previous compile are destroyed, so the previous execution must have finished.
+ */
+VkResult LAVA_API lava_graph_compile(lava_render_graph* graph);
+/**
+ @brief Record and submit every pass, one command buffer per queue submission.
+
+ The first submission on each queue waits for the last one of the other queue in the previous execution,
+ so async compute of a frame never overlaps graphics of the previous frame on transient memory.
+ */
+VkResult LAVA_API lava_graph_execute(lava_render_graph* graph, const lava_graph_execute_info* execute_info);
+
+VkImage LAVA_API lava_graph_get_image(const lava_render_graph* graph, lava_graph_resource resource);
+VkBuffer LAVA_API lava_graph_get_buffer(const lava_render_graph* graph, lava_graph_resource resource);
+void LAVA_API lava_graph_get_stats(const lava_render_graph* graph, lava_graph_stats* stats);
+
+//--- Queues
+//--------------------------------------------------------------------
+typedef struct lava_queue_t lava_queue;
+
+typedef struct lava_queue_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    VkQueue queue;
+    uint32_t queue_family_index;
+} lava_queue_create_info;
+
+typedef struct lava_queue_stats_t
+{
+    uint64_t submit_calls; //!< vkQueueSubmit2 calls.
+    uint64_t batches; //!< VkSubmitInfo2 submitted by those calls.
+} lava_queue_stats;
+
+/**
+ @brief Identify a submission, which has finished once the timeline of the queue reaches value.
+ */
+typedef struct lava_submit_ticket_t
+{
+    lava_queue* queue;
+    uint64_t value;
+} lava_submit_ticket;
+
+/**
+ @brief Wrap a VkQueue with a timeline semaphore, which every submission signals with the next value.
+ */
+VkResult LAVA_API lava_create_queue(const lava_queue_create_info* create_info, lava_queue** queue);
+void LAVA_API lava_destroy_queue(lava_queue* queue);
+
+VkQueue LAVA_API lava_get_vk_queue(const lava_queue* queue);
+uint32_t LAVA_API lava_get_queue_family_index(const lava_queue* queue);
+VkSemaphore LAVA_API lava_get_queue_timeline(const lava_queue* queue);
+
+/**
+ @brief Submit the deferred batches then the given ones in one call, the last batch also signaling the timeline of the queue.
+
+ Submissions are serialized by the queue, so several threads may share it.
+ @param ticket Receives the value signaled, may be null.
+ */
+VkResult LAVA_API lava_submit(lava_queue* queue, uint32_t submit_count, const VkSubmitInfo2* submits, VkFence fence, lava_submit_ticket* ticket);
+/**
+ @brief Push a batch to the deferred list of the queue, lock free, for the next lava_submit or lava_flush_submits.
+
+ The arrays of the batch are copied, its pNext chain must stay valid until the flush.
+ Waiting on the ticket with lava_wait_ticket flushes the queue first.
+ */
+VkResult LAVA_API lava_defer_submit(lava_queue* queue, const VkSubmitInfo2* submit, lava_submit_ticket* ticket);
+/**
+ @brief Submit every deferred batch with one vkQueueSubmit2, at a sync point such as the end of a frame.
+ */
+VkResult LAVA_API lava_flush_submits(lava_queue* queue, VkFence fence, lava_submit_ticket* ticket);
+void LAVA_API lava_get_queue_stats(lava_queue* queue, lava_queue_stats* stats);
+/**
+ @brief Last value signaled by a submission of the queue.
+ */
+lava_submit_ticket LAVA_API lava_get_last_ticket(lava_queue* queue);
+
+/**
+ @brief Query the timeline counter and cache it.
+ @return The value the GPU has reached.
+ */
+uint64_t LAVA_API lava_update_queue(lava_queue* queue);
+/**
+ @brief Compare with the cached counter only, without calling into the driver.
+
+ The cache moves forward with lava_update_queue or lava_wait_ticket. A ticket without queue is complete.
+ */
+bool LAVA_API lava_is_complete(lava_submit_ticket ticket);
+/**
+ @brief Wait until the ticket is complete.
+ @return VK_TIMEOUT if it is not complete after timeout nanoseconds.
+ */
+VkResult LAVA_API lava_wait_ticket(lava_submit_ticket ticket, uint64_t timeout);
+
+//--- Deferred destruction
+//--------------------------------------------------------------------
+typedef struct lava_deletion_queue_t lava_deletion_queue;
+
+/**
+ @brief Convert a Vulkan handle to the 64 bit value taken by lava_defer_destroy.
+ */
+#if VK_USE_64_BIT_PTR_DEFINES == 1
+#    define LAVA_OBJECT_HANDLE(HANDLE) ((uint64_t)(uintptr_t)(HANDLE))
+#else
+#    define LAVA_OBJECT_HANDLE(HANDLE) ((uint64_t)(HANDLE))
+#endif
+
+typedef enum lava_deletion_queue_create_flag_bits_t
+{
+    LAVA_DELETION_QUEUE_CREATE_MANUAL_BIT = 0x00000001, //!< No background thread, lava_collect_deletions drains the queue.
+} lava_deletion_queue_create_flag_bits;
+typedef uint32_t lava_deletion_queue_create_flags;
+
+typedef struct lava_deletion_queue_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_memory_allocator* memory_allocator; //!< Frees allocations of lava_defer_destroy_buffer and friends, may be null.
+    lava_deletion_queue_create_flags flags;
+} lava_deletion_queue_create_info;
+
+typedef void(VKAPI_PTR* PFN_lava_deferred_call)(void* user_data);
+
+/**
+ @brief Queue objects to destroy once the GPU timeline passes the ticket of their last use.
+
+ A background thread destroys retired objects in bulk. It only waits on queue timelines and never flushes deferred batches.
+ While only tickets of unflushed batches remain it sleeps, so they retire at the next request or lava_collect_deletions once the application has flushed them.
+ Destroying the queue waits for every ticket and destroys the rest.
+ */
+VkResult LAVA_API lava_create_deletion_queue(const lava_deletion_queue_create_info* create_info, lava_deletion_queue** deletion_queue);
+void LAVA_API lava_destroy_deletion_queue(lava_deletion_queue* deletion_queue);
+
+/**
+ @brief Queue a Vulkan object, without blocking.
+
+ Any thread may call it. Types without a matching vkDestroy or vkFree function fail with VK_ERROR_UNKNOWN.
+ @param handle LAVA_OBJECT_HANDLE of the object.
+ */
+VkResult LAVA_API lava_defer_destroy(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkObjectType type, uint64_t handle);
+VkResult LAVA_API lava_defer_destroy_buffer(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkBuffer buffer, lava_allocation* allocation);
+VkResult LAVA_API lava_defer_destroy_image(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, VkImage image, lava_allocation* allocation);
+VkResult LAVA_API lava_defer_free_memory(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, lava_allocation* allocation);
+/**
+ @brief Queue a function, called from the thread draining the queue.
+ */
+VkResult LAVA_API lava_defer_call(lava_deletion_queue* deletion_queue, lava_submit_ticket ticket, PFN_lava_deferred_call function, void* user_data);
+
+/**
+ @brief Destroy the objects whose tickets are complete. Thread safe, also alongside the background thread.
+
+ Must not be called from a function queued with lava_defer_call.
+ @param wait Wait for every ticket, flushing their queues, and destroy everything queued.
+ @return The number of objects destroyed.
+ */
+uint32_t LAVA_API lava_collect_deletions(lava_deletion_queue* deletion_queue, bool wait);
+
+//--- Synchronization pools
+//--------------------------------------------------------------------
+typedef struct lava_sync_pool_t lava_sync_pool;
+
+typedef struct lava_sync_pool_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t initial_fence_count; //!< Created up front.
+    uint32_t initial_semaphore_count;
+} lava_sync_pool_create_info;
+
+typedef struct lava_sync_pool_stats_t
+{
+    uint32_t fence_count; //!< Fences owned by the pool.
+    uint32_t free_fence_count;
+    uint32_t semaphore_count;
+    uint32_t free_semaphore_count; //!< Free or waiting for their consumer to retire.
+    uint64_t created_fences; //!< Fences created since the pool was created, stays flat in steady frames.
+    uint64_t created_semaphores;
+    uint64_t acquired_fences;
+    uint64_t acquired_semaphores;
+} lava_sync_pool_stats;
+
+/**
+ @brief Recycle fences and binary semaphores instead of creating them per submission. Thread safe.
+ */
+VkResult LAVA_API lava_create_sync_pool(const lava_sync_pool_create_info* create_info, lava_sync_pool** pool);
+void LAVA_API lava_destroy_sync_pool(lava_sync_pool* pool);
+
+/**
+ @brief Get an unsignaled fence, creating one only when none is free.
+ */
+VkResult LAVA_API lava_acquire_fence(lava_sync_pool* pool, VkFence* fence);
+/**
+ @brief Give back a fence which is signaled or was never submitted. Released fences are reset in bulk when they are needed again.
+ */
+void LAVA_API lava_release_fence(lava_sync_pool* pool, VkFence fence);
+
+/**
+ @brief Get an unsignaled binary semaphore, with no pending wait.
+ */
+VkResult LAVA_API lava_acquire_semaphore(lava_sync_pool* pool, VkSemaphore* semaphore);
+/**
+ @brief Give back a binary semaphore once the submission waiting on it has been queued.
+ @param ticket Submission consuming the signal. The semaphore is reused after it completes.
+ */
+void LAVA_API lava_release_semaphore(lava_sync_pool* pool, VkSemaphore semaphore, lava_submit_ticket ticket);
+
+void LAVA_API lava_get_sync_pool_stats(lava_sync_pool* pool, lava_sync_pool_stats* stats);
+
+//--- Queue families
+//--------------------------------------------------------------------
+typedef enum lava_queue_role_t
+{
+    LAVA_QUEUE_ROLE_GRAPHICS = 0,
+    LAVA_QUEUE_ROLE_COMPUTE = 1, //!< A compute only family if the device has one.
+    LAVA_QUEUE_ROLE_TRANSFER = 2, //!< A transfer only family if the device has one.
+    LAVA_QUEUE_ROLE_COUNT = 3,
+} lava_queue_role;
+
+/**
+ @brief Where each role runs, and the queues to request when creating the device.
+ */
+typedef struct lava_queue_families_t
+{
+    uint32_t family_indices[LAVA_QUEUE_ROLE_COUNT];
+    uint32_t queue_indices[LAVA_QUEUE_ROLE_COUNT]; //!< Roles falling back to the same family take separate queues while it has enough.
+    uint32_t queue_create_info_count;
+    VkDeviceQueueCreateInfo queue_create_infos[LAVA_QUEUE_ROLE_COUNT];
+} lava_queue_families;
+
+/**
+ @brief Choose dedicated compute and transfer families, falling back to compute then graphics.
+ @return VK_ERROR_FEATURE_NOT_PRESENT without a graphics family.
+ */
+VkResult LAVA_API lava_find_queue_families(VkPhysicalDevice physical_device, lava_queue_families* families);
+
+typedef struct lava_device_queues_t lava_device_queues;
+
+typedef struct lava_device_queues_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    const lava_queue_families* families; //!< The device was created with its queue_create_infos.
+} lava_device_queues_create_info;
+
+/**
+ @brief Move a resource between the families of two roles, one half recorded on each queue.
+
+ Without a family change, release records nothing and acquire records an ordinary barrier.
+ */
+typedef struct lava_ownership_transfer_t
+{
+    lava_queue_role src_role;
+    lava_queue_role dst_role;
+    VkImage image; //!< Either an image range or a buffer range.
+    VkImageSubresourceRange range;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    lava_resource_state src_state; //!< Last access on the source queue.
+    lava_resource_state dst_state; //!< First access on the destination queue.
+} lava_ownership_transfer;
+
+/**
+ @brief Create one lava_queue per distinct queue of the roles.
+ */
+VkResult LAVA_API lava_create_device_queues(const lava_device_queues_create_info* create_info, lava_device_queues** queues);
+void LAVA_API lava_destroy_device_queues(lava_device_queues* queues);
+
+/**
+ @brief Queue which runs the work of a role, shared with another role when the device has no dedicated family.
+ */
+lava_queue* LAVA_API lava_get_role_queue(const lava_device_queues* queues, lava_queue_role role);
+uint32_t LAVA_API lava_get_role_family_index(const lava_device_queues* queues, lava_queue_role role);
+/**
+ @brief Whether two roles run on different queues, and so need a timeline wait between them.
+ */
+bool LAVA_API lava_roles_need_semaphore(const lava_device_queues* queues, lava_queue_role role0, lava_queue_role role1);
+
+/**
+ @brief Wait for a ticket inside a VkSubmitInfo2, before stage_mask of the waiting batch.
+ */
+VkSemaphoreSubmitInfo LAVA_API lava_ticket_wait_info(lava_submit_ticket ticket, VkPipelineStageFlags2 stage_mask);
+
+/**
+ @brief Submit on the queue of a role after the tickets of other queues, skipping tickets of the same queue.
+ */
+VkResult LAVA_API lava_submit_role(lava_device_queues* queues, lava_queue_role role, uint32_t wait_count, const lava_submit_ticket* waits, uint32_t command_buffer_count, const VkCommandBuffer* command_buffers, lava_submit_ticket* ticket);
+
+void LAVA_API lava_cmd_release_ownership(const lava_device_queues* queues, VkCommandBuffer command_buffer, uint32_t transfer_count, const lava_ownership_transfer* transfers);
+void LAVA_API lava_cmd_acquire_ownership(const lava_device_queues* queues, VkCommandBuffer command_buffer, uint32_t transfer_count, const lava_ownership_transfer* transfers);
+
+//--- Descriptor cache
+//--------------------------------------------------------------------
+typedef struct lava_descriptor_cache_t lava_descriptor_cache;
+
+typedef struct lava_descriptor_cache_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t thread_count; //!< One set of pools per recording thread and frame in flight.
+    uint32_t frame_count;
+    uint32_t sets_per_pool; //!< 0 selects the default.
+    uint32_t pool_size_count; //!< 0 selects default sizes proportional to sets_per_pool.
+    const VkDescriptorPoolSize* pool_sizes;
+} lava_descriptor_cache_create_info;
+
+/**
+ @brief One descriptor of a set. Only the info matching type is read.
+ */
+typedef struct lava_descriptor_binding_t
+{
+    uint32_t binding;
+    uint32_t array_element;
+    VkDescriptorType type;
+    VkDescriptorImageInfo image_info;
+    VkDescriptorBufferInfo buffer_info;
+    VkBufferView texel_buffer_view;
+} lava_descriptor_binding;
+
+typedef struct lava_descriptor_cache_stats_t
+{
+    uint64_t requests;
+    uint64_t hits; //!< Requests which found an identical set of the same frame.
+    uint64_t allocated_sets;
+    uint64_t written_descriptors;
+    uint64_t saved_descriptor_writes; //!< Descriptors the hits did not write again.
+    uint32_t pool_count;
+} lava_descriptor_cache_stats;
+
+VkResult LAVA_API lava_create_descriptor_cache(const lava_descriptor_cache_create_info* create_info, lava_descriptor_cache** cache);
+void LAVA_API lava_destroy_descriptor_cache(lava_descriptor_cache* cache);
+
+/**
+ @brief Make the frame slot of frame_index current. The GPU must be done with the sets last allocated in it.
+
+ Pools of the slot are reset in bulk, lazily by their own thread.
+ */
+void LAVA_API lava_begin_descriptor_frame(lava_descriptor_cache* cache, uint64_t frame_index);
+/**
+ @brief Get a set of the layout with the given descriptors, reusing an identical set allocated by the same thread in the frame.
+
+ Lock free as long as each thread_index is used by one thread at a time. Sets stay valid until the slot comes back.
+ */
+VkResult LAVA_API lava_get_descriptor_set(lava_descriptor_cache* cache, uint32_t thread_index, VkDescriptorSetLayout layout, uint32_t binding_count, const lava_descriptor_binding* bindings, VkDescriptorSet* set);
+void LAVA_API lava_get_descriptor_cache_stats(const lava_descriptor_cache* cache, lava_descriptor_cache_stats* stats);
+
+//--- Descriptor layouts
+//--------------------------------------------------------------------
+typedef struct lava_descriptor_layout_t lava_descriptor_layout;
+
+#define LAVA_DESCRIPTOR_INVALID_OFFSET (0xFFFFFFFFU)
+
+typedef enum lava_descriptor_layout_flag_bits_t
+{
+    LAVA_DESCRIPTOR_LAYOUT_PUSH_BIT = 0x01U, //!< Push descriptor layout, needs VK_KHR_push_descriptor.
+    LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT = 0x02U, //!< Written into a lava_descriptor_ring instead of sets, needs VK_EXT_descriptor_buffer. Texel and dynamic buffers fail with VK_ERROR_FEATURE_NOT_PRESENT.
+} lava_descriptor_layout_flag_bits;
+typedef uint32_t lava_descriptor_layout_flags;
+
+typedef struct lava_descriptor_layout_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    lava_descriptor_layout_flags flags;
+    VkPipelineBindPoint pipeline_bind_point; //!< Push layouts only.
+    uint32_t set; //!< Push layouts only, the set number in pipeline layouts.
+    uint32_t binding_count;
+    const VkDescriptorSetLayoutBinding* bindings;
+} lava_descriptor_layout_create_info;
+
+/**
+ @brief Create a set layout with an update template over a tightly packed struct of its descriptors.
+ */
+VkResult LAVA_API lava_create_descriptor_layout(const lava_descriptor_layout_create_info* create_info, lava_descriptor_layout** layout);
+void LAVA_API lava_destroy_descriptor_layout(lava_descriptor_layout* layout);
+VkDescriptorSetLayout LAVA_API lava_get_descriptor_set_layout(const lava_descriptor_layout* layout);
+/**
+ @brief Size in bytes of the packed descriptor data.
+ */
+uint32_t LAVA_API lava_get_descriptor_data_size(const lava_descriptor_layout* layout);
+/**
+ @brief Offset of an array element of a binding in the packed data, or LAVA_DESCRIPTOR_INVALID_OFFSET.
+ */
+uint32_t LAVA_API lava_get_descriptor_data_offset(const lava_descriptor_layout* layout, uint32_t binding, uint32_t array_element);
+void LAVA_API lava_write_descriptor_image(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, const VkDescriptorImageInfo* image_info);
+void LAVA_API lava_write_descriptor_buffer(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, const VkDescriptorBufferInfo* buffer_info);
+void LAVA_API lava_write_descriptor_texel_buffer(const lava_descriptor_layout* layout, void* data, uint32_t binding, uint32_t array_element, VkBufferView buffer_view);
+/**
+ @brief Write every descriptor of a set with one vkUpdateDescriptorSetWithTemplate.
+ */
+void LAVA_API lava_update_descriptor_set(const lava_descriptor_layout* layout, VkDescriptorSet set, const void* data);
+/**
+ @brief Create the push template of a push layout. The template needs a pipeline layout including the set layout, so it comes after it.
+
+ Call once before recording, any compatible pipeline layout can be pushed to afterwards.
+ */
+VkResult LAVA_API lava_prepare_push_descriptors(lava_descriptor_layout* layout, VkPipelineLayout pipeline_layout);
+/**
+ @brief Push every descriptor of a push layout with one vkCmdPushDescriptorSetWithTemplateKHR.
+ */
+void LAVA_API lava_cmd_push_descriptors(VkCommandBuffer command_buffer, const lava_descriptor_layout* layout, VkPipelineLayout pipeline_layout, const void* data);
+
+//--- Bindless heap
+//--------------------------------------------------------------------
+typedef struct lava_bindless_heap_t lava_bindless_heap;
+
+#define LAVA_BINDLESS_INVALID_INDEX (0xFFFFFFFFU)
+
+/**
+ @brief Arrays of the bindless set, the binding number is the type.
+ */
+typedef enum lava_bindless_type_t
+{
+    LAVA_BINDLESS_SAMPLED_IMAGE = 0,
+    LAVA_BINDLESS_STORAGE_IMAGE = 1,
+    LAVA_BINDLESS_SAMPLER = 2,
+    LAVA_BINDLESS_STORAGE_BUFFER = 3, //!< Variable count, declare it unsized last in shaders.
+    LAVA_BINDLESS_TYPE_COUNT = 4,
+} lava_bindless_type;
+
+typedef struct lava_bindless_heap_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t frame_count; //!< Freed indices are reused after this many frames.
+    VkShaderStageFlags stage_flags;
+    uint32_t counts[LAVA_BINDLESS_TYPE_COUNT];
+} lava_bindless_heap_create_info;
+
+/**
+ @brief Create one update-after-bind, partially bound set holding every resource.
+
+ Needs the descriptor indexing features of Vulkan 1.2 for the used types.
+ */
+VkResult LAVA_API lava_create_bindless_heap(const lava_bindless_heap_create_info* create_info, lava_bindless_heap** heap);
+void LAVA_API lava_destroy_bindless_heap(lava_bindless_heap* heap);
+VkDescriptorSetLayout LAVA_API lava_get_bindless_set_layout(const lava_bindless_heap* heap);
+VkDescriptorSet LAVA_API lava_get_bindless_set(const lava_bindless_heap* heap);
+
+/**
+ @brief Get a stable index into the array of the type, or LAVA_BINDLESS_INVALID_INDEX when full.
+ */
+uint32_t LAVA_API lava_bindless_allocate(lava_bindless_heap* heap, lava_bindless_type type);
+/**
+ @brief Return an index, it is reused once the frames in flight referencing it are done.
+
+ Freeing an index twice, or one never allocated, asserts and is otherwise ignored.
+ */
+void LAVA_API lava_bindless_free(lava_bindless_heap* heap, lava_bindless_type type, uint32_t index);
+void LAVA_API lava_bindless_write_image(lava_bindless_heap* heap, lava_bindless_type type, uint32_t index, VkImageView image_view, VkImageLayout image_layout);
+void LAVA_API lava_bindless_write_sampler(lava_bindless_heap* heap, uint32_t index, VkSampler sampler);
+void LAVA_API lava_bindless_write_buffer(lava_bindless_heap* heap, uint32_t index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+
+/**
+ @brief Write the queued descriptors with one vkUpdateDescriptorSets.
+ */
+void LAVA_API lava_flush_bindless_writes(lava_bindless_heap* heap);
+/**
+ @brief Flush the queued writes and recycle the indices freed in the slot of frame_index. The GPU must be done with that frame.
+ */
+void LAVA_API lava_begin_bindless_frame(lava_bindless_heap* heap, uint64_t frame_index);
+void LAVA_API lava_cmd_bind_bindless_heap(VkCommandBuffer command_buffer, const lava_bindless_heap* heap, VkPipelineBindPoint pipeline_bind_point, VkPipelineLayout pipeline_layout, uint32_t set);
+
+//--- Descriptor buffers
+//--------------------------------------------------------------------
+#ifndef VK_EXT_descriptor_buffer
+//Declarations of VK_EXT_descriptor_buffer, newer than the bundled headers
+#define VK_EXT_descriptor_buffer 1
+#define VK_EXT_DESCRIPTOR_BUFFER_SPEC_VERSION 1
+#define VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME "VK_EXT_descriptor_buffer"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT ((VkStructureType)1000316000)
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT ((VkStructureType)1000316002)
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT ((VkStructureType)1000316003)
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT ((VkStructureType)1000316004)
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT ((VkStructureType)1000316011)
+#define VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT (0x00000010U)
+#define VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT (0x00200000U)
+#define VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT (0x00400000U)
+#define VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT (0x20000000U)
+
+typedef struct VkPhysicalDeviceDescriptorBufferFeaturesEXT
+{
+    VkStructureType sType;
+    void* pNext;
+    VkBool32 descriptorBuffer;
+    VkBool32 descriptorBufferCaptureReplay;
+    VkBool32 descriptorBufferImageLayoutIgnored;
+    VkBool32 descriptorBufferPushDescriptors;
+} VkPhysicalDeviceDescriptorBufferFeaturesEXT;
+
+typedef struct VkPhysicalDeviceDescriptorBufferPropertiesEXT
+{
+    VkStructureType sType;
+    void* pNext;
+    VkBool32 combinedImageSamplerDescriptorSingleArray;
+    VkBool32 bufferlessPushDescriptors;
+    VkBool32 allowSamplerImageViewPostSubmitCreation;
+    VkDeviceSize descriptorBufferOffsetAlignment;
+    uint32_t maxDescriptorBufferBindings;
+    uint32_t maxResourceDescriptorBufferBindings;
+    uint32_t maxSamplerDescriptorBufferBindings;
+    uint32_t maxEmbeddedImmutableSamplerBindings;
+    uint32_t maxEmbeddedImmutableSamplers;
+    size_t bufferCaptureReplayDescriptorDataSize;
+    size_t imageCaptureReplayDescriptorDataSize;
+    size_t imageViewCaptureReplayDescriptorDataSize;
+    size_t samplerCaptureReplayDescriptorDataSize;
+    size_t accelerationStructureCaptureReplayDescriptorDataSize;
+    size_t samplerDescriptorSize;
+    size_t combinedImageSamplerDescriptorSize;
+    size_t sampledImageDescriptorSize;
+    size_t storageImageDescriptorSize;
+    size_t uniformTexelBufferDescriptorSize;
+    size_t robustUniformTexelBufferDescriptorSize;
+    size_t storageTexelBufferDescriptorSize;
+    size_t robustStorageTexelBufferDescriptorSize;
+    size_t uniformBufferDescriptorSize;
+    size_t robustUniformBufferDescriptorSize;
+    size_t storageBufferDescriptorSize;
+    size_t robustStorageBufferDescriptorSize;
+    size_t inputAttachmentDescriptorSize;
+    size_t accelerationStructureDescriptorSize;
+    VkDeviceSize maxSamplerDescriptorBufferRange;
+    VkDeviceSize maxResourceDescriptorBufferRange;
+    VkDeviceSize samplerDescriptorBufferAddressSpaceSize;
+    VkDeviceSize resourceDescriptorBufferAddressSpaceSize;
+    VkDeviceSize descriptorBufferAddressSpaceSize;
+} VkPhysicalDeviceDescriptorBufferPropertiesEXT;
+
+typedef struct VkDescriptorAddressInfoEXT
+{
+    VkStructureType sType;
+    void* pNext;
+    VkDeviceAddress address;
+    VkDeviceSize range;
+    VkFormat format;
+} VkDescriptorAddressInfoEXT;
+
+typedef union VkDescriptorDataEXT
+{
+    const VkSampler* pSampler;
+    const VkDescriptorImageInfo* pCombinedImageSampler;
+    const VkDescriptorImageInfo* pInputAttachmentImage;
+    const VkDescriptorImageInfo* pSampledImage;
+    const VkDescriptorImageInfo* pStorageImage;
+    const VkDescriptorAddressInfoEXT* pUniformTexelBuffer;
+    const VkDescriptorAddressInfoEXT* pStorageTexelBuffer;
+    const VkDescriptorAddressInfoEXT* pUniformBuffer;
+    const VkDescriptorAddressInfoEXT* pStorageBuffer;
+    VkDeviceAddress accelerationStructure;
+} VkDescriptorDataEXT;
+
+typedef struct VkDescriptorGetInfoEXT
+{
+    VkStructureType sType;
+    const void* pNext;
+    VkDescriptorType type;
+    VkDescriptorDataEXT data;
+} VkDescriptorGetInfoEXT;
+
+typedef struct VkDescriptorBufferBindingInfoEXT
+{
+    VkStructureType sType;
+    void* pNext;
+    VkDeviceAddress address;
+    VkBufferUsageFlags usage;
+} VkDescriptorBufferBindingInfoEXT;
+
+typedef void(VKAPI_PTR* PFN_vkGetDescriptorSetLayoutSizeEXT)(VkDevice device, VkDescriptorSetLayout layout, VkDeviceSize* pLayoutSizeInBytes);
+typedef void(VKAPI_PTR* PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)(VkDevice device, VkDescriptorSetLayout layout, uint32_t binding, VkDeviceSize* pOffset);
+typedef void(VKAPI_PTR* PFN_vkGetDescriptorEXT)(VkDevice device, const VkDescriptorGetInfoEXT* pDescriptorInfo, size_t dataSize, void* pDescriptor);
+typedef void(VKAPI_PTR* PFN_vkCmdBindDescriptorBuffersEXT)(VkCommandBuffer commandBuffer, uint32_t bufferCount, const VkDescriptorBufferBindingInfoEXT* pBindingInfos);
+typedef void(VKAPI_PTR* PFN_vkCmdSetDescriptorBufferOffsetsEXT)(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const uint32_t* pBufferIndices, const VkDeviceSize* pOffsets);
+#endif
+
+typedef struct lava_descriptor_ring_t lava_descriptor_ring;
+
+typedef enum lava_descriptor_backend_t
+{
+    LAVA_DESCRIPTOR_BACKEND_SETS = 0, //!< Descriptor sets, lava_descriptor_cache or lava_update_descriptor_set.
+    LAVA_DESCRIPTOR_BACKEND_BUFFER = 1, //!< lava_descriptor_ring.
+} lava_descriptor_backend;
+
+/**
+ @brief Select the descriptor buffer backend when the device supports VK_EXT_descriptor_buffer.
+
+ The caller enables the extension and the descriptorBuffer feature when LAVA_DESCRIPTOR_BACKEND_BUFFER is returned.
+ */
+lava_descriptor_backend LAVA_API lava_select_descriptor_backend(VkPhysicalDevice physical_device);
+
+typedef struct lava_descriptor_ring_create_info_t
+{
+    lava_memory_allocator* memory_allocator; //!< Must be created with LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT.
+    VkPhysicalDevice physical_device;
+    uint32_t frame_count;
+    VkDeviceSize frame_size; //!< Bytes of descriptors per frame. 0 selects the default.
+} lava_descriptor_ring_create_info;
+
+/**
+ @brief A mapped descriptor buffer split in one region per frame in flight.
+ */
+VkResult LAVA_API lava_create_descriptor_ring(const lava_descriptor_ring_create_info* create_info, lava_descriptor_ring** ring);
+void LAVA_API lava_destroy_descriptor_ring(lava_descriptor_ring* ring);
+/**
+ @brief Rewind the region of frame_index. The GPU must be done with the descriptors last written in it.
+ */
+void LAVA_API lava_begin_descriptor_ring_frame(lava_descriptor_ring* ring, uint64_t frame_index);
+/**
+ @brief Write the packed descriptor data of a layout with vkGetDescriptorEXT. Thread safe.
+
+ The layout needs LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT. Buffer descriptors need buffers with a device address and a range other than VK_WHOLE_SIZE.
+ Texel buffers are not supported, since a packed VkBufferView lacks the address and format vkGetDescriptorEXT needs, bind them through descriptor sets.
+ @param offset Receives the offset of the set for lava_cmd_set_descriptor_ring_offset.
+ */
+VkResult LAVA_API lava_write_descriptor_ring(lava_descriptor_ring* ring, const lava_descriptor_layout* layout, const void* data, VkDeviceSize* offset);
+/**
+ @brief Bind the ring as descriptor buffer 0.
+ */
+void LAVA_API lava_cmd_bind_descriptor_ring(VkCommandBuffer command_buffer, const lava_descriptor_ring* ring);
+void LAVA_API lava_cmd_set_descriptor_ring_offset(VkCommandBuffer command_buffer, const lava_descriptor_ring* ring, VkPipelineBindPoint pipeline_bind_point, VkPipelineLayout pipeline_layout, uint32_t set, VkDeviceSize offset);
+
+//--- Sampler cache
+//--------------------------------------------------------------------
+typedef struct lava_sampler_cache_t lava_sampler_cache;
 
+typedef struct lava_sampler_cache_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    uint32_t max_sampler_count; //!< Distinct samplers, at most maxSamplerAllocationCount. 0 selects the guaranteed minimum, 4000.
+} lava_sampler_cache_create_info;
+
+typedef struct lava_sampler_cache_stats_t
+{
+    uint64_t requests;
+    uint64_t hits;
+    uint32_t sampler_count; //!< Distinct cached samplers.
+    uint32_t uncached_count; //!< Live samplers with chained structs the cache does not know.
+} lava_sampler_cache_stats;
+
+VkResult LAVA_API lava_create_sampler_cache(const lava_sampler_cache_create_info* create_info, lava_sampler_cache** cache);
+void LAVA_API lava_destroy_sampler_cache(lava_sampler_cache* cache);
+/**
+ @brief Get a shared sampler with the state of create_info, counting a reference. Lock free when it exists.
+
+ The key covers VkSamplerCreateInfo, VkSamplerYcbcrConversionInfo and VkSamplerReductionModeCreateInfo. Other chained structs get a sampler of their own.
+ */
+VkResult LAVA_API lava_acquire_sampler(lava_sampler_cache* cache, const VkSamplerCreateInfo* create_info, VkSampler* sampler);
+/**
+ @brief Drop a reference, under the cache lock so it may overlap lava_trim_sampler_cache. Unreferenced samplers stay cached until the next trim.
+ */
+void LAVA_API lava_release_sampler(lava_sampler_cache* cache, VkSampler sampler);
+/**
+ @brief Destroy the unreferenced samplers. Must not run concurrently with acquires, and the GPU must be done with them.
+ */
+void LAVA_API lava_trim_sampler_cache(lava_sampler_cache* cache);
+void LAVA_API lava_get_sampler_cache_stats(lava_sampler_cache* cache, lava_sampler_cache_stats* stats);
+
+//--- Pipeline cache
+//--------------------------------------------------------------------
+typedef struct lava_pipeline_cache_t lava_pipeline_cache;
+
+#define LAVA_MAX_SHADER_STAGES (5)
+#define LAVA_MAX_ENTRY_POINT_NAME (32)
+#define LAVA_MAX_SPECIALIZATION_CONSTANTS (16)
+#define LAVA_MAX_VERTEX_BINDINGS (16)
+#define LAVA_MAX_VERTEX_ATTRIBUTES (16)
+#define LAVA_MAX_COLOR_ATTACHMENTS (8)
+#define LAVA_MAX_DYNAMIC_STATES (32)
+
+typedef struct lava_shader_stage_t
+{
+    VkShaderStageFlagBits stage;
+    VkShaderModule module;
+    char entry_point[LAVA_MAX_ENTRY_POINT_NAME]; //!< Empty selects "main".
+} lava_shader_stage;
+
+typedef struct lava_specialization_constant_t
+{
+    uint32_t constant_id;
+    uint32_t value; //!< Bool, int and float constants are 32 bits.
+} lava_specialization_constant;
+
+/**
+ @brief Plain data of a graphics pipeline, the key is its bytes.
+
+ Start from lava_graphics_pipeline_state_initialize so that unused elements and padding are zero.
+ Viewport and scissor are always dynamic.
+ */
+typedef struct lava_graphics_pipeline_state_t
+{
+    VkPipelineCreateFlags flags;
+    VkPipelineLayout layout;
+    uint32_t stage_count;
+    lava_shader_stage stages[LAVA_MAX_SHADER_STAGES];
+    uint32_t specialization_count;
+    lava_specialization_constant specializations[LAVA_MAX_SPECIALIZATION_CONSTANTS]; //!< Applied to every stage.
+    uint32_t vertex_binding_count;
+    VkVertexInputBindingDescription vertex_bindings[LAVA_MAX_VERTEX_BINDINGS];
+    uint32_t vertex_attribute_count;
+    VkVertexInputAttributeDescription vertex_attributes[LAVA_MAX_VERTEX_ATTRIBUTES];
+    VkPrimitiveTopology topology;
+    VkBool32 primitive_restart;
+    uint32_t patch_control_points; //!< 0 without tessellation.
+    VkBool32 depth_clamp;
+    VkBool32 rasterizer_discard;
+    VkPolygonMode polygon_mode;
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkBool32 depth_bias;
+    float depth_bias_constant; //!< Factors used when depth_bias is enabled.
+    float depth_bias_clamp;
+    float depth_bias_slope;
+    VkSampleCountFlagBits samples;
+    VkBool32 alpha_to_coverage;
+    VkBool32 depth_test;
+    VkBool32 depth_write;
+    VkCompareOp depth_compare;
+    VkBool32 stencil_test;
+    VkStencilOpState stencil_front;
+    VkStencilOpState stencil_back;
+    uint32_t color_attachment_count;
+    VkPipelineColorBlendAttachmentState blend[LAVA_MAX_COLOR_ATTACHMENTS];
+    VkRenderPass render_pass; //!< Null selects dynamic rendering with the formats below.
+    uint32_t subpass;
+    uint32_t view_mask;
+    VkFormat color_formats[LAVA_MAX_COLOR_ATTACHMENTS];
+    VkFormat depth_format;
+    VkFormat stencil_format;
+    uint32_t dynamic_state_count;
+    VkDynamicState dynamic_states[LAVA_MAX_DYNAMIC_STATES];
+} lava_graphics_pipeline_state;
+
+/**
+ @brief Plain data of a compute pipeline, the key is its bytes.
+ */
+typedef struct lava_compute_pipeline_state_t
+{
+    VkPipelineCreateFlags flags;
+    VkPipelineLayout layout;
+    lava_shader_stage stage;
+    uint32_t specialization_count;
+    lava_specialization_constant specializations[LAVA_MAX_SPECIALIZATION_CONSTANTS];
+} lava_compute_pipeline_state;
+
+/**
+ @brief Whether the device has VK_EXT_graphics_pipeline_library with fast linking, for LAVA_PIPELINE_CACHE_GRAPHICS_PIPELINE_LIBRARY_BIT.
+ */
+VkBool32 LAVA_API lava_supports_graphics_pipeline_library(VkPhysicalDevice physical_device);
+
+/**
+ @brief Zero the state, then set a single sample, triangle lists, no culling, and opaque writes to every color channel.
+ */
+void LAVA_API lava_graphics_pipeline_state_initialize(lava_graphics_pipeline_state* state);
+void LAVA_API lava_compute_pipeline_state_initialize(lava_compute_pipeline_state* state);
+
+typedef enum lava_dynamic_state_flag_bits_t
+{
+    LAVA_DYNAMIC_STATE_CORE_BIT = 0x01U, //!< Vulkan 1.3 cull mode, front face, topology within its class, depth and stencil tests, rasterizer discard, depth bias and primitive restart.
+    LAVA_DYNAMIC_STATE_PATCH_CONTROL_POINTS_BIT = 0x02U, //!< extendedDynamicState2PatchControlPoints of VK_EXT_extended_dynamic_state2.
+    LAVA_DYNAMIC_STATE_VERTEX_INPUT_BIT = 0x04U, //!< Vertex bindings and attributes, VK_EXT_vertex_input_dynamic_state.
+} lava_dynamic_state_flag_bits;
+typedef uint32_t lava_dynamic_state_flags;
+
+/**
+ @brief The states the device can set in command buffers, its extensions and features have to be enabled.
+ */
+lava_dynamic_state_flags LAVA_API lava_get_dynamic_state_support(VkPhysicalDevice physical_device);
+/**
+ @brief Reset the dynamic parts of a state to fixed values and mark them dynamic, states differing only there share a pipeline.
+ */
+void LAVA_API lava_get_dynamic_pipeline_key(lava_dynamic_state_flags flags, const lava_graphics_pipeline_state* state, lava_graphics_pipeline_state* key);
+
+typedef enum lava_pipeline_cache_flag_bits_t
+{
+    /**
+     Compile the vertex input, pre-rasterization, fragment shader and fragment output parts of graphics pipelines as cached libraries.
+     A new pipeline is fast linked from its parts, then replaced by a link time optimized one built in the background.
+     Requires VK_EXT_graphics_pipeline_library, see lava_supports_graphics_pipeline_library.
+     */
+    LAVA_PIPELINE_CACHE_GRAPHICS_PIPELINE_LIBRARY_BIT = 0x01U,
+} lava_pipeline_cache_flag_bits;
+typedef uint32_t lava_pipeline_cache_flags;
+
+typedef struct lava_pipeline_cache_create_info_t
+{
+    crater_device* device;
+    const VkAllocationCallbacks* allocator;
+    VkPipelineCache pipeline_cache; //!< Seeds a driver cache per compiling thread, and receives them in lava_merge_pipeline_caches. May be null.
+    uint32_t thread_count; //!< Compiling threads. 0 selects half of the cores.
+    uint32_t max_pipeline_count; //!< 0 selects the default, library parts count too.
+    lava_pipeline_cache_flags flags;
+    lava_dynamic_state_flags dynamic_state_flags; //!< Graphics keys go through lava_get_dynamic_pipeline_key, set the state with lava_cmd_set_dynamic_state.
+} lava_pipeline_cache_create_info;
+
+typedef enum lava_pipeline_request_flag_bits_t
+{
+    LAVA_PIPELINE_REQUEST_WAIT_BIT = 0x01U, //!< Block until the pipeline is compiled.
+} lava_pipeline_request_flag_bits;
+typedef uint32_t lava_pipeline_request_flags;
+
+typedef struct lava_pipeline_cache_stats_t
+{
+    uint64_t requests;
+    uint64_t hits; //!< Requests answered with a compiled pipeline.
+    uint64_t not_ready; //!< Requests answered with the fallback.
+    uint32_t pipeline_count; //!< Including the library parts.
+    uint32_t pending_count;
+    uint32_t failed_count;
+    uint32_t library_count; //!< Graphics pipeline library parts.
+    uint32_t optimized_count; //!< Fast linked pipelines replaced by link time optimized ones.
+    uint64_t compile_time; //!< Nanoseconds spent in the driver, summed over the compiling threads.
+} lava_pipeline_cache_stats;
+
+VkResult LAVA_API lava_create_pipeline_cache(const lava_pipeline_cache_create_info* create_info, lava_pipeline_cache** cache);
+/**
+ @brief Wait for the running compilations and destroy every pipeline.
+ */
+void LAVA_API lava_destroy_pipeline_cache(lava_pipeline_cache* cache);
+/**
+ @brief Look a pipeline up, lock free when the key is known. Misses are queued to the compiling threads.
+
+ With graphics pipeline libraries, the returned handle changes once the optimized link is done, both stay valid until the cache is destroyed.
+ @return VK_SUCCESS with the pipeline, VK_NOT_READY with fallback while it compiles, or the error of its compilation.
+ */
+VkResult LAVA_API lava_request_graphics_pipeline(lava_pipeline_cache* cache, const lava_graphics_pipeline_state* state, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline);
+VkResult LAVA_API lava_request_compute_pipeline(lava_pipeline_cache* cache, const lava_compute_pipeline_state* state, lava_pipeline_request_flags flags, VkPipeline fallback, VkPipeline* pipeline);
+/**
+ @brief Block until every queued compilation is done, e.g. behind a loading screen.
+ */
+void LAVA_API lava_wait_pipeline_compiles(lava_pipeline_cache* cache);
+void LAVA_API lava_get_pipeline_cache_stats(lava_pipeline_cache* cache, lava_pipeline_cache_stats* stats);
+
+//--- Pipeline cache files
+//--------------------------------------------------------------------
+typedef struct lava_pipeline_cache_file_info_t
+{
+    crater_device* device;
+    VkPhysicalDevice physical_device;
+    const VkAllocationCallbacks* allocator;
+    const char* path;
+} lava_pipeline_cache_file_info;
+
+/**
+ @brief Create a VkPipelineCache from a memory mapped file.
+
+ The file is used only when its header matches the vendorID, deviceID and pipelineCacheUUID of the device, the cache starts empty otherwise.
+ @param loaded Receives VK_TRUE when the file was used, may be null.
+ */
+VkResult LAVA_API lava_load_pipeline_cache(const lava_pipeline_cache_file_info* file_info, VkPipelineCache* pipeline_cache, VkBool32* loaded);
+/**
+ @brief Write vkGetPipelineCacheData to a temporary file and move it over the file, a crash never leaves a torn file.
+ */
+VkResult LAVA_API lava_save_pipeline_cache(const lava_pipeline_cache_file_info* file_info, VkPipelineCache pipeline_cache);
+/**
+ @brief Merge the caches of the compiling threads into the pipeline cache of the create info, before saving it.
+ */
+VkResult LAVA_API lava_merge_pipeline_caches(lava_pipeline_cache* cache);
+
+//--- Pipeline manifest
+//--------------------------------------------------------------------
+/**
+ @brief Give a shader module, pipeline layout or render pass an id that is stable across runs, e.g. a hash of its source.
+
+ Manifests store these ids in place of the handles. Objects registered this way are not described in the manifest.
+ @param handle LAVA_OBJECT_HANDLE of the object.
+ */
+VkResult LAVA_API lava_register_pipeline_object(lava_pipeline_cache* cache, uint64_t handle, uint64_t id);
+/**
+ @brief Register a shader module with a hash of its code as id, and store the code in manifests.
+ */
+VkResult LAVA_API lava_register_shader_module(lava_pipeline_cache* cache, VkShaderModule module, size_t code_size, const uint32_t* code);
+/**
+ @brief Register a pipeline layout with a hash of its description as id, and store the description in manifests.
+
+ pNext chains of the set layouts are not described.
+ @return VK_ERROR_FEATURE_NOT_PRESENT when a binding has immutable samplers, use lava_register_pipeline_object for such layouts.
+ */
+VkResult LAVA_API lava_register_pipeline_layout(
+    lava_pipeline_cache* cache,
+    VkPipelineLayout layout,
+    uint32_t set_layout_count,
+    const VkDescriptorSetLayoutCreateInfo* set_layout_infos,
+    uint32_t push_constant_range_count,
+    const VkPushConstantRange* push_constant_ranges);
+/**
+ @brief Create and register the shader modules and pipeline layouts described in a manifest whose ids are not registered yet.
+
+ Lets a tool replay a manifest without the application. The cache owns these objects and destroys them.
+ Pipelines using render passes or objects registered with lava_register_pipeline_object stay skipped.
+ @param created Receives the number of created objects, may be null.
+ */
+VkResult LAVA_API lava_create_pipeline_manifest_objects(lava_pipeline_cache* cache, const char* path, uint32_t* created);
+/**
+ @brief Record the key of every pipeline requested so far, when all of its objects are registered.
+ @param written Receives the number of recorded pipelines, may be null.
+ */
+VkResult LAVA_API lava_save_pipeline_manifest(lava_pipeline_cache* cache, const char* path, uint32_t* written);
+/**
+ @brief Queue every pipeline of a manifest to the compiling threads, then lava_wait_pipeline_compiles while loading.
+
+ A missing or outdated manifest queues nothing.
+ @param skipped Receives the number of pipelines with unregistered ids, may be null.
+ */
+VkResult LAVA_API lava_load_pipeline_manifest(lava_pipeline_cache* cache, const char* path, uint32_t* queued, uint32_t* skipped);
+
+typedef struct lava_pipeline_compile_time_t
+{
+    uint64_t key; //!< Hash of the pipeline state.
+    VkPipelineBindPoint bind_point;
+    VkResult result;
+    uint64_t time; //!< Nanoseconds.
+} lava_pipeline_compile_time;
+
+/**
+ @brief Compile times of the finished pipelines, in request order.
+ @return The number of written times.
+ */
+uint32_t LAVA_API lava_get_pipeline_compile_times(lava_pipeline_cache* cache, uint32_t max_count, lava_pipeline_compile_time* times);
+
+//--- Dynamic state
+//--------------------------------------------------------------------
+/**
+ @brief Dynamic state set in a command buffer, to skip redundant commands.
+ */
+typedef struct lava_dynamic_state_t
+{
+    const crater_device* device;
+    lava_dynamic_state_flags flags;
+    uint32_t valid; //!< Values set since the reset.
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkPrimitiveTopology topology;
+    VkBool32 primitive_restart;
+    VkBool32 rasterizer_discard;
+    VkBool32 depth_bias;
+    VkBool32 depth_test;
+    VkBool32 depth_write;
+    VkCompareOp depth_compare;
+    VkBool32 stencil_test;
+    VkStencilOpState stencil_front;
+    VkStencilOpState stencil_back;
+    uint32_t patch_control_points;
+    uint32_t vertex_binding_count;
+    VkVertexInputBindingDescription vertex_bindings[LAVA_MAX_VERTEX_BINDINGS];
+    uint32_t vertex_attribute_count;
+    VkVertexInputAttributeDescription vertex_attributes[LAVA_MAX_VERTEX_ATTRIBUTES];
+    uint32_t set_count; //!< Recorded commands.
+    uint32_t skipped_count; //!< Commands skipped as redundant.
+} lava_dynamic_state;
+
+/**
+ @brief Initialize the tracking at the beginning of a command buffer.
+ */
+void LAVA_API lava_reset_dynamic_state(lava_dynamic_state* dynamic_state, const crater_device* device, lava_dynamic_state_flags flags);
+/**
+ @brief Forget the values set so far, keeping the flags and counters.
+
+ Binding a pipeline where some of this state is static leaves the dynamic values undefined, call this after such a bind
+ so the next lava_cmd_set_dynamic_state records every value again. Pipelines from lava_get_dynamic_pipeline_key with the same flags do not need it.
+ */
+void LAVA_API lava_invalidate_dynamic_state(lava_dynamic_state* dynamic_state);
+/**
+ @brief Record the dynamic part of a state before a draw with its pipeline, the values already set are skipped.
+ */
+void LAVA_API lava_cmd_set_dynamic_state(lava_dynamic_state* dynamic_state, VkCommandBuffer command_buffer, const lava_graphics_pipeline_state* state);
+
+#endif //INC_LAVA_H_
@@ -1,5 +1,11 @@
 #include "crater.h"
+#include "lava.h"
 #include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
 
 int32_t crater_device_features(VkPhysicalDevice physical_device)
 {
@@ -47,8 +53,526 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
     return VK_FALSE;
 }
 
-int main(void)
+static void VKAPI_PTR record_draws(void* user_data, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, uint32_t worker_index)
 {
+    // State changes stand in for the draws of a scene, no pipeline is needed to record them
+    for(uint32_t i = first_draw; i < (first_draw + draw_count); ++i) {
+        VkViewport viewport = {0.0f, 0.0f, 256.0f, 256.0f, 0.0f, 1.0f};
+        VkRect2D scissor = {{static_cast<int32_t>(i & 0xFFU), 0}, {256, 256}};
+        vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+        vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+        vkCmdSetStencilReference(command_buffer, VK_STENCIL_FACE_FRONT_AND_BACK, i & 0xFFU);
+    }
+}
+
+void benchmark_parallel_record(crater_device& device, uint32_t queue_family_index)
+{
+    static const uint32_t draw_count = 200000;
+    static const uint32_t frame_count = 16;
+
+    lava_job_system_create_info job_system_info = {nullptr, 0, 0};
+    lava_job_system* job_system = nullptr;
+    if(VK_SUCCESS != lava_create_job_system(&job_system_info, &job_system)) {
+        return;
+    }
+    uint32_t max_worker_count = lava_get_job_worker_count(job_system);
+    lava_destroy_job_system(job_system);
+
+    VkFormat color_format = VK_FORMAT_B8G8R8A8_UNORM;
+    VkCommandBufferInheritanceRenderingInfo rendering_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        nullptr,
+        0,
+        0,
+        1,
+        &color_format,
+        VK_FORMAT_UNDEFINED,
+        VK_FORMAT_UNDEFINED,
+        VK_SAMPLE_COUNT_1_BIT,
+    };
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        &rendering_info,
+        VK_NULL_HANDLE,
+        0,
+        VK_NULL_HANDLE,
+        VK_FALSE,
+        0,
+        0,
+    };
+
+    printf("parallel record: %u draws\n", draw_count);
+    double single_ms = 0.0;
+    for(uint32_t worker_count = 1; worker_count <= max_worker_count; ++worker_count) {
+        job_system_info.worker_count = worker_count;
+        if(VK_SUCCESS != lava_create_job_system(&job_system_info, &job_system)) {
+            break;
+        }
+        lava_command_pool_set_create_info pool_set_info = {&device, nullptr, queue_family_index, worker_count, 1};
+        lava_command_pool_set* pool_set = nullptr;
+        if(VK_SUCCESS != lava_create_command_pool_set(&pool_set_info, &pool_set)) {
+            lava_destroy_job_system(job_system);
+            break;
+        }
+        lava_parallel_record_info record_info = {job_system, pool_set, 0, &inheritance_info, draw_count, 0, record_draws, nullptr};
+        VkCommandBuffer command_buffers[LAVA_MAX_PARALLEL_RECORD_CHUNKS];
+        uint32_t command_buffer_count = 0;
+        double total_ms = 0.0;
+        // The first frame allocates the command buffers, the others reuse them
+        for(uint32_t frame = 0; frame <= frame_count; ++frame) {
+            lava_begin_command_frame(pool_set, frame);
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            lava_record_parallel(&record_info, &command_buffer_count, command_buffers);
+            std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+            if(0 < frame) {
+                total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+            }
+        }
+        double average_ms = total_ms / frame_count;
+        if(1 == worker_count) {
+            single_ms = average_ms;
+        }
+        printf("  %2u workers: %8.3f ms, %2u secondaries, x%.2f\n", worker_count, average_ms, command_buffer_count, single_ms / average_ms);
+        lava_destroy_command_pool_set(pool_set);
+        lava_destroy_job_system(job_system);
+    }
+}
+
+void benchmark_graph_compile(crater_device& device, VkPhysicalDevice physical_device, uint32_t queue_family_index)
+{
+    static const uint32_t pass_count = 500;
+    static const uint32_t compile_count = 16;
+
+    lava_memory_allocator_create_info allocator_info = {&device, physical_device, nullptr, 0, 0, 0, 0.0f};
+    lava_memory_allocator* memory_allocator = nullptr;
+    if(VK_SUCCESS != lava_create_memory_allocator(&allocator_info, &memory_allocator)) {
+        return;
+    }
+    lava_render_graph_create_info graph_info = {memory_allocator, queue_family_index, VK_QUEUE_FAMILY_IGNORED};
+    lava_render_graph* graph = nullptr;
+    if(VK_SUCCESS != lava_create_render_graph(&graph_info, &graph)) {
+        lava_destroy_memory_allocator(memory_allocator);
+        return;
+    }
+    VkImageCreateInfo image_info = {
+        VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        nullptr,
+        0,
+        VK_IMAGE_TYPE_2D,
+        VK_FORMAT_R8G8B8A8_UNORM,
+        {256, 256, 1},
+        1,
+        1,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        nullptr,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    lava_resource_state write_state = {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_QUEUE_FAMILY_IGNORED};
+    lava_resource_state read_state = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_FAMILY_IGNORED};
+
+    double declare_ms = 0.0;
+    double first_compile_ms = 0.0;
+    double compile_ms = 0.0;
+    for(uint32_t iteration = 0; iteration < compile_count; ++iteration) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        lava_graph_reset(graph);
+        lava_graph_resource outputs[pass_count];
+        for(uint32_t i = 0; i < pass_count; ++i) {
+            lava_graph_pass_info pass_info = {"pass", LAVA_GRAPH_QUEUE_GRAPHICS, 0, nullptr, nullptr};
+            uint32_t pass = lava_graph_add_pass(graph, &pass_info);
+            outputs[i] = lava_graph_create_image(graph, &image_info);
+            lava_graph_write(graph, pass, outputs[i], &write_state);
+            // Every pass samples two earlier outputs, which gives a wide and deep dependency graph
+            if(0 < i) {
+                lava_graph_read(graph, pass, outputs[i - 1], &read_state);
+                lava_graph_read(graph, pass, outputs[i / 2], &read_state);
+            }
+        }
+        lava_graph_export(graph, outputs[pass_count - 1], &read_state);
+        std::chrono::high_resolution_clock::time_point declared = std::chrono::high_resolution_clock::now();
+        VkResult result = lava_graph_compile(graph);
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+        if(VK_SUCCESS != result) {
+            break;
+        }
+        declare_ms += std::chrono::duration<double, std::milli>(declared - start).count();
+        // The structure does not change, so only the first compile does the work
+        if(0 == iteration) {
+            first_compile_ms = std::chrono::duration<double, std::milli>(end - declared).count();
+        } else {
+            compile_ms += std::chrono::duration<double, std::milli>(end - declared).count();
+        }
+    }
+    lava_graph_stats stats;
+    lava_graph_get_stats(graph, &stats);
+    printf("render graph: %u passes\n", pass_count);
+    printf("  declare %8.3f ms, first compile %8.3f ms, cached compile %8.3f ms\n", declare_ms / compile_count, first_compile_ms, compile_ms / (compile_count - 1));
+    printf("  %u culled, %u levels, %u barriers in %u dependencies, %llu of %llu bytes after aliasing\n",
+           stats.culled_pass_count,
+           stats.level_count,
+           stats.barrier_count,
+           stats.dependency_count,
+           static_cast<unsigned long long>(stats.transient.heap_bytes),
+           static_cast<unsigned long long>(stats.transient.resource_bytes));
+    lava_destroy_render_graph(graph);
+    lava_destroy_memory_allocator(memory_allocator);
+}
+
+void benchmark_descriptor_cache(crater_device& device)
+{
+    static const uint32_t draw_count = 100000;
+    static const uint32_t frame_count = 3;
+    static const uint32_t sampler_count = 16;
+
+    // Samplers need no memory, 16x4 combinations stand in for the materials of a scene
+    VkSampler samplers[sampler_count] = {};
+    for(uint32_t i = 0; i < sampler_count; ++i) {
+        VkSamplerCreateInfo sampler_info = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+        sampler_info.minLod = 0.0f;
+        sampler_info.maxLod = static_cast<float>(i);
+        vkCreateSampler(device.device_, &sampler_info, nullptr, &samplers[i]);
+    }
+    VkDescriptorSetLayoutBinding layout_bindings[2] = {
+        {0, VK_DESCRIPTOR_TYPE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+        {1, VK_DESCRIPTOR_TYPE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, nullptr, 0, 2, layout_bindings};
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    vkCreateDescriptorSetLayout(device.device_, &layout_info, nullptr, &layout);
+
+    lava_descriptor_cache_create_info cache_info = {&device, nullptr, 1, frame_count, 0, 0, nullptr};
+    lava_descriptor_cache* cache = nullptr;
+    if(VK_SUCCESS == lava_create_descriptor_cache(&cache_info, &cache)) {
+        double total_ms = 0.0;
+        for(uint32_t frame = 0; frame < frame_count; ++frame) {
+            lava_begin_descriptor_frame(cache, frame);
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            for(uint32_t i = 0; i < draw_count; ++i) {
+                lava_descriptor_binding bindings[2] = {};
+                bindings[0].binding = 0;
+                bindings[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+                bindings[0].image_info.sampler = samplers[i % sampler_count];
+                bindings[1].binding = 1;
+                bindings[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+                bindings[1].image_info.sampler = samplers[(i / sampler_count) % 4];
+                VkDescriptorSet set = VK_NULL_HANDLE;
+                lava_get_descriptor_set(cache, 0, layout, 2, bindings, &set);
+            }
+            std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+            total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+        lava_descriptor_cache_stats stats;
+        lava_get_descriptor_cache_stats(cache, &stats);
+        double hit_rate = (0 < stats.requests) ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.requests) : 0.0;
+        printf("descriptor cache: %u draws, %8.3f ms/frame\n", draw_count, total_ms / frame_count);
+        printf("  hit rate %.2f%%, %llu sets, %llu writes, %llu writes saved, %u pools\n",
+               hit_rate,
+               static_cast<unsigned long long>(stats.allocated_sets),
+               static_cast<unsigned long long>(stats.written_descriptors),
+               static_cast<unsigned long long>(stats.saved_descriptor_writes),
+               stats.pool_count);
+        lava_destroy_descriptor_cache(cache);
+    }
+    vkDestroyDescriptorSetLayout(device.device_, layout, nullptr);
+    for(uint32_t i = 0; i < sampler_count; ++i) {
+        vkDestroySampler(device.device_, samplers[i], nullptr);
+    }
+}
+
+void benchmark_descriptor_writes(crater_device& device, VkPhysicalDevice physical_device, lava_descriptor_backend backend)
+{
+    static const uint32_t set_count = 4096;
+    static const uint32_t frame_count = 16;
+    static const uint32_t binding_count = 4;
+
+    VkSampler sampler = VK_NULL_HANDLE;
+    VkSamplerCreateInfo sampler_info = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    vkCreateSampler(device.device_, &sampler_info, nullptr, &sampler);
+    VkDescriptorSetLayoutBinding layout_bindings[binding_count];
+    for(uint32_t i = 0; i < binding_count; ++i) {
+        layout_bindings[i] = {i, VK_DESCRIPTOR_TYPE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr};
+    }
+    uint64_t data[64] = {};
+
+    // Classic path, one template update per set
+    double sets_ms = 0.0;
+    lava_descriptor_layout_create_info layout_info = {&device, nullptr, 0, VK_PIPELINE_BIND_POINT_GRAPHICS, 0, binding_count, layout_bindings};
+    lava_descriptor_layout* layout = nullptr;
+    if(VK_SUCCESS == lava_create_descriptor_layout(&layout_info, &layout)) {
+        VkDescriptorImageInfo image_info = {sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED};
+        for(uint32_t i = 0; i < binding_count; ++i) {
+            lava_write_descriptor_image(layout, data, i, 0, &image_info);
+        }
+        VkDescriptorPoolSize pool_size = {VK_DESCRIPTOR_TYPE_SAMPLER, set_count * binding_count};
+        VkDescriptorPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO, nullptr, 0, set_count, 1, &pool_size};
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        vkCreateDescriptorPool(device.device_, &pool_info, nullptr, &pool);
+        VkDescriptorSetLayout set_layout = lava_get_descriptor_set_layout(layout);
+        VkDescriptorSet* sets = new VkDescriptorSet[set_count];
+        for(uint32_t frame = 0; frame < frame_count; ++frame) {
+            vkResetDescriptorPool(device.device_, pool, 0);
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            for(uint32_t i = 0; i < set_count; ++i) {
+                VkDescriptorSetAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, nullptr, pool, 1, &set_layout};
+                vkAllocateDescriptorSets(device.device_, &allocate_info, &sets[i]);
+                lava_update_descriptor_set(layout, sets[i], data);
+            }
+            std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+            sets_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+        delete[] sets;
+        vkDestroyDescriptorPool(device.device_, pool, nullptr);
+        lava_destroy_descriptor_layout(layout);
+    }
+    double descriptor_count = static_cast<double>(set_count) * binding_count * frame_count;
+    printf("descriptor writes: sets   %12.0f descriptors/s\n", descriptor_count / (sets_ms * 0.001));
+
+    // Descriptor buffer path, written straight into mapped memory
+    if(LAVA_DESCRIPTOR_BACKEND_BUFFER == backend) {
+        lava_memory_allocator_create_info allocator_info = {&device, physical_device, nullptr, 0, LAVA_MEMORY_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT, 0, 0.0f};
+        lava_memory_allocator* memory_allocator = nullptr;
+        if(VK_SUCCESS == lava_create_memory_allocator(&allocator_info, &memory_allocator)) {
+            layout_info.flags = LAVA_DESCRIPTOR_LAYOUT_DESCRIPTOR_BUFFER_BIT;
+            lava_descriptor_ring_create_info ring_info = {memory_allocator, physical_device, 2, 0};
+            lava_descriptor_ring* ring = nullptr;
+            if(VK_SUCCESS == lava_create_descriptor_layout(&layout_info, &layout)) {
+                ring_info.frame_size = 2 * set_count * 256;
+                if(VK_SUCCESS == lava_create_descriptor_ring(&ring_info, &ring)) {
+                    double buffer_ms = 0.0;
+                    for(uint32_t frame = 0; frame < frame_count; ++frame) {
+                        lava_begin_descriptor_ring_frame(ring, frame);
+                        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+                        for(uint32_t i = 0; i < set_count; ++i) {
+                            VkDeviceSize offset = 0;
+                            lava_write_descriptor_ring(ring, layout, data, &offset);
+                        }
+                        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+                        buffer_ms += std::chrono::duration<double, std::milli>(end - start).count();
+                    }
+                    printf("descriptor writes: buffer %12.0f descriptors/s, x%.2f\n", descriptor_count / (buffer_ms * 0.001), sets_ms / buffer_ms);
+                    lava_destroy_descriptor_ring(ring);
+                }
+                lava_destroy_descriptor_layout(layout);
+            }
+            lava_destroy_memory_allocator(memory_allocator);
+        }
+    } else {
+        printf("descriptor writes: VK_EXT_descriptor_buffer is not supported\n");
+    }
+    vkDestroySampler(device.device_, sampler, nullptr);
+}
+
+// SPIR-V of an empty compute shader, the workgroup width is patched so that every variant is a distinct module
+static const uint32_t compute_shader_code[35] = {
+    0x07230203, 0x00010000, 0x00000000, 0x00000005, 0x00000000, // Header, id bound 5
+    0x00020011, 0x00000001, // OpCapability Shader
+    0x0003000E, 0x00000000, 0x00000001, // OpMemoryModel Logical GLSL450
+    0x0005000F, 0x00000005, 0x00000001, 0x6E69616D, 0x00000000, // OpEntryPoint GLCompute %1 "main"
+    0x00060010, 0x00000001, 0x00000011, 0x00000001, 0x00000001, 0x00000001, // OpExecutionMode %1 LocalSize 1 1 1
+    0x00020013, 0x00000002, // %2 = OpTypeVoid
+    0x00030021, 0x00000003, 0x00000002, // %3 = OpTypeFunction %2
+    0x00050036, 0x00000002, 0x00000001, 0x00000000, 0x00000003, // %1 = OpFunction %2 None %3
+    0x000200F8, 0x00000004, // %4 = OpLabel
+    0x000100FD, // OpReturn
+    0x00010038, // OpFunctionEnd
+};
+static const uint32_t compute_shader_local_size_x = 18;
+
+void benchmark_pipeline_cache_file(crater_device& device, VkPhysicalDevice physical_device, VkBool32 pipeline_library, lava_dynamic_state_flags dynamic_state_flags)
+{
+    lava_pipeline_cache_file_info file_info = {&device, physical_device, nullptr, "pipeline_cache.bin"};
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    VkBool32 loaded = VK_FALSE;
+    if(VK_SUCCESS != lava_load_pipeline_cache(&file_info, &pipeline_cache, &loaded)) {
+        return;
+    }
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    printf("pipeline cache: %s in %lld us\n", loaded ? "loaded" : "created empty",
+           static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()));
+
+    lava_pipeline_cache_create_info cache_info = {&device, nullptr, pipeline_cache, 0, 0, (VK_TRUE == pipeline_library) ? LAVA_PIPELINE_CACHE_GRAPHICS_PIPELINE_LIBRARY_BIT : 0U, dynamic_state_flags};
+    lava_pipeline_cache* cache = nullptr;
+    if(VK_SUCCESS == lava_create_pipeline_cache(&cache_info, &cache)) {
+        // Modules and layouts are registered as they are created, before the last run is precompiled while loading
+        static const uint32_t module_count = 32;
+        std::vector<VkShaderModule> modules;
+        for(uint32_t i = 0; i < module_count; ++i) {
+            uint32_t code[35];
+            memcpy(code, compute_shader_code, sizeof(code));
+            code[compute_shader_local_size_x] = i + 1;
+            VkShaderModuleCreateInfo module_info = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, nullptr, 0, sizeof(code), code};
+            VkShaderModule module = VK_NULL_HANDLE;
+            if(VK_SUCCESS == vkCreateShaderModule(device.device_, &module_info, nullptr, &module)) {
+                lava_register_shader_module(cache, module, sizeof(code), code);
+                modules.push_back(module);
+            }
+        }
+        VkPipelineLayoutCreateInfo layout_info = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO, nullptr, 0, 0, nullptr, 0, nullptr};
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        if(VK_SUCCESS == vkCreatePipelineLayout(device.device_, &layout_info, nullptr, &layout)) {
+            lava_register_pipeline_layout(cache, layout, 0, nullptr, 0, nullptr);
+
+            start = std::chrono::high_resolution_clock::now();
+            uint32_t queued = 0;
+            uint32_t skipped = 0;
+            lava_load_pipeline_manifest(cache, "pipelines.manifest", &queued, &skipped);
+            lava_wait_pipeline_compiles(cache);
+            end = std::chrono::high_resolution_clock::now();
+            printf("pipeline manifest: %u precompiled, %u skipped, %.3f ms\n", queued, skipped,
+                   std::chrono::duration<double, std::milli>(end - start).count());
+
+            // The pipelines the application needs on its first frame, compiled now unless the manifest had them
+            start = std::chrono::high_resolution_clock::now();
+            for(size_t i = 0; i < modules.size(); ++i) {
+                lava_compute_pipeline_state state;
+                lava_compute_pipeline_state_initialize(&state);
+                state.layout = layout;
+                state.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+                state.stage.module = modules[i];
+                VkPipeline pipeline = VK_NULL_HANDLE;
+                lava_request_compute_pipeline(cache, &state, LAVA_PIPELINE_REQUEST_WAIT_BIT, VK_NULL_HANDLE, &pipeline);
+            }
+            end = std::chrono::high_resolution_clock::now();
+            lava_pipeline_cache_stats stats;
+            lava_get_pipeline_cache_stats(cache, &stats);
+            printf("pipeline requests: %zu pipelines, %llu ready, %.3f ms\n", modules.size(),
+                   static_cast<unsigned long long>(stats.hits),
+                   std::chrono::duration<double, std::milli>(end - start).count());
+
+            uint32_t written = 0;
+            lava_save_pipeline_manifest(cache, "pipelines.manifest", &written);
+            printf("pipeline manifest: %u recorded\n", written);
+        }
+        lava_merge_pipeline_caches(cache);
+        lava_destroy_pipeline_cache(cache);
+        if(VK_NULL_HANDLE != layout) {
+            vkDestroyPipelineLayout(device.device_, layout, nullptr);
+        }
+        for(size_t i = 0; i < modules.size(); ++i) {
+            vkDestroyShaderModule(device.device_, modules[i], nullptr);
+        }
+    }
+    if(VK_SUCCESS != lava_save_pipeline_cache(&file_info, pipeline_cache)) {
+        printf("pipeline cache: failed to save\n");
+    }
+    vkDestroyPipelineCache(device.device_, pipeline_cache, nullptr);
+}
+
+void benchmark_dynamic_state(crater_device& device, uint32_t queue_family_index, lava_dynamic_state_flags dynamic_state_flags)
+{
+    static const uint32_t draw_count = 100000;
+
+    // Materials of a scene, vertex formats, cull modes, winding, depth modes, topologies and blend modes
+    std::vector<lava_graphics_pipeline_state> states;
+    for(uint32_t i = 0; i < 4 * 2 * 2 * 3 * 2 * 3; ++i) {
+        lava_graphics_pipeline_state state;
+        lava_graphics_pipeline_state_initialize(&state);
+        state.stage_count = 1;
+        state.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        state.vertex_binding_count = 1;
+        state.vertex_bindings[0].stride = 12 + 4 * (i % 4);
+        state.vertex_attribute_count = 1;
+        state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        state.cull_mode = (0 == (i / 4) % 2) ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+        state.front_face = (0 == (i / 8) % 2) ? VK_FRONT_FACE_COUNTER_CLOCKWISE : VK_FRONT_FACE_CLOCKWISE;
+        state.depth_test = (0 < (i / 16) % 3) ? VK_TRUE : VK_FALSE;
+        state.depth_write = (2 == (i / 16) % 3) ? VK_TRUE : VK_FALSE;
+        state.depth_compare = VK_COMPARE_OP_GREATER_OR_EQUAL;
+        state.topology = (0 == (i / 48) % 2) ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+        state.color_attachment_count = 1;
+        state.color_formats[0] = VK_FORMAT_B8G8R8A8_UNORM;
+        state.blend[0].blendEnable = (0 < (i / 96) % 3) ? VK_TRUE : VK_FALSE;
+        state.blend[0].dstColorBlendFactor = (2 == (i / 96) % 3) ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        states.push_back(state);
+    }
+    std::set<std::string> static_keys;
+    std::set<std::string> dynamic_keys;
+    for(size_t i = 0; i < states.size(); ++i) {
+        lava_graphics_pipeline_state key;
+        lava_get_dynamic_pipeline_key(dynamic_state_flags, &states[i], &key);
+        static_keys.insert(std::string(reinterpret_cast<const char*>(&states[i]), sizeof(lava_graphics_pipeline_state)));
+        dynamic_keys.insert(std::string(reinterpret_cast<const char*>(&key), sizeof(lava_graphics_pipeline_state)));
+    }
+    printf("dynamic state: %zu unique pipelines static, %zu with dynamic state\n", static_keys.size(), dynamic_keys.size());
+    if(0 == (dynamic_state_flags & LAVA_DYNAMIC_STATE_CORE_BIT)) {
+        return;
+    }
+
+    VkCommandPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, 0, queue_family_index};
+    VkCommandPool command_pool = VK_NULL_HANDLE;
+    if(VK_SUCCESS != vkCreateCommandPool(device.device_, &pool_info, nullptr, &command_pool)) {
+        return;
+    }
+    VkCommandBufferAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr, command_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkCommandBufferBeginInfo begin_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, nullptr};
+    if(VK_SUCCESS == vkAllocateCommandBuffers(device.device_, &allocate_info, &command_buffer)
+       && VK_SUCCESS == vkBeginCommandBuffer(command_buffer, &begin_info)) {
+        // Draws sorted by material, as a renderer submits them
+        lava_dynamic_state dynamic_state;
+        lava_reset_dynamic_state(&dynamic_state, &device, dynamic_state_flags);
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        for(uint32_t i = 0; i < draw_count; ++i) {
+            lava_cmd_set_dynamic_state(&dynamic_state, command_buffer, &states[static_cast<size_t>(i) * states.size() / draw_count]);
+        }
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+        vkEndCommandBuffer(command_buffer);
+        printf("dynamic state: %u draws, %u commands recorded, %u redundant skipped, %.3f ms\n",
+               draw_count, dynamic_state.set_count, dynamic_state.skipped_count,
+               std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    vkDestroyCommandPool(device.device_, command_pool, nullptr);
+}
+
+void replay_pipeline_manifest(crater_device& device, const char* path)
+{
+    lava_pipeline_cache_create_info cache_info = {&device, nullptr, VK_NULL_HANDLE, 0, 0, 0, 0};
+    lava_pipeline_cache* cache = nullptr;
+    if(VK_SUCCESS != lava_create_pipeline_cache(&cache_info, &cache)) {
+        return;
+    }
+    // Modules and layouts are created from their descriptions in the manifest, pipelines of undescribed objects are skipped
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    uint32_t created = 0;
+    uint32_t queued = 0;
+    uint32_t skipped = 0;
+    lava_create_pipeline_manifest_objects(cache, path, &created);
+    lava_load_pipeline_manifest(cache, path, &queued, &skipped);
+    lava_wait_pipeline_compiles(cache);
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+    lava_pipeline_compile_time* times = new lava_pipeline_compile_time[queued + 1];
+    uint32_t count = lava_get_pipeline_compile_times(cache, queued, times);
+    for(uint32_t i = 0; i < count; ++i) {
+        printf("%016llx %s %8.3f ms%s\n",
+               static_cast<unsigned long long>(times[i].key),
+               (VK_PIPELINE_BIND_POINT_GRAPHICS == times[i].bind_point) ? "graphics" : "compute ",
+               static_cast<double>(times[i].time) * 1.0e-6,
+               (VK_SUCCESS == times[i].result) ? "" : " failed");
+    }
+    delete[] times;
+    lava_pipeline_cache_stats stats;
+    lava_get_pipeline_cache_stats(cache, &stats);
+    printf("replay: %u objects, %u pipelines, %u skipped, %u failed, %.3f ms on the threads, %lld ms total\n",
+           created, stats.pipeline_count, skipped, stats.failed_count,
+           static_cast<double>(stats.compile_time) * 1.0e-6,
+           static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()));
+    lava_destroy_pipeline_cache(cache);
+}
+
+int main(int argc, char** argv)
+{
+    // test --replay-manifest <path> compiles a recorded manifest and reports compile times
+    const char* replay_path = nullptr;
+    if(3 <= argc && 0 == strcmp(argv[1], "--replay-manifest")) {
+        replay_path = argv[2];
+    }
+
     initialize_crater("vulkan-1.dll");
 
     const char* layers[] = {
@@ -74,7 +598,7 @@ int main(void)
         0,
         "test_engine",
         0,
-        0,
+        VK_API_VERSION_1_3,
     };
     VkInstanceCreateInfo create_info = {
         VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -99,6 +623,85 @@ int main(void)
     int32_t priorities[1];
     vk_choose_physical_devices(&physical_device_count, physical_devices, priorities, crater_device_features);
 
+    lava_queue_families queue_families = {};
+    if(0 < physical_device_count && VK_SUCCESS == lava_find_queue_families(physical_devices[0], &queue_families)) {
+        uint32_t queue_family_index = queue_families.family_indices[LAVA_QUEUE_ROLE_GRAPHICS];
+        printf("queue families: graphics %u, compute %u, transfer %u\n",
+               queue_families.family_indices[LAVA_QUEUE_ROLE_GRAPHICS],
+               queue_families.family_indices[LAVA_QUEUE_ROLE_COMPUTE],
+               queue_families.family_indices[LAVA_QUEUE_ROLE_TRANSFER]);
+
+        // Descriptor buffers are used when supported, descriptor sets otherwise
+        lava_descriptor_backend descriptor_backend = lava_select_descriptor_backend(physical_devices[0]);
+        VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer_features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT};
+        // Graphics pipelines are linked from cached libraries when supported
+        VkBool32 pipeline_library = lava_supports_graphics_pipeline_library(physical_devices[0]);
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipeline_library_features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT};
+        // States the device sets dynamically are left out of the pipeline keys
+        lava_dynamic_state_flags dynamic_state_flags = lava_get_dynamic_state_support(physical_devices[0]);
+        VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamic_state2_features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT};
+        VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT vertex_input_features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_INPUT_DYNAMIC_STATE_FEATURES_EXT};
+        const char* device_extensions[5] = {};
+        uint32_t device_extension_count = 0;
+
+        // Enable every supported feature of the chain
+        VkPhysicalDeviceVulkan13Features features13 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
+        if(LAVA_DESCRIPTOR_BACKEND_BUFFER == descriptor_backend) {
+            device_extensions[device_extension_count++] = VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME;
+            descriptor_buffer_features.pNext = features13.pNext;
+            features13.pNext = &descriptor_buffer_features;
+        }
+        if(VK_TRUE == pipeline_library) {
+            device_extensions[device_extension_count++] = VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME;
+            device_extensions[device_extension_count++] = VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME;
+            pipeline_library_features.pNext = features13.pNext;
+            features13.pNext = &pipeline_library_features;
+        }
+        if(0 != (dynamic_state_flags & LAVA_DYNAMIC_STATE_PATCH_CONTROL_POINTS_BIT)) {
+            device_extensions[device_extension_count++] = VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME;
+            dynamic_state2_features.pNext = features13.pNext;
+            features13.pNext = &dynamic_state2_features;
+        }
+        if(0 != (dynamic_state_flags & LAVA_DYNAMIC_STATE_VERTEX_INPUT_BIT)) {
+            device_extensions[device_extension_count++] = VK_EXT_VERTEX_INPUT_DYNAMIC_STATE_EXTENSION_NAME;
+            vertex_input_features.pNext = features13.pNext;
+            features13.pNext = &vertex_input_features;
+        }
+        VkPhysicalDeviceVulkan12Features features12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES, &features13};
+        VkPhysicalDeviceFeatures2 features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &features12};
+        vkGetPhysicalDeviceFeatures2(physical_devices[0], &features);
+
+        VkDeviceCreateInfo device_info = {
+            VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            &features,
+            0,
+            queue_families.queue_create_info_count,
+            queue_families.queue_create_infos,
+            0,
+            nullptr,
+            device_extension_count,
+            device_extensions,
+            nullptr,
+        };
+        crater_device device = {};
+        if(VK_SUCCESS == vk_create_device(physical_devices[0], &device_info, nullptr, &device)) {
+            lava_device_queues_create_info queues_info = {&device, nullptr, &queue_families};
+            lava_device_queues* queues = nullptr;
+            if(nullptr != replay_path) {
+                replay_pipeline_manifest(device, replay_path);
+            } else if(VK_SUCCESS == lava_create_device_queues(&queues_info, &queues)) {
+                benchmark_parallel_record(device, queue_family_index);
+                benchmark_graph_compile(device, physical_devices[0], queue_family_index);
+                benchmark_descriptor_cache(device);
+                benchmark_descriptor_writes(device, physical_devices[0], descriptor_backend);
+                benchmark_pipeline_cache_file(device, physical_devices[0], pipeline_library, dynamic_state_flags);
+                benchmark_dynamic_state(device, queue_family_index, dynamic_state_flags);
+                lava_destroy_device_queues(queues);
+            }
+            vk_destroy_device(&device, nullptr);
+        }
+    }
+
     vk_destroy_debug_utils_message(nullptr);
     vk_destroy_instance(nullptr);
     terminate_crater();